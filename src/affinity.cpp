@@ -0,0 +1,291 @@
+/*
+ * affinity.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the functions placing worker threads on CPUs and NUMA nodes.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "affinity.h"
+#include "functions.h"
+
+/**
+ * @var int The memory policy preferring one node, from linux/mempolicy.h, which libc does not wrap
+ */
+static const int PREFERRED_POLICY = 1;
+
+/**
+ * @var size_t The NUMA nodes a memory policy mask can name
+ */
+static const size_t MAX_NODES = 1024;
+
+/**
+ * @var std::vector<int> The CPUs threads are placed on, empty when placement is not configured
+ */
+static std::vector<int> placement_cpus;
+
+/**
+ * @var std::vector<int> The NUMA node of each placement CPU, or -1 if unknown; empty unless memory follows the CPU
+ */
+static std::vector<int> placement_nodes;
+
+/**
+ * @var std::atomic<size_t> The number of threads placed in turn so far
+ */
+static std::atomic<size_t> placed_threads(0);
+
+/**
+ * Parses a list of CPUs in the kernel's format, such as "0-3,8,10-11"
+ *
+ * @param const std::string& list The list, or an empty string for none
+ *
+ * @return std::vector<int> The CPUs in ascending order, without repeats
+ *
+ * @throws std::runtime_error If the list is malformed
+ */
+std::vector<int> parse_cpu_list(const std::string& list)
+{
+	std::vector<int> cpus;
+	std::stringstream ranges(list);
+	std::string range;
+
+	while (std::getline(ranges, range, ','))
+	{
+		size_t dash = range.find('-');
+		std::string first = range.substr(0, dash);
+		std::string last = dash == std::string::npos ? first : range.substr(dash + 1);
+
+		if (first.empty() || last.empty() || first.size() > 5 || last.size() > 5
+			|| first.find_first_not_of("0123456789") != std::string::npos || last.find_first_not_of("0123456789") != std::string::npos)
+		{
+			throw std::runtime_error("CPU list must be CPU numbers and ranges such as 0-3,8, not \"" + list + "\"");
+		}
+
+		int from = std::atoi(first.c_str());
+		int to = std::atoi(last.c_str());
+		if (from > to || to >= CPU_SETSIZE)
+		{
+			throw std::runtime_error("CPU range " + range + " is empty or beyond CPU " + std::to_string(CPU_SETSIZE - 1));
+		}
+
+		for (int cpu = from; cpu <= to; ++cpu)
+		{
+			cpus.push_back(cpu);
+		}
+	}
+
+	std::sort(cpus.begin(), cpus.end());
+	cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+	return cpus;
+}
+
+/**
+ * Finds the NUMA node a CPU belongs to, from the nodeN link sysfs keeps beside it
+ *
+ * @param int cpu The CPU
+ *
+ * @return int The node, or -1 if the kernel reports none
+ */
+static int cpu_node(int cpu)
+{
+	std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+	DIR* directory = opendir(path.c_str());
+	if (directory == nullptr)
+	{
+		return -1;
+	}
+
+	int node = -1;
+	struct dirent* entry;
+	while (node == -1 && (entry = readdir(directory)) != nullptr)
+	{
+		if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9')
+		{
+			node = std::atoi(entry->d_name + 4);
+		}
+	}
+
+	closedir(directory);
+	return node;
+}
+
+/**
+ * Sets the CPUs worker threads are placed on, before any is started
+ *
+ * With numa, each placed thread prefers memory from its CPU's node, so the
+ * buffers and connection state it allocates and touches stay local even when the
+ * process was started under an interleaving or remote memory policy.
+ *
+ * @param const std::vector<int>& cpus The CPUs, or empty for every CPU the process may run on
+ * @param bool numa Whether each thread allocates memory from the NUMA node of its CPU
+ *
+ * @return void
+ *
+ * @throws std::runtime_error If a CPU is not one the process may run on
+ */
+void configure_placement(const std::vector<int>& cpus, bool numa)
+{
+	placement_cpus.clear();
+	placement_nodes.clear();
+	if (cpus.empty() && !numa)
+	{
+		return;
+	}
+
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+	{
+		throw std::runtime_error(std::string("Failed to read the CPUs this process may run on: ") + strerror(errno));
+	}
+
+	for (size_t i = 0; i < cpus.size(); ++i)
+	{
+		if (!CPU_ISSET(cpus[i], &allowed))
+		{
+			throw std::runtime_error("CPU " + std::to_string(cpus[i]) + " is offline or outside this process's affinity mask");
+		}
+	}
+
+	placement_cpus = cpus;
+	if (placement_cpus.empty())
+	{
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &allowed))
+			{
+				placement_cpus.push_back(cpu);
+			}
+		}
+	}
+
+	std::string nodes;
+	if (numa)
+	{
+		for (size_t i = 0; i < placement_cpus.size(); ++i)
+		{
+			placement_nodes.push_back(cpu_node(placement_cpus[i]));
+			nodes += (i > 0 ? "," : "") + std::to_string(placement_nodes.back());
+		}
+	}
+
+	debug("Placing worker threads on %zu CPUs%s%s", placement_cpus.size(), numa ? ", on NUMA nodes " : "", nodes.c_str());
+}
+
+/**
+ * Pins the calling thread to one of the placement CPUs, and with numa, its memory to that CPU's node
+ *
+ * Failures are not fatal: the thread then runs wherever the scheduler puts it.
+ *
+ * @param size_t index The CPU's index in the placement CPUs
+ *
+ * @return int The CPU
+ */
+static int place_on(size_t index)
+{
+	int cpu = placement_cpus[index];
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int status = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (status != 0)
+	{
+		debug("Failed to pin a thread to CPU %d: %s", cpu, strerror(status));
+	}
+
+	int node = placement_nodes.empty() ? -1 : placement_nodes[index];
+	if (node >= 0 && static_cast<size_t>(node) < MAX_NODES)
+	{
+		unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+		mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_set_mempolicy, PREFERRED_POLICY, mask, MAX_NODES) != 0)
+		{
+			debug("Failed to prefer memory from NUMA node %d: %s", node, strerror(errno));
+		}
+	}
+
+	return cpu;
+}
+
+/**
+ * Places the calling thread on the next configured CPU in turn
+ *
+ * @return int The CPU, or -1 if placement is not configured
+ */
+int place_thread()
+{
+	if (placement_cpus.empty())
+	{
+		return -1;
+	}
+
+	return place_on(placed_threads.fetch_add(1, std::memory_order_relaxed) % placement_cpus.size());
+}
+
+/**
+ * Places the calling thread, which serves an accepted connection, on the CPU that
+ * handled the connection's receive interrupts, if it is a configured one
+ *
+ * SO_INCOMING_CPU reports the CPU the kernel last processed the connection's
+ * packets on, which is where its receive queue's interrupts are steered, so the
+ * thread reading it shares that CPU's caches. Connections arriving on other CPUs,
+ * and Unix domain sockets, are placed in turn.
+ *
+ * @param int fd The connection's socket
+ *
+ * @return int The CPU, or -1 if placement is not configured
+ */
+int place_connection_thread(int fd)
+{
+	if (placement_cpus.empty())
+	{
+		return -1;
+	}
+
+	int incoming = -1;
+	socklen_t size = sizeof(incoming);
+	#ifdef SO_INCOMING_CPU
+	if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &incoming, &size) != 0)
+	{
+		incoming = -1;
+	}
+	#else
+	(void)fd;
+	(void)size;
+	#endif /* SO_INCOMING_CPU */
+
+	std::vector<int>::const_iterator found = std::lower_bound(placement_cpus.begin(), placement_cpus.end(), incoming);
+	if (incoming >= 0 && found != placement_cpus.end() && *found == incoming)
+	{
+		return place_on(found - placement_cpus.begin());
+	}
+
+	return place_thread();
+}
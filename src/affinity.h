@@ -0,0 +1,68 @@
+/*
+ * affinity.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the functions placing worker threads on CPUs and NUMA nodes.
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Parses a list of CPUs in the kernel's format, such as "0-3,8,10-11"
+ *
+ * @param const std::string& list The list, or an empty string for none
+ *
+ * @return std::vector<int> The CPUs in ascending order, without repeats
+ *
+ * @throws std::runtime_error If the list is malformed
+ */
+std::vector<int> parse_cpu_list(const std::string& list);
+
+/**
+ * Sets the CPUs worker threads are placed on, before any is started
+ *
+ * @param const std::vector<int>& cpus The CPUs, or empty for every CPU the process may run on
+ * @param bool numa Whether each thread allocates memory from the NUMA node of its CPU
+ *
+ * @return void
+ *
+ * @throws std::runtime_error If a CPU is not one the process may run on
+ */
+void configure_placement(const std::vector<int>& cpus, bool numa);
+
+/**
+ * Places the calling thread on the next configured CPU in turn
+ *
+ * @return int The CPU, or -1 if placement is not configured
+ */
+int place_thread();
+
+/**
+ * Places the calling thread, which serves an accepted connection, on the CPU that
+ * handled the connection's receive interrupts, if it is a configured one
+ *
+ * @param int fd The connection's socket
+ *
+ * @return int The CPU, or -1 if placement is not configured
+ */
+int place_connection_thread(int fd);
+
+#endif /* AFFINITY_H */
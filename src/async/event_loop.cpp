@@ -0,0 +1,374 @@
+/*
+ * event_loop.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the Async::EventLoop class and its awaitables.
+ */
+
+#include "busy_poll.h"
+#include "event_loop.h"
+
+#if COROUTINE_SUPPORT == 1
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * @namespace Async
+ * Coroutines that wait for sockets and timers on a single-threaded event loop
+ */
+namespace Async
+{
+
+	/**
+	 * Logs an exception escaping a Task, which has no caller to rethrow it to
+	 *
+	 * @return void
+	 */
+	void Task::promise_type::unhandled_exception() noexcept
+	{
+		try
+		{
+			throw;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Connection failed: " << e.what() << std::endl;
+		}
+		catch (...)
+		{
+			std::cerr << "Connection failed" << std::endl;
+		}
+	}
+
+	/**
+	 * Construct a Wait
+	 *
+	 * @param EventLoop& loop The loop to wait on
+	 * @param int fd The socket, or -1 to only wait for the deadline
+	 * @param uint32_t events The epoll events to wait for
+	 * @param Clock::time_point deadline When to give up
+	 */
+	Wait::Wait(EventLoop& loop, int fd, uint32_t events, Clock::time_point deadline) : loop_(loop), fd_(fd), events_(events), deadline_(deadline), timed_out_(false)
+	{
+	}
+
+	/**
+	 * Hands the suspended coroutine to the loop
+	 *
+	 * @param std::coroutine_handle<> handle The coroutine
+	 *
+	 * @return void
+	 */
+	void Wait::await_suspend(std::coroutine_handle<> handle)
+	{
+		handle_ = handle;
+		loop_.watch(this);
+	}
+
+	/**
+	 * Construct a Transfer
+	 *
+	 * @param EventLoop& loop The loop to wait on
+	 * @param Operation operation What to do
+	 * @param int fd The socket
+	 * @param char* buffer The bytes to write, or where to read them to
+	 * @param size_t size The size of buffer
+	 * @param Clock::time_point deadline When to give up waiting
+	 * @param int flags Extra send() flags to write with
+	 */
+	Transfer::Transfer(EventLoop& loop, Operation operation, int fd, char* buffer, size_t size, Clock::time_point deadline, int flags) : operation_(operation), buffer_(buffer), size_(size), flags_(flags), wait_(loop, fd, operation == WRITE ? EPOLLOUT : EPOLLIN, deadline), result_(-1), suspended_(false)
+	{
+	}
+
+	/**
+	 * Runs the operation once, without blocking
+	 *
+	 * @return ssize_t The result of the system call
+	 */
+	ssize_t Transfer::attempt()
+	{
+		ssize_t result;
+		do
+		{
+			switch (operation_)
+			{
+				case READ:
+					result = recv(wait_.fd_, buffer_, size_, MSG_DONTWAIT);
+					break;
+				case WRITE:
+					result = send(wait_.fd_, buffer_, size_, MSG_DONTWAIT | MSG_NOSIGNAL | flags_);
+					break;
+				default:
+					result = accept4(wait_.fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+					break;
+			}
+		}
+		while (result == -1 && errno == EINTR);
+
+		return result;
+	}
+
+	/**
+	 * Tries the operation, so the coroutine only suspends if the socket is not ready
+	 *
+	 * @return bool Whether the operation completed or failed outright
+	 */
+	bool Transfer::await_ready()
+	{
+		result_ = attempt();
+		return result_ != -1 || (errno != EAGAIN && errno != EWOULDBLOCK);
+	}
+
+	/**
+	 * Waits for the socket to become ready
+	 *
+	 * @param std::coroutine_handle<> handle The coroutine
+	 *
+	 * @return void
+	 */
+	void Transfer::await_suspend(std::coroutine_handle<> handle)
+	{
+		suspended_ = true;
+		wait_.await_suspend(handle);
+	}
+
+	/**
+	 * Finishes the operation once the socket is ready
+	 *
+	 * @return ssize_t What the system call returned, or -1 with errno set to ETIMEDOUT
+	 */
+	ssize_t Transfer::await_resume()
+	{
+		if (!suspended_)
+		{
+			return result_;
+		}
+
+		suspended_ = false;
+		if (!wait_.await_resume())
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		// Readiness is only a hint: another process may have taken the connection first, leaving EAGAIN
+		return attempt();
+	}
+
+	/**
+	 * Construct an EventLoop
+	 *
+	 * @throws std::runtime_error If epoll is unavailable
+	 */
+	EventLoop::EventLoop() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)), waiting_(0)
+	{
+		if (epoll_fd_ == -1)
+		{
+			throw std::runtime_error(std::string("Failed to create event loop: ") + std::strerror(errno));
+		}
+	}
+
+	/**
+	 * Destruct the EventLoop
+	 */
+	EventLoop::~EventLoop()
+	{
+		close(epoll_fd_);
+	}
+
+	/**
+	 * Starts watching for a suspended Wait's socket and deadline
+	 *
+	 * @param Wait* wait The Wait
+	 *
+	 * @return void
+	 */
+	void EventLoop::watch(Wait* wait)
+	{
+		if (wait->fd_ != -1)
+		{
+			epoll_event event = {};
+			event.events = wait->events_;
+			event.data.ptr = wait;
+			if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wait->fd_, &event) == -1)
+			{
+				throw std::runtime_error(std::string("Failed to watch socket: ") + std::strerror(errno));
+			}
+		}
+
+		wait->timer_ = wait->deadline_ == Clock::time_point::max() ? timers_.end() : timers_.emplace(wait->deadline_, wait);
+		++waiting_;
+	}
+
+	/**
+	 * Stops watching for a Wait and resumes its coroutine
+	 *
+	 * @param Wait* wait The Wait
+	 * @param bool timed_out Whether its deadline passed
+	 *
+	 * @return void
+	 */
+	void EventLoop::wake(Wait* wait, bool timed_out)
+	{
+		if (wait->fd_ != -1)
+		{
+			epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, wait->fd_, nullptr);
+		}
+
+		if (wait->timer_ != timers_.end())
+		{
+			timers_.erase(wait->timer_);
+			wait->timer_ = timers_.end();
+		}
+
+		--waiting_;
+		wait->timed_out_ = timed_out;
+		wait->handle_.resume();
+	}
+
+	/**
+	 * Resume waiting coroutines as their sockets and deadlines come due, until none is waiting
+	 *
+	 * Each Wait watches a single socket and only its own coroutine can end it, so
+	 * every event from one epoll_wait() still refers to a suspended Wait.
+	 *
+	 * @return void
+	 */
+	void EventLoop::run()
+	{
+		std::vector<epoll_event> events(64);
+
+		while (waiting_ > 0)
+		{
+			int timeout = -1;
+			if (!timers_.empty())
+			{
+				Clock::duration remaining = timers_.begin()->first - Clock::now();
+				timeout = remaining.count() <= 0 ? 0 : static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+			}
+
+			int ready = wait_for_events(epoll_fd_, events.data(), static_cast<int>(events.size()), timeout);
+			if (ready == -1 && errno != EINTR)
+			{
+				throw std::runtime_error(std::string("Failed to wait for events: ") + std::strerror(errno));
+			}
+
+			for (int i = 0; i < ready; ++i)
+			{
+				wake(static_cast<Wait*>(events[i].data.ptr), false);
+			}
+
+			Clock::time_point now = Clock::now();
+			while (!timers_.empty() && timers_.begin()->first <= now)
+			{
+				wake(timers_.begin()->second, true);
+			}
+		}
+	}
+
+	/**
+	 * Wait until a socket is readable
+	 *
+	 * @param int fd The socket
+	 * @param Clock::time_point deadline When to give up
+	 *
+	 * @return Wait The awaitable
+	 */
+	Wait EventLoop::readable(int fd, Clock::time_point deadline)
+	{
+		return Wait(*this, fd, EPOLLIN, deadline);
+	}
+
+	/**
+	 * Wait until a socket is writable
+	 *
+	 * @param int fd The socket
+	 * @param Clock::time_point deadline When to give up
+	 *
+	 * @return Wait The awaitable
+	 */
+	Wait EventLoop::writable(int fd, Clock::time_point deadline)
+	{
+		return Wait(*this, fd, EPOLLOUT, deadline);
+	}
+
+	/**
+	 * Wait until a point in time
+	 *
+	 * @param Clock::time_point deadline When to resume
+	 *
+	 * @return Wait The awaitable
+	 */
+	Wait EventLoop::sleep_until(Clock::time_point deadline)
+	{
+		return Wait(*this, -1, 0, deadline);
+	}
+
+	/**
+	 * Read from a socket, waiting while nothing has arrived
+	 *
+	 * @param int fd The non-blocking socket
+	 * @param char* buffer Where to read to
+	 * @param size_t size The size of buffer
+	 * @param Clock::time_point deadline When to give up
+	 *
+	 * @return Transfer The awaitable
+	 */
+	Transfer EventLoop::read(int fd, char* buffer, size_t size, Clock::time_point deadline)
+	{
+		return Transfer(*this, Transfer::READ, fd, buffer, size, deadline);
+	}
+
+	/**
+	 * Write to a socket, waiting while its send buffer is full
+	 *
+	 * @param int fd The non-blocking socket
+	 * @param const char* data The bytes to write
+	 * @param size_t size The number of bytes
+	 * @param Clock::time_point deadline When to give up
+	 * @param int flags Extra send() flags
+	 *
+	 * @return Transfer The awaitable
+	 */
+	Transfer EventLoop::write(int fd, const char* data, size_t size, Clock::time_point deadline, int flags)
+	{
+		return Transfer(*this, Transfer::WRITE, fd, const_cast<char*>(data), size, deadline, flags);
+	}
+
+	/**
+	 * Accept a connection, waiting while none is pending
+	 *
+	 * @param int fd The non-blocking listening socket
+	 *
+	 * @return Transfer The awaitable
+	 */
+	Transfer EventLoop::accept(int fd)
+	{
+		return Transfer(*this, Transfer::ACCEPT, fd, nullptr, 0, Clock::time_point::max());
+	}
+}
+
+#endif /* COROUTINE_SUPPORT */
@@ -0,0 +1,318 @@
+/*
+ * event_loop.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definitions for the Async::EventLoop class and its awaitables.
+ */
+
+#include "config.h"
+
+#if COROUTINE_SUPPORT == 1
+
+#ifndef ASYNC_EVENT_LOOP_H
+#define ASYNC_EVENT_LOOP_H
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <sys/types.h>
+
+/**
+ * @namespace Async
+ * Coroutines that wait for sockets and timers on a single-threaded event loop
+ */
+namespace Async
+{
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * @brief A coroutine that runs on its own once started
+	 *
+	 * Calling a coroutine returning Task runs it until it first waits; the event
+	 * loop resumes it from then on, and its frame is freed when it returns. Nothing
+	 * waits on a Task, so exceptions escaping it are logged and dropped.
+	 */
+	struct Task
+	{
+		struct promise_type
+		{
+			Task get_return_object() noexcept
+			{
+				return Task();
+			}
+
+			std::suspend_never initial_suspend() noexcept
+			{
+				return std::suspend_never();
+			}
+
+			std::suspend_never final_suspend() noexcept
+			{
+				return std::suspend_never();
+			}
+
+			void return_void() noexcept
+			{
+			}
+
+			void unhandled_exception() noexcept;
+		};
+	};
+
+	class EventLoop;
+
+	/**
+	 * @brief Suspends a coroutine until a socket is ready or a deadline passes
+	 *
+	 * co_await yields true if the socket became ready and false if the deadline
+	 * passed first. Without a socket, it simply sleeps until the deadline.
+	 */
+	class Wait
+	{
+		public:
+			/**
+			 * Construct a Wait
+			 *
+			 * @param EventLoop& loop The loop to wait on
+			 * @param int fd The socket, or -1 to only wait for the deadline
+			 * @param uint32_t events The epoll events to wait for, e.g. EPOLLIN
+			 * @param Clock::time_point deadline When to give up, or Clock::time_point::max() to wait forever
+			 */
+			Wait(EventLoop& loop, int fd, uint32_t events, Clock::time_point deadline);
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			void await_suspend(std::coroutine_handle<> handle);
+
+			bool await_resume() const noexcept
+			{
+				return !timed_out_;
+			}
+
+		private:
+			friend class EventLoop;
+			friend class Transfer;
+
+			EventLoop& loop_;
+			int fd_;
+			uint32_t events_;
+			Clock::time_point deadline_;
+			std::coroutine_handle<> handle_;
+			bool timed_out_;
+			std::multimap<Clock::time_point, Wait*>::iterator timer_;
+	};
+
+	/**
+	 * @brief Reads, writes or accepts on a non-blocking socket, suspending while it would block
+	 *
+	 * The operation is tried straight away, and only suspends the coroutine if the
+	 * socket is not ready; co_await yields what recv(), send() or accept4() returned,
+	 * or -1 with errno set to ETIMEDOUT if the deadline passed first. A socket can
+	 * lose its readiness before the retry, so -1 with EAGAIN means try again.
+	 */
+	class Transfer
+	{
+		public:
+			/**
+			 * @enum Operation
+			 * What the Transfer does once the socket is ready
+			 */
+			enum Operation
+			{
+				READ,
+				WRITE,
+				ACCEPT
+			};
+
+			/**
+			 * Construct a Transfer
+			 *
+			 * @param EventLoop& loop The loop to wait on
+			 * @param Operation operation What to do
+			 * @param int fd The socket
+			 * @param char* buffer The bytes to write, or where to read them to; unused to accept
+			 * @param size_t size The size of buffer
+			 * @param Clock::time_point deadline When to give up waiting
+			 * @param int flags Extra send() flags to write with, e.g. MSG_MORE
+			 */
+			Transfer(EventLoop& loop, Operation operation, int fd, char* buffer, size_t size, Clock::time_point deadline, int flags = 0);
+
+			bool await_ready();
+
+			void await_suspend(std::coroutine_handle<> handle);
+
+			ssize_t await_resume();
+
+		private:
+			/**
+			 * Runs the operation once, without blocking
+			 *
+			 * @return ssize_t The result of the system call
+			 */
+			ssize_t attempt();
+
+			Operation operation_;
+			char* buffer_;
+			size_t size_;
+			int flags_;
+			Wait wait_;
+			ssize_t result_;
+			bool suspended_;
+	};
+
+	/**
+	 * @brief Resumes coroutines when their sockets are ready or their deadlines pass
+	 *
+	 * Sockets are watched with epoll, level-triggered, for as long as a coroutine
+	 * waits on them; deadlines are kept in order, so the next one bounds each
+	 * epoll_wait(). A loop and its coroutines belong to the thread that runs it.
+	 */
+	class EventLoop
+	{
+		public:
+			/**
+			 * Construct an EventLoop
+			 *
+			 * @throws std::runtime_error If epoll is unavailable
+			 */
+			EventLoop();
+
+			/**
+			 * Destruct the EventLoop
+			 */
+			~EventLoop();
+
+			/**
+			 * Resume waiting coroutines as their sockets and deadlines come due, until none is waiting
+			 *
+			 * @return void
+			 */
+			void run();
+
+			/**
+			 * Wait until a socket is readable
+			 *
+			 * @param int fd The socket
+			 * @param Clock::time_point deadline When to give up
+			 *
+			 * @return Wait The awaitable, yielding whether the socket became readable
+			 */
+			Wait readable(int fd, Clock::time_point deadline = Clock::time_point::max());
+
+			/**
+			 * Wait until a socket is writable
+			 *
+			 * @param int fd The socket
+			 * @param Clock::time_point deadline When to give up
+			 *
+			 * @return Wait The awaitable, yielding whether the socket became writable
+			 */
+			Wait writable(int fd, Clock::time_point deadline = Clock::time_point::max());
+
+			/**
+			 * Wait until a point in time
+			 *
+			 * @param Clock::time_point deadline When to resume
+			 *
+			 * @return Wait The awaitable
+			 */
+			Wait sleep_until(Clock::time_point deadline);
+
+			/**
+			 * Read from a socket, waiting while nothing has arrived
+			 *
+			 * @param int fd The non-blocking socket
+			 * @param char* buffer Where to read to
+			 * @param size_t size The size of buffer
+			 * @param Clock::time_point deadline When to give up
+			 *
+			 * @return Transfer The awaitable, yielding the bytes read, 0 at end of stream, or -1 on error
+			 */
+			Transfer read(int fd, char* buffer, size_t size, Clock::time_point deadline = Clock::time_point::max());
+
+			/**
+			 * Write to a socket, waiting while its send buffer is full
+			 *
+			 * @param int fd The non-blocking socket
+			 * @param const char* data The bytes to write
+			 * @param size_t size The number of bytes
+			 * @param Clock::time_point deadline When to give up
+			 * @param int flags Extra send() flags, e.g. MSG_MORE when more of the message follows
+			 *
+			 * @return Transfer The awaitable, yielding the bytes written, or -1 on error
+			 */
+			Transfer write(int fd, const char* data, size_t size, Clock::time_point deadline = Clock::time_point::max(), int flags = 0);
+
+			/**
+			 * Accept a connection, waiting while none is pending
+			 *
+			 * @param int fd The non-blocking listening socket
+			 *
+			 * @return Transfer The awaitable, yielding the new non-blocking socket, or -1 on error
+			 */
+			Transfer accept(int fd);
+
+		private:
+			friend class Wait;
+
+			EventLoop(const EventLoop&);
+			EventLoop& operator=(const EventLoop&);
+
+			/**
+			 * Starts watching for a suspended Wait's socket and deadline
+			 *
+			 * @param Wait* wait The Wait
+			 *
+			 * @return void
+			 */
+			void watch(Wait* wait);
+
+			/**
+			 * Stops watching for a Wait and resumes its coroutine
+			 *
+			 * @param Wait* wait The Wait
+			 * @param bool timed_out Whether its deadline passed
+			 *
+			 * @return void
+			 */
+			void wake(Wait* wait, bool timed_out);
+
+			/**
+			 * @var int The epoll instance
+			 */
+			int epoll_fd_;
+
+			/**
+			 * @var std::multimap<Clock::time_point, Wait*> Waits with a deadline, soonest first
+			 */
+			std::multimap<Clock::time_point, Wait*> timers_;
+
+			/**
+			 * @var size_t The number of coroutines waiting
+			 */
+			size_t waiting_;
+	};
+}
+
+#endif /* ASYNC_EVENT_LOOP_H */
+
+#endif /* COROUTINE_SUPPORT */
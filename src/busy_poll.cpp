@@ -0,0 +1,247 @@
+/*
+ * busy_poll.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the functions that spin on sockets instead of blocking on them.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "busy_poll.h"
+#include "functions.h"
+
+/**
+ * @typedef Clock
+ * The clock spins are timed against
+ */
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * @var unsigned int How long each wait spins before blocking, in microseconds, or 0 when busy polling is off
+ */
+static unsigned int busy_poll_microseconds = 0;
+
+/**
+ * @var std::atomic<bool> Whether a failure to set SO_BUSY_POLL was already reported, so it is reported once
+ */
+static std::atomic<bool> busy_poll_refused(false);
+
+/**
+ * Sets how long each wait for a socket spins before blocking, before any socket is opened
+ *
+ * Waking a thread blocked on a socket costs several microseconds of scheduler
+ * and interrupt work, which shows up in every latency measured against a fast
+ * service. Busy polling spends a CPU instead: each wait first polls without a
+ * timeout for up to this long, much as the kernel's own busy polling does, and
+ * only blocks when nothing arrived meanwhile. A spin time longer than the gap
+ * between arrivals keeps a busy thread from ever blocking. With a single CPU
+ * online it stays off, as the spinning thread would hold off the very peer it is
+ * waiting on.
+ *
+ * @param unsigned int microseconds The spin time, or 0 to always block at once
+ *
+ * @return void
+ */
+void configure_busy_poll(unsigned int microseconds)
+{
+	busy_poll_microseconds = microseconds;
+	if (microseconds > 0 && sysconf(_SC_NPROCESSORS_ONLN) == 1)
+	{
+		busy_poll_microseconds = 0;
+		debug("Not busy polling, as only one CPU is online");
+	}
+	else if (microseconds > 0)
+	{
+		debug("Busy polling sockets for %u us before blocking", microseconds);
+	}
+}
+
+/**
+ * Asks the kernel to busy poll the device queue when a socket is read with nothing queued
+ *
+ * SO_BUSY_POLL only helps on network devices with NAPI busy polling, not on
+ * loopback or Unix domain sockets, and raising it above net.core.busy_read
+ * takes CAP_NET_ADMIN; the user-space spin works regardless.
+ *
+ * @param int fd The socket
+ *
+ * @return void
+ */
+void busy_poll_socket(int fd)
+{
+	#ifdef SO_BUSY_POLL
+	int microseconds = static_cast<int>(busy_poll_microseconds);
+	if (microseconds > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &microseconds, sizeof(microseconds)) != 0
+		&& !busy_poll_refused.exchange(true))
+	{
+		debug("Failed to set SO_BUSY_POLL, spinning in user space only: %s", strerror(errno));
+	}
+	#else
+	(void)fd;
+	#endif /* SO_BUSY_POLL */
+}
+
+/**
+ * Returns what is left of a timeout after spinning
+ *
+ * @param Clock::time_point start When the wait started
+ * @param int timeout Milliseconds to wait in total, or -1 to wait indefinitely
+ *
+ * @return int Milliseconds left to block for, rounded up, 0 if none, or -1 to block indefinitely
+ */
+static int remaining_timeout(Clock::time_point start, int timeout)
+{
+	if (timeout < 0)
+	{
+		return -1;
+	}
+
+	Clock::duration left = start + std::chrono::milliseconds(timeout) - Clock::now();
+	if (left <= Clock::duration::zero())
+	{
+		return 0;
+	}
+
+	return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(left + std::chrono::milliseconds(1) - Clock::duration(1)).count());
+}
+
+/**
+ * Returns when a wait that started now stops spinning
+ *
+ * @param Clock::time_point start When the wait started
+ * @param int timeout Milliseconds to wait in total, or -1 to wait indefinitely
+ *
+ * @return Clock::time_point The end of the spin, at most the end of the timeout
+ */
+static Clock::time_point spin_end(Clock::time_point start, int timeout)
+{
+	Clock::time_point end = start + std::chrono::microseconds(busy_poll_microseconds);
+	if (timeout >= 0 && start + std::chrono::milliseconds(timeout) < end)
+	{
+		end = start + std::chrono::milliseconds(timeout);
+	}
+
+	return end;
+}
+
+/**
+ * Waits for events on an epoll instance, spinning before blocking when busy polling
+ *
+ * @param int epoll_fd The epoll instance
+ * @param struct epoll_event* events Where to store the ready events
+ * @param int max_events The most events to return
+ * @param int timeout Milliseconds to wait, or -1 to wait indefinitely
+ *
+ * @return int The number of ready events, 0 on timeout, or -1 on error as epoll_wait() returns
+ */
+int wait_for_events(int epoll_fd, struct epoll_event* events, int max_events, int timeout)
+{
+	if (busy_poll_microseconds > 0 && timeout != 0)
+	{
+		Clock::time_point start = Clock::now();
+		Clock::time_point end = spin_end(start, timeout);
+		do
+		{
+			int ready = epoll_wait(epoll_fd, events, max_events, 0);
+			if (ready != 0)
+			{
+				return ready;
+			}
+		}
+		while (Clock::now() < end);
+
+		timeout = remaining_timeout(start, timeout);
+		if (timeout == 0)
+		{
+			return 0;
+		}
+	}
+
+	return epoll_wait(epoll_fd, events, max_events, timeout);
+}
+
+/**
+ * Waits for events on file descriptors, spinning before blocking when busy polling
+ *
+ * @param struct pollfd* fds The file descriptors and the events to wait for
+ * @param nfds_t count How many
+ * @param int timeout Milliseconds to wait, or -1 to wait indefinitely
+ *
+ * @return int The number of ready file descriptors, 0 on timeout, or -1 on error as poll() returns
+ */
+int wait_for_poll(struct pollfd* fds, nfds_t count, int timeout)
+{
+	if (busy_poll_microseconds > 0 && timeout != 0)
+	{
+		Clock::time_point start = Clock::now();
+		Clock::time_point end = spin_end(start, timeout);
+		do
+		{
+			int ready = poll(fds, count, 0);
+			if (ready != 0)
+			{
+				return ready;
+			}
+		}
+		while (Clock::now() < end);
+
+		timeout = remaining_timeout(start, timeout);
+		if (timeout == 0)
+		{
+			return 0;
+		}
+	}
+
+	return poll(fds, count, timeout);
+}
+
+/**
+ * Spins until a socket is readable, for at most the busy poll time
+ *
+ * Called before a blocking read, so the read finds data already queued rather
+ * than putting the thread to sleep; the read then blocks as usual, honouring
+ * any SO_RCVTIMEO, if nothing arrived during the spin.
+ *
+ * @param int fd The socket
+ *
+ * @return void
+ */
+void spin_until_readable(int fd)
+{
+	if (busy_poll_microseconds == 0)
+	{
+		return;
+	}
+
+	struct pollfd descriptor;
+	descriptor.fd = fd;
+	descriptor.events = POLLIN;
+	Clock::time_point end = Clock::now() + std::chrono::microseconds(busy_poll_microseconds);
+	do
+	{
+		descriptor.revents = 0;
+		if (poll(&descriptor, 1, 0) != 0)
+		{
+			return;
+		}
+	}
+	while (Clock::now() < end);
+}
@@ -0,0 +1,78 @@
+/*
+ * busy_poll.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the functions that spin on sockets instead of blocking on them.
+ */
+
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <poll.h>
+#include <sys/epoll.h>
+
+/**
+ * Sets how long each wait for a socket spins before blocking, before any socket is opened
+ *
+ * @param unsigned int microseconds The spin time, or 0 to always block at once
+ *
+ * @return void
+ */
+void configure_busy_poll(unsigned int microseconds);
+
+/**
+ * Asks the kernel to busy poll the device queue when a socket is read with nothing queued
+ *
+ * @param int fd The socket
+ *
+ * @return void
+ */
+void busy_poll_socket(int fd);
+
+/**
+ * Waits for events on an epoll instance, spinning before blocking when busy polling
+ *
+ * @param int epoll_fd The epoll instance
+ * @param struct epoll_event* events Where to store the ready events
+ * @param int max_events The most events to return
+ * @param int timeout Milliseconds to wait, or -1 to wait indefinitely
+ *
+ * @return int The number of ready events, 0 on timeout, or -1 on error as epoll_wait() returns
+ */
+int wait_for_events(int epoll_fd, struct epoll_event* events, int max_events, int timeout);
+
+/**
+ * Waits for events on file descriptors, spinning before blocking when busy polling
+ *
+ * @param struct pollfd* fds The file descriptors and the events to wait for
+ * @param nfds_t count How many
+ * @param int timeout Milliseconds to wait, or -1 to wait indefinitely
+ *
+ * @return int The number of ready file descriptors, 0 on timeout, or -1 on error as poll() returns
+ */
+int wait_for_poll(struct pollfd* fds, nfds_t count, int timeout);
+
+/**
+ * Spins until a socket is readable, for at most the busy poll time
+ *
+ * @param int fd The socket
+ *
+ * @return void
+ */
+void spin_until_readable(int fd);
+
+#endif /* BUSY_POLL_H */
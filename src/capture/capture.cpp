@@ -0,0 +1,559 @@
+/*
+ * capture.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the capture reading and writing classes.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture.h"
+
+/**
+ * @namespace Capture
+ * Recording of traffic to capture files, and reading it back for replay
+ */
+namespace Capture
+{
+
+	/**
+	 * @var const char* The first line of every capture file
+	 */
+	static const char* const FILE_HEADER = "HAPERF-CAPTURE 1\n";
+
+	/**
+	 * Returns the value of an attribute
+	 *
+	 * @param const std::string& key The attribute name
+	 *
+	 * @return std::string The value, or an empty string if the attribute is absent
+	 */
+	std::string Record::attribute(const std::string& key) const
+	{
+		for (size_t i = 0; i < attributes.size(); ++i)
+		{
+			if (attributes[i].first == key)
+			{
+				return attributes[i].second;
+			}
+		}
+
+		return "";
+	}
+
+	/**
+	 * Returns the current time as stored in records
+	 *
+	 * @return uint64_t Microseconds since the Unix epoch
+	 */
+	uint64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	/**
+	 * Adds a TCP sample to a record's attributes
+	 *
+	 * Round-trip times are stored in microseconds, the congestion window in
+	 * segments and the delivery rate in bytes per second, as the kernel reports them.
+	 *
+	 * @param const TcpSample& sample The sample, added only if valid
+	 * @param[out] attributes The attributes to add it to
+	 *
+	 * @return void
+	 */
+	void add_tcp_attributes(const TcpSample& sample, Attributes& attributes)
+	{
+		if (!sample.valid)
+		{
+			return;
+		}
+
+		attributes.push_back(std::make_pair("rtt", std::to_string(sample.rtt)));
+		attributes.push_back(std::make_pair("rttvar", std::to_string(sample.rtt_var)));
+		attributes.push_back(std::make_pair("retrans", std::to_string(sample.retransmits)));
+		attributes.push_back(std::make_pair("cwnd", std::to_string(sample.cwnd)));
+		attributes.push_back(std::make_pair("delivery_rate", std::to_string(sample.delivery_rate)));
+	}
+
+	/**
+	 * Reads back a TCP sample added to a record by add_tcp_attributes()
+	 *
+	 * @param const Record& record The record
+	 *
+	 * @return TcpSample The sample, invalid if the record has none
+	 */
+	TcpSample tcp_attributes(const Record& record)
+	{
+		TcpSample sample;
+		std::string rtt = record.attribute("rtt");
+		if (rtt.empty())
+		{
+			return sample;
+		}
+
+		sample.valid = true;
+		sample.rtt = std::strtoul(rtt.c_str(), nullptr, 10);
+		sample.rtt_var = std::strtoul(record.attribute("rttvar").c_str(), nullptr, 10);
+		sample.retransmits = std::strtoul(record.attribute("retrans").c_str(), nullptr, 10);
+		sample.cwnd = std::strtoul(record.attribute("cwnd").c_str(), nullptr, 10);
+		sample.delivery_rate = std::strtoull(record.attribute("delivery_rate").c_str(), nullptr, 10);
+
+		return sample;
+	}
+
+	/**
+	 * Writer constructor
+	 *
+	 * @param const std::string& path The path to the capture file
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If the file cannot be created
+	 */
+	Writer::Writer(const std::string& path)
+		: file_(fopen(path.c_str(), "wb")),
+		  closing_(false),
+		  next_connection_(1),
+		  sample_interval_(0),
+		  stopping_(false)
+	{
+		if (file_ == nullptr)
+		{
+			throw std::runtime_error("Failed to create capture file " + path);
+		}
+
+		fputs(FILE_HEADER, file_);
+		fflush(file_);
+
+		flusher_ = std::thread(&Writer::flush_records, this);
+	}
+
+	/**
+	 * Writer destructor
+	 *
+	 * @return void
+	 */
+	Writer::~Writer()
+	{
+		if (sampler_.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(watched_mutex_);
+				stopping_ = true;
+			}
+			stop_.notify_one();
+			sampler_.join();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closing_ = true;
+		}
+		queue_filled_.notify_one();
+		flusher_.join();
+
+		fclose(file_);
+	}
+
+	/**
+	 * Allocates an identifier for a new connection
+	 *
+	 * @return uint64_t The connection identifier, unique within the capture
+	 */
+	uint64_t Writer::open_connection()
+	{
+		return next_connection_++;
+	}
+
+	/**
+	 * Appends a record
+	 *
+	 * The record is only queued; the writing thread writes and flushes it moments
+	 * later, so a recorder stopped with a signal leaves a capture behind that is
+	 * complete up to the last few records. When the disk falls MAX_QUEUED bytes
+	 * behind, this waits for it rather than buffer without bound.
+	 *
+	 * @param const Record& record The record to write
+	 *
+	 * @return void
+	 */
+	void Writer::write(const Record& record)
+	{
+		std::ostringstream header;
+		header << record.type << ' ' << record.connection << ' ' << record.timestamp << ' '
+			<< record.direction << ' ' << record.payload.size();
+
+		for (size_t i = 0; i < record.attributes.size(); ++i)
+		{
+			header << ' ' << record.attributes[i].first << '=' << record.attributes[i].second;
+		}
+		header << '\n';
+
+		std::string line = header.str();
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		queue_drained_.wait(lock, [this]() { return queued_.size() < MAX_QUEUED; });
+
+		bool was_empty = queued_.empty();
+		queued_.append(line);
+		queued_.append(record.payload);
+		queued_.push_back('\n');
+		lock.unlock();
+
+		if (was_empty)
+		{
+			queue_filled_.notify_one();
+		}
+	}
+
+	/**
+	 * Writes and flushes queued records until closing and the queue is empty
+	 *
+	 * The whole queue is taken at once and written without the lock held, so
+	 * connections keep queueing records while the disk catches up.
+	 *
+	 * @return void
+	 */
+	void Writer::flush_records()
+	{
+		std::string records;
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			queue_filled_.wait(lock, [this]() { return !queued_.empty() || closing_; });
+			if (queued_.empty())
+			{
+				return;
+			}
+
+			records.swap(queued_);
+			lock.unlock();
+			queue_drained_.notify_all();
+
+			fwrite(records.data(), 1, records.size(), file_);
+			fflush(file_);
+			records.clear();
+
+			lock.lock();
+		}
+	}
+
+	/**
+	 * Appends a record stamped with the current time
+	 *
+	 * @param const std::string& type The record type
+	 * @param uint64_t connection The connection identifier
+	 * @param char direction The direction of the record
+	 * @param const std::string& payload The payload
+	 * @param const Attributes& attributes Extra details for the header line
+	 *
+	 * @return void
+	 */
+	void Writer::write(const std::string& type, uint64_t connection, char direction, const std::string& payload, const Attributes& attributes)
+	{
+		Record record;
+		record.type = type;
+		record.connection = connection;
+		record.timestamp = now();
+		record.direction = direction;
+		record.attributes = attributes;
+		record.payload = payload;
+
+		write(record);
+	}
+
+	/**
+	 * Starts recording the TCP statistics of watched connections at an interval, before any connection is watched
+	 *
+	 * Statistics sampled only at close cannot tell a connection that suffered
+	 * losses early on from one that suffered them just before a slow response, so
+	 * long-lived connections such as tunnels and WebSockets can be sampled while
+	 * open too, as tcp-info records.
+	 *
+	 * @param unsigned int milliseconds The interval, or 0 to only record them when connections close
+	 *
+	 * @return void
+	 */
+	void Writer::start_tcp_sampling(unsigned int milliseconds)
+	{
+		if (milliseconds == 0 || sampler_.joinable())
+		{
+			return;
+		}
+
+		sample_interval_ = std::chrono::milliseconds(milliseconds);
+		sampler_ = std::thread(&Writer::sample_connections, this);
+	}
+
+	/**
+	 * Samples a connection's TCP statistics at the sampling interval until it closes
+	 *
+	 * @param int fd The connection's socket
+	 * @param uint64_t connection The connection identifier
+	 *
+	 * @return void
+	 */
+	void Writer::watch(int fd, uint64_t connection)
+	{
+		if (sample_interval_.count() == 0)
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(watched_mutex_);
+		watched_[fd] = connection;
+	}
+
+	/**
+	 * Appends a connection's close record with its final TCP statistics, before its socket is closed
+	 *
+	 * The connection stops being watched first, so the sampling thread never
+	 * samples a socket number that was closed and reused by another connection.
+	 *
+	 * @param int fd The connection's socket
+	 * @param uint64_t connection The connection identifier
+	 *
+	 * @return void
+	 */
+	void Writer::close_connection(int fd, uint64_t connection)
+	{
+		if (sample_interval_.count() > 0)
+		{
+			std::lock_guard<std::mutex> lock(watched_mutex_);
+			watched_.erase(fd);
+		}
+
+		TcpSample sample;
+		sample_tcp_info(fd, sample);
+
+		Attributes attributes;
+		add_tcp_attributes(sample, attributes);
+		write("close", connection, NO_DIRECTION, "", attributes);
+	}
+
+	/**
+	 * Records the TCP statistics of every watched connection once per interval until stopped
+	 *
+	 * The sockets are sampled with the watched connections locked, so none is
+	 * closed and its number reused meanwhile, but the records are written after
+	 * the lock is released, so watching and closing connections does not wait on
+	 * the capture file.
+	 *
+	 * @return void
+	 */
+	void Writer::sample_connections()
+	{
+		std::vector<Record> records;
+
+		std::unique_lock<std::mutex> lock(watched_mutex_);
+		while (!stop_.wait_for(lock, sample_interval_, [this]() { return stopping_; }))
+		{
+			for (std::map<int, uint64_t>::const_iterator it = watched_.begin(); it != watched_.end(); ++it)
+			{
+				TcpSample sample;
+				if (sample_tcp_info(it->first, sample))
+				{
+					Record record;
+					record.type = "tcp-info";
+					record.connection = it->second;
+					record.timestamp = now();
+					record.direction = NO_DIRECTION;
+					add_tcp_attributes(sample, record.attributes);
+					records.push_back(record);
+				}
+			}
+
+			lock.unlock();
+			for (size_t i = 0; i < records.size(); ++i)
+			{
+				write(records[i]);
+			}
+			records.clear();
+			lock.lock();
+		}
+	}
+
+	/**
+	 * Reader constructor
+	 *
+	 * The mapping is advised for sequential access, so the kernel reads ahead
+	 * aggressively and may drop pages soon after they are parsed, and with
+	 * huge_pages for transparent huge pages, which for a file only take effect
+	 * where the kernel supports them on its filesystem.
+	 *
+	 * @param const std::string& path The path to the capture file
+	 * @param bool huge_pages Whether to ask for the file's memory to be on huge pages
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If the file cannot be opened or is not a capture
+	 */
+	Reader::Reader(const std::string& path, bool huge_pages)
+		: path_(path),
+		  mapping_(nullptr),
+		  buffer_(huge_pages),
+		  data_(nullptr),
+		  size_(0),
+		  position_(0)
+	{
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+		{
+			throw std::runtime_error("Failed to open capture file " + path);
+		}
+
+		struct stat status;
+		if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0)
+		{
+			void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED)
+			{
+				mapping_ = mapping;
+				data_ = static_cast<const char*>(mapping);
+				size_ = status.st_size;
+				madvise(mapping, size_, MADV_SEQUENTIAL);
+				if (huge_pages)
+				{
+					advise_huge_pages(mapping, size_);
+				}
+			}
+		}
+
+		if (mapping_ == nullptr)
+		{
+			char chunk[65536];
+			ssize_t bytes;
+			while ((bytes = read(fd, chunk, sizeof(chunk))) != 0)
+			{
+				if (bytes == -1 && errno != EINTR)
+				{
+					close(fd);
+					throw std::runtime_error("Failed to read capture file " + path + ": " + strerror(errno));
+				}
+				if (bytes > 0)
+				{
+					buffer_.append(chunk, bytes);
+				}
+			}
+
+			data_ = buffer_.data();
+			size_ = buffer_.size();
+		}
+
+		close(fd);
+
+		size_t header_size = strlen(FILE_HEADER);
+		if (size_ < header_size || memcmp(data_, FILE_HEADER, header_size) != 0)
+		{
+			if (mapping_ != nullptr)
+			{
+				munmap(mapping_, size_);
+			}
+			throw std::runtime_error(path + " is not a capture file");
+		}
+
+		position_ = header_size;
+	}
+
+	/**
+	 * Reader destructor
+	 *
+	 * @return void
+	 */
+	Reader::~Reader()
+	{
+		if (mapping_ != nullptr)
+		{
+			munmap(mapping_, size_);
+		}
+	}
+
+	/**
+	 * Returns how many bytes of the file's memory the kernel currently backs with huge pages
+	 *
+	 * @return size_t The number of bytes
+	 */
+	size_t Reader::huge_bytes() const
+	{
+		return mapping_ != nullptr ? huge_page_bytes(mapping_, size_) : buffer_.huge_bytes();
+	}
+
+	/**
+	 * Reads the next record
+	 *
+	 * @param[out] record The record read
+	 *
+	 * @return bool Whether a record was read, false at the end of the file
+	 *
+	 * @throws std::runtime_error If the file is truncated or malformed
+	 */
+	bool Reader::next(Record& record)
+	{
+		if (position_ >= size_)
+		{
+			return false;
+		}
+
+		const char* start = data_ + position_;
+		const char* newline = static_cast<const char*>(memchr(start, '\n', size_ - position_));
+		size_t line_size = newline != nullptr ? newline - start : size_ - position_;
+		std::string line(start, line_size);
+		position_ += line_size + (newline != nullptr ? 1 : 0);
+
+		if (line.empty())
+		{
+			return false;
+		}
+
+		std::istringstream header(line);
+		size_t length = 0;
+		record.attributes.clear();
+		if (!(header >> record.type >> record.connection >> record.timestamp >> record.direction >> length))
+		{
+			throw std::runtime_error(path_ + ": malformed record header \"" + line + "\"");
+		}
+
+		std::string attribute;
+		while (header >> attribute)
+		{
+			size_t equals = attribute.find('=');
+			if (equals != std::string::npos)
+			{
+				record.attributes.push_back(std::make_pair(attribute.substr(0, equals), attribute.substr(equals + 1)));
+			}
+		}
+
+		if (length >= size_ - position_ || data_[position_ + length] != '\n')
+		{
+			throw std::runtime_error(path_ + ": truncated record");
+		}
+
+		record.payload.assign(data_ + position_, length);
+		position_ += length + 1;
+		return true;
+	}
+}
@@ -0,0 +1,388 @@
+/*
+ * capture.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definitions for reading and writing captures.
+ *
+ * A capture file starts with the line "HAPERF-CAPTURE 1", followed by records:
+ *
+ *   <type> <connection> <timestamp> <direction> <length>[ <key>=<value>...]\n
+ *   <payload of length bytes>\n
+ *
+ * The timestamp is in microseconds since the Unix epoch, and the direction is '>'
+ * for client to server, '<' for server to client, or '-' for connection events.
+ * Close records, and tcp-info records written while a connection is open, carry
+ * the kernel's TCP statistics for it: rtt, rttvar, retrans, cwnd and delivery_rate.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "huge_pages.h"
+#include "tcp_info.h"
+
+/**
+ * @namespace Capture
+ * Recording of traffic to capture files, and reading it back for replay
+ */
+namespace Capture
+{
+
+	/**
+	 * @var char Direction of a record sent by the client
+	 */
+	const char TO_SERVER = '>';
+
+	/**
+	 * @var char Direction of a record sent by the server
+	 */
+	const char TO_CLIENT = '<';
+
+	/**
+	 * @var char Direction of a connection event
+	 */
+	const char NO_DIRECTION = '-';
+
+	/**
+	 * @typedef Attributes
+	 * Extra key/value details stored on a record's header line
+	 */
+	typedef std::vector<std::pair<std::string, std::string>> Attributes;
+
+	/**
+	 * @struct Record
+	 *
+	 * A single captured event: a connection opening or closing, a request, a response, a piece of a streamed response or a WebSocket frame
+	 */
+	struct Record
+	{
+		std::string type;
+		uint64_t connection = 0;
+		uint64_t timestamp = 0;
+		char direction = NO_DIRECTION;
+		Attributes attributes;
+		std::string payload;
+
+		/**
+		 * Returns the value of an attribute
+		 *
+		 * @param const std::string& key The attribute name
+		 *
+		 * @return std::string The value, or an empty string if the attribute is absent
+		 */
+		std::string attribute(const std::string& key) const;
+	};
+
+	/**
+	 * Returns the current time as stored in records
+	 *
+	 * @return uint64_t Microseconds since the Unix epoch
+	 */
+	uint64_t now();
+
+	/**
+	 * Adds a TCP sample to a record's attributes
+	 *
+	 * @param const TcpSample& sample The sample, added only if valid
+	 * @param[out] attributes The attributes to add it to
+	 *
+	 * @return void
+	 */
+	void add_tcp_attributes(const TcpSample& sample, Attributes& attributes);
+
+	/**
+	 * Reads back a TCP sample added to a record by add_tcp_attributes()
+	 *
+	 * @param const Record& record The record
+	 *
+	 * @return TcpSample The sample, invalid if the record has none
+	 */
+	TcpSample tcp_attributes(const Record& record);
+
+	/**
+	 * @brief Appends records to a capture file
+	 *
+	 * Safe to use from every connection thread at once; each record is written whole.
+	 * Records are queued and written and flushed by a thread of the Writer's own, so
+	 * a connection, or an event loop serving many, does not wait on the disk unless
+	 * the queue is full. With TCP sampling started, a thread also samples every watched connection's
+	 * TCP statistics at an interval and records them.
+	 */
+	class Writer
+	{
+		public:
+			/**
+			 * @var size_t The most record bytes queued for writing before writers wait for the disk
+			 */
+			static const size_t MAX_QUEUED = 64 * 1024 * 1024;
+
+			/**
+			 * Construct a Writer, creating or truncating the capture file
+			 *
+			 * @param const std::string& path The path to the capture file
+			 */
+			explicit Writer(const std::string& path);
+
+			/**
+			 * Destruct the Writer, writing every queued record and closing the file
+			 */
+			~Writer();
+
+			/**
+			 * Allocate an identifier for a new connection
+			 *
+			 * @return uint64_t The connection identifier, unique within the capture
+			 */
+			uint64_t open_connection();
+
+			/**
+			 * Append a record
+			 *
+			 * @param const Record& record The record to write
+			 *
+			 * @return void
+			 */
+			void write(const Record& record);
+
+			/**
+			 * Append a record stamped with the current time
+			 *
+			 * @param const std::string& type The record type
+			 * @param uint64_t connection The connection identifier
+			 * @param char direction The direction of the record
+			 * @param const std::string& payload The payload
+			 * @param const Attributes& attributes Extra details for the header line
+			 *
+			 * @return void
+			 */
+			void write(const std::string& type, uint64_t connection, char direction, const std::string& payload, const Attributes& attributes = Attributes());
+
+			/**
+			 * Start recording the TCP statistics of watched connections at an interval, before any connection is watched
+			 *
+			 * @param unsigned int milliseconds The interval, or 0 to only record them when connections close
+			 *
+			 * @return void
+			 */
+			void start_tcp_sampling(unsigned int milliseconds);
+
+			/**
+			 * Sample a connection's TCP statistics at the sampling interval until it closes
+			 *
+			 * @param int fd The connection's socket
+			 * @param uint64_t connection The connection identifier
+			 *
+			 * @return void
+			 */
+			void watch(int fd, uint64_t connection);
+
+			/**
+			 * Append a connection's close record with its final TCP statistics, before its socket is closed
+			 *
+			 * @param int fd The connection's socket
+			 * @param uint64_t connection The connection identifier
+			 *
+			 * @return void
+			 */
+			void close_connection(int fd, uint64_t connection);
+
+		private:
+			Writer(const Writer&);
+			Writer& operator=(const Writer&);
+
+			/**
+			 * @var FILE* The capture file
+			 */
+			FILE* file_;
+
+			/**
+			 * @var std::mutex Guards queued_ and closing_
+			 */
+			std::mutex mutex_;
+
+			/**
+			 * @var std::string Records waiting to be written, in order
+			 */
+			std::string queued_;
+
+			/**
+			 * @var bool Whether the writing thread should stop once the queue is empty
+			 */
+			bool closing_;
+
+			/**
+			 * @var std::condition_variable Wakes the writing thread when records are queued or it should stop
+			 */
+			std::condition_variable queue_filled_;
+
+			/**
+			 * @var std::condition_variable Wakes writers waiting for room in the queue
+			 */
+			std::condition_variable queue_drained_;
+
+			/**
+			 * @var std::thread The thread writing queued records to the file
+			 */
+			std::thread flusher_;
+
+			/**
+			 * Writes and flushes queued records until closing and the queue is empty
+			 *
+			 * @return void
+			 */
+			void flush_records();
+
+			/**
+			 * @var std::atomic<uint64_t> The next connection identifier
+			 */
+			std::atomic<uint64_t> next_connection_;
+
+			/**
+			 * Records the TCP statistics of every watched connection once per interval until stopped
+			 *
+			 * @return void
+			 */
+			void sample_connections();
+
+			/**
+			 * @var std::chrono::milliseconds How often watched connections are sampled, or 0 when they are not
+			 */
+			std::chrono::milliseconds sample_interval_;
+
+			/**
+			 * @var std::map<int, uint64_t> The connection identifier of each watched socket
+			 */
+			std::map<int, uint64_t> watched_;
+
+			/**
+			 * @var std::mutex Guards watched_ and stopping_, and is held while sockets are sampled so none is closed meanwhile
+			 */
+			std::mutex watched_mutex_;
+
+			/**
+			 * @var std::condition_variable Wakes the sampling thread to stop
+			 */
+			std::condition_variable stop_;
+
+			/**
+			 * @var bool Whether the sampling thread should stop
+			 */
+			bool stopping_;
+
+			/**
+			 * @var std::thread The sampling thread, if started
+			 */
+			std::thread sampler_;
+	};
+
+	/**
+	 * @brief Reads records back from a capture file
+	 *
+	 * The file is mapped into memory and records are parsed in place, so loading
+	 * copies each payload once rather than through stdio's buffer as well. Files
+	 * that cannot be mapped, such as pipes, are read whole into memory instead.
+	 */
+	class Reader
+	{
+		public:
+			/**
+			 * Construct a Reader and check the capture file header
+			 *
+			 * @param const std::string& path The path to the capture file
+			 * @param bool huge_pages Whether to ask for the file's memory to be on huge pages
+			 */
+			explicit Reader(const std::string& path, bool huge_pages = false);
+
+			/**
+			 * Destruct the Reader, unmapping the file
+			 */
+			~Reader();
+
+			/**
+			 * Read the next record
+			 *
+			 * @param[out] record The record read
+			 *
+			 * @return bool Whether a record was read, false at the end of the file
+			 */
+			bool next(Record& record);
+
+			/**
+			 * Returns the size of the capture file
+			 *
+			 * @return size_t The size in bytes
+			 */
+			size_t size() const
+			{
+				return size_;
+			}
+
+			/**
+			 * Returns how many bytes of the file's memory the kernel currently backs with huge pages
+			 *
+			 * @return size_t The number of bytes
+			 */
+			size_t huge_bytes() const;
+
+		private:
+			Reader(const Reader&);
+			Reader& operator=(const Reader&);
+
+			/**
+			 * @var std::string The path to the capture file, for error messages
+			 */
+			std::string path_;
+
+			/**
+			 * @var void* The file's mapping, or nullptr if it was read into buffer_
+			 */
+			void* mapping_;
+
+			/**
+			 * @var HugePageBuffer The file's contents, when it could not be mapped
+			 */
+			HugePageBuffer buffer_;
+
+			/**
+			 * @var const char* The file's contents, in the mapping or the buffer
+			 */
+			const char* data_;
+
+			/**
+			 * @var size_t The size of the file
+			 */
+			size_t size_;
+
+			/**
+			 * @var size_t Where the next record starts
+			 */
+			size_t position_;
+	};
+}
+
+#endif /* CAPTURE_H */
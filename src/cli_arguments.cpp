@@ -19,10 +19,46 @@
  * This file implements the command-line argument parsing logic.
  */
 
+#include <cstdlib>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "affinity.h"
 #include "cli_arguments.h"
+#include "config_file.h"
 #include "constants.h"
 
+/**
+ * @enum LongOption
+ *
+ * Identifiers for options that only have a long form, kept clear of the short option characters
+ */
+enum LongOption
+{
+	OPTION_CONFIG = 256,
+	OPTION_SSL_ADDRESS,
+	OPTION_SSL_PORT,
+	OPTION_PROXY_PROTOCOL,
+	OPTION_TLS_CIPHERS,
+	OPTION_TLS_CIPHERSUITES,
+	OPTION_TLS_MIN_VERSION,
+	OPTION_TLS_MAX_VERSION,
+	OPTION_TLS_CURVES,
+	OPTION_TLS_ALPN,
+	OPTION_UPSTREAM,
+	OPTION_TUNNEL_HOSTS,
+	OPTION_CACHE_SIZE,
+	OPTION_CAPTURE,
+	OPTION_TARGET,
+	OPTION_PROTOCOL,
+	OPTION_SPIN_BUDGET,
+	OPTION_HUGE_PAGES,
+	OPTION_CPUS,
+	OPTION_NUMA,
+	OPTION_BUSY_POLL,
+	OPTION_TCP_INFO_INTERVAL
+};
+
 /**
  * Parses the command-line arguments passed to the application
  *
@@ -40,10 +76,32 @@ void parse_arguments(int argc, char* argv[], Options& options, Commands& command
 		{"help", no_argument, nullptr, 'h'},
 		{"version", no_argument, nullptr, 'V'},
 		{"verbose", no_argument, nullptr, 'v'},
+		{"config", required_argument, nullptr, OPTION_CONFIG},
 		{"cert-file", required_argument, nullptr, 'c'},
 		{"cert-key", required_argument, nullptr, 'k'},
 		{"address", required_argument, nullptr, 'a'},
 		{"port", required_argument, nullptr, 'p'},
+		{"ssl-address", required_argument, nullptr, OPTION_SSL_ADDRESS},
+		{"ssl-port", required_argument, nullptr, OPTION_SSL_PORT},
+		{"proxy-protocol", no_argument, nullptr, OPTION_PROXY_PROTOCOL},
+		{"tls-ciphers", required_argument, nullptr, OPTION_TLS_CIPHERS},
+		{"tls-ciphersuites", required_argument, nullptr, OPTION_TLS_CIPHERSUITES},
+		{"tls-min-version", required_argument, nullptr, OPTION_TLS_MIN_VERSION},
+		{"tls-max-version", required_argument, nullptr, OPTION_TLS_MAX_VERSION},
+		{"tls-curves", required_argument, nullptr, OPTION_TLS_CURVES},
+		{"tls-alpn", required_argument, nullptr, OPTION_TLS_ALPN},
+		{"upstream", required_argument, nullptr, OPTION_UPSTREAM},
+		{"tunnel-hosts", required_argument, nullptr, OPTION_TUNNEL_HOSTS},
+		{"cache-size", required_argument, nullptr, OPTION_CACHE_SIZE},
+		{"capture", required_argument, nullptr, OPTION_CAPTURE},
+		{"target", required_argument, nullptr, OPTION_TARGET},
+		{"protocol", required_argument, nullptr, OPTION_PROTOCOL},
+		{"spin-budget", required_argument, nullptr, OPTION_SPIN_BUDGET},
+		{"huge-pages", no_argument, nullptr, OPTION_HUGE_PAGES},
+		{"cpus", required_argument, nullptr, OPTION_CPUS},
+		{"numa", no_argument, nullptr, OPTION_NUMA},
+		{"busy-poll", required_argument, nullptr, OPTION_BUSY_POLL},
+		{"tcp-info-interval", required_argument, nullptr, OPTION_TCP_INFO_INTERVAL},
 		{nullptr, 0, nullptr, 0}
 	};
 
@@ -61,11 +119,14 @@ void parse_arguments(int argc, char* argv[], Options& options, Commands& command
 			case 'v':
 				options.verbose = true;
 				break;
+			case OPTION_CONFIG:
+				options.config_file = optarg;
+				break;
 			case 'c':
-				options.cert_file = optarg;
+				options.cert_files.push_back(optarg);
 				break;
 			case 'k':
-				options.cert_key = optarg;
+				options.cert_keys.push_back(optarg);
 				break;
 			case 'a':
 				options.address = optarg;
@@ -73,6 +134,69 @@ void parse_arguments(int argc, char* argv[], Options& options, Commands& command
 			case 'p':
 				options.port = optarg;
 				break;
+			case OPTION_SSL_ADDRESS:
+				options.ssl_address = optarg;
+				break;
+			case OPTION_SSL_PORT:
+				options.ssl_port = optarg;
+				break;
+			case OPTION_PROXY_PROTOCOL:
+				options.proxy_protocol = true;
+				break;
+			case OPTION_TLS_CIPHERS:
+				options.tls_ciphers = optarg;
+				break;
+			case OPTION_TLS_CIPHERSUITES:
+				options.tls_ciphersuites = optarg;
+				break;
+			case OPTION_TLS_MIN_VERSION:
+				options.tls_min_version = optarg;
+				break;
+			case OPTION_TLS_MAX_VERSION:
+				options.tls_max_version = optarg;
+				break;
+			case OPTION_TLS_CURVES:
+				options.tls_curves = optarg;
+				break;
+			case OPTION_TLS_ALPN:
+				options.tls_alpn = optarg;
+				break;
+			case OPTION_UPSTREAM:
+				options.upstream = optarg;
+				break;
+			case OPTION_TUNNEL_HOSTS:
+				options.tunnel_hosts = optarg;
+				break;
+			case OPTION_CACHE_SIZE:
+				options.cache_size = optarg;
+				break;
+			case OPTION_CAPTURE:
+				options.capture_file = optarg;
+				break;
+			case OPTION_TARGET:
+				options.target = optarg;
+				break;
+			case OPTION_PROTOCOL:
+				options.protocol = optarg;
+				break;
+			case OPTION_SPIN_BUDGET:
+				options.spin_budget = optarg;
+				break;
+			case OPTION_HUGE_PAGES:
+				options.huge_pages = true;
+				break;
+			case OPTION_CPUS:
+				options.cpus = optarg;
+				break;
+			case OPTION_NUMA:
+				options.numa = true;
+				break;
+			case OPTION_BUSY_POLL:
+				options.busy_poll = optarg;
+				break;
+			case OPTION_TCP_INFO_INTERVAL:
+				options.tcp_info_interval = optarg;
+				break;
 			default:
 				break;
 		}
@@ -93,6 +217,144 @@ void parse_arguments(int argc, char* argv[], Options& options, Commands& command
 	}
 }
 
+/**
+ * Overrides settings with the options given on the command line
+ *
+ * Only options that were actually given take effect, so the command line wins over
+ * the configuration file, which in turn wins over the defaults.
+ *
+ * @param const Options& options The parsed command-line options
+ * @param[out] settings The settings to update
+ *
+ * @return void
+ *
+ * @throws std::runtime_error If an option is malformed
+ */
+void apply_options(const Options& options, Settings& settings)
+{
+	if (options.verbose)
+	{
+		settings.verbose = true;
+	}
+	if (options.proxy_protocol)
+	{
+		settings.proxy_protocol = true;
+	}
+	if (options.numa)
+	{
+		settings.numa = true;
+	}
+	if (options.huge_pages)
+	{
+		settings.huge_pages = true;
+	}
+	if (!options.cpus.empty())
+	{
+		settings.cpus = parse_cpu_list(options.cpus);
+	}
+	if (!options.address.empty())
+	{
+		settings.address = options.address;
+	}
+	if (!options.port.empty())
+	{
+		settings.port = options.port;
+	}
+	if (!options.ssl_address.empty())
+	{
+		settings.ssl_address = options.ssl_address;
+	}
+	if (!options.ssl_port.empty())
+	{
+		settings.ssl_port = options.ssl_port;
+	}
+	if (!options.cert_files.empty() || !options.cert_keys.empty())
+	{
+		settings.cert_files = options.cert_files;
+		settings.cert_keys = options.cert_keys;
+	}
+	if (!options.tls_ciphers.empty())
+	{
+		settings.tls_ciphers = options.tls_ciphers;
+	}
+	if (!options.tls_ciphersuites.empty())
+	{
+		settings.tls_ciphersuites = options.tls_ciphersuites;
+	}
+	if (!options.tls_min_version.empty())
+	{
+		settings.tls_min_version = options.tls_min_version;
+	}
+	if (!options.tls_max_version.empty())
+	{
+		settings.tls_max_version = options.tls_max_version;
+	}
+	if (!options.tls_curves.empty())
+	{
+		settings.tls_curves = options.tls_curves;
+	}
+	if (!options.upstream.empty())
+	{
+		settings.upstream = options.upstream;
+	}
+	if (!options.capture_file.empty())
+	{
+		settings.capture_file = options.capture_file;
+	}
+	if (!options.target.empty())
+	{
+		settings.target = options.target;
+	}
+	if (!options.protocol.empty())
+	{
+		settings.protocol = options.protocol;
+	}
+	if (!options.cache_size.empty())
+	{
+		settings.cache_size = parse_number("--cache-size", options.cache_size, MAX_CACHE_SIZE);
+	}
+	if (!options.spin_budget.empty())
+	{
+		settings.spin_budget = parse_number("--spin-budget", options.spin_budget, MAX_SPIN_BUDGET);
+	}
+	if (!options.busy_poll.empty())
+	{
+		settings.busy_poll = parse_number("--busy-poll", options.busy_poll, MAX_BUSY_POLL);
+	}
+	if (!options.tcp_info_interval.empty())
+	{
+		settings.tcp_info_interval = parse_number("--tcp-info-interval", options.tcp_info_interval, MAX_TCP_INFO_INTERVAL);
+	}
+	if (!options.tunnel_hosts.empty())
+	{
+		settings.tunnel_hosts.clear();
+
+		std::stringstream host_list(options.tunnel_hosts);
+		std::string host;
+		while (std::getline(host_list, host, ','))
+		{
+			if (!host.empty())
+			{
+				settings.tunnel_hosts.push_back(host);
+			}
+		}
+	}
+	if (!options.tls_alpn.empty())
+	{
+		settings.tls_alpn.clear();
+
+		std::stringstream alpn_list(options.tls_alpn);
+		std::string alpn_protocol;
+		while (std::getline(alpn_list, alpn_protocol, ','))
+		{
+			if (!alpn_protocol.empty())
+			{
+				settings.tls_alpn.push_back(alpn_protocol);
+			}
+		}
+	}
+}
+
 /**
  * Prints a help message detailing the usage and options of the application
  *
@@ -110,22 +372,48 @@ void print_usage(const char* program_name)
 	<< "\n"
 	<< "  To record data, use the \"record\" command with the required certificate file and certificate key options.\n"
 	<< "  You may also provide an optional IP address and port number to listen on.\n"
+	<< "  Repeat the certificate options to serve several host names; each client is given the certificate\n"
+	<< "  matching the name it requests (SNI), or the first one if none matches.\n"
+	<< "  Settings may also be read from a configuration file; command-line options take precedence.\n"
+	<< "  Send SIGHUP to reload the certificate file and key without restarting. The configuration file\n"
+	<< "  is re-read too, and settings that are safe to change at runtime take effect immediately.\n"
+	<< "\n"
+	<< "  With --upstream, requests are forwarded to that server instead of being echoed back, and\n"
+	<< "  connections upgraded to WebSocket are relayed frame by frame. HTTP/2 clients with prior knowledge,\n"
+	<< "  such as gRPC clients, are relayed unchanged. With --capture, every request, response, WebSocket\n"
+	<< "  frame, HTTP/2 header block and gRPC message is written to the capture file with its timing, and\n"
+	<< "  each connection's round-trip time, retransmits, congestion window and delivery rate when it closes.\n"
+	<< "  Listeners, the upstream and the replay target may be Unix domain sockets, given as unix:<path>, so\n"
+	<< "  local servers can be measured without the TCP stack in the way.\n"
+	<< "  With --proxy-protocol, every connection must open with a PROXY protocol header from a load balancer,\n"
+	<< "  so captures record the real client address rather than the balancer's.\n"
+	<< "  With --cache-size, GET responses are cached in memory as Cache-Control and ETag allow, and\n"
+	<< "  identical requests that miss together share a single upstream fetch.\n"
+	<< "  CONNECT tunnels to the hosts given with --tunnel-hosts are relayed without being decrypted, spliced\n"
+	<< "  between the sockets inside the kernel, and only their byte counts and timing are captured.\n"
 	<< "\n"
-	<< "  To replay data (which is currently a work in progress), use the \"replay\" command.\n"
-	<< "  This command currently has no options.\n"
+	<< "  To replay data, use the \"replay\" command with a capture file and a target server. Each captured\n"
+	<< "  connection is replayed on its recorded schedule, and WebSocket frames and HTTP/2 streams on theirs.\n"
+	<< "  HTTP/2 calls are reported per method, with their grpc-status codes and a latency histogram.\n"
+	<< "  The TCP statistics of every replayed connection are reported too, against the slowest responses, to\n"
+	<< "  tell latency added by the network from latency added by the server.\n"
+	<< "  With --protocol, plain HTTP requests are replayed over HTTP/2 or HTTP/3 instead of HTTP/1.1, so the\n"
+	<< "  latency and CPU time of the same workload can be compared; HTTP/3 needs a build with QUIC support.\n"
+	<< "  Each send sleeps until shortly before it is due, then spins for up to --spin-budget microseconds to\n"
+	<< "  send on time; the report shows how late the sends were.\n"
 	<< "\n"
 
 	<< "\033[1mUsage:\033[0m\n"
 	<< "\n"
 	<< "  " << program_name << " [--help] [--version]\n"
-	<< "  " << program_name << " record --cert-file=<cert_file> --cert-key=<cert_key> [--address=<address>] [--port=<port>] [--verbose]\n"
-	<< "  " << program_name << " replay\n"
+	<< "  " << program_name << " record [--config=<file>] --cert-file=<cert_file> --cert-key=<cert_key> [--address=<address>] [--port=<port>] [--ssl-address=<address>] [--ssl-port=<port>] [--proxy-protocol] [--tls-...] [--upstream=<host:port>] [--tunnel-hosts=<list>] [--cache-size=<bytes>] [--capture=<file>] [--tcp-info-interval=<ms>] [--cpus=<list>] [--numa] [--busy-poll=<us>] [--verbose]\n"
+	<< "  " << program_name << " replay [--config=<file>] --capture=<file> --target=<host:port> [--protocol=<h1|h2|h3>] [--spin-budget=<us>] [--huge-pages] [--cpus=<list>] [--numa] [--busy-poll=<us>] [--verbose]\n"
 	<< "\n"
 
 	<< "\033[1mCommands:\033[0m\n"
 	<< "\n"
 	<< "  record    Record data\n"
-	<< "  replay    Replay data (work in progress)\n"
+	<< "  replay    Replay recorded data against a server\n"
 	<< "\n"
 
 	<< "\033[1mOptions:\033[0m\n"
@@ -133,10 +421,32 @@ void print_usage(const char* program_name)
 	<< "  --help, -h                                 Show this help message and exit\n"
 	<< "  --version, -V                              Information about this software version\n"
 	<< "  --verbose, -v                              Show more info (for supported commands)\n"
-	<< "  --cert-file=<cert_file>, -c <cert_file>    Path to certificate file (required)\n"
-	<< "  --cert-key=<cert_key>, -k <cert_key>       Path to certificate key (required)\n"
-	<< "  --address=<address>, -a <address>          IP address to record (default: ::)\n"
+	<< "  --config=<file>                            Read settings from an INI-style configuration file\n"
+	<< "  --cert-file=<cert_file>, -c <cert_file>    Path to certificate file (required, repeatable)\n"
+	<< "  --cert-key=<cert_key>, -k <cert_key>       Path to certificate key (required, repeatable)\n"
+	<< "  --address=<address>, -a <address>          IP address or unix:<path> to record (default: ::)\n"
 	<< "  --port=<port>, -p <port>                   Port number to record (default: 80)\n"
+	<< "  --ssl-address=<address>                    IP address or unix:<path> to record HTTPS on (default: same as --address)\n"
+	<< "  --ssl-port=<port>                          Port number to record HTTPS on (default: 443)\n"
+	<< "  --proxy-protocol                           Expect a PROXY protocol v1 or v2 header on every connection\n"
+	<< "  --tls-min-version=<version>                Lowest TLS version to accept, e.g. 1.2 (default: OpenSSL's)\n"
+	<< "  --tls-max-version=<version>                Highest TLS version to accept, e.g. 1.3 (default: OpenSSL's)\n"
+	<< "  --tls-ciphers=<list>                       OpenSSL cipher list for TLS 1.2 and below\n"
+	<< "  --tls-ciphersuites=<list>                  OpenSSL cipher suites for TLS 1.3\n"
+	<< "  --tls-curves=<list>                        Key exchange groups in preference order, e.g. X25519:P-256\n"
+	<< "  --tls-alpn=<list>                          Comma-separated ALPN protocols in preference order, e.g. http/1.1\n"
+	<< "  --upstream=<host:port>                     Forward recorded requests to this server, or unix:<path>, instead of echoing them\n"
+	<< "  --tunnel-hosts=<list>                      Comma-separated hosts or host:port pairs to allow CONNECT tunnels to, or *\n"
+	<< "  --cache-size=<bytes>                       Cache up to this many bytes of upstream responses (default: 0, off)\n"
+	<< "  --capture=<file>                           Capture file to record to, or to replay from\n"
+	<< "  --tcp-info-interval=<ms>                   Also capture each connection's TCP statistics this often, not only at close (default: 0)\n"
+	<< "  --target=<host:port>                       Server to replay captured traffic against, or unix:<path>\n"
+	<< "  --protocol=<h1|h2|h3>                      Protocol to replay plain HTTP requests over (default: h1)\n"
+	<< "  --spin-budget=<us>                         Microseconds to spin before each scheduled send, 0 to only sleep (default: 50)\n"
+	<< "  --huge-pages                               Put the capture and the requests to replay on huge pages where the kernel allows\n"
+	<< "  --cpus=<list>                              Pin worker threads to these CPUs in turn, e.g. 0-3,8\n"
+	<< "  --numa                                     Pin worker threads and allocate their memory on their CPU's NUMA node\n"
+	<< "  --busy-poll=<us>                           Spin this long on sockets before blocking, trading CPU for wake-up latency (default: 0, off)\n"
 	<< "\n"
 
 	<< "\033[1mExamples:\033[0m\n"
@@ -152,6 +462,36 @@ void print_usage(const char* program_name)
 	<< "\n"
 	<< "  To record data with certificate file \"server.crt\" and certificate key \"server.key\", using default IP address and port number:\n"
 	<< "      " << program_name << " record -c server.crt -k server.key\n"
+	<< "\n"
+	<< "  To record HTTPS as an unprivileged user on port 8443, accepting only TLS 1.3 with X25519:\n"
+	<< "      " << program_name << " record -c server.crt -k server.key -p 8080 --ssl-port=8443 --tls-min-version=1.3 --tls-curves=X25519\n"
+	<< "\n"
+	<< "  To record data for two host names, each with its own certificate:\n"
+	<< "      " << program_name << " record -c a.example.com.crt -k a.example.com.key -c b.example.com.crt -k b.example.com.key\n"
+	<< "\n"
+	<< "  To record traffic to a local application on port 3000, then replay it against a staging server:\n"
+	<< "      " << program_name << " record -c server.crt -k server.key --upstream=127.0.0.1:3000 --capture=traffic.cap\n"
+	<< "      " << program_name << " replay --capture=traffic.cap --target=staging.example.com:80\n"
+	<< "\n"
+	<< "  To compare the same workload over HTTP/2 and HTTP/3 against a local server listening on TCP and UDP port 8443:\n"
+	<< "      " << program_name << " replay --capture=traffic.cap --target=127.0.0.1:8443 --protocol=h2\n"
+	<< "      " << program_name << " replay --capture=traffic.cap --target=127.0.0.1:8443 --protocol=h3\n"
+	<< "\n"
+	<< "  To record on the first socket of a dual-socket host, keeping memory on its NUMA node:\n"
+	<< "      " << program_name << " record -c server.crt -k server.key --cpus=0-15 --numa\n"
+	<< "\n"
+	<< "  To replay a multi-gigabyte capture with its data on huge pages, reserving 1024 of them first:\n"
+	<< "      sysctl vm.nr_hugepages=1024\n"
+	<< "      " << program_name << " replay --capture=traffic.cap --target=127.0.0.1:8080 --huge-pages --verbose\n"
+	<< "\n"
+	<< "  To measure a sub-100 microsecond service without the replay's own wake-ups in the latencies:\n"
+	<< "      " << program_name << " replay --capture=traffic.cap --target=10.0.0.5:8080 --cpus=2-5 --busy-poll=200\n"
+	<< "\n"
+	<< "  To record a long-lived WebSocket workload with the TCP statistics of each connection every second:\n"
+	<< "      " << program_name << " record -c server.crt -k server.key --upstream=127.0.0.1:3000 --capture=traffic.cap --tcp-info-interval=1000\n"
+	<< "\n"
+	<< "  To replay against an application server listening on a Unix domain socket:\n"
+	<< "      " << program_name << " replay --capture=traffic.cap --target=unix:/run/app.sock\n"
 
 	<< "\n";
 }
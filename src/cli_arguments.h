@@ -24,6 +24,8 @@
 
 #include <getopt.h>
 #include <string>
+#include <vector>
+#include "settings.h"
 
 
 struct Commands
@@ -40,10 +42,32 @@ struct Commands
 struct Options
 {
 	bool verbose = false;
-	std::string cert_file;
-	std::string cert_key;
+	std::string config_file;
+	std::vector<std::string> cert_files;
+	std::vector<std::string> cert_keys;
 	std::string address;
 	std::string port;
+	bool proxy_protocol = false;
+	std::string ssl_address;
+	std::string ssl_port;
+	std::string tls_ciphers;
+	std::string tls_ciphersuites;
+	std::string tls_min_version;
+	std::string tls_max_version;
+	std::string tls_curves;
+	std::string tls_alpn;
+	std::string upstream;
+	std::string tunnel_hosts;
+	std::string cache_size;
+	std::string capture_file;
+	std::string target;
+	std::string protocol;
+	std::string spin_budget;
+	bool huge_pages = false;
+	std::string cpus;
+	bool numa = false;
+	std::string busy_poll;
+	std::string tcp_info_interval;
 };
 
 /**
@@ -58,6 +82,18 @@ struct Options
  */
 void parse_arguments(int argc, char* argv[], Options& options, Commands& commands);
 
+/**
+ * Overrides settings with the options given on the command line
+ *
+ * @param const Options& options The parsed command-line options
+ * @param[out] settings The settings to update
+ *
+ * @return void
+ *
+ * @throws std::runtime_error If an option is malformed
+ */
+void apply_options(const Options& options, Settings& settings);
+
 /**
  * Prints a help message detailing the usage and options of the application
  *
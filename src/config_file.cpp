@@ -0,0 +1,460 @@
+/*
+ * config_file.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file implements the configuration file loading functions.
+ */
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cerrno>
+#include "affinity.h"
+#include "functions.h"
+#include "config_file.h"
+
+/**
+ * Removes leading and trailing whitespace from a string
+ *
+ * @param const std::string& value The string to trim
+ *
+ * @return std::string The trimmed string
+ */
+static std::string trim(const std::string& value)
+{
+	size_t start = value.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos)
+	{
+		return "";
+	}
+
+	size_t end = value.find_last_not_of(" \t\r\n");
+	return value.substr(start, end - start + 1);
+}
+
+/**
+ * Parses a boolean value such as "true", "no" or "1"
+ *
+ * @param const std::string& key The key being set, for error messages
+ * @param const std::string& value The value to parse
+ *
+ * @return bool The parsed value
+ *
+ * @throws std::runtime_error If the value is not a boolean
+ */
+static bool parse_bool(const std::string& key, const std::string& value)
+{
+	if (value == "true" || value == "yes" || value == "on" || value == "1")
+	{
+		return true;
+	}
+	if (value == "false" || value == "no" || value == "off" || value == "0")
+	{
+		return false;
+	}
+
+	throw std::runtime_error(key + " must be true or false");
+}
+
+/**
+ * Parses a non-negative integer value
+ *
+ * @param const std::string& key The key or option being set, for error messages
+ * @param const std::string& value The value to parse
+ * @param unsigned long long maximum The largest accepted value
+ *
+ * @return unsigned long long The parsed value
+ *
+ * @throws std::runtime_error If the value is not a non-negative integer no larger than maximum
+ */
+unsigned long long parse_number(const std::string& key, const std::string& value, unsigned long long maximum)
+{
+	if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+	{
+		throw std::runtime_error(key + " must be a non-negative integer");
+	}
+
+	errno = 0;
+	unsigned long long number = std::strtoull(value.c_str(), nullptr, 10);
+	if (errno == ERANGE || number > maximum)
+	{
+		throw std::runtime_error(key + " must be at most " + std::to_string(maximum));
+	}
+
+	return number;
+}
+
+/**
+ * Splits a comma-separated list, dropping empty entries
+ *
+ * @param const std::string& value The list to split
+ *
+ * @return std::vector<std::string> The trimmed entries
+ */
+static std::vector<std::string> parse_list(const std::string& value)
+{
+	std::vector<std::string> entries;
+	std::stringstream list(value);
+	std::string entry;
+
+	while (std::getline(list, entry, ','))
+	{
+		entry = trim(entry);
+		if (!entry.empty())
+		{
+			entries.push_back(entry);
+		}
+	}
+
+	return entries;
+}
+
+/**
+ * Applies a single "<section>.<key> = <value>" setting
+ *
+ * @param const std::string& key The fully qualified key
+ * @param const std::string& value The unquoted value
+ * @param[out] settings The settings to update
+ *
+ * @return void
+ *
+ * @throws std::runtime_error If the key is unknown or the value invalid
+ */
+static void apply_setting(const std::string& key, const std::string& value, Settings& settings)
+{
+	if (key == "verbose")
+	{
+		settings.verbose = parse_bool(key, value);
+	}
+	else if (key == "cpus")
+	{
+		settings.cpus = parse_cpu_list(value);
+	}
+	else if (key == "numa")
+	{
+		settings.numa = parse_bool(key, value);
+	}
+	else if (key == "busy_poll")
+	{
+		settings.busy_poll = parse_number(key, value, MAX_BUSY_POLL);
+	}
+	else if (key == "record.address")
+	{
+		settings.address = value;
+	}
+	else if (key == "record.port")
+	{
+		settings.port = value;
+	}
+	else if (key == "record.proxy_protocol")
+	{
+		settings.proxy_protocol = parse_bool(key, value);
+	}
+	else if (key == "record.read_buffer_size")
+	{
+		settings.read_buffer_size = parse_number(key, value, 64 * 1024 * 1024);
+	}
+	else if (key == "record.read_timeout")
+	{
+		settings.read_timeout = parse_number(key, value, 86400);
+	}
+	else if (key == "record.upstream")
+	{
+		settings.upstream = value;
+	}
+	else if (key == "record.cache_size")
+	{
+		settings.cache_size = parse_number(key, value, MAX_CACHE_SIZE);
+	}
+	else if (key == "record.tunnel_hosts")
+	{
+		settings.tunnel_hosts = parse_list(value);
+	}
+	else if (key == "capture.file")
+	{
+		settings.capture_file = value;
+	}
+	else if (key == "capture.tcp_info_interval")
+	{
+		settings.tcp_info_interval = parse_number(key, value, MAX_TCP_INFO_INTERVAL);
+	}
+	else if (key == "replay.target")
+	{
+		settings.target = value;
+	}
+	else if (key == "replay.protocol")
+	{
+		settings.protocol = value;
+	}
+	else if (key == "replay.spin_budget")
+	{
+		settings.spin_budget = parse_number(key, value, MAX_SPIN_BUDGET);
+	}
+	else if (key == "replay.huge_pages")
+	{
+		settings.huge_pages = parse_bool(key, value);
+	}
+	else if (key == "tls.address")
+	{
+		settings.ssl_address = value;
+	}
+	else if (key == "tls.port")
+	{
+		settings.ssl_port = value;
+	}
+	else if (key == "tls.certificate")
+	{
+		settings.cert_files.push_back(value);
+	}
+	else if (key == "tls.key")
+	{
+		settings.cert_keys.push_back(value);
+	}
+	else if (key == "tls.ciphers")
+	{
+		settings.tls_ciphers = value;
+	}
+	else if (key == "tls.ciphersuites")
+	{
+		settings.tls_ciphersuites = value;
+	}
+	else if (key == "tls.min_version")
+	{
+		settings.tls_min_version = value;
+	}
+	else if (key == "tls.max_version")
+	{
+		settings.tls_max_version = value;
+	}
+	else if (key == "tls.curves")
+	{
+		settings.tls_curves = value;
+	}
+	else if (key == "tls.alpn")
+	{
+		settings.tls_alpn = parse_list(value);
+	}
+	else if (key == "tls.handshake_workers")
+	{
+		settings.handshake_workers = parse_number(key, value, 1024);
+	}
+	else if (key == "tls.handshake_timeout")
+	{
+		settings.handshake_timeout = parse_number(key, value, 3600);
+	}
+	else
+	{
+		throw std::runtime_error("unknown setting " + key);
+	}
+}
+
+/**
+ * Reads a configuration file on top of the given settings
+ *
+ * Recognised keys:
+ *   verbose, cpus (a list such as 0-3,8), numa, busy_poll (microseconds)
+ *   record.address, record.port, record.proxy_protocol, record.read_buffer_size, record.read_timeout, record.upstream,
+ *   record.cache_size (bytes), record.tunnel_hosts (comma-separated)
+ *   capture.file, capture.tcp_info_interval (milliseconds)
+ *   replay.target, replay.protocol (h1, h2 or h3), replay.spin_budget (microseconds), replay.huge_pages
+ *   tls.address, tls.port, tls.certificate, tls.key (both repeatable, paired in order),
+ *   tls.ciphers, tls.ciphersuites, tls.min_version, tls.max_version, tls.curves,
+ *   tls.alpn (comma-separated), tls.handshake_workers, tls.handshake_timeout
+ *
+ * Values may be wrapped in double quotes to keep surrounding whitespace or a '#'.
+ *
+ * @param const std::string& path The path to the configuration file
+ * @param[out] settings The settings to update
+ *
+ * @return void
+ *
+ * @throws std::runtime_error If the file cannot be read or contains an unknown key or invalid value
+ */
+void load_config_file(const std::string& path, Settings& settings)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+	{
+		throw std::runtime_error("Failed to open configuration file " + path);
+	}
+
+	std::string section;
+	std::string line;
+	int line_number = 0;
+
+	while (std::getline(file, line))
+	{
+		++line_number;
+		std::string location = path + ":" + std::to_string(line_number) + ": ";
+
+		line = trim(line);
+		if (line.empty() || line[0] == '#' || line[0] == ';')
+		{
+			continue;
+		}
+
+		if (line[0] == '[')
+		{
+			if (line[line.size() - 1] != ']')
+			{
+				throw std::runtime_error(location + "unterminated section header");
+			}
+			section = trim(line.substr(1, line.size() - 2));
+			continue;
+		}
+
+		size_t equals = line.find('=');
+		if (equals == std::string::npos)
+		{
+			throw std::runtime_error(location + "expected <key> = <value>");
+		}
+
+		std::string key = trim(line.substr(0, equals));
+		std::string value = trim(line.substr(equals + 1));
+
+		if (!value.empty() && value[0] == '"')
+		{
+			size_t closing = value.find('"', 1);
+			if (closing == std::string::npos)
+			{
+				throw std::runtime_error(location + "unterminated quoted value");
+			}
+			value = value.substr(1, closing - 1);
+		}
+		else
+		{
+			size_t comment = value.find(" #");
+			if (comment != std::string::npos)
+			{
+				value = trim(value.substr(0, comment));
+			}
+		}
+
+		try
+		{
+			apply_setting(section.empty() ? key : section + "." + key, value, settings);
+		}
+		catch (const std::runtime_error& e)
+		{
+			throw std::runtime_error(location + e.what());
+		}
+	}
+}
+
+/**
+ * Checks that a port is a service name or a number between 1 and 65535
+ *
+ * @param const std::string& name The setting name, for error messages
+ * @param const std::string& port The port to check
+ *
+ * @return void
+ *
+ * @throws std::runtime_error If the port is invalid
+ */
+static void validate_port(const std::string& name, const std::string& port)
+{
+	if (port.empty())
+	{
+		throw std::runtime_error(name + " must not be empty");
+	}
+
+	if (port.find_first_not_of("0123456789") == std::string::npos)
+	{
+		unsigned long number = std::strtoul(port.c_str(), nullptr, 10);
+		if (number < 1 || number > 65535 || port.size() > 5)
+		{
+			throw std::runtime_error(name + " must be between 1 and 65535");
+		}
+	}
+}
+
+/**
+ * Checks that settings are consistent and within their allowed ranges
+ *
+ * @param const Settings& settings The settings to check
+ *
+ * @return void
+ *
+ * @throws std::runtime_error Describing the first invalid setting
+ */
+void validate_settings(const Settings& settings)
+{
+	validate_port("record.port", settings.port);
+	validate_port("tls.port", settings.ssl_port);
+
+	if (settings.read_buffer_size < 512 || settings.read_buffer_size > 64 * 1024 * 1024)
+	{
+		throw std::runtime_error("record.read_buffer_size must be between 512 bytes and 64 MiB");
+	}
+
+	if (settings.read_timeout < 0 || settings.read_timeout > 86400)
+	{
+		throw std::runtime_error("record.read_timeout must be between 0 and 86400 seconds");
+	}
+
+	std::string host;
+	std::string port;
+	if (!settings.upstream.empty() && !split_host_port(settings.upstream, host, port))
+	{
+		throw std::runtime_error("record.upstream must be <host>:<port>");
+	}
+	if (!settings.target.empty() && !split_host_port(settings.target, host, port))
+	{
+		throw std::runtime_error("replay.target must be <host>:<port>");
+	}
+	if (settings.protocol != "h1" && settings.protocol != "h2" && settings.protocol != "h3")
+	{
+		throw std::runtime_error("replay.protocol must be h1, h2 or h3");
+	}
+	if (settings.spin_budget > MAX_SPIN_BUDGET)
+	{
+		throw std::runtime_error("replay.spin_budget must be at most " + std::to_string(MAX_SPIN_BUDGET) + " microseconds");
+	}
+	if (settings.busy_poll > MAX_BUSY_POLL)
+	{
+		throw std::runtime_error("busy_poll must be at most " + std::to_string(MAX_BUSY_POLL) + " microseconds");
+	}
+	if (settings.tcp_info_interval > MAX_TCP_INFO_INTERVAL)
+	{
+		throw std::runtime_error("capture.tcp_info_interval must be at most " + std::to_string(MAX_TCP_INFO_INTERVAL) + " milliseconds");
+	}
+
+	if (is_unix_address(settings.address) && settings.ssl_address.empty())
+	{
+		throw std::runtime_error("tls.address must be set when record.address is a Unix domain socket");
+	}
+	if (is_unix_address(settings.address) && settings.ssl_address == settings.address)
+	{
+		throw std::runtime_error("record.address and tls.address must be different Unix domain sockets");
+	}
+
+	if (settings.cert_files.size() != settings.cert_keys.size())
+	{
+		throw std::runtime_error("Each certificate file needs a matching certificate key");
+	}
+
+	if (settings.handshake_workers > 1024)
+	{
+		throw std::runtime_error("tls.handshake_workers must be at most 1024");
+	}
+
+	if (settings.handshake_timeout < 1 || settings.handshake_timeout > 3600)
+	{
+		throw std::runtime_error("tls.handshake_timeout must be between 1 and 3600 seconds");
+	}
+}
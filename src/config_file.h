@@ -0,0 +1,89 @@
+/*
+ * config_file.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file declares the configuration file loading functions.
+ *
+ * Configuration files are INI-like:
+ *
+ *   # Comments start with '#' or ';'
+ *   verbose = true
+ *
+ *   [record]
+ *   address = ::
+ *   port = 8080
+ *
+ *   [tls]
+ *   port = 8443
+ *   certificate = server.crt
+ *   key = server.key
+ *
+ * Keys in a section are named "<section>.<key>"; see load_config_file() for the full list.
+ */
+
+#ifndef CONFIG_FILE_H
+#define CONFIG_FILE_H
+
+#include <string>
+#include "settings.h"
+
+/**
+ * The largest values accepted for settings that can be given both on the command
+ * line and in a configuration file
+ */
+const unsigned long long MAX_BUSY_POLL = 1000000;
+const unsigned long long MAX_CACHE_SIZE = 64ULL * 1024 * 1024 * 1024;
+const unsigned long long MAX_TCP_INFO_INTERVAL = 3600000;
+const unsigned long long MAX_SPIN_BUDGET = 100000;
+
+/**
+ * Reads a configuration file on top of the given settings
+ *
+ * @param const std::string& path The path to the configuration file
+ * @param[out] settings The settings to update
+ *
+ * @return void
+ *
+ * @throws std::runtime_error If the file cannot be read or contains an unknown key or invalid value
+ */
+void load_config_file(const std::string& path, Settings& settings);
+
+/**
+ * Parses a non-negative integer value
+ *
+ * @param const std::string& key The key or option being set, for error messages
+ * @param const std::string& value The value to parse
+ * @param unsigned long long maximum The largest accepted value
+ *
+ * @return unsigned long long The parsed value
+ *
+ * @throws std::runtime_error If the value is not a non-negative integer no larger than maximum
+ */
+unsigned long long parse_number(const std::string& key, const std::string& value, unsigned long long maximum);
+
+/**
+ * Checks that settings are consistent and within their allowed ranges
+ *
+ * @param const Settings& settings The settings to check
+ *
+ * @return void
+ *
+ * @throws std::runtime_error Describing the first invalid setting
+ */
+void validate_settings(const Settings& settings);
+
+#endif /* CONFIG_FILE_H */
@@ -45,7 +45,7 @@
  */
 void debug(const char* message, ...)
 {
-	if (!verbose)
+	if (!settings().verbose)
 	{
 		return;
 	}
@@ -59,3 +59,57 @@ void debug(const char* message, ...)
     std::vprintf((std::string(timestamp) + ": " + message + "\n").c_str(), args);
     va_end(args);
 }
+
+/**
+ * Checks whether an address names a Unix domain socket, as "unix:<path>"
+ *
+ * @param const std::string& address The address
+ *
+ * @return bool Whether the address has the "unix:" prefix and a path
+ */
+bool is_unix_address(const std::string& address)
+{
+	return address.size() > 5 && address.compare(0, 5, "unix:") == 0;
+}
+
+/**
+ * Splits a "host:port" string, accepting bracketed IPv6 addresses such as "[::1]:8080"
+ *
+ * A Unix domain socket address, "unix:<path>", is kept whole as the host, with an
+ * empty port.
+ *
+ * @param const std::string& address The address to split
+ * @param[out] host The host part
+ * @param[out] port The port part
+ *
+ * @return bool Whether both parts were present
+ */
+bool split_host_port(const std::string& address, std::string& host, std::string& port)
+{
+	if (is_unix_address(address))
+	{
+		host = address;
+		port.clear();
+		return true;
+	}
+
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos || colon == 0 || colon + 1 == address.size())
+	{
+		return false;
+	}
+
+	host = address.substr(0, colon);
+	port = address.substr(colon + 1);
+
+	if (host[0] == '[')
+	{
+		if (host[host.size() - 1] != ']')
+		{
+			return false;
+		}
+		host = host.substr(1, host.size() - 2);
+	}
+
+	return !host.empty();
+}
@@ -22,6 +22,8 @@
 #ifndef FUNCTIONS_H
 #define FUNCTIONS_H
 
+#include <string>
+
 /**
  * Outputs a verbose message to the console, including a timestamp
  *
@@ -32,4 +34,25 @@
  */
 void debug(const char* message, ...);
 
+/**
+ * Checks whether an address names a Unix domain socket, as "unix:<path>"
+ *
+ * @param const std::string& address The address
+ *
+ * @return bool Whether the address has the "unix:" prefix and a path
+ */
+bool is_unix_address(const std::string& address);
+
+/**
+ * Splits a "host:port" string, accepting bracketed IPv6 addresses such as "[::1]:8080"
+ * and keeping a "unix:<path>" address whole as the host, with an empty port
+ *
+ * @param const std::string& address The address to split
+ * @param[out] host The host part
+ * @param[out] port The port part
+ *
+ * @return bool Whether both parts were present
+ */
+bool split_host_port(const std::string& address, std::string& host, std::string& port);
+
 #endif /* FUNCTIONS_H */
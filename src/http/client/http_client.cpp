@@ -0,0 +1,163 @@
+/*
+ * http_client.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HTTP::Client class.
+ */
+
+#include <stdexcept>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include "busy_poll.h"
+#include "functions.h"
+#include "http_client.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * Client constructor
+	 *
+	 * @return void
+	 */
+	Client::Client()
+		: SocketConnection(-1)
+	{
+	}
+
+	/**
+	 * Client destructor
+	 *
+	 * @return void
+	 */
+	Client::~Client()
+	{
+		close();
+	}
+
+	/**
+	 * Connects to the first reachable address of the specified host and port
+	 *
+	 * @param const std::string& host The host name or IP address to connect to, or "unix:<path>" for a Unix domain socket
+	 * @param const std::string& port The port number or service name to connect to, ignored for a Unix domain socket
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If the host cannot be resolved or none of its addresses accept the connection
+	 */
+	void Client::connect(const std::string& host, const std::string& port)
+	{
+		close();
+
+		if (is_unix_address(host))
+		{
+			connect_unix(host.substr(5));
+			return;
+		}
+
+		struct addrinfo hints, *res;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+		if (status != 0)
+		{
+			throw std::runtime_error("Failed to resolve " + host + ": " + gai_strerror(status));
+		}
+
+		for (struct addrinfo* candidate = res; candidate != nullptr; candidate = candidate->ai_next)
+		{
+			fd_ = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+			if (fd_ == -1)
+			{
+				continue;
+			}
+
+			if (::connect(fd_, candidate->ai_addr, candidate->ai_addrlen) == 0)
+			{
+				break;
+			}
+
+			::close(fd_);
+			fd_ = -1;
+		}
+		freeaddrinfo(res);
+
+		if (fd_ == -1)
+		{
+			throw std::runtime_error("Failed to connect to " + host + ":" + port);
+		}
+
+		// Requests are written in one go and waited on, so there is nothing for Nagle to coalesce
+		int optval = 1;
+		setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+		busy_poll_socket(fd_);
+	}
+
+	/**
+	 * Connects to a Unix domain socket
+	 *
+	 * @param const std::string& path The socket's path
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If the path is too long or nothing accepts the connection
+	 */
+	void Client::connect_unix(const std::string& path)
+	{
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path))
+		{
+			throw std::runtime_error("Unix socket path too long: " + path);
+		}
+		memcpy(address.sun_path, path.c_str(), path.size());
+
+		fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd_ == -1 || ::connect(fd_, (struct sockaddr*)&address, sizeof(address)) == -1)
+		{
+			close();
+			throw std::runtime_error("Failed to connect to unix:" + path);
+		}
+	}
+
+	/**
+	 * Closes the connection, if open
+	 *
+	 * @return void
+	 */
+	void Client::close()
+	{
+		if (fd_ != -1)
+		{
+			::close(fd_);
+			fd_ = -1;
+		}
+	}
+}
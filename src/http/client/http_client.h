@@ -0,0 +1,85 @@
+/*
+ * http_client.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the HTTP::Client.
+ */
+
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+#include <string>
+#include "connection.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @brief An outgoing connection to an HTTP server
+	 *
+	 * Used by the recorder to reach its upstream and by the replay engine to reach its target.
+	 */
+	class Client : public SocketConnection
+	{
+		public:
+			/**
+			 * Construct an unconnected Client
+			 */
+			Client();
+
+			/**
+			 * Destruct the Client, closing its connection
+			 */
+			virtual ~Client();
+
+			/**
+			 * Connect to the specified host and port
+			 *
+			 * @param const std::string& host The host name or IP address to connect to, or "unix:<path>" for a Unix domain socket
+			 * @param const std::string& port The port number or service name to connect to, ignored for a Unix domain socket
+			 *
+			 * @return void
+			 */
+			void connect(const std::string& host, const std::string& port);
+
+			/**
+			 * Close the connection, if open
+			 *
+			 * @return void
+			 */
+			void close();
+
+		private:
+			Client(const Client&);
+			Client& operator=(const Client&);
+
+			/**
+			 * Connect to a Unix domain socket
+			 *
+			 * @param const std::string& path The socket's path
+			 *
+			 * @return void
+			 */
+			void connect_unix(const std::string& path);
+	};
+}
+
+#endif /* HTTP_CLIENT_H */
@@ -0,0 +1,538 @@
+/*
+ * connection.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HTTP::Connection classes.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+#include "busy_poll.h"
+#include "functions.h"
+#include "http_message.h"
+#include "connection.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @var int Seconds to wait for the kernel to finish with a body sent with MSG_ZEROCOPY
+	 */
+	static const int ZEROCOPY_TIMEOUT = 10;
+
+	/**
+	 * @var std::atomic<bool> Whether the kernel has copied a MSG_ZEROCOPY send to a loopback peer
+	 *
+	 * It always does, so once one connection has found that out, later loopback
+	 * connections skip zerocopy without each paying for a large message first.
+	 */
+	static std::atomic<bool> loopback_copies(false);
+
+	/**
+	 * Returns whether a socket's peer is on the loopback interface
+	 *
+	 * @param int fd The socket
+	 *
+	 * @return bool Whether the peer address is 127.0.0.0/8 or ::1, plain or IPv4-mapped
+	 */
+	static bool has_loopback_peer(int fd)
+	{
+		struct sockaddr_storage address;
+		socklen_t length = sizeof(address);
+		if (getpeername(fd, reinterpret_cast<struct sockaddr*>(&address), &length) != 0)
+		{
+			return false;
+		}
+
+		if (address.ss_family == AF_INET)
+		{
+			const struct sockaddr_in* ipv4 = reinterpret_cast<const struct sockaddr_in*>(&address);
+			return (ntohl(ipv4->sin_addr.s_addr) >> 24) == 127;
+		}
+		if (address.ss_family == AF_INET6)
+		{
+			const struct in6_addr* ipv6 = &reinterpret_cast<const struct sockaddr_in6*>(&address)->sin6_addr;
+			return IN6_IS_ADDR_LOOPBACK(ipv6) || (IN6_IS_ADDR_V4MAPPED(ipv6) && ipv6->s6_addr[12] == 127);
+		}
+
+		return false;
+	}
+
+	/**
+	 * Connection destructor
+	 *
+	 * @return void
+	 */
+	Connection::~Connection()
+	{
+	}
+
+	/**
+	 * Returns the number of bytes that can be read without waiting on the socket
+	 *
+	 * @return size_t 0, as plain sockets buffer nothing in user space
+	 */
+	size_t Connection::pending() const
+	{
+		return 0;
+	}
+
+	/**
+	 * Writes all of the given bytes to the peer, retrying short writes
+	 *
+	 * @param const char* data The bytes to write
+	 * @param size_t size The number of bytes to write
+	 *
+	 * @return bool Whether everything was written
+	 */
+	bool Connection::write_all(const char* data, size_t size)
+	{
+		while (size > 0)
+		{
+			ssize_t written = write(data, size);
+			if (written <= 0)
+			{
+				return false;
+			}
+
+			data += written;
+			size -= written;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Writes all of a string to the peer
+	 *
+	 * @param const std::string& data The bytes to write
+	 *
+	 * @return bool Whether everything was written
+	 */
+	bool Connection::write_all(const std::string& data)
+	{
+		return write_all(data.data(), data.size());
+	}
+
+	/**
+	 * Writes a message head and its body to the peer, coalesced into as few segments as possible
+	 *
+	 * The socket is corked for the two writes, so a small message leaves in one
+	 * segment instead of the head in one and the body in the next. Sockets that
+	 * are not TCP refuse the cork and are written to as they are.
+	 *
+	 * @param const char* head The head
+	 * @param size_t head_size Its length
+	 * @param const char* body The body, which must stay unchanged until the call returns
+	 * @param size_t body_size Its length
+	 *
+	 * @return bool Whether everything was written
+	 */
+	bool Connection::write_message(const char* head, size_t head_size, const char* body, size_t body_size)
+	{
+		int cork = 1;
+		bool corked = body_size > 0 && setsockopt(fd(), IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork)) == 0;
+
+		bool written = write_all(head, head_size) && write_all(body, body_size);
+
+		if (corked)
+		{
+			cork = 0;
+			setsockopt(fd(), IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+		}
+
+		return written;
+	}
+
+	/**
+	 * Reads until buffer holds a complete message head
+	 *
+	 * @param[out] buffer The bytes read, appended to what it already holds
+	 * @param size_t max_size The largest head accepted
+	 * @param size_t chunk_size The number of bytes to read at a time
+	 *
+	 * @return size_t The length of the head, or 0 if the stream ended or the head grew too large
+	 */
+	size_t Connection::read_head(std::string& buffer, size_t max_size, size_t chunk_size)
+	{
+		std::vector<char> chunk(chunk_size);
+
+		while (true)
+		{
+			size_t head_end = Message::find_head_end(buffer);
+			if (head_end != std::string::npos)
+			{
+				return head_end;
+			}
+
+			if (buffer.size() > max_size)
+			{
+				return 0;
+			}
+
+			ssize_t received = read(chunk.data(), chunk.size());
+			if (received <= 0)
+			{
+				return 0;
+			}
+
+			buffer.append(chunk.data(), received);
+		}
+	}
+
+	/**
+	 * SocketConnection constructor
+	 *
+	 * @param int fd The socket file descriptor
+	 *
+	 * @return void
+	 */
+	SocketConnection::SocketConnection(int fd)
+		: fd_(fd),
+		  zerocopy_(0),
+		  zerocopy_pending_(0)
+	{
+	}
+
+	/**
+	 * Reads from the socket, retrying when interrupted by a signal
+	 *
+	 * When busy polling, the thread spins until data arrives before blocking in recv().
+	 *
+	 * @param char* buffer The buffer to read into
+	 * @param size_t size The size of the buffer
+	 *
+	 * @return ssize_t The number of bytes read, 0 at end of stream, or -1 on error
+	 */
+	ssize_t SocketConnection::read(char* buffer, size_t size)
+	{
+		spin_until_readable(fd_);
+
+		ssize_t received;
+		do
+		{
+			received = recv(fd_, buffer, size, 0);
+		}
+		while (received == -1 && errno == EINTR);
+
+		return received;
+	}
+
+	/**
+	 * Writes to the socket without raising SIGPIPE if the peer has gone
+	 *
+	 * @param const char* data The bytes to write
+	 * @param size_t size The number of bytes to write
+	 *
+	 * @return ssize_t The number of bytes written, or -1 on error
+	 */
+	ssize_t SocketConnection::write(const char* data, size_t size)
+	{
+		ssize_t written;
+		do
+		{
+			written = send(fd_, data, size, MSG_NOSIGNAL);
+		}
+		while (written == -1 && errno == EINTR);
+
+		return written;
+	}
+
+	/**
+	 * Sends all of the given bytes with extra send() flags, retrying short writes
+	 *
+	 * @param const char* data The bytes to send
+	 * @param size_t size The number of bytes to send
+	 * @param int flags Extra flags, e.g. MSG_MORE
+	 *
+	 * @return bool Whether everything was sent
+	 */
+	bool SocketConnection::send_all(const char* data, size_t size, int flags)
+	{
+		while (size > 0)
+		{
+			ssize_t sent = send(fd_, data, size, flags | MSG_NOSIGNAL);
+			if (sent == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			if (sent <= 0)
+			{
+				return false;
+			}
+
+			data += sent;
+			size -= sent;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Writes a message head and its body to the peer, coalesced into as few segments as possible
+	 *
+	 * A body of at least ZEROCOPY_MIN_SIZE goes out with MSG_ZEROCOPY, after the
+	 * head sent with MSG_MORE so the two still share a segment. As the body must
+	 * stay untouched until the kernel is done with it, such a write only returns
+	 * once the peer has acknowledged the whole body: one round trip per large
+	 * message, rather than returning as soon as it fits in the send buffer. Peers
+	 * that make the kernel copy anyway turn zerocopy off after the first large
+	 * message, and with it the wait; for loopback peers, once one has, no other
+	 * connection in the process tries it again. Anything smaller,
+	 * or on a socket without zerocopy support, is written with one sendmsg() of
+	 * both parts, so neither is copied into a concatenated string first.
+	 *
+	 * @param const char* head The head
+	 * @param size_t head_size Its length
+	 * @param const char* body The body, which must stay unchanged until the call returns
+	 * @param size_t body_size Its length
+	 *
+	 * @return bool Whether everything was written
+	 */
+	bool SocketConnection::write_message(const char* head, size_t head_size, const char* body, size_t body_size)
+	{
+		#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+		if (body_size >= ZEROCOPY_MIN_SIZE && zerocopy_ == 0)
+		{
+			if (loopback_copies.load(std::memory_order_relaxed) && has_loopback_peer(fd_))
+			{
+				zerocopy_ = -1;
+			}
+			else
+			{
+				int enable = 1;
+				zerocopy_ = setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0 ? 1 : -1;
+			}
+		}
+
+		if (body_size >= ZEROCOPY_MIN_SIZE && zerocopy_ == 1)
+		{
+			return send_all(head, head_size, MSG_MORE) && send_zerocopy(body, body_size);
+		}
+		#endif /* MSG_ZEROCOPY && SO_ZEROCOPY */
+
+		struct iovec vectors[2];
+		vectors[0].iov_base = const_cast<char*>(head);
+		vectors[0].iov_len = head_size;
+		vectors[1].iov_base = const_cast<char*>(body);
+		vectors[1].iov_len = body_size;
+
+		size_t index = 0;
+		while (index < 2)
+		{
+			if (vectors[index].iov_len == 0)
+			{
+				++index;
+				continue;
+			}
+
+			struct msghdr message;
+			memset(&message, 0, sizeof(message));
+			message.msg_iov = vectors + index;
+			message.msg_iovlen = 2 - index;
+
+			ssize_t sent = sendmsg(fd_, &message, MSG_NOSIGNAL);
+			if (sent == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			if (sent <= 0)
+			{
+				return false;
+			}
+
+			// Skip past whatever went out, which may end partway through either part
+			size_t left = sent;
+			while (left > 0)
+			{
+				size_t step = std::min(left, vectors[index].iov_len);
+				vectors[index].iov_base = static_cast<char*>(vectors[index].iov_base) + step;
+				vectors[index].iov_len -= step;
+				left -= step;
+				if (vectors[index].iov_len == 0)
+				{
+					++index;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Sends bytes with MSG_ZEROCOPY and waits until the kernel is done with them
+	 *
+	 * The kernel transmits from the caller's pages until the peer acknowledges
+	 * them, so the call only returns once every send's completion has been read
+	 * from the error queue. When too much memory is pinned already
+	 * (net.core.optmem_max), the rest is sent by copying.
+	 *
+	 * @param const char* data The bytes to send
+	 * @param size_t size The number of bytes to send
+	 *
+	 * @return bool Whether everything was sent and the kernel is done with it
+	 */
+	bool SocketConnection::send_zerocopy(const char* data, size_t size)
+	{
+		bool sent_all = true;
+
+		#ifdef MSG_ZEROCOPY
+		while (size > 0)
+		{
+			ssize_t sent = send(fd_, data, size, MSG_ZEROCOPY | MSG_NOSIGNAL);
+			if (sent == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			if (sent == -1 && errno == ENOBUFS)
+			{
+				sent_all = send_all(data, size, 0);
+				break;
+			}
+			if (sent <= 0)
+			{
+				sent_all = false;
+				break;
+			}
+
+			++zerocopy_pending_;
+			data += sent;
+			size -= sent;
+		}
+		#else
+		sent_all = send_all(data, size, 0);
+		#endif /* MSG_ZEROCOPY */
+
+		// Even a failed send may have queued part of the bytes, which the kernel still reads
+		bool reaped = reap_zerocopy();
+		return sent_all && reaped;
+	}
+
+	/**
+	 * Reads zerocopy completions from the socket's error queue until none is pending
+	 *
+	 * Each completion covers a range of sends. One the kernel had to copy after
+	 * all, as it does over loopback, turns zerocopy off for the rest of the
+	 * connection, as pinning the pages then only adds cost, and for every later
+	 * loopback connection too if the peer is one. If the completions
+	 * do not arrive within ZEROCOPY_TIMEOUT, or the error queue cannot be read,
+	 * the kernel may still be reading the caller's buffer, so this fails and the
+	 * connection has to be closed rather than used for anything else.
+	 *
+	 * @return bool Whether every completion was read
+	 */
+	bool SocketConnection::reap_zerocopy()
+	{
+		#if defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(ZEROCOPY_TIMEOUT);
+
+		while (zerocopy_pending_ > 0)
+		{
+			char control[128];
+			struct msghdr message;
+			memset(&message, 0, sizeof(message));
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+
+			if (recvmsg(fd_, &message, MSG_ERRQUEUE) == -1)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				long long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+				if ((errno != EAGAIN && errno != EWOULDBLOCK) || left <= 0)
+				{
+					debug("Gave up on %llu zerocopy completions: %s", (unsigned long long)zerocopy_pending_, left <= 0 ? "timed out" : strerror(errno));
+					return false;
+				}
+
+				// A queued completion shows as POLLERR, which poll() reports without asking
+				struct pollfd descriptor;
+				descriptor.fd = fd_;
+				descriptor.events = 0;
+				descriptor.revents = 0;
+				int ready = poll(&descriptor, 1, static_cast<int>(left));
+				if (ready == -1 && errno == EINTR)
+				{
+					continue;
+				}
+				if (ready <= 0 || (descriptor.revents & POLLERR) == 0)
+				{
+					debug("Gave up on %llu zerocopy completions: %s", (unsigned long long)zerocopy_pending_, ready == 0 ? "timed out" : "no completion queued");
+					return false;
+				}
+				continue;
+			}
+
+			for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+			{
+				if (!(header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR)
+					&& !(header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR))
+				{
+					continue;
+				}
+
+				const struct sock_extended_err* error = reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(header));
+				if (error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				{
+					continue;
+				}
+
+				uint64_t completed = static_cast<uint32_t>(error->ee_data - error->ee_info) + 1ULL;
+				zerocopy_pending_ -= std::min(completed, zerocopy_pending_);
+				if ((error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && zerocopy_ == 1)
+				{
+					zerocopy_ = -1;
+					if (has_loopback_peer(fd_))
+					{
+						loopback_copies.store(true, std::memory_order_relaxed);
+					}
+				}
+			}
+		}
+		#endif /* MSG_ZEROCOPY && SO_EE_ORIGIN_ZEROCOPY */
+
+		return true;
+	}
+
+	/**
+	 * Returns the socket file descriptor
+	 *
+	 * @return int The file descriptor
+	 */
+	int SocketConnection::fd() const
+	{
+		return fd_;
+	}
+}
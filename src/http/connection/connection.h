@@ -0,0 +1,223 @@
+/*
+ * connection.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definitions for HTTP::Connection and HTTP::SocketConnection.
+ */
+
+#ifndef HTTP_CONNECTION_H
+#define HTTP_CONNECTION_H
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @brief A byte stream to a peer, plain or encrypted
+	 *
+	 * Lets the same request handling code run over plain sockets and TLS sessions.
+	 */
+	class Connection
+	{
+		public:
+			/**
+			 * Destruct the Connection
+			 */
+			virtual ~Connection();
+
+			/**
+			 * Read up to size bytes from the peer
+			 *
+			 * @param char* buffer The buffer to read into
+			 * @param size_t size The size of the buffer
+			 *
+			 * @return ssize_t The number of bytes read, 0 at end of stream, or -1 on error
+			 */
+			virtual ssize_t read(char* buffer, size_t size) = 0;
+
+			/**
+			 * Write up to size bytes to the peer
+			 *
+			 * @param const char* data The bytes to write
+			 * @param size_t size The number of bytes to write
+			 *
+			 * @return ssize_t The number of bytes written, or -1 on error
+			 */
+			virtual ssize_t write(const char* data, size_t size) = 0;
+
+			/**
+			 * Returns the underlying socket file descriptor
+			 *
+			 * @return int The file descriptor
+			 */
+			virtual int fd() const = 0;
+
+			/**
+			 * Returns the number of bytes that can be read without waiting on the socket
+			 *
+			 * @return size_t The number of bytes already buffered, e.g. decrypted TLS records
+			 */
+			virtual size_t pending() const;
+
+			/**
+			 * Write all of the given bytes to the peer
+			 *
+			 * @param const char* data The bytes to write
+			 * @param size_t size The number of bytes to write
+			 *
+			 * @return bool Whether everything was written
+			 */
+			bool write_all(const char* data, size_t size);
+
+			/**
+			 * Write all of a string to the peer
+			 *
+			 * @param const std::string& data The bytes to write
+			 *
+			 * @return bool Whether everything was written
+			 */
+			bool write_all(const std::string& data);
+
+			/**
+			 * Write a message head and its body to the peer, coalesced into as few segments as possible
+			 *
+			 * @param const char* head The head
+			 * @param size_t head_size Its length
+			 * @param const char* body The body, which must stay unchanged until the call returns
+			 * @param size_t body_size Its length
+			 *
+			 * @return bool Whether everything was written
+			 */
+			virtual bool write_message(const char* head, size_t head_size, const char* body, size_t body_size);
+
+			/**
+			 * Write a message head and its body to the peer, coalesced into as few segments as possible
+			 *
+			 * @param const std::string& head The head
+			 * @param const std::string& body The body
+			 *
+			 * @return bool Whether everything was written
+			 */
+			bool write_message(const std::string& head, const std::string& body)
+			{
+				return write_message(head.data(), head.size(), body.data(), body.size());
+			}
+
+			/**
+			 * Read until buffer holds a complete message head
+			 *
+			 * Bytes after the head (the start of the body) are left in buffer.
+			 *
+			 * @param[out] buffer The bytes read, appended to what it already holds
+			 * @param size_t max_size The largest head accepted
+			 * @param size_t chunk_size The number of bytes to read at a time
+			 *
+			 * @return size_t The length of the head, or 0 if the stream ended or the head grew too large
+			 */
+			size_t read_head(std::string& buffer, size_t max_size, size_t chunk_size = 4096);
+	};
+
+	/**
+	 * @brief A Connection over a plain socket
+	 *
+	 * The socket is not closed by this class; its owner stays responsible for it.
+	 * Large bodies are sent with MSG_ZEROCOPY where the socket supports it, so the
+	 * kernel transmits straight from the caller's buffer instead of copying it;
+	 * writing one then waits for the peer to acknowledge it.
+	 */
+	class SocketConnection : public Connection
+	{
+		public:
+			/**
+			 * Construct a SocketConnection over an open socket
+			 *
+			 * @param int fd The socket file descriptor
+			 */
+			explicit SocketConnection(int fd);
+
+			using Connection::write_message;
+
+			virtual ssize_t read(char* buffer, size_t size) override;
+			virtual ssize_t write(const char* data, size_t size) override;
+			virtual int fd() const override;
+			virtual bool write_message(const char* head, size_t head_size, const char* body, size_t body_size) override;
+
+			/**
+			 * @var size_t The smallest body sent with MSG_ZEROCOPY; below it, pinning pages costs more than copying them
+			 *
+			 * A body this large is not written until the peer has acknowledged it, a
+			 * round trip per message, which copying into the send buffer avoids.
+			 */
+			static const size_t ZEROCOPY_MIN_SIZE = 16 * 1024;
+
+		protected:
+
+			/**
+			 * @var int The socket file descriptor
+			 */
+			int fd_;
+
+		private:
+
+			/**
+			 * Sends all of the given bytes with extra send() flags, retrying short writes
+			 *
+			 * @param const char* data The bytes to send
+			 * @param size_t size The number of bytes to send
+			 * @param int flags Extra flags, e.g. MSG_MORE
+			 *
+			 * @return bool Whether everything was sent
+			 */
+			bool send_all(const char* data, size_t size, int flags);
+
+			/**
+			 * Sends bytes with MSG_ZEROCOPY and waits until the kernel is done with them
+			 *
+			 * @param const char* data The bytes to send
+			 * @param size_t size The number of bytes to send
+			 *
+			 * @return bool Whether everything was sent and the kernel is done with it
+			 */
+			bool send_zerocopy(const char* data, size_t size);
+
+			/**
+			 * Reads zerocopy completions from the socket's error queue until none is pending
+			 *
+			 * @return bool Whether every completion was read; if not, the connection must be closed
+			 */
+			bool reap_zerocopy();
+
+			/**
+			 * @var int Whether MSG_ZEROCOPY is used: 0 until first tried, 1 if enabled, -1 if unsupported or not worth it
+			 */
+			int zerocopy_;
+
+			/**
+			 * @var uint64_t The MSG_ZEROCOPY sends whose completion has not been read yet
+			 */
+			uint64_t zerocopy_pending_;
+	};
+}
+
+#endif /* HTTP_CONNECTION_H */
@@ -0,0 +1,151 @@
+/*
+ * grpc.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the gRPC message framing functions and classes.
+ */
+
+#include <algorithm>
+#include "http2.h"
+#include "grpc.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace GRPC
+	 * The length-prefixed message framing gRPC uses inside HTTP/2 DATA frames
+	 */
+	namespace GRPC
+	{
+
+		/**
+		 * @var size_t The size of the compressed flag and length that prefix every message
+		 */
+		static const size_t PREFIX_SIZE = 5;
+
+		/**
+		 * Checks whether a request or response carries gRPC
+		 *
+		 * @param const Headers& headers The decoded HTTP/2 header fields
+		 *
+		 * @return bool Whether the content-type is application/grpc or one of its variants, e.g. application/grpc+proto
+		 */
+		bool is_grpc(const Headers& headers)
+		{
+			const std::string* content_type = HTTP2::field(headers, "content-type");
+			if (content_type == nullptr || content_type->compare(0, 16, "application/grpc") != 0)
+			{
+				return false;
+			}
+
+			return content_type->size() == 16 || (*content_type)[16] == '+' || (*content_type)[16] == ';';
+		}
+
+		/**
+		 * Encodes a single message with its 5-byte prefix
+		 *
+		 * @param const std::string& payload The serialised message
+		 * @param bool compressed Whether the payload is compressed with the call's grpc-encoding
+		 *
+		 * @return std::string The framed message
+		 */
+		std::string encode_message(const std::string& payload, bool compressed)
+		{
+			std::string message(PREFIX_SIZE, '\0');
+			message[0] = compressed ? 1 : 0;
+			message[1] = static_cast<char>((payload.size() >> 24) & 0xff);
+			message[2] = static_cast<char>((payload.size() >> 16) & 0xff);
+			message[3] = static_cast<char>((payload.size() >> 8) & 0xff);
+			message[4] = static_cast<char>(payload.size() & 0xff);
+			message += payload;
+
+			return message;
+		}
+
+		/**
+		 * MessageParser constructor
+		 *
+		 * @param size_t max_payload The largest payload kept
+		 *
+		 * @return void
+		 */
+		MessageParser::MessageParser(size_t max_payload)
+			: max_payload_(max_payload),
+			  skipping_(0)
+		{
+		}
+
+		/**
+		 * Appends the content of a DATA frame, discarding the rest of any oversized message
+		 *
+		 * @param const std::string& data The content
+		 *
+		 * @return void
+		 */
+		void MessageParser::feed(const std::string& data)
+		{
+			size_t skipped = static_cast<size_t>(std::min<uint64_t>(skipping_, data.size()));
+			skipping_ -= skipped;
+			buffer_.append(data, skipped, std::string::npos);
+		}
+
+		/**
+		 * Takes the next complete message
+		 *
+		 * A message larger than the payload limit is returned as soon as its prefix
+		 * arrives, without payload, and its bytes are discarded as they are fed in.
+		 *
+		 * @param[out] message The message
+		 *
+		 * @return bool Whether a message was available
+		 */
+		bool MessageParser::next(Message& message)
+		{
+			if (skipping_ > 0 || buffer_.size() < PREFIX_SIZE)
+			{
+				return false;
+			}
+
+			const unsigned char* prefix = reinterpret_cast<const unsigned char*>(buffer_.data());
+			message.compressed = prefix[0] != 0;
+			message.length = (static_cast<uint32_t>(prefix[1]) << 24) | (prefix[2] << 16) | (prefix[3] << 8) | prefix[4];
+			message.payload.clear();
+
+			if (message.length > max_payload_)
+			{
+				size_t available = std::min<size_t>(message.length, buffer_.size() - PREFIX_SIZE);
+				skipping_ = message.length - available;
+				buffer_.erase(0, PREFIX_SIZE + available);
+				return true;
+			}
+
+			if (buffer_.size() - PREFIX_SIZE < message.length)
+			{
+				return false;
+			}
+
+			message.payload.assign(buffer_, PREFIX_SIZE, message.length);
+			buffer_.erase(0, PREFIX_SIZE + message.length);
+			return true;
+		}
+	}
+}
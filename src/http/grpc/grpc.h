@@ -0,0 +1,129 @@
+/*
+ * grpc.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the gRPC message framing functions and classes.
+ */
+
+#ifndef GRPC_H
+#define GRPC_H
+
+#include <cstdint>
+#include <string>
+#include "http_message.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace GRPC
+	 * The length-prefixed message framing gRPC uses inside HTTP/2 DATA frames
+	 */
+	namespace GRPC
+	{
+
+		/**
+		 * @struct Message
+		 *
+		 * A single gRPC message. The payload is left empty for messages larger than
+		 * the parser's payload limit, with length still set.
+		 */
+		struct Message
+		{
+			bool compressed = false;
+			uint32_t length = 0;
+			std::string payload;
+		};
+
+		/**
+		 * Checks whether a request or response carries gRPC
+		 *
+		 * @param const Headers& headers The decoded HTTP/2 header fields
+		 *
+		 * @return bool Whether the content-type is application/grpc or one of its variants
+		 */
+		bool is_grpc(const Headers& headers);
+
+		/**
+		 * Encodes a single message with its 5-byte prefix
+		 *
+		 * @param const std::string& payload The serialised message
+		 * @param bool compressed Whether the payload is compressed with the call's grpc-encoding
+		 *
+		 * @return std::string The framed message
+		 */
+		std::string encode_message(const std::string& payload, bool compressed);
+
+		/**
+		 * @brief Incremental decoder for the messages of one direction of a call
+		 *
+		 * The content of DATA frames is fed in as it arrives and complete messages are
+		 * taken out, regardless of how they were split across frames.
+		 */
+		class MessageParser
+		{
+			public:
+				/**
+				 * Construct a MessageParser
+				 *
+				 * @param size_t max_payload The largest payload kept; larger messages are reported without payload
+				 */
+				explicit MessageParser(size_t max_payload);
+
+				/**
+				 * Append the content of a DATA frame
+				 *
+				 * @param const std::string& data The content
+				 *
+				 * @return void
+				 */
+				void feed(const std::string& data);
+
+				/**
+				 * Take the next complete message
+				 *
+				 * @param[out] message The message
+				 *
+				 * @return bool Whether a message was available
+				 */
+				bool next(Message& message);
+
+			private:
+
+				/**
+				 * @var std::string Bytes received but not yet returned as messages
+				 */
+				std::string buffer_;
+
+				/**
+				 * @var size_t The largest payload kept
+				 */
+				size_t max_payload_;
+
+				/**
+				 * @var uint64_t Bytes of an oversized payload still to be discarded
+				 */
+				uint64_t skipping_;
+		};
+	}
+}
+
+#endif /* GRPC_H */
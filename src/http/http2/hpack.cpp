@@ -0,0 +1,547 @@
+/*
+ * hpack.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HPACK header compression classes.
+ */
+
+#include <cctype>
+#include <vector>
+#include "hpack.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace HPACK
+	 * Header compression for HTTP/2
+	 */
+	namespace HPACK
+	{
+
+		/**
+		 * @var size_t The dynamic table size every HTTP/2 connection starts with
+		 */
+		static const size_t DEFAULT_TABLE_SIZE = 4096;
+
+		/**
+		 * @var size_t The largest dynamic table size accepted from an encoder
+		 */
+		static const size_t MAX_TABLE_SIZE = 1024 * 1024;
+
+		/**
+		 * @var const char* const[][2] The static table of RFC 7541 Appendix A, indexed from 1
+		 */
+		static const char* const STATIC_TABLE[][2] = {
+			{":authority", ""},
+			{":method", "GET"},
+			{":method", "POST"},
+			{":path", "/"},
+			{":path", "/index.html"},
+			{":scheme", "http"},
+			{":scheme", "https"},
+			{":status", "200"},
+			{":status", "204"},
+			{":status", "206"},
+			{":status", "304"},
+			{":status", "400"},
+			{":status", "404"},
+			{":status", "500"},
+			{"accept-charset", ""},
+			{"accept-encoding", "gzip, deflate"},
+			{"accept-language", ""},
+			{"accept-ranges", ""},
+			{"accept", ""},
+			{"access-control-allow-origin", ""},
+			{"age", ""},
+			{"allow", ""},
+			{"authorization", ""},
+			{"cache-control", ""},
+			{"content-disposition", ""},
+			{"content-encoding", ""},
+			{"content-language", ""},
+			{"content-length", ""},
+			{"content-location", ""},
+			{"content-range", ""},
+			{"content-type", ""},
+			{"cookie", ""},
+			{"date", ""},
+			{"etag", ""},
+			{"expect", ""},
+			{"expires", ""},
+			{"from", ""},
+			{"host", ""},
+			{"if-match", ""},
+			{"if-modified-since", ""},
+			{"if-none-match", ""},
+			{"if-range", ""},
+			{"if-unmodified-since", ""},
+			{"last-modified", ""},
+			{"link", ""},
+			{"location", ""},
+			{"max-forwards", ""},
+			{"proxy-authenticate", ""},
+			{"proxy-authorization", ""},
+			{"range", ""},
+			{"referer", ""},
+			{"refresh", ""},
+			{"retry-after", ""},
+			{"server", ""},
+			{"set-cookie", ""},
+			{"strict-transport-security", ""},
+			{"transfer-encoding", ""},
+			{"user-agent", ""},
+			{"vary", ""},
+			{"via", ""},
+			{"www-authenticate", ""}
+		};
+
+		/**
+		 * @var size_t The number of entries in the static table
+		 */
+		static const size_t STATIC_TABLE_SIZE = sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+		/**
+		 * @var uint32_t[256] The Huffman code of each byte, from RFC 7541 Appendix B, right-aligned
+		 */
+		static const uint32_t HUFFMAN_CODES[256] = {
+			0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+			0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+			0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+			0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+			0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+			0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+			0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+			0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+			0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+			0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+			0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+			0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+			0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+			0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+			0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+			0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+			0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+			0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+			0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+			0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+			0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+			0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+			0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+			0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+			0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+			0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+			0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+			0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+			0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+			0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+			0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+			0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee
+		};
+
+		/**
+		 * @var uint8_t[256] The length in bits of each byte's Huffman code
+		 */
+		static const uint8_t HUFFMAN_LENGTHS[256] = {
+			13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+			28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+			6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+			5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+			13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+			7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+			15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+			6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+			20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+			24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+			22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+			21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+			26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+			19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+			20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+			26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26
+		};
+
+		/**
+		 * @struct HuffmanNode
+		 *
+		 * A node of the Huffman decoding tree; leaves carry the decoded byte
+		 */
+		struct HuffmanNode
+		{
+			int children[2];
+			int symbol;
+		};
+
+		/**
+		 * Builds the Huffman decoding tree from the code table
+		 *
+		 * @return std::vector<HuffmanNode> The tree, rooted at index 0
+		 */
+		static std::vector<HuffmanNode> build_huffman_tree()
+		{
+			HuffmanNode empty = {{-1, -1}, -1};
+			std::vector<HuffmanNode> tree(1, empty);
+
+			for (int symbol = 0; symbol < 256; ++symbol)
+			{
+				int node = 0;
+				for (int bit = HUFFMAN_LENGTHS[symbol] - 1; bit >= 0; --bit)
+				{
+					int branch = (HUFFMAN_CODES[symbol] >> bit) & 1;
+					if (tree[node].children[branch] == -1)
+					{
+						tree[node].children[branch] = static_cast<int>(tree.size());
+						tree.push_back(empty);
+					}
+					node = tree[node].children[branch];
+				}
+				tree[node].symbol = symbol;
+			}
+
+			return tree;
+		}
+
+		/**
+		 * Decodes a Huffman-coded string
+		 *
+		 * The code is padded to a whole byte with the most significant bits of the EOS
+		 * symbol, i.e. up to seven 1 bits; anything else is an error.
+		 *
+		 * @param const std::string& data The coded bytes
+		 * @param[out] decoded The decoded string
+		 *
+		 * @return bool Whether the data was validly coded and padded
+		 */
+		bool huffman_decode(const std::string& data, std::string& decoded)
+		{
+			static const std::vector<HuffmanNode> tree = build_huffman_tree();
+
+			decoded.clear();
+			int node = 0;
+			int depth = 0;
+			bool padding = true;
+
+			for (size_t i = 0; i < data.size(); ++i)
+			{
+				unsigned char byte = data[i];
+				for (int bit = 7; bit >= 0; --bit)
+				{
+					int branch = (byte >> bit) & 1;
+					node = tree[node].children[branch];
+					if (node == -1)
+					{
+						return false;
+					}
+
+					++depth;
+					padding = padding && branch == 1;
+
+					if (tree[node].symbol >= 0)
+					{
+						decoded += static_cast<char>(tree[node].symbol);
+						node = 0;
+						depth = 0;
+						padding = true;
+					}
+				}
+			}
+
+			return depth <= 7 && padding;
+		}
+
+		/**
+		 * Decodes an integer with an N-bit prefix
+		 *
+		 * @param const std::string& block The header block
+		 * @param[out] position The offset of the integer, advanced past it
+		 * @param int prefix_bits The number of bits of the first byte used by the integer
+		 * @param[out] value The decoded integer
+		 *
+		 * @return bool Whether the integer was complete and fits in 64 bits
+		 */
+		static bool decode_integer(const std::string& block, size_t& position, int prefix_bits, uint64_t& value)
+		{
+			if (position >= block.size())
+			{
+				return false;
+			}
+
+			uint64_t max_prefix = (1u << prefix_bits) - 1;
+			value = static_cast<unsigned char>(block[position++]) & max_prefix;
+			if (value < max_prefix)
+			{
+				return true;
+			}
+
+			for (int shift = 0; position < block.size() && shift <= 56; shift += 7)
+			{
+				unsigned char byte = block[position++];
+				value += static_cast<uint64_t>(byte & 0x7f) << shift;
+				if ((byte & 0x80) == 0)
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		/**
+		 * Decodes a string literal, Huffman-coded or not
+		 *
+		 * @param const std::string& block The header block
+		 * @param[out] position The offset of the string, advanced past it
+		 * @param[out] value The decoded string
+		 *
+		 * @return bool Whether the string was complete and validly coded
+		 */
+		static bool decode_string(const std::string& block, size_t& position, std::string& value)
+		{
+			if (position >= block.size())
+			{
+				return false;
+			}
+
+			bool huffman = (block[position] & 0x80) != 0;
+			uint64_t length;
+			if (!decode_integer(block, position, 7, length) || length > block.size() - position)
+			{
+				return false;
+			}
+
+			std::string raw = block.substr(position, length);
+			position += length;
+
+			if (huffman)
+			{
+				return huffman_decode(raw, value);
+			}
+
+			value = raw;
+			return true;
+		}
+
+		/**
+		 * Encodes an integer with an N-bit prefix
+		 *
+		 * @param[out] out The string to append to
+		 * @param uint64_t value The integer
+		 * @param int prefix_bits The number of bits of the first byte used by the integer
+		 * @param unsigned char flags The bits of the first byte above the prefix
+		 *
+		 * @return void
+		 */
+		static void encode_integer(std::string& out, uint64_t value, int prefix_bits, unsigned char flags)
+		{
+			uint64_t max_prefix = (1u << prefix_bits) - 1;
+			if (value < max_prefix)
+			{
+				out += static_cast<char>(flags | value);
+				return;
+			}
+
+			out += static_cast<char>(flags | max_prefix);
+			value -= max_prefix;
+			while (value >= 0x80)
+			{
+				out += static_cast<char>((value & 0x7f) | 0x80);
+				value >>= 7;
+			}
+			out += static_cast<char>(value);
+		}
+
+		/**
+		 * Decoder constructor
+		 *
+		 * @return void
+		 */
+		Decoder::Decoder()
+			: size_(0),
+			  max_size_(DEFAULT_TABLE_SIZE)
+		{
+		}
+
+		/**
+		 * Decodes a complete header block
+		 *
+		 * @param const std::string& block The header block, reassembled from HEADERS and CONTINUATION frames
+		 * @param[out] headers The decoded header fields
+		 *
+		 * @return bool Whether the block was well formed
+		 */
+		bool Decoder::decode(const std::string& block, Headers& headers)
+		{
+			headers.clear();
+			size_t position = 0;
+
+			while (position < block.size())
+			{
+				unsigned char first = block[position];
+				std::pair<std::string, std::string> field;
+				uint64_t index;
+
+				// Indexed header field
+				if (first & 0x80)
+				{
+					if (!decode_integer(block, position, 7, index) || !lookup(index, field))
+					{
+						return false;
+					}
+					headers.push_back(field);
+					continue;
+				}
+
+				// Dynamic table size update
+				if ((first & 0xe0) == 0x20)
+				{
+					if (!decode_integer(block, position, 5, index) || index > MAX_TABLE_SIZE)
+					{
+						return false;
+					}
+					max_size_ = index;
+					evict();
+					continue;
+				}
+
+				// Literal header field, with incremental indexing, without indexing or never indexed
+				bool indexing = (first & 0xc0) == 0x40;
+				if (!decode_integer(block, position, indexing ? 6 : 4, index))
+				{
+					return false;
+				}
+
+				if (index == 0)
+				{
+					if (!decode_string(block, position, field.first))
+					{
+						return false;
+					}
+				}
+				else if (!lookup(index, field))
+				{
+					return false;
+				}
+
+				if (!decode_string(block, position, field.second))
+				{
+					return false;
+				}
+
+				if (indexing)
+				{
+					insert(field);
+				}
+				headers.push_back(field);
+			}
+
+			return true;
+		}
+
+		/**
+		 * Looks up a field in the static or dynamic table
+		 *
+		 * @param uint64_t index The 1-based HPACK index
+		 * @param[out] field The field found
+		 *
+		 * @return bool Whether the index was valid
+		 */
+		bool Decoder::lookup(uint64_t index, std::pair<std::string, std::string>& field) const
+		{
+			if (index == 0)
+			{
+				return false;
+			}
+
+			if (index <= STATIC_TABLE_SIZE)
+			{
+				field.first = STATIC_TABLE[index - 1][0];
+				field.second = STATIC_TABLE[index - 1][1];
+				return true;
+			}
+
+			index -= STATIC_TABLE_SIZE + 1;
+			if (index >= table_.size())
+			{
+				return false;
+			}
+
+			field = table_[index];
+			return true;
+		}
+
+		/**
+		 * Adds a field to the dynamic table, evicting the oldest fields to make room
+		 *
+		 * A field larger than the whole table empties it, as RFC 7541 section 4.4 requires.
+		 *
+		 * @param const std::pair<std::string, std::string>& field The field to add
+		 *
+		 * @return void
+		 */
+		void Decoder::insert(const std::pair<std::string, std::string>& field)
+		{
+			table_.push_front(field);
+			size_ += field.first.size() + field.second.size() + 32;
+			evict();
+		}
+
+		/**
+		 * Evicts the oldest fields until the table fits its maximum size
+		 *
+		 * @return void
+		 */
+		void Decoder::evict()
+		{
+			while (size_ > max_size_ && !table_.empty())
+			{
+				size_ -= table_.back().first.size() + table_.back().second.size() + 32;
+				table_.pop_back();
+			}
+		}
+
+		/**
+		 * Encodes header fields as a header block
+		 *
+		 * @param const Headers& headers The header fields, names in lowercase
+		 *
+		 * @return std::string The header block
+		 */
+		std::string encode(const Headers& headers)
+		{
+			std::string block;
+
+			for (size_t i = 0; i < headers.size(); ++i)
+			{
+				block += '\0';
+				encode_integer(block, headers[i].first.size(), 7, 0);
+				for (size_t c = 0; c < headers[i].first.size(); ++c)
+				{
+					block += static_cast<char>(std::tolower(static_cast<unsigned char>(headers[i].first[c])));
+				}
+
+				encode_integer(block, headers[i].second.size(), 7, 0);
+				block += headers[i].second;
+			}
+
+			return block;
+		}
+	}
+}
@@ -0,0 +1,136 @@
+/*
+ * hpack.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the HPACK (RFC 7541) header compression classes used by HTTP/2.
+ */
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include "http_message.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace HPACK
+	 * Header compression for HTTP/2
+	 */
+	namespace HPACK
+	{
+
+		/**
+		 * @brief Decodes the header blocks sent in one direction of an HTTP/2 connection
+		 *
+		 * Keeps the dynamic table the peer's encoder builds up, so every block of the
+		 * connection must be decoded, in order, by the same Decoder.
+		 */
+		class Decoder
+		{
+			public:
+				/**
+				 * Construct a Decoder with the initial dynamic table size of 4096 bytes
+				 */
+				Decoder();
+
+				/**
+				 * Decode a complete header block
+				 *
+				 * @param const std::string& block The header block, reassembled from HEADERS and CONTINUATION frames
+				 * @param[out] headers The decoded header fields, names in lowercase as HTTP/2 requires
+				 *
+				 * @return bool Whether the block was well formed
+				 */
+				bool decode(const std::string& block, Headers& headers);
+
+			private:
+
+				/**
+				 * Looks up a field in the static or dynamic table
+				 *
+				 * @param uint64_t index The 1-based HPACK index
+				 * @param[out] field The field found
+				 *
+				 * @return bool Whether the index was valid
+				 */
+				bool lookup(uint64_t index, std::pair<std::string, std::string>& field) const;
+
+				/**
+				 * Adds a field to the dynamic table, evicting the oldest fields to make room
+				 *
+				 * @param const std::pair<std::string, std::string>& field The field to add
+				 *
+				 * @return void
+				 */
+				void insert(const std::pair<std::string, std::string>& field);
+
+				/**
+				 * Evicts the oldest fields until the table fits its maximum size
+				 *
+				 * @return void
+				 */
+				void evict();
+
+				/**
+				 * @var std::deque<std::pair<std::string, std::string>> The dynamic table, newest first
+				 */
+				std::deque<std::pair<std::string, std::string>> table_;
+
+				/**
+				 * @var size_t The size of the dynamic table as RFC 7541 counts it
+				 */
+				size_t size_;
+
+				/**
+				 * @var size_t The largest size the encoder has set for the dynamic table
+				 */
+				size_t max_size_;
+		};
+
+		/**
+		 * Encodes header fields as a header block
+		 *
+		 * Every field is sent as a literal without indexing and without Huffman coding,
+		 * which any decoder accepts and which needs no state shared with the peer.
+		 *
+		 * @param const Headers& headers The header fields, names in lowercase
+		 *
+		 * @return std::string The header block
+		 */
+		std::string encode(const Headers& headers);
+
+		/**
+		 * Decodes a Huffman-coded string
+		 *
+		 * @param const std::string& data The coded bytes
+		 * @param[out] decoded The decoded string
+		 *
+		 * @return bool Whether the data was validly coded and padded
+		 */
+		bool huffman_decode(const std::string& data, std::string& decoded);
+	}
+}
+
+#endif /* HPACK_H */
@@ -0,0 +1,332 @@
+/*
+ * http2.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HTTP/2 framing functions and classes.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "http2.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace HTTP2
+	 * Framing for HTTP/2 connections
+	 */
+	namespace HTTP2
+	{
+
+		/**
+		 * @var size_t The size of the fixed frame header
+		 */
+		static const size_t FRAME_HEADER_SIZE = 9;
+
+		/**
+		 * Encodes a single frame
+		 *
+		 * @param int type The frame type
+		 * @param int flags The frame flags
+		 * @param uint32_t stream The stream identifier, 0 for the connection
+		 * @param const std::string& payload The frame payload
+		 *
+		 * @return std::string The encoded frame
+		 */
+		std::string encode_frame(int type, int flags, uint32_t stream, const std::string& payload)
+		{
+			std::string frame(FRAME_HEADER_SIZE, '\0');
+			frame[0] = static_cast<char>((payload.size() >> 16) & 0xff);
+			frame[1] = static_cast<char>((payload.size() >> 8) & 0xff);
+			frame[2] = static_cast<char>(payload.size() & 0xff);
+			frame[3] = static_cast<char>(type);
+			frame[4] = static_cast<char>(flags);
+			frame[5] = static_cast<char>((stream >> 24) & 0x7f);
+			frame[6] = static_cast<char>((stream >> 16) & 0xff);
+			frame[7] = static_cast<char>((stream >> 8) & 0xff);
+			frame[8] = static_cast<char>(stream & 0xff);
+			frame += payload;
+
+			return frame;
+		}
+
+		/**
+		 * Returns the value of a header field
+		 *
+		 * @param const Headers& headers The decoded header fields
+		 * @param const std::string& name The field name, in lowercase
+		 *
+		 * @return const std::string* The first matching value, or nullptr if the field is absent
+		 */
+		const std::string* field(const Headers& headers, const std::string& name)
+		{
+			for (size_t i = 0; i < headers.size(); ++i)
+			{
+				if (headers[i].first == name)
+				{
+					return &headers[i].second;
+				}
+			}
+
+			return nullptr;
+		}
+
+		/**
+		 * Serialises header fields as "name: value" lines
+		 *
+		 * @param const Headers& headers The header fields
+		 *
+		 * @return std::string One CRLF-terminated line per field
+		 */
+		std::string format_headers(const Headers& headers)
+		{
+			std::string text;
+			for (size_t i = 0; i < headers.size(); ++i)
+			{
+				text += headers[i].first + ": " + headers[i].second + "\r\n";
+			}
+
+			return text;
+		}
+
+		/**
+		 * Parses header fields serialised by format_headers()
+		 *
+		 * Pseudo-header names start with a colon, so the separator is the first ": " after the first character.
+		 *
+		 * @param const std::string& text The serialised fields
+		 *
+		 * @return Headers The header fields
+		 */
+		Headers parse_headers(const std::string& text)
+		{
+			Headers headers;
+			size_t position = 0;
+
+			while (position < text.size())
+			{
+				size_t line_end = text.find("\r\n", position);
+				if (line_end == std::string::npos)
+				{
+					line_end = text.size();
+				}
+
+				size_t separator = text.find(": ", position + 1);
+				if (separator != std::string::npos && separator < line_end)
+				{
+					headers.push_back(std::make_pair(text.substr(position, separator - position), text.substr(separator + 2, line_end - separator - 2)));
+				}
+
+				position = line_end + 2;
+			}
+
+			return headers;
+		}
+
+		/**
+		 * Removes the padding, and optionally leading fields, from a frame payload
+		 *
+		 * @param[out] frame The frame whose payload is trimmed
+		 * @param size_t skip The bytes to drop after the pad length, e.g. the priority fields of HEADERS
+		 *
+		 * @return bool Whether the padding was consistent with the payload length
+		 */
+		static bool strip_padding(Frame& frame, size_t skip)
+		{
+			size_t padding = 0;
+			size_t start = skip;
+
+			if (frame.flags & PADDED)
+			{
+				if (frame.payload.empty())
+				{
+					return false;
+				}
+				padding = static_cast<unsigned char>(frame.payload[0]);
+				start += 1;
+			}
+
+			if (start + padding > frame.payload.size())
+			{
+				return false;
+			}
+
+			frame.payload = frame.payload.substr(start, frame.payload.size() - start - padding);
+			return true;
+		}
+
+		/**
+		 * FrameReader constructor
+		 *
+		 * @param bool client_side Whether the bytes come from the client, and so start with the connection preface
+		 *
+		 * @return void
+		 */
+		FrameReader::FrameReader(bool client_side)
+			: position_(0),
+			  preface_remaining_(client_side ? PREFACE_SIZE : 0),
+			  continuing_(false),
+			  failed_(false)
+		{
+		}
+
+		/**
+		 * Appends bytes read from the connection
+		 *
+		 * @param const char* data The bytes read
+		 * @param size_t size The number of bytes
+		 *
+		 * @return void
+		 */
+		void FrameReader::feed(const char* data, size_t size)
+		{
+			// Drop returned frames once they make up most of the buffer, so appends stay cheap
+			if (position_ > 0 && position_ >= buffer_.size() / 2)
+			{
+				buffer_.erase(0, position_);
+				position_ = 0;
+			}
+
+			buffer_.append(data, size);
+		}
+
+		/**
+		 * Takes the next complete frame
+		 *
+		 * @param[out] frame The frame
+		 *
+		 * @return bool Whether a frame was available
+		 */
+		bool FrameReader::next(Frame& frame)
+		{
+			while (!failed_)
+			{
+				if (preface_remaining_ > 0)
+				{
+					size_t available = std::min(preface_remaining_, buffer_.size() - position_);
+					size_t offset = PREFACE_SIZE - preface_remaining_;
+					if (memcmp(buffer_.data() + position_, PREFACE + offset, available) != 0)
+					{
+						failed_ = true;
+						break;
+					}
+
+					position_ += available;
+					preface_remaining_ -= available;
+					if (preface_remaining_ > 0)
+					{
+						return false;
+					}
+				}
+
+				if (buffer_.size() - position_ < FRAME_HEADER_SIZE)
+				{
+					return false;
+				}
+
+				const unsigned char* header = reinterpret_cast<const unsigned char*>(buffer_.data() + position_);
+				size_t length = (header[0] << 16) | (header[1] << 8) | header[2];
+				if (buffer_.size() - position_ - FRAME_HEADER_SIZE < length)
+				{
+					return false;
+				}
+
+				Frame current;
+				current.type = header[3];
+				current.flags = header[4];
+				current.stream = ((header[5] & 0x7f) << 24) | (header[6] << 16) | (header[7] << 8) | header[8];
+				current.payload.assign(buffer_, position_ + FRAME_HEADER_SIZE, length);
+				position_ += FRAME_HEADER_SIZE + length;
+
+				// A header block must be finished before any other frame is sent
+				if (continuing_ != (current.type == CONTINUATION))
+				{
+					failed_ = true;
+					break;
+				}
+
+				switch (current.type)
+				{
+					case DATA:
+						if (!strip_padding(current, 0))
+						{
+							failed_ = true;
+							continue;
+						}
+						frame = current;
+						return true;
+
+					case HEADERS:
+					case PUSH_PROMISE:
+					{
+						size_t skip = current.type == PUSH_PROMISE ? 4 : ((current.flags & PRIORITY_FLAG) ? 5 : 0);
+						if (!strip_padding(current, skip))
+						{
+							failed_ = true;
+							continue;
+						}
+						pending_ = current;
+						break;
+					}
+
+					case CONTINUATION:
+						pending_.payload += current.payload;
+						pending_.flags |= current.flags & END_HEADERS;
+						break;
+
+					default:
+						frame = current;
+						return true;
+				}
+
+				continuing_ = (pending_.flags & END_HEADERS) == 0;
+				if (continuing_)
+				{
+					continue;
+				}
+
+				// The header block is complete; decoding it keeps the HPACK state in step with the peer
+				if (!decoder_.decode(pending_.payload, pending_.headers))
+				{
+					failed_ = true;
+					break;
+				}
+
+				frame = pending_;
+				frame.payload.clear();
+				return true;
+			}
+
+			return false;
+		}
+
+		/**
+		 * Returns whether the connection broke the protocol
+		 *
+		 * @return bool Whether the stream could not be decoded
+		 */
+		bool FrameReader::failed() const
+		{
+			return failed_;
+		}
+	}
+}
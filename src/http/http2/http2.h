@@ -0,0 +1,225 @@
+/*
+ * http2.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the HTTP/2 (RFC 9113) framing functions and classes.
+ */
+
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <cstdint>
+#include <string>
+#include "http_message.h"
+#include "hpack.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace HTTP2
+	 * Framing for HTTP/2 connections
+	 */
+	namespace HTTP2
+	{
+
+		/**
+		 * @var const char* The connection preface every HTTP/2 client sends first
+		 */
+		const char* const PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+		/**
+		 * @var size_t The length of the connection preface
+		 */
+		const size_t PREFACE_SIZE = 24;
+
+		/**
+		 * @enum FrameType
+		 *
+		 * The frame types defined by RFC 9113
+		 */
+		enum FrameType
+		{
+			DATA = 0x0,
+			HEADERS = 0x1,
+			PRIORITY = 0x2,
+			RST_STREAM = 0x3,
+			SETTINGS = 0x4,
+			PUSH_PROMISE = 0x5,
+			PING = 0x6,
+			GOAWAY = 0x7,
+			WINDOW_UPDATE = 0x8,
+			CONTINUATION = 0x9
+		};
+
+		/**
+		 * @enum Flag
+		 *
+		 * The frame flags defined by RFC 9113
+		 */
+		enum Flag
+		{
+			END_STREAM = 0x1,
+			ACK = 0x1,
+			END_HEADERS = 0x4,
+			PADDED = 0x8,
+			PRIORITY_FLAG = 0x20
+		};
+
+		/**
+		 * @struct Frame
+		 *
+		 * A frame as returned by FrameReader. Padding is removed, and a header block
+		 * split over CONTINUATION frames is returned as one frame with its fields decoded.
+		 */
+		struct Frame
+		{
+			int type = DATA;
+			int flags = 0;
+			uint32_t stream = 0;
+			std::string payload;
+			Headers headers;
+		};
+
+		/**
+		 * Encodes a single frame
+		 *
+		 * @param int type The frame type
+		 * @param int flags The frame flags
+		 * @param uint32_t stream The stream identifier, 0 for the connection
+		 * @param const std::string& payload The frame payload
+		 *
+		 * @return std::string The encoded frame
+		 */
+		std::string encode_frame(int type, int flags, uint32_t stream, const std::string& payload);
+
+		/**
+		 * Returns the value of a header field
+		 *
+		 * @param const Headers& headers The decoded header fields
+		 * @param const std::string& name The field name, in lowercase
+		 *
+		 * @return const std::string* The first matching value, or nullptr if the field is absent
+		 */
+		const std::string* field(const Headers& headers, const std::string& name);
+
+		/**
+		 * Serialises header fields as "name: value" lines, for captures and logs
+		 *
+		 * @param const Headers& headers The header fields
+		 *
+		 * @return std::string One CRLF-terminated line per field
+		 */
+		std::string format_headers(const Headers& headers);
+
+		/**
+		 * Parses header fields serialised by format_headers()
+		 *
+		 * @param const std::string& text The serialised fields
+		 *
+		 * @return Headers The header fields
+		 */
+		Headers parse_headers(const std::string& text);
+
+		/**
+		 * @brief Incremental decoder for one direction of an HTTP/2 connection
+		 *
+		 * Bytes are fed in as they are read from the socket and complete frames are
+		 * taken out. Header blocks are decoded as they complete, so every frame sent in
+		 * that direction must pass through the same FrameReader.
+		 */
+		class FrameReader
+		{
+			public:
+				/**
+				 * Construct a FrameReader
+				 *
+				 * @param bool client_side Whether the bytes come from the client, and so start with the connection preface
+				 */
+				explicit FrameReader(bool client_side);
+
+				/**
+				 * Append bytes read from the connection
+				 *
+				 * @param const char* data The bytes read
+				 * @param size_t size The number of bytes
+				 *
+				 * @return void
+				 */
+				void feed(const char* data, size_t size);
+
+				/**
+				 * Take the next complete frame
+				 *
+				 * @param[out] frame The frame
+				 *
+				 * @return bool Whether a frame was available
+				 */
+				bool next(Frame& frame);
+
+				/**
+				 * Returns whether the connection broke the protocol, after which no more frames are returned
+				 *
+				 * @return bool Whether the stream could not be decoded
+				 */
+				bool failed() const;
+
+			private:
+
+				/**
+				 * @var std::string Bytes received but not yet returned as frames
+				 */
+				std::string buffer_;
+
+				/**
+				 * @var size_t How far into buffer_ the next frame starts
+				 */
+				size_t position_;
+
+				/**
+				 * @var size_t Bytes of the connection preface still to be checked
+				 */
+				size_t preface_remaining_;
+
+				/**
+				 * @var HPACK::Decoder The header decompression state of this direction
+				 */
+				HPACK::Decoder decoder_;
+
+				/**
+				 * @var Frame A HEADERS or PUSH_PROMISE frame waiting for its CONTINUATION frames
+				 */
+				Frame pending_;
+
+				/**
+				 * @var bool Whether pending_ is waiting for CONTINUATION frames
+				 */
+				bool continuing_;
+
+				/**
+				 * @var bool Whether the connection broke the protocol
+				 */
+				bool failed_;
+		};
+	}
+}
+
+#endif /* HTTP2_H */
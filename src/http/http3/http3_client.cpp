@@ -0,0 +1,569 @@
+/*
+ * http3_client.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HTTP::HTTP3::Client class.
+ */
+
+#include "config.h"
+
+#if HTTP3_SUPPORT == 1
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include "busy_poll.h"
+#include "http3_client.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace HTTP3
+	 * HTTP/3 over QUIC, for replaying captured requests
+	 */
+	namespace HTTP3
+	{
+
+		/**
+		 * @var unsigned char[] The ALPN protocol list offered to the server, in wire format
+		 */
+		static const unsigned char ALPN[] = { 2, 'h', '3' };
+
+		/**
+		 * @var size_t The most buffers taken from nghttp3 per write
+		 */
+		static const size_t MAX_VECTORS = 16;
+
+		/**
+		 * Client constructor
+		 *
+		 * @return void
+		 */
+		Client::Client()
+			: ctx_(nullptr),
+			  ssl_(nullptr),
+			  fd_(-1),
+			  h3_(nullptr),
+			  request_stream_(-1),
+			  body_(nullptr),
+			  body_sent_(false),
+			  status_(0),
+			  body_size_(0),
+			  complete_(false)
+		{
+		}
+
+		/**
+		 * Client destructor
+		 *
+		 * Stream objects are freed before the connection they belong to.
+		 *
+		 * @return void
+		 */
+		Client::~Client()
+		{
+			for (std::map<int64_t, SSL*>::iterator it = streams_.begin(); it != streams_.end(); ++it)
+			{
+				SSL_free(it->second);
+			}
+
+			if (h3_ != nullptr)
+			{
+				nghttp3_conn_del(h3_);
+			}
+
+			if (ssl_ != nullptr)
+			{
+				// Starts an orderly close; the peer times the connection out if it never completes
+				SSL_shutdown(ssl_);
+				SSL_free(ssl_);
+			}
+			else if (fd_ != -1)
+			{
+				BIO_closesocket(fd_);
+			}
+
+			if (ctx_ != nullptr)
+			{
+				SSL_CTX_free(ctx_);
+			}
+		}
+
+		/**
+		 * Connects to the specified host and UDP port and completes the QUIC handshake
+		 *
+		 * Once the handshake is done, the control stream and the two QPACK streams
+		 * HTTP/3 requires are opened and bound to nghttp3.
+		 *
+		 * @param const std::string& host The host name or IP address to connect to
+		 * @param const std::string& port The port number or service name to connect to
+		 * @param int timeout Seconds to wait for the handshake
+		 *
+		 * @return void
+		 *
+		 * @throws std::runtime_error If the connection or handshake fails
+		 */
+		void Client::connect(const std::string& host, const std::string& port, int timeout)
+		{
+			deadline_ = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+
+			ctx_ = SSL_CTX_new(OSSL_QUIC_client_method());
+			if (ctx_ == nullptr)
+			{
+				throw std::runtime_error("Failed to create QUIC context");
+			}
+			SSL_CTX_set_verify(ctx_, SSL_VERIFY_NONE, nullptr);
+
+			ssl_ = SSL_new(ctx_);
+			if (ssl_ == nullptr)
+			{
+				throw std::runtime_error("Failed to create QUIC connection");
+			}
+
+			BIO_ADDRINFO* addresses = nullptr;
+			if (!BIO_lookup_ex(host.c_str(), port.c_str(), BIO_LOOKUP_CLIENT, AF_UNSPEC, SOCK_DGRAM, IPPROTO_UDP, &addresses))
+			{
+				throw std::runtime_error("Failed to resolve " + host + ":" + port);
+			}
+
+			for (const BIO_ADDRINFO* address = addresses; address != nullptr; address = BIO_ADDRINFO_next(address))
+			{
+				fd_ = BIO_socket(BIO_ADDRINFO_family(address), SOCK_DGRAM, IPPROTO_UDP, 0);
+				if (fd_ == -1)
+				{
+					continue;
+				}
+
+				if (BIO_connect(fd_, BIO_ADDRINFO_address(address), 0) && BIO_socket_nbio(fd_, 1)
+					&& SSL_set1_initial_peer_addr(ssl_, BIO_ADDRINFO_address(address)))
+				{
+					break;
+				}
+
+				BIO_closesocket(fd_);
+				fd_ = -1;
+			}
+			BIO_ADDRINFO_free(addresses);
+
+			if (fd_ == -1)
+			{
+				throw std::runtime_error("Failed to connect to " + host + ":" + port + " over UDP");
+			}
+			busy_poll_socket(fd_);
+
+			BIO* bio = BIO_new(BIO_s_datagram());
+			if (bio == nullptr)
+			{
+				throw std::runtime_error("Failed to create datagram BIO");
+			}
+			BIO_set_fd(bio, fd_, BIO_CLOSE);
+			SSL_set_bio(ssl_, bio, bio);
+
+			SSL_set_tlsext_host_name(ssl_, host.c_str());
+			if (SSL_set_alpn_protos(ssl_, ALPN, sizeof(ALPN)) != 0)
+			{
+				throw std::runtime_error("Failed to set ALPN");
+			}
+
+			// HTTP/3 uses several streams explicitly, so the connection itself carries none
+			SSL_set_default_stream_mode(ssl_, SSL_DEFAULT_STREAM_MODE_NONE);
+			SSL_set_blocking_mode(ssl_, 0);
+
+			for (;;)
+			{
+				int result = SSL_connect(ssl_);
+				if (result == 1)
+				{
+					break;
+				}
+
+				int error = SSL_get_error(ssl_, result);
+				if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+				{
+					ERR_print_errors_fp(stderr);
+					throw std::runtime_error("QUIC handshake with " + host + ":" + port + " failed");
+				}
+
+				wait();
+			}
+
+			nghttp3_callbacks callbacks = {};
+			callbacks.recv_header = on_header;
+			callbacks.recv_data = on_data;
+			callbacks.end_stream = on_end_stream;
+
+			nghttp3_settings h3_settings;
+			nghttp3_settings_default(&h3_settings);
+
+			int result = nghttp3_conn_client_new(&h3_, &callbacks, &h3_settings, nghttp3_mem_default(), this);
+			if (result != 0)
+			{
+				throw std::runtime_error(std::string("Failed to create HTTP/3 connection: ") + nghttp3_strerror(result));
+			}
+
+			int64_t control = open_stream(true);
+			int64_t encoder = open_stream(true);
+			int64_t decoder = open_stream(true);
+			if (nghttp3_conn_bind_control_stream(h3_, control) != 0 || nghttp3_conn_bind_qpack_streams(h3_, encoder, decoder) != 0)
+			{
+				throw std::runtime_error("Failed to bind HTTP/3 control streams");
+			}
+
+			flush();
+		}
+
+		/**
+		 * Sends a request and waits for the whole response
+		 *
+		 * @param const Headers& fields The request header fields, pseudo-header fields first
+		 * @param const std::string& body The request content
+		 * @param int timeout Seconds to wait for the response
+		 * @param[out] body_size The number of content bytes received
+		 *
+		 * @return int The response status code
+		 *
+		 * @throws std::runtime_error If the request cannot be sent or the response does not complete
+		 */
+		int Client::request(const Headers& fields, const std::string& body, int timeout, uint64_t& body_size)
+		{
+			deadline_ = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+			body_ = &body;
+			body_sent_ = false;
+			status_ = 0;
+			body_size_ = 0;
+			complete_ = false;
+
+			std::vector<nghttp3_nv> headers(fields.size());
+			for (size_t i = 0; i < fields.size(); ++i)
+			{
+				headers[i].name = reinterpret_cast<uint8_t*>(const_cast<char*>(fields[i].first.data()));
+				headers[i].namelen = fields[i].first.size();
+				headers[i].value = reinterpret_cast<uint8_t*>(const_cast<char*>(fields[i].second.data()));
+				headers[i].valuelen = fields[i].second.size();
+				headers[i].flags = NGHTTP3_NV_FLAG_NONE;
+			}
+
+			nghttp3_data_reader reader = {};
+			reader.read_data = read_body;
+
+			request_stream_ = open_stream(false);
+			int result = nghttp3_conn_submit_request(h3_, request_stream_, headers.data(), headers.size(), body.empty() ? nullptr : &reader, nullptr);
+			if (result != 0)
+			{
+				throw std::runtime_error(std::string("Failed to submit HTTP/3 request: ") + nghttp3_strerror(result));
+			}
+
+			for (;;)
+			{
+				flush();
+				receive();
+				if (complete_)
+				{
+					break;
+				}
+				wait();
+			}
+
+			body_ = nullptr;
+			body_size = body_size_;
+			return status_;
+		}
+
+		/**
+		 * Opens a locally initiated stream and registers it
+		 *
+		 * @param bool unidirectional Whether the stream only carries data to the peer
+		 *
+		 * @return int64_t The stream identifier
+		 *
+		 * @throws std::runtime_error If the stream cannot be opened
+		 */
+		int64_t Client::open_stream(bool unidirectional)
+		{
+			SSL* stream = SSL_new_stream(ssl_, unidirectional ? SSL_STREAM_FLAG_UNI : 0);
+			if (stream == nullptr)
+			{
+				throw std::runtime_error("Failed to open QUIC stream");
+			}
+
+			SSL_set_mode(stream, SSL_MODE_ENABLE_PARTIAL_WRITE);
+
+			int64_t id = static_cast<int64_t>(SSL_get_stream_id(stream));
+			streams_[id] = stream;
+			return id;
+		}
+
+		/**
+		 * Writes everything nghttp3 has queued to the QUIC streams
+		 *
+		 * OpenSSL keeps its own copy of written data until the peer acknowledges it, so
+		 * nghttp3 is told its data was acknowledged as soon as it is written.
+		 *
+		 * @return void
+		 *
+		 * @throws std::runtime_error If a stream cannot be written
+		 */
+		void Client::flush()
+		{
+			for (;;)
+			{
+				int64_t stream_id = -1;
+				int fin = 0;
+				nghttp3_vec vectors[MAX_VECTORS];
+
+				nghttp3_ssize count = nghttp3_conn_writev_stream(h3_, &stream_id, &fin, vectors, MAX_VECTORS);
+				if (count < 0)
+				{
+					throw std::runtime_error(std::string("HTTP/3 error: ") + nghttp3_strerror(static_cast<int>(count)));
+				}
+				if (stream_id < 0)
+				{
+					return;
+				}
+
+				std::map<int64_t, SSL*>::iterator stream = streams_.find(stream_id);
+				if (stream == streams_.end())
+				{
+					throw std::runtime_error("HTTP/3 data for an unknown stream");
+				}
+
+				size_t total = 0;
+				for (nghttp3_ssize i = 0; i < count; ++i)
+				{
+					size_t position = 0;
+					while (position < vectors[i].len)
+					{
+						size_t written = 0;
+						if (SSL_write_ex(stream->second, vectors[i].base + position, vectors[i].len - position, &written))
+						{
+							position += written;
+							continue;
+						}
+
+						int error = SSL_get_error(stream->second, 0);
+						if (error != SSL_ERROR_WANT_WRITE && error != SSL_ERROR_WANT_READ)
+						{
+							throw std::runtime_error("Failed to write to QUIC stream");
+						}
+
+						// The peer's flow control window is full
+						wait();
+					}
+					total += vectors[i].len;
+				}
+
+				nghttp3_conn_add_write_offset(h3_, stream_id, total);
+				nghttp3_conn_add_ack_offset(h3_, stream_id, total);
+
+				if (fin)
+				{
+					SSL_stream_conclude(stream->second, 0);
+				}
+			}
+		}
+
+		/**
+		 * Reads what has arrived on every stream and passes it to nghttp3
+		 *
+		 * Streams the server opens, its control stream and QPACK streams, are accepted
+		 * first. The unidirectional streams this side opened are never read.
+		 *
+		 * @return void
+		 *
+		 * @throws std::runtime_error If the peer broke the protocol or reset the request
+		 */
+		void Client::receive()
+		{
+			while (SSL* incoming = SSL_accept_stream(ssl_, SSL_ACCEPT_STREAM_NO_BLOCK))
+			{
+				streams_[static_cast<int64_t>(SSL_get_stream_id(incoming))] = incoming;
+			}
+
+			uint8_t buffer[16384];
+			for (std::map<int64_t, SSL*>::iterator it = streams_.begin(); it != streams_.end(); ++it)
+			{
+				int64_t id = it->first;
+				bool local_unidirectional = (id & 0x3) == 0x2;
+				if (local_unidirectional || finished_.count(id) != 0)
+				{
+					continue;
+				}
+
+				for (;;)
+				{
+					size_t size = 0;
+					if (SSL_read_ex(it->second, buffer, sizeof(buffer), &size))
+					{
+						if (nghttp3_conn_read_stream(h3_, id, buffer, size, 0) < 0)
+						{
+							throw std::runtime_error("Invalid HTTP/3 data from target");
+						}
+						continue;
+					}
+
+					int error = SSL_get_error(it->second, 0);
+					if (error == SSL_ERROR_WANT_READ)
+					{
+						break;
+					}
+
+					if (error == SSL_ERROR_ZERO_RETURN)
+					{
+						finished_.insert(id);
+						if (nghttp3_conn_read_stream(h3_, id, nullptr, 0, 1) < 0)
+						{
+							throw std::runtime_error("Invalid HTTP/3 data from target");
+						}
+						break;
+					}
+
+					if (SSL_get_stream_read_state(it->second) == SSL_STREAM_STATE_RESET_REMOTE)
+					{
+						throw std::runtime_error("Stream reset by target");
+					}
+
+					throw std::runtime_error("QUIC connection failed");
+				}
+			}
+		}
+
+		/**
+		 * Waits for the socket or the next QUIC timer, then lets OpenSSL process them
+		 *
+		 * @return void
+		 *
+		 * @throws std::runtime_error If the deadline of the current operation has passed
+		 */
+		void Client::wait()
+		{
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (now >= deadline_)
+			{
+				throw std::runtime_error("Timed out waiting for the target");
+			}
+
+			int timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline_ - now).count()) + 1;
+
+			struct timeval event_timeout;
+			int infinite = 1;
+			if (SSL_get_event_timeout(ssl_, &event_timeout, &infinite) && !infinite)
+			{
+				int event_ms = static_cast<int>(event_timeout.tv_sec * 1000 + (event_timeout.tv_usec + 999) / 1000);
+				timeout = std::min(timeout, event_ms);
+			}
+
+			struct pollfd descriptor;
+			descriptor.fd = fd_;
+			descriptor.events = POLLIN | (SSL_net_write_desired(ssl_) ? POLLOUT : 0);
+			descriptor.revents = 0;
+			wait_for_poll(&descriptor, 1, timeout);
+
+			SSL_handle_events(ssl_);
+		}
+
+		/**
+		 * Records the status code of the final response
+		 *
+		 * @return int 0, to continue
+		 */
+		int Client::on_header(nghttp3_conn*, int64_t stream_id, int32_t token, nghttp3_rcbuf*, nghttp3_rcbuf* value, uint8_t, void* user_data, void*)
+		{
+			Client* client = static_cast<Client*>(user_data);
+			if (stream_id != client->request_stream_ || token != NGHTTP3_QPACK_TOKEN__STATUS)
+			{
+				return 0;
+			}
+
+			nghttp3_vec status = nghttp3_rcbuf_get_buf(value);
+			int code = std::atoi(std::string(reinterpret_cast<const char*>(status.base), status.len).c_str());
+
+			// Interim responses such as 100 Continue are followed by the final one
+			if (code >= 200)
+			{
+				client->status_ = code;
+			}
+
+			return 0;
+		}
+
+		/**
+		 * Counts the response content
+		 *
+		 * @return int 0, to continue
+		 */
+		int Client::on_data(nghttp3_conn*, int64_t stream_id, const uint8_t*, size_t size, void* user_data, void*)
+		{
+			Client* client = static_cast<Client*>(user_data);
+			if (stream_id == client->request_stream_)
+			{
+				client->body_size_ += size;
+			}
+
+			return 0;
+		}
+
+		/**
+		 * Marks the response as complete once the server ends the request stream
+		 *
+		 * @return int 0, to continue
+		 */
+		int Client::on_end_stream(nghttp3_conn*, int64_t stream_id, void* user_data, void*)
+		{
+			Client* client = static_cast<Client*>(user_data);
+			if (stream_id == client->request_stream_)
+			{
+				client->complete_ = true;
+			}
+
+			return 0;
+		}
+
+		/**
+		 * Hands the whole request content to nghttp3 at once
+		 *
+		 * @return nghttp3_ssize The number of vectors filled
+		 */
+		nghttp3_ssize Client::read_body(nghttp3_conn*, int64_t, nghttp3_vec* vec, size_t, uint32_t* flags, void* user_data, void*)
+		{
+			Client* client = static_cast<Client*>(user_data);
+			*flags |= NGHTTP3_DATA_FLAG_EOF;
+
+			if (client->body_sent_ || client->body_ == nullptr)
+			{
+				return 0;
+			}
+
+			vec[0].base = reinterpret_cast<uint8_t*>(const_cast<char*>(client->body_->data()));
+			vec[0].len = client->body_->size();
+			client->body_sent_ = true;
+			return 1;
+		}
+	}
+}
+
+#endif /* HTTP3_SUPPORT */
@@ -0,0 +1,221 @@
+/*
+ * http3_client.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the HTTP::HTTP3::Client class.
+ */
+
+#include "config.h"
+
+#if HTTP3_SUPPORT == 1
+
+#ifndef HTTP3_CLIENT_H
+#define HTTP3_CLIENT_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <openssl/ssl.h>
+#include <nghttp3/nghttp3.h>
+#include "http_message.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace HTTP3
+	 * HTTP/3 over QUIC, for replaying captured requests
+	 */
+	namespace HTTP3
+	{
+
+		/**
+		 * @brief An outgoing HTTP/3 connection that sends a single request
+		 *
+		 * QUIC, with its TLS handshake, loss recovery and flow control, is provided by
+		 * OpenSSL's QUIC client; nghttp3 provides the HTTP/3 framing and QPACK. Each
+		 * QUIC stream is its own SSL object, and the connection is driven without
+		 * blocking from a poll() loop on its UDP socket. The peer certificate is not
+		 * verified, as replay targets are usually test servers.
+		 */
+		class Client
+		{
+			public:
+				/**
+				 * Construct an unconnected Client
+				 */
+				Client();
+
+				/**
+				 * Destruct the Client, closing its connection
+				 */
+				~Client();
+
+				/**
+				 * Connect to the specified host and UDP port and complete the QUIC handshake
+				 *
+				 * @param const std::string& host The host name or IP address to connect to
+				 * @param const std::string& port The port number or service name to connect to
+				 * @param int timeout Seconds to wait for the handshake
+				 *
+				 * @return void
+				 *
+				 * @throws std::runtime_error If the connection or handshake fails
+				 */
+				void connect(const std::string& host, const std::string& port, int timeout);
+
+				/**
+				 * Send a request and wait for the whole response
+				 *
+				 * @param const Headers& fields The request header fields, pseudo-header fields first
+				 * @param const std::string& body The request content
+				 * @param int timeout Seconds to wait for the response
+				 * @param[out] body_size The number of content bytes received
+				 *
+				 * @return int The response status code
+				 *
+				 * @throws std::runtime_error If the request cannot be sent or the response does not complete
+				 */
+				int request(const Headers& fields, const std::string& body, int timeout, uint64_t& body_size);
+
+			private:
+				Client(const Client&);
+				Client& operator=(const Client&);
+
+				/**
+				 * Open a locally initiated stream and register it
+				 *
+				 * @param bool unidirectional Whether the stream only carries data to the peer
+				 *
+				 * @return int64_t The stream identifier
+				 *
+				 * @throws std::runtime_error If the stream cannot be opened
+				 */
+				int64_t open_stream(bool unidirectional);
+
+				/**
+				 * Write everything nghttp3 has queued to the QUIC streams
+				 *
+				 * @return void
+				 *
+				 * @throws std::runtime_error If a stream cannot be written
+				 */
+				void flush();
+
+				/**
+				 * Read what has arrived on every stream and pass it to nghttp3
+				 *
+				 * @return void
+				 *
+				 * @throws std::runtime_error If the peer broke the protocol or reset the request
+				 */
+				void receive();
+
+				/**
+				 * Wait for the socket or the next QUIC timer, then let OpenSSL process them
+				 *
+				 * @return void
+				 *
+				 * @throws std::runtime_error If the deadline of the current operation has passed
+				 */
+				void wait();
+
+				/**
+				 * nghttp3 callbacks, with the Client as connection user data
+				 */
+				static int on_header(nghttp3_conn* conn, int64_t stream_id, int32_t token, nghttp3_rcbuf* name, nghttp3_rcbuf* value, uint8_t flags, void* user_data, void* stream_user_data);
+				static int on_data(nghttp3_conn* conn, int64_t stream_id, const uint8_t* data, size_t size, void* user_data, void* stream_user_data);
+				static int on_end_stream(nghttp3_conn* conn, int64_t stream_id, void* user_data, void* stream_user_data);
+				static nghttp3_ssize read_body(nghttp3_conn* conn, int64_t stream_id, nghttp3_vec* vec, size_t vec_count, uint32_t* flags, void* user_data, void* stream_user_data);
+
+				/**
+				 * @var SSL_CTX* The QUIC client context
+				 */
+				SSL_CTX* ctx_;
+
+				/**
+				 * @var SSL* The QUIC connection
+				 */
+				SSL* ssl_;
+
+				/**
+				 * @var int The UDP socket, owned by the connection's BIO
+				 */
+				int fd_;
+
+				/**
+				 * @var nghttp3_conn* The HTTP/3 state of the connection
+				 */
+				nghttp3_conn* h3_;
+
+				/**
+				 * @var std::map<int64_t, SSL*> Every open stream, by stream identifier
+				 */
+				std::map<int64_t, SSL*> streams_;
+
+				/**
+				 * @var std::set<int64_t> Streams whose peer has finished sending
+				 */
+				std::set<int64_t> finished_;
+
+				/**
+				 * @var std::chrono::steady_clock::time_point When the current handshake or request times out
+				 */
+				std::chrono::steady_clock::time_point deadline_;
+
+				/**
+				 * @var int64_t The request stream
+				 */
+				int64_t request_stream_;
+
+				/**
+				 * @var const std::string* The request content, while it is being sent
+				 */
+				const std::string* body_;
+
+				/**
+				 * @var bool Whether the request content has been handed to nghttp3
+				 */
+				bool body_sent_;
+
+				/**
+				 * @var int The response status code, or 0 until a final response arrives
+				 */
+				int status_;
+
+				/**
+				 * @var uint64_t The response content bytes received
+				 */
+				uint64_t body_size_;
+
+				/**
+				 * @var bool Whether the response has ended
+				 */
+				bool complete_;
+		};
+	}
+}
+
+#endif /* HTTP3_CLIENT_H */
+
+#endif /* HTTP3_SUPPORT */
@@ -0,0 +1,270 @@
+/*
+ * header_names.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the perfect hash identifying well-known header field names.
+ */
+
+#include <string.h>
+#include <cstdint>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+#include "header_names.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @var size_t The longest known name, zero-padded so it compares as two 16-byte blocks
+	 */
+	static const size_t NAME_SIZE = 32;
+
+	/**
+	 * @var char[][] The known names in lowercase, in HeaderId order
+	 */
+	alignas(16) static constexpr char NAMES[HEADER_COUNT][NAME_SIZE] = {
+		"",
+		"accept",
+		"accept-encoding",
+		"age",
+		"authorization",
+		"cache-control",
+		"connection",
+		"content-encoding",
+		"content-length",
+		"content-type",
+		"cookie",
+		"date",
+		"etag",
+		"expect",
+		"expires",
+		"host",
+		"if-modified-since",
+		"if-none-match",
+		"keep-alive",
+		"last-modified",
+		"location",
+		"pragma",
+		"proxy-authorization",
+		"proxy-connection",
+		"range",
+		"set-cookie",
+		"te",
+		"trailer",
+		"transfer-encoding",
+		"upgrade",
+		"user-agent",
+		"vary"
+	};
+
+	/**
+	 * @var size_t The number of hash slots, a power of two comfortably above HEADER_COUNT
+	 */
+	static const size_t SLOTS = 128;
+
+	/*
+	 * The hash and the search for a multiplier that makes it perfect are constexpr,
+	 * written as single-return recursive functions so they build as C++11 too.
+	 */
+
+	/**
+	 * Returns the length of a known name
+	 *
+	 * @param const char* name The name
+	 *
+	 * @return size_t Its length
+	 */
+	static constexpr size_t name_size(const char* name)
+	{
+		return *name == '\0' ? 0 : 1 + name_size(name + 1);
+	}
+
+	/**
+	 * Hashes a name from its length, first and last characters, ignoring ASCII case
+	 *
+	 * Folding with 0x20 lowercases letters and may confuse other bytes, which the
+	 * final compare rules out.
+	 *
+	 * @param unsigned multiplier The multiplier the perfect hash was built with
+	 * @param unsigned first The first character
+	 * @param unsigned last The last character
+	 * @param size_t size The length of the name
+	 *
+	 * @return size_t The slot
+	 */
+	static constexpr size_t slot(unsigned multiplier, unsigned first, unsigned last, size_t size)
+	{
+		return ((first | 0x20) * multiplier + (last | 0x20) * 31 + size) & (SLOTS - 1);
+	}
+
+	/**
+	 * Returns the slot of a known name
+	 *
+	 * @param unsigned multiplier The multiplier to try
+	 * @param size_t id The HeaderId of the name
+	 *
+	 * @return size_t The slot
+	 */
+	static constexpr size_t known_slot(unsigned multiplier, size_t id)
+	{
+		return slot(multiplier, static_cast<unsigned char>(NAMES[id][0]), static_cast<unsigned char>(NAMES[id][name_size(NAMES[id]) - 1]), name_size(NAMES[id]));
+	}
+
+	/**
+	 * Checks that no name from other onwards shares a slot with name id
+	 *
+	 * @param unsigned multiplier The multiplier to try
+	 * @param size_t id The HeaderId of the name
+	 * @param size_t other The first HeaderId to compare with
+	 *
+	 * @return bool Whether the slot is unique
+	 */
+	static constexpr bool unique_slot(unsigned multiplier, size_t id, size_t other)
+	{
+		return other >= HEADER_COUNT || (known_slot(multiplier, id) != known_slot(multiplier, other) && unique_slot(multiplier, id, other + 1));
+	}
+
+	/**
+	 * Checks that every name from id onwards has a slot of its own
+	 *
+	 * @param unsigned multiplier The multiplier to try
+	 * @param size_t id The first HeaderId to check
+	 *
+	 * @return bool Whether the hash is perfect for those names
+	 */
+	static constexpr bool perfect(unsigned multiplier, size_t id)
+	{
+		return id >= HEADER_COUNT || (unique_slot(multiplier, id, id + 1) && perfect(multiplier, id + 1));
+	}
+
+	/**
+	 * Finds the smallest multiplier from the given one that makes the hash perfect
+	 *
+	 * @param unsigned multiplier The first multiplier to try
+	 *
+	 * @return unsigned The multiplier
+	 */
+	static constexpr unsigned find_multiplier(unsigned multiplier)
+	{
+		return perfect(multiplier, HEADER_OTHER + 1) ? multiplier : find_multiplier(multiplier + 1);
+	}
+
+	/**
+	 * @var unsigned The multiplier making the hash perfect for the known names
+	 */
+	static constexpr unsigned MULTIPLIER = find_multiplier(1);
+
+	/**
+	 * Returns the known name hashing to a slot
+	 *
+	 * @param size_t index The slot
+	 * @param size_t id The first HeaderId to look at
+	 *
+	 * @return unsigned char The HeaderId, or HEADER_OTHER (0) if no name hashes there
+	 */
+	static constexpr unsigned char slot_id(size_t index, size_t id)
+	{
+		return id >= HEADER_COUNT ? 0 : (known_slot(MULTIPLIER, id) == index ? id : slot_id(index, id + 1));
+	}
+
+	#define SLOT_ROW(row) \
+		slot_id(row + 0, 1), slot_id(row + 1, 1), slot_id(row + 2, 1), slot_id(row + 3, 1), \
+		slot_id(row + 4, 1), slot_id(row + 5, 1), slot_id(row + 6, 1), slot_id(row + 7, 1)
+
+	/**
+	 * @var unsigned char[] The HeaderId in each slot
+	 */
+	static constexpr unsigned char SLOT_IDS[SLOTS] = {
+		SLOT_ROW(0), SLOT_ROW(8), SLOT_ROW(16), SLOT_ROW(24), SLOT_ROW(32), SLOT_ROW(40), SLOT_ROW(48), SLOT_ROW(56),
+		SLOT_ROW(64), SLOT_ROW(72), SLOT_ROW(80), SLOT_ROW(88), SLOT_ROW(96), SLOT_ROW(104), SLOT_ROW(112), SLOT_ROW(120)
+	};
+
+	#undef SLOT_ROW
+
+	static_assert(SLOTS == 128, "SLOT_IDS lists 128 slots");
+
+	/**
+	 * Identifies a header field name
+	 *
+	 * @param const char* name The field name, in any case
+	 * @param size_t size The length of the name
+	 *
+	 * @return HeaderId The field, or HEADER_OTHER if it is not a known one
+	 */
+	HeaderId header_id(const char* name, size_t size)
+	{
+		if (size == 0 || size >= NAME_SIZE)
+		{
+			return HEADER_OTHER;
+		}
+
+		unsigned char id = SLOT_IDS[slot(MULTIPLIER, static_cast<unsigned char>(name[0]), static_cast<unsigned char>(name[size - 1]), size)];
+		if (id == HEADER_OTHER || NAMES[id][size] != '\0' || NAMES[id][size - 1] == '\0')
+		{
+			return HEADER_OTHER;
+		}
+
+		// Zero-padded, so the bytes past the name match the known name's padding
+		alignas(16) char folded[NAME_SIZE] = {0};
+		memcpy(folded, name, size);
+
+		#ifdef __SSE2__
+		// Lowercase A-Z only, then compare both blocks at once
+		const __m128i before_a = _mm_set1_epi8('A' - 1);
+		const __m128i after_z = _mm_set1_epi8('Z' + 1);
+		const __m128i case_bit = _mm_set1_epi8(0x20);
+		int equal = 0xFFFF;
+		for (size_t i = 0; i < NAME_SIZE; i += 16)
+		{
+			__m128i block = _mm_load_si128(reinterpret_cast<const __m128i*>(folded + i));
+			__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(block, before_a), _mm_cmplt_epi8(block, after_z));
+			block = _mm_or_si128(block, _mm_and_si128(upper, case_bit));
+			equal &= _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_load_si128(reinterpret_cast<const __m128i*>(NAMES[id] + i))));
+		}
+
+		return equal == 0xFFFF ? static_cast<HeaderId>(id) : HEADER_OTHER;
+		#else
+		for (size_t i = 0; i < size; ++i)
+		{
+			char c = folded[i] >= 'A' && folded[i] <= 'Z' ? folded[i] + 0x20 : folded[i];
+			if (c != NAMES[id][i])
+			{
+				return HEADER_OTHER;
+			}
+		}
+
+		return static_cast<HeaderId>(id);
+		#endif /* __SSE2__ */
+	}
+
+	/**
+	 * Returns the lowercase name of a known header field
+	 *
+	 * @param HeaderId id The field
+	 *
+	 * @return const char* The name, or "" for HEADER_OTHER
+	 */
+	const char* header_name(HeaderId id)
+	{
+		return id > HEADER_OTHER && id < HEADER_COUNT ? NAMES[id] : "";
+	}
+}
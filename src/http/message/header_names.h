@@ -0,0 +1,113 @@
+/*
+ * header_names.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the identifiers of well-known header field names.
+ */
+
+#ifndef HTTP_HEADER_NAMES_H
+#define HTTP_HEADER_NAMES_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @enum HeaderId
+	 *
+	 * The header fields this program acts on, so code can switch on a field rather
+	 * than compare its name. Any other field is HEADER_OTHER.
+	 */
+	enum HeaderId
+	{
+		HEADER_OTHER = 0,
+		HEADER_ACCEPT,
+		HEADER_ACCEPT_ENCODING,
+		HEADER_AGE,
+		HEADER_AUTHORIZATION,
+		HEADER_CACHE_CONTROL,
+		HEADER_CONNECTION,
+		HEADER_CONTENT_ENCODING,
+		HEADER_CONTENT_LENGTH,
+		HEADER_CONTENT_TYPE,
+		HEADER_COOKIE,
+		HEADER_DATE,
+		HEADER_ETAG,
+		HEADER_EXPECT,
+		HEADER_EXPIRES,
+		HEADER_HOST,
+		HEADER_IF_MODIFIED_SINCE,
+		HEADER_IF_NONE_MATCH,
+		HEADER_KEEP_ALIVE,
+		HEADER_LAST_MODIFIED,
+		HEADER_LOCATION,
+		HEADER_PRAGMA,
+		HEADER_PROXY_AUTHORIZATION,
+		HEADER_PROXY_CONNECTION,
+		HEADER_RANGE,
+		HEADER_SET_COOKIE,
+		HEADER_TE,
+		HEADER_TRAILER,
+		HEADER_TRANSFER_ENCODING,
+		HEADER_UPGRADE,
+		HEADER_USER_AGENT,
+		HEADER_VARY,
+		HEADER_COUNT
+	};
+
+	/**
+	 * Identifies a header field name
+	 *
+	 * A perfect hash built at compile time picks the only known name the field can
+	 * be, which one case-insensitive compare then confirms.
+	 *
+	 * @param const char* name The field name, in any case
+	 * @param size_t size The length of the name
+	 *
+	 * @return HeaderId The field, or HEADER_OTHER if it is not a known one
+	 */
+	HeaderId header_id(const char* name, size_t size);
+
+	/**
+	 * Identifies a header field name
+	 *
+	 * @param const std::string& name The field name, in any case
+	 *
+	 * @return HeaderId The field, or HEADER_OTHER if it is not a known one
+	 */
+	inline HeaderId header_id(const std::string& name)
+	{
+		return header_id(name.data(), name.size());
+	}
+
+	/**
+	 * Returns the lowercase name of a known header field, as HTTP/2 and HTTP/3 send it
+	 *
+	 * @param HeaderId id The field
+	 *
+	 * @return const char* The name, or "" for HEADER_OTHER
+	 */
+	const char* header_name(HeaderId id);
+}
+
+#endif /* HTTP_HEADER_NAMES_H */
@@ -0,0 +1,522 @@
+/*
+ * http_message.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HTTP::Message class.
+ */
+
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include "http_message.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * Returns the position just past the blank line ending a message head
+	 *
+	 * @param const std::string& data The bytes received so far
+	 *
+	 * @return size_t The length of the head including the blank line, or std::string::npos if it is incomplete
+	 */
+	size_t Message::find_head_end(const std::string& data)
+	{
+		size_t end = data.find("\r\n\r\n");
+		if (end == std::string::npos)
+		{
+			return std::string::npos;
+		}
+
+		return end + 4;
+	}
+
+	/**
+	 * Compares two strings ignoring ASCII case
+	 *
+	 * @param const std::string& a The first string
+	 * @param const std::string& b The second string
+	 *
+	 * @return bool Whether the strings are equal ignoring case
+	 */
+	bool Message::iequals(const std::string& a, const std::string& b)
+	{
+		if (a.size() != b.size())
+		{
+			return false;
+		}
+
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Returns the value of a header field
+	 *
+	 * @param const std::string& name The field name, matched case-insensitively
+	 *
+	 * @return const std::string* The first matching value, or nullptr if the field is absent
+	 */
+	const std::string* Message::header(const std::string& name) const
+	{
+		HeaderId id = header_id(name);
+		for (size_t i = 0; i < headers.size(); ++i)
+		{
+			if (named(headers[i], id, name))
+			{
+				return &headers[i].second;
+			}
+		}
+
+		return nullptr;
+	}
+
+	/**
+	 * Returns the value of a known header field
+	 *
+	 * @param HeaderId id The field
+	 *
+	 * @return const std::string* The first matching value, or nullptr if the field is absent
+	 */
+	const std::string* Message::header(HeaderId id) const
+	{
+		for (size_t i = 0; i < headers.size(); ++i)
+		{
+			if (headers[i].id == id)
+			{
+				return &headers[i].second;
+			}
+		}
+
+		return nullptr;
+	}
+
+	/**
+	 * Replaces all fields of the given name with a single field
+	 *
+	 * @param const std::string& name The field name
+	 * @param const std::string& value The field value
+	 *
+	 * @return void
+	 */
+	void Message::set_header(const std::string& name, const std::string& value)
+	{
+		remove_header(name);
+		headers.push_back(std::make_pair(name, value));
+	}
+
+	/**
+	 * Removes all fields of the given name
+	 *
+	 * @param const std::string& name The field name, matched case-insensitively
+	 *
+	 * @return void
+	 */
+	void Message::remove_header(const std::string& name)
+	{
+		HeaderId id = header_id(name);
+		for (size_t i = headers.size(); i > 0; --i)
+		{
+			if (named(headers[i - 1], id, name))
+			{
+				headers.erase(headers.begin() + (i - 1));
+			}
+		}
+	}
+
+	/**
+	 * Removes all fields of a known name
+	 *
+	 * @param HeaderId id The field
+	 *
+	 * @return void
+	 */
+	void Message::remove_header(HeaderId id)
+	{
+		for (size_t i = headers.size(); i > 0; --i)
+		{
+			if (headers[i - 1].id == id)
+			{
+				headers.erase(headers.begin() + (i - 1));
+			}
+		}
+	}
+
+	/**
+	 * Checks whether a comma-separated header field contains a token
+	 *
+	 * @param const std::string& name The field name
+	 * @param const std::string& token The token, matched case-insensitively
+	 *
+	 * @return bool Whether any field of that name lists the token
+	 */
+	bool Message::has_token(const std::string& name, const std::string& token) const
+	{
+		HeaderId id = header_id(name);
+		for (size_t i = 0; i < headers.size(); ++i)
+		{
+			if (named(headers[i], id, name) && lists_token(headers[i].second, token))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Checks whether a known comma-separated header field contains a token
+	 *
+	 * @param HeaderId id The field
+	 * @param const std::string& token The token, matched case-insensitively
+	 *
+	 * @return bool Whether any field of that name lists the token
+	 */
+	bool Message::has_token(HeaderId id, const std::string& token) const
+	{
+		for (size_t i = 0; i < headers.size(); ++i)
+		{
+			if (headers[i].id == id && lists_token(headers[i].second, token))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Checks whether a field has a name
+	 *
+	 * Known names compare by identifier; others are still compared as strings.
+	 *
+	 * @param const HeaderField& field The field
+	 * @param HeaderId id The name's identifier, HEADER_OTHER if it is not a known one
+	 * @param const std::string& name The name, compared when it is not a known one
+	 *
+	 * @return bool Whether the field has that name
+	 */
+	bool Message::named(const HeaderField& field, HeaderId id, const std::string& name)
+	{
+		if (id != HEADER_OTHER)
+		{
+			return field.id == id;
+		}
+
+		return field.id == HEADER_OTHER && iequals(field.first, name);
+	}
+
+	/**
+	 * Checks whether a comma-separated field value contains a token
+	 *
+	 * @param const std::string& value The field value
+	 * @param const std::string& token The token, matched case-insensitively
+	 *
+	 * @return bool Whether the value lists the token
+	 */
+	bool Message::lists_token(const std::string& value, const std::string& token)
+	{
+		size_t start = 0;
+		while (start < value.size())
+		{
+			size_t end = value.find(',', start);
+			if (end == std::string::npos)
+			{
+				end = value.size();
+			}
+
+			size_t first = value.find_first_not_of(" \t", start);
+			size_t last = value.find_last_not_of(" \t", end - 1);
+			if (first < end && last >= first && iequals(value.substr(first, last - first + 1), token))
+			{
+				return true;
+			}
+
+			start = end + 1;
+		}
+
+		return false;
+	}
+
+	/**
+	 * Returns the value of the Content-Length field
+	 *
+	 * @return long long The body length, or -1 if the field is absent or invalid
+	 */
+	long long Message::content_length() const
+	{
+		const std::string* value = header(HEADER_CONTENT_LENGTH);
+		if (value == nullptr || value->empty() || value->find_first_not_of("0123456789") != std::string::npos)
+		{
+			return -1;
+		}
+
+		return std::strtoll(value->c_str(), nullptr, 10);
+	}
+
+	/**
+	 * Checks whether the body uses chunked transfer coding
+	 *
+	 * @return bool Whether Transfer-Encoding lists "chunked"
+	 */
+	bool Message::is_chunked() const
+	{
+		return has_token(HEADER_TRANSFER_ENCODING, "chunked");
+	}
+
+	/**
+	 * Parses the header field lines following the start line
+	 *
+	 * @param const std::string& head The message head
+	 * @param size_t position The offset of the first field line
+	 *
+	 * @return bool Whether every field line was well formed
+	 */
+	bool Message::parse_headers(const std::string& head, size_t position)
+	{
+		headers.clear();
+
+		while (position < head.size())
+		{
+			size_t line_end = head.find("\r\n", position);
+			if (line_end == std::string::npos || line_end == position)
+			{
+				break;
+			}
+
+			size_t colon = head.find(':', position);
+			if (colon == std::string::npos || colon > line_end || colon == position)
+			{
+				return false;
+			}
+
+			size_t value_start = head.find_first_not_of(" \t", colon + 1);
+			size_t value_end = head.find_last_not_of(" \t", line_end - 1);
+			std::string value;
+			if (value_start != std::string::npos && value_start < line_end && value_end >= value_start)
+			{
+				value = head.substr(value_start, value_end - value_start + 1);
+			}
+
+			headers.push_back(HeaderField(head.substr(position, colon - position), value));
+			position = line_end + 2;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Appends the header fields and the blank line ending the head
+	 *
+	 * @param[out] out The string to append to
+	 *
+	 * @return void
+	 */
+	void Message::serialize_headers(std::string& out) const
+	{
+		for (size_t i = 0; i < headers.size(); ++i)
+		{
+			out += headers[i].first;
+			out += ": ";
+			out += headers[i].second;
+			out += "\r\n";
+		}
+		out += "\r\n";
+	}
+
+	/**
+	 * BodyFraming constructor
+	 *
+	 * @return void
+	 */
+	BodyFraming::BodyFraming()
+		: state_(DONE),
+		  remaining_(0)
+	{
+	}
+
+	/**
+	 * BodyFraming constructor
+	 *
+	 * Chunked transfer coding takes precedence over Content-Length, as RFC 9112 requires.
+	 *
+	 * @param const Message& message The message whose body follows
+	 * @param bool has_body Whether the message can have a body at all
+	 *
+	 * @return void
+	 */
+	BodyFraming::BodyFraming(const Message& message, bool has_body)
+		: state_(DONE),
+		  remaining_(0)
+	{
+		if (!has_body)
+		{
+			return;
+		}
+
+		if (message.is_chunked())
+		{
+			state_ = CHUNK_SIZE;
+			return;
+		}
+
+		long long length = message.content_length();
+		if (length > 0)
+		{
+			state_ = LENGTH;
+			remaining_ = length;
+		}
+		else if (length < 0)
+		{
+			state_ = CLOSE;
+		}
+	}
+
+	/**
+	 * Consumes bytes following the head, stopping at the end of the body
+	 *
+	 * @param const char* data The bytes received
+	 * @param size_t size The number of bytes received
+	 * @param[out] content If not nullptr, the body content is appended to it with any chunked framing removed
+	 *
+	 * @return size_t The number of leading bytes that belong to the body
+	 */
+	size_t BodyFraming::consume(const char* data, size_t size, std::string* content)
+	{
+		size_t used = 0;
+
+		while (used < size && state_ != DONE)
+		{
+			char c = data[used];
+
+			switch (state_)
+			{
+				case CLOSE:
+					if (content != nullptr)
+					{
+						content->append(data + used, size - used);
+					}
+					return size;
+
+				case LENGTH:
+				case CHUNK_DATA:
+				{
+					size_t take = static_cast<size_t>(std::min<uint64_t>(remaining_, size - used));
+					if (content != nullptr)
+					{
+						content->append(data + used, take);
+					}
+					used += take;
+					remaining_ -= take;
+					if (remaining_ == 0)
+					{
+						state_ = state_ == LENGTH ? DONE : CHUNK_DATA_CR;
+					}
+					continue;
+				}
+
+				case CHUNK_SIZE:
+					if (std::isxdigit(static_cast<unsigned char>(c)))
+					{
+						remaining_ = remaining_ * 16 + (std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : (std::tolower(c) - 'a' + 10));
+					}
+					else if (c == ';' || c == ' ' || c == '\t')
+					{
+						state_ = CHUNK_EXTENSION;
+					}
+					else if (c == '\r')
+					{
+						state_ = CHUNK_SIZE_LF;
+					}
+					break;
+
+				case CHUNK_EXTENSION:
+					if (c == '\r')
+					{
+						state_ = CHUNK_SIZE_LF;
+					}
+					break;
+
+				case CHUNK_SIZE_LF:
+					state_ = remaining_ == 0 ? TRAILER_START : CHUNK_DATA;
+					break;
+
+				case CHUNK_DATA_CR:
+					state_ = CHUNK_DATA_LF;
+					break;
+
+				case CHUNK_DATA_LF:
+					state_ = CHUNK_SIZE;
+					remaining_ = 0;
+					break;
+
+				case TRAILER_START:
+					state_ = c == '\r' ? FINAL_LF : TRAILER_LINE;
+					break;
+
+				case TRAILER_LINE:
+					if (c == '\n')
+					{
+						state_ = TRAILER_START;
+					}
+					break;
+
+				case FINAL_LF:
+					state_ = DONE;
+					break;
+
+				case DONE:
+					break;
+			}
+
+			++used;
+		}
+
+		return used;
+	}
+
+	/**
+	 * Returns whether the whole body has been consumed
+	 *
+	 * @return bool Whether the body is complete
+	 */
+	bool BodyFraming::complete() const
+	{
+		return state_ == DONE;
+	}
+
+	/**
+	 * Returns whether the body only ends when the connection closes
+	 *
+	 * @return bool Whether the body is delimited by the connection closing
+	 */
+	bool BodyFraming::until_close() const
+	{
+		return state_ == CLOSE;
+	}
+}
@@ -0,0 +1,327 @@
+/*
+ * http_message.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the HTTP::Message.
+ */
+
+#ifndef HTTP_MESSAGE_H
+#define HTTP_MESSAGE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include "header_names.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @brief A header field name and value, with the field identified once when it is made
+	 */
+	struct HeaderField : std::pair<std::string, std::string>
+	{
+		/**
+		 * Construct a HeaderField
+		 *
+		 * @param std::string name The field name, kept as sent
+		 * @param std::string value The field value
+		 */
+		HeaderField(std::string name, std::string value)
+			: std::pair<std::string, std::string>(std::move(name), std::move(value)),
+			  id(header_id(first))
+		{
+		}
+
+		/**
+		 * Construct a HeaderField from a name and value pair
+		 *
+		 * @param const std::pair<Name, Value>& field The name and value
+		 */
+		template <typename Name, typename Value>
+		HeaderField(const std::pair<Name, Value>& field)
+			: std::pair<std::string, std::string>(field.first, field.second),
+			  id(header_id(first))
+		{
+		}
+
+		/**
+		 * @var HeaderId The field, or HEADER_OTHER if it is not a known one
+		 */
+		HeaderId id;
+	};
+
+	/**
+	 * @typedef Headers
+	 * Header fields in the order they appeared, names kept as sent
+	 */
+	typedef std::vector<HeaderField> Headers;
+
+	/**
+	 * @brief The parts shared by HTTP requests and responses
+	 *
+	 * Holds the header fields and body, and provides case-insensitive access to the headers.
+	 */
+	class Message
+	{
+		public:
+			/**
+			 * @var size_t The largest message head accepted, in bytes
+			 */
+			static const size_t MAX_HEAD_SIZE = 64 * 1024;
+
+			/**
+			 * Returns the position just past the blank line ending a message head
+			 *
+			 * @param const std::string& data The bytes received so far
+			 *
+			 * @return size_t The length of the head including the blank line, or std::string::npos if it is incomplete
+			 */
+			static size_t find_head_end(const std::string& data);
+
+			/**
+			 * Returns the value of a header field
+			 *
+			 * @param const std::string& name The field name, matched case-insensitively
+			 *
+			 * @return const std::string* The first matching value, or nullptr if the field is absent
+			 */
+			const std::string* header(const std::string& name) const;
+
+			/**
+			 * Returns the value of a known header field
+			 *
+			 * @param HeaderId id The field
+			 *
+			 * @return const std::string* The first matching value, or nullptr if the field is absent
+			 */
+			const std::string* header(HeaderId id) const;
+
+			/**
+			 * Replaces all fields of the given name with a single field
+			 *
+			 * @param const std::string& name The field name
+			 * @param const std::string& value The field value
+			 *
+			 * @return void
+			 */
+			void set_header(const std::string& name, const std::string& value);
+
+			/**
+			 * Removes all fields of the given name
+			 *
+			 * @param const std::string& name The field name, matched case-insensitively
+			 *
+			 * @return void
+			 */
+			void remove_header(const std::string& name);
+
+			/**
+			 * Removes all fields of a known name
+			 *
+			 * @param HeaderId id The field
+			 *
+			 * @return void
+			 */
+			void remove_header(HeaderId id);
+
+			/**
+			 * Checks whether a comma-separated header field contains a token, such as "upgrade" in Connection
+			 *
+			 * @param const std::string& name The field name
+			 * @param const std::string& token The token, matched case-insensitively
+			 *
+			 * @return bool Whether any field of that name lists the token
+			 */
+			bool has_token(const std::string& name, const std::string& token) const;
+
+			/**
+			 * Checks whether a known comma-separated header field contains a token
+			 *
+			 * @param HeaderId id The field
+			 * @param const std::string& token The token, matched case-insensitively
+			 *
+			 * @return bool Whether any field of that name lists the token
+			 */
+			bool has_token(HeaderId id, const std::string& token) const;
+
+			/**
+			 * Returns the value of the Content-Length field
+			 *
+			 * @return long long The body length, or -1 if the field is absent or invalid
+			 */
+			long long content_length() const;
+
+			/**
+			 * Checks whether the body uses chunked transfer coding
+			 *
+			 * @return bool Whether Transfer-Encoding lists "chunked"
+			 */
+			bool is_chunked() const;
+
+			/**
+			 * Compares two strings ignoring ASCII case
+			 *
+			 * @param const std::string& a The first string
+			 * @param const std::string& b The second string
+			 *
+			 * @return bool Whether the strings are equal ignoring case
+			 */
+			static bool iequals(const std::string& a, const std::string& b);
+
+			/**
+			 * @var Headers The header fields
+			 */
+			Headers headers;
+
+			/**
+			 * @var std::string The message body, if it has been read
+			 */
+			std::string body;
+
+		protected:
+
+			/**
+			 * Checks whether a field has a name
+			 *
+			 * @param const HeaderField& field The field
+			 * @param HeaderId id The name's identifier, HEADER_OTHER if it is not a known one
+			 * @param const std::string& name The name, compared when it is not a known one
+			 *
+			 * @return bool Whether the field has that name
+			 */
+			static bool named(const HeaderField& field, HeaderId id, const std::string& name);
+
+			/**
+			 * Checks whether a comma-separated field value contains a token
+			 *
+			 * @param const std::string& value The field value
+			 * @param const std::string& token The token, matched case-insensitively
+			 *
+			 * @return bool Whether the value lists the token
+			 */
+			static bool lists_token(const std::string& value, const std::string& token);
+
+			/**
+			 * Parses the header field lines following the start line
+			 *
+			 * @param const std::string& head The message head
+			 * @param size_t position The offset of the first field line
+			 *
+			 * @return bool Whether every field line was well formed
+			 */
+			bool parse_headers(const std::string& head, size_t position);
+
+			/**
+			 * Appends the header fields and the blank line ending the head
+			 *
+			 * @param[out] out The string to append to
+			 *
+			 * @return void
+			 */
+			void serialize_headers(std::string& out) const;
+	};
+
+	/**
+	 * @brief Finds where a message body ends as its bytes arrive
+	 *
+	 * Bodies are delimited by Content-Length, by chunked transfer coding, or by the
+	 * connection closing. Callers relay or store the bytes as is, and may ask for the
+	 * content with the chunked framing removed.
+	 */
+	class BodyFraming
+	{
+		public:
+			/**
+			 * Construct a BodyFraming for a message without a body
+			 */
+			BodyFraming();
+
+			/**
+			 * Construct a BodyFraming from a message's framing headers
+			 *
+			 * @param const Message& message The message whose body follows
+			 * @param bool has_body Whether the message can have a body at all, e.g. false for responses to HEAD
+			 */
+			BodyFraming(const Message& message, bool has_body);
+
+			/**
+			 * Consume bytes following the head, stopping at the end of the body
+			 *
+			 * @param const char* data The bytes received
+			 * @param size_t size The number of bytes received
+			 * @param[out] content If not nullptr, the body content is appended to it with any chunked framing removed
+			 *
+			 * @return size_t The number of leading bytes that belong to the body
+			 */
+			size_t consume(const char* data, size_t size, std::string* content = nullptr);
+
+			/**
+			 * Returns whether the whole body has been consumed
+			 *
+			 * @return bool Whether the body is complete
+			 */
+			bool complete() const;
+
+			/**
+			 * Returns whether the body only ends when the connection closes
+			 *
+			 * @return bool Whether the body is delimited by the connection closing
+			 */
+			bool until_close() const;
+
+		private:
+
+			/**
+			 * @enum State
+			 *
+			 * Where the parser is within the body
+			 */
+			enum State
+			{
+				LENGTH,
+				CLOSE,
+				CHUNK_SIZE,
+				CHUNK_EXTENSION,
+				CHUNK_SIZE_LF,
+				CHUNK_DATA,
+				CHUNK_DATA_CR,
+				CHUNK_DATA_LF,
+				TRAILER_START,
+				TRAILER_LINE,
+				FINAL_LF,
+				DONE
+			};
+
+			/**
+			 * @var State The current parser state
+			 */
+			State state_;
+
+			/**
+			 * @var uint64_t Bytes left in a Content-Length body or the current chunk
+			 */
+			uint64_t remaining_;
+	};
+}
+
+#endif /* HTTP_MESSAGE_H */
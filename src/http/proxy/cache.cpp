@@ -0,0 +1,561 @@
+/*
+ * cache.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HTTP::Cache class.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include "cache.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * Trims spaces and tabs from both ends of a string
+	 *
+	 * @param const std::string& value The string to trim
+	 *
+	 * @return std::string The trimmed string
+	 */
+	static std::string trim(const std::string& value)
+	{
+		size_t start = value.find_first_not_of(" \t");
+		if (start == std::string::npos)
+		{
+			return "";
+		}
+
+		return value.substr(start, value.find_last_not_of(" \t") - start + 1);
+	}
+
+	/**
+	 * Splits every field of the given name into its comma-separated elements
+	 *
+	 * @param const Message& message The message
+	 * @param HeaderId id The field
+	 *
+	 * @return std::vector<std::string> The trimmed, non-empty elements
+	 */
+	static std::vector<std::string> elements(const Message& message, HeaderId id)
+	{
+		std::vector<std::string> found;
+		for (size_t i = 0; i < message.headers.size(); ++i)
+		{
+			if (message.headers[i].id != id)
+			{
+				continue;
+			}
+
+			const std::string& value = message.headers[i].second;
+			size_t start = 0;
+			while (start <= value.size())
+			{
+				size_t end = value.find(',', start);
+				if (end == std::string::npos)
+				{
+					end = value.size();
+				}
+
+				std::string element = trim(value.substr(start, end - start));
+				if (!element.empty())
+				{
+					found.push_back(element);
+				}
+				start = end + 1;
+			}
+		}
+
+		return found;
+	}
+
+	/**
+	 * Looks up a Cache-Control directive
+	 *
+	 * @param const Message& message The message
+	 * @param const std::string& name The directive name, e.g. "max-age"
+	 * @param[out] value The directive's argument, unquoted, or empty if it has none
+	 *
+	 * @return bool Whether the directive is present
+	 */
+	static bool directive(const Message& message, const std::string& name, std::string& value)
+	{
+		std::vector<std::string> directives = elements(message, HEADER_CACHE_CONTROL);
+		for (size_t i = 0; i < directives.size(); ++i)
+		{
+			size_t equals = directives[i].find('=');
+			if (!Message::iequals(trim(directives[i].substr(0, equals)), name))
+			{
+				continue;
+			}
+
+			value = equals == std::string::npos ? "" : trim(directives[i].substr(equals + 1));
+			if (value.size() >= 2 && value[0] == '"' && value[value.size() - 1] == '"')
+			{
+				value = value.substr(1, value.size() - 2);
+			}
+			return true;
+		}
+
+		return false;
+	}
+
+	/**
+	 * Checks whether a Cache-Control directive is present
+	 *
+	 * @param const Message& message The message
+	 * @param const std::string& name The directive name, e.g. "no-store"
+	 *
+	 * @return bool Whether the directive is present
+	 */
+	static bool directive(const Message& message, const std::string& name)
+	{
+		std::string value;
+		return directive(message, name, value);
+	}
+
+	/**
+	 * Parses an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+	 *
+	 * @param const std::string* value The field value, or nullptr
+	 * @param[out] time The parsed time
+	 *
+	 * @return bool Whether the value was a valid date
+	 */
+	static bool parse_date(const std::string* value, time_t& time)
+	{
+		if (value == nullptr)
+		{
+			return false;
+		}
+
+		struct tm parts = {};
+		const char* end = strptime(value->c_str(), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+		if (end == nullptr)
+		{
+			return false;
+		}
+
+		time = timegm(&parts);
+		return true;
+	}
+
+	/**
+	 * Returns how long a response stays fresh from when it was received
+	 *
+	 * s-maxage wins over max-age, which wins over Expires; "no-cache" means the
+	 * response must be revalidated before every use.
+	 *
+	 * @param const Response& response The response
+	 *
+	 * @return long The freshness lifetime in seconds, less the Age it arrived with, or -1 if the response sets none
+	 */
+	static long freshness_lifetime(const Response& response)
+	{
+		std::string value;
+		long lifetime = -1;
+
+		if (directive(response, "no-cache"))
+		{
+			return 0;
+		}
+		else if (directive(response, "s-maxage", value) || directive(response, "max-age", value))
+		{
+			lifetime = std::atol(value.c_str());
+		}
+		else
+		{
+			time_t expires;
+			time_t date = std::time(nullptr);
+			if (parse_date(response.header(HEADER_EXPIRES), expires))
+			{
+				parse_date(response.header(HEADER_DATE), date);
+				lifetime = expires > date ? static_cast<long>(expires - date) : 0;
+			}
+			else if (response.header(HEADER_EXPIRES) != nullptr)
+			{
+				// An invalid Expires means already expired
+				lifetime = 0;
+			}
+		}
+
+		const std::string* age = response.header(HEADER_AGE);
+		if (lifetime > 0 && age != nullptr)
+		{
+			lifetime = std::max(0L, lifetime - std::atol(age->c_str()));
+		}
+
+		return lifetime;
+	}
+
+	/**
+	 * Cache constructor
+	 *
+	 * @param size_t capacity The most response bytes held at once
+	 *
+	 * @return void
+	 */
+	Cache::Cache(size_t capacity)
+		: capacity_(capacity),
+		  size_(0)
+	{
+	}
+
+	/**
+	 * Checks whether a request may be answered from the cache
+	 *
+	 * Requests asking to bypass caches with "no-cache" or "Pragma: no-cache", as
+	 * browsers do on a forced reload, go upstream.
+	 *
+	 * @param const Request& request The request
+	 *
+	 * @return bool Whether it is a GET without a body, credentials or "no-store"
+	 */
+	bool Cache::cacheable(const Request& request)
+	{
+		return request.method == "GET"
+			&& !request.is_chunked()
+			&& request.content_length() <= 0
+			&& request.header(HEADER_AUTHORIZATION) == nullptr
+			&& !request.is_websocket_upgrade()
+			&& !directive(request, "no-store")
+			&& !directive(request, "no-cache")
+			&& !request.has_token(HEADER_PRAGMA, "no-cache");
+	}
+
+	/**
+	 * Returns the key responses to a request are stored under
+	 *
+	 * @param const Request& request The request
+	 *
+	 * @return std::string The host and target
+	 */
+	std::string Cache::key(const Request& request)
+	{
+		const std::string* host = request.header(HEADER_HOST);
+		return (host != nullptr ? *host : "") + " " + request.target;
+	}
+
+	/**
+	 * Checks whether a request carries the field values an entry was stored for
+	 *
+	 * @param const Entry& entry The entry
+	 * @param const Request& request The request
+	 *
+	 * @return bool Whether every field named by Vary matches
+	 */
+	bool Cache::matches(const Entry& entry, const Request& request)
+	{
+		for (size_t i = 0; i < entry.vary.size(); ++i)
+		{
+			const std::string* value = request.header(entry.vary[i].first);
+			if ((value != nullptr ? *value : "") != entry.vary[i].second)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Looks up a fresh response, or becomes the request that fetches it
+	 *
+	 * @param const Request& request The request
+	 * @param[out] leader Whether the caller now fetches the response for others
+	 *
+	 * @return std::shared_ptr<const Entry> The fresh or stale response, or nullptr
+	 */
+	std::shared_ptr<const Cache::Entry> Cache::acquire(const Request& request, bool& leader)
+	{
+		std::string entry_key = key(request);
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		while (true)
+		{
+			std::shared_ptr<const Entry> entry;
+			std::map<std::string, Slot>::iterator slot = entries_.find(entry_key);
+			if (slot != entries_.end() && matches(*slot->second.entry, request))
+			{
+				entry = slot->second.entry;
+				order_.splice(order_.begin(), order_, slot->second.position);
+
+				if (Clock::now() < entry->expires)
+				{
+					leader = false;
+					return entry;
+				}
+			}
+
+			std::map<std::string, std::shared_ptr<Flight>>::iterator flight = flights_.find(entry_key);
+			if (flight == flights_.end())
+			{
+				flights_[entry_key] = std::make_shared<Flight>();
+				leader = true;
+				return entry;
+			}
+
+			// A leader whose upstream stalls must not hold every identical request with it
+			std::shared_ptr<Flight> awaited = flight->second;
+			bool done = finished_.wait_for(lock, std::chrono::seconds(FETCH_WAIT), [&awaited]() {
+				return awaited->done;
+			});
+
+			if (!done || !awaited->stored)
+			{
+				leader = false;
+				return nullptr;
+			}
+		}
+	}
+
+	/**
+	 * Checks whether a response head already rules out storing it
+	 *
+	 * Responses that set cookies are never shared between clients.
+	 *
+	 * @param const Request& request The request it answers
+	 * @param const Response& response The parsed response head
+	 *
+	 * @return bool Whether the response may be stored once complete
+	 */
+	bool Cache::storable(const Request& request, const Response& response)
+	{
+		static const int STATUSES[] = { 200, 203, 300, 301, 404, 410 };
+
+		bool status = false;
+		for (size_t i = 0; i < sizeof(STATUSES) / sizeof(STATUSES[0]); ++i)
+		{
+			status = status || response.status == STATUSES[i];
+		}
+
+		std::vector<std::string> vary = elements(response, HEADER_VARY);
+		for (size_t i = 0; i < vary.size(); ++i)
+		{
+			if (vary[i] == "*")
+			{
+				return false;
+			}
+		}
+
+		return status
+			&& cacheable(request)
+			&& !directive(response, "no-store")
+			&& !directive(response, "private")
+			&& response.header(HEADER_SET_COOKIE) == nullptr
+			&& response.content_length() <= static_cast<long long>(MAX_ENTRY_SIZE);
+	}
+
+	/**
+	 * Builds an entry from a complete upstream response, if it may be stored
+	 *
+	 * Responses without any freshness information are only stored when they carry
+	 * a validator, as they must be revalidated before every use.
+	 *
+	 * @param const Request& request The request it answers
+	 * @param const Response& response The parsed response head
+	 * @param const std::string& raw The raw response head and body
+	 * @param size_t head_size The length of the head within raw
+	 *
+	 * @return std::shared_ptr<Entry> The entry, or nullptr if the response may not be stored
+	 */
+	std::shared_ptr<Cache::Entry> Cache::make_entry(const Request& request, const Response& response, const std::string& raw, size_t head_size)
+	{
+		if (raw.size() > MAX_ENTRY_SIZE || !storable(request, response))
+		{
+			return nullptr;
+		}
+
+		std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+		entry->response = raw;
+		entry->head_size = head_size;
+
+		const std::string* etag = response.header(HEADER_ETAG);
+		const std::string* last_modified = response.header(HEADER_LAST_MODIFIED);
+		entry->etag = etag != nullptr ? *etag : "";
+		entry->last_modified = last_modified != nullptr ? *last_modified : "";
+
+		long lifetime = std::max(0L, freshness_lifetime(response));
+		if (lifetime == 0 && entry->etag.empty() && entry->last_modified.empty())
+		{
+			return nullptr;
+		}
+
+		entry->stored = Clock::now();
+		entry->expires = entry->stored + std::chrono::seconds(lifetime);
+
+		std::vector<std::string> vary = elements(response, HEADER_VARY);
+		for (size_t i = 0; i < vary.size(); ++i)
+		{
+			const std::string* value = request.header(vary[i]);
+			entry->vary.push_back(std::make_pair(vary[i], value != nullptr ? *value : ""));
+		}
+
+		return entry;
+	}
+
+	/**
+	 * Extends the freshness of a stored response the upstream has confirmed with a 304
+	 *
+	 * @param const Entry& entry The stale entry
+	 * @param const Response& response The 304 response
+	 *
+	 * @return std::shared_ptr<Entry> A copy of the entry with the new freshness
+	 */
+	std::shared_ptr<Cache::Entry> Cache::revalidate(const Entry& entry, const Response& response)
+	{
+		std::shared_ptr<Entry> refreshed = std::make_shared<Entry>(entry);
+
+		long lifetime = freshness_lifetime(response);
+		Clock::duration previous = entry.expires - entry.stored;
+
+		refreshed->stored = Clock::now();
+		refreshed->expires = refreshed->stored + (lifetime >= 0 ? std::chrono::seconds(lifetime) : previous);
+
+		const std::string* etag = response.header(HEADER_ETAG);
+		if (etag != nullptr)
+		{
+			refreshed->etag = *etag;
+		}
+
+		return refreshed;
+	}
+
+	/**
+	 * Checks whether a response forbids a shared cache to keep any response to its request
+	 *
+	 * @param const Response& response The parsed response head
+	 *
+	 * @return bool Whether it is marked "no-store" or "private"
+	 */
+	bool Cache::forbids_storing(const Response& response)
+	{
+		return directive(response, "no-store") || directive(response, "private");
+	}
+
+	/**
+	 * Ends the fetch acquire() started, storing its response and waking the requests waiting on it
+	 *
+	 * A stored response is only dropped when the new one replaces it, or when the
+	 * caller says so, as for a response that forbids storing. Anything else, such
+	 * as a failed fetch or a 304 to the client's own conditional request, leaves
+	 * it to be revalidated later.
+	 *
+	 * @param const Request& request The request
+	 * @param std::shared_ptr<const Entry> entry The response to store, or nullptr if it may not be stored
+	 * @param bool drop_stale Whether to drop the stored response even if nothing replaces it
+	 *
+	 * @return void
+	 */
+	void Cache::finish(const Request& request, std::shared_ptr<const Entry> entry, bool drop_stale)
+	{
+		std::string entry_key = key(request);
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		bool stored = entry && entry->response.size() <= capacity_;
+		std::map<std::string, Slot>::iterator slot = entries_.find(entry_key);
+		if (slot != entries_.end() && (stored || drop_stale))
+		{
+			size_ -= slot->second.entry->response.size();
+			order_.erase(slot->second.position);
+			entries_.erase(slot);
+		}
+
+		if (stored)
+		{
+			order_.push_front(entry_key);
+
+			Slot& added = entries_[entry_key];
+			added.entry = entry;
+			added.position = order_.begin();
+			size_ += entry->response.size();
+
+			evict();
+		}
+
+		std::map<std::string, std::shared_ptr<Flight>>::iterator flight = flights_.find(entry_key);
+		if (flight != flights_.end())
+		{
+			flight->second->done = true;
+			flight->second->stored = stored;
+			flights_.erase(flight);
+		}
+
+		finished_.notify_all();
+	}
+
+	/**
+	 * Removes least recently used entries until size_ fits the capacity
+	 *
+	 * @return void
+	 */
+	void Cache::evict()
+	{
+		while (size_ > capacity_ && !order_.empty())
+		{
+			std::map<std::string, Slot>::iterator slot = entries_.find(order_.back());
+			size_ -= slot->second.entry->response.size();
+			entries_.erase(slot);
+			order_.pop_back();
+		}
+	}
+
+	/**
+	 * Serialises the head of a stored response for a client, with its Age
+	 *
+	 * The body is left in the entry, for the caller to send from there.
+	 *
+	 * @param const Entry& entry The stored response
+	 * @param const Request& request The request it answers
+	 * @param[out] with_body Whether the stored body follows the head
+	 *
+	 * @return std::string The response head, or a 304 if the client's If-None-Match holds the ETag
+	 */
+	std::string Cache::serve(const Entry& entry, const Request& request, bool& with_body)
+	{
+		with_body = false;
+
+		Response response;
+		response.parse_head(entry.response.substr(0, entry.head_size));
+
+		long age = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - entry.stored).count();
+		response.set_header("Age", std::to_string(age));
+		response.set_header("Connection", "close");
+
+		std::vector<std::string> validators = elements(request, HEADER_IF_NONE_MATCH);
+		for (size_t i = 0; i < validators.size() && !entry.etag.empty(); ++i)
+		{
+			if (validators[i] == entry.etag || validators[i] == "*")
+			{
+				response.status = 304;
+				response.reason = "Not Modified";
+				response.remove_header(HEADER_CONTENT_LENGTH);
+				response.remove_header(HEADER_TRANSFER_ENCODING);
+				return response.serialize_head();
+			}
+		}
+
+		with_body = true;
+		return response.serialize_head();
+	}
+}
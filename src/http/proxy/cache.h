@@ -0,0 +1,299 @@
+/*
+ * cache.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the HTTP::Cache class.
+ */
+
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "http_request.h"
+#include "http_response.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @brief A shared in-memory cache of upstream responses
+	 *
+	 * Stores responses to GET requests as the upstream allows with Cache-Control,
+	 * Expires and Vary, up to a total size, evicting the least recently used first.
+	 * Stale responses with an ETag or Last-Modified are revalidated rather than
+	 * fetched again. While one request fetches a response, identical requests wait
+	 * for it instead of going upstream too, so many clients missing together cost
+	 * the origin a single fetch.
+	 */
+	class Cache
+	{
+		public:
+			typedef std::chrono::steady_clock Clock;
+
+			/**
+			 * @struct Entry
+			 *
+			 * A stored response
+			 */
+			struct Entry
+			{
+				/**
+				 * @var std::string The raw response head and body, as received from the upstream
+				 */
+				std::string response;
+
+				/**
+				 * @var size_t The length of the head within response
+				 */
+				size_t head_size = 0;
+
+				/**
+				 * @var std::string The ETag validator, or empty
+				 */
+				std::string etag;
+
+				/**
+				 * @var std::string The Last-Modified validator, or empty
+				 */
+				std::string last_modified;
+
+				/**
+				 * @var Clock::time_point When the response was stored or last revalidated
+				 */
+				Clock::time_point stored;
+
+				/**
+				 * @var Clock::time_point When the response stops being fresh
+				 */
+				Clock::time_point expires;
+
+				/**
+				 * @var std::vector<std::pair<std::string, std::string>> The request fields named by Vary, with the values they were stored for
+				 */
+				std::vector<std::pair<std::string, std::string>> vary;
+			};
+
+			/**
+			 * Construct an empty Cache
+			 *
+			 * @param size_t capacity The most response bytes held at once
+			 */
+			explicit Cache(size_t capacity);
+
+			/**
+			 * Check whether a request may be answered from the cache
+			 *
+			 * @param const Request& request The request
+			 *
+			 * @return bool Whether it is a GET without a body, credentials or "no-store"
+			 */
+			static bool cacheable(const Request& request);
+
+			/**
+			 * Look up a fresh response, or become the request that fetches it
+			 *
+			 * Waits while another request fetches the same response. Afterwards, a fresh
+			 * response is returned with leader set to false. Otherwise, leader is set to
+			 * true and the request must fetch the response and call finish(), with any
+			 * stale response returned for revalidation, unless the request it waited on
+			 * found the response uncacheable or did not finish within FETCH_WAIT; then
+			 * nothing is returned and leader is false, so the request goes upstream on
+			 * its own.
+			 *
+			 * @param const Request& request The request
+			 * @param[out] leader Whether the caller now fetches the response for others
+			 *
+			 * @return std::shared_ptr<const Entry> The fresh or stale response, or nullptr
+			 */
+			std::shared_ptr<const Entry> acquire(const Request& request, bool& leader);
+
+			/**
+			 * Build an entry from a complete upstream response, if it may be stored
+			 *
+			 * @param const Request& request The request it answers
+			 * @param const Response& response The parsed response head
+			 * @param const std::string& raw The raw response head and body
+			 * @param size_t head_size The length of the head within raw
+			 *
+			 * @return std::shared_ptr<Entry> The entry, or nullptr if the response may not be stored
+			 */
+			static std::shared_ptr<Entry> make_entry(const Request& request, const Response& response, const std::string& raw, size_t head_size);
+
+			/**
+			 * Check whether a response head already rules out storing it
+			 *
+			 * @param const Request& request The request it answers
+			 * @param const Response& response The parsed response head
+			 *
+			 * @return bool Whether the response may be stored once complete
+			 */
+			static bool storable(const Request& request, const Response& response);
+
+			/**
+			 * Extend the freshness of a stored response the upstream has confirmed with a 304
+			 *
+			 * @param const Entry& entry The stale entry
+			 * @param const Response& response The 304 response
+			 *
+			 * @return std::shared_ptr<Entry> A copy of the entry with the new freshness
+			 */
+			static std::shared_ptr<Entry> revalidate(const Entry& entry, const Response& response);
+
+			/**
+			 * Check whether a response forbids a shared cache to keep any response to its request
+			 *
+			 * @param const Response& response The parsed response head
+			 *
+			 * @return bool Whether it is marked "no-store" or "private"
+			 */
+			static bool forbids_storing(const Response& response);
+
+			/**
+			 * End the fetch acquire() started, storing its response and waking the requests waiting on it
+			 *
+			 * @param const Request& request The request
+			 * @param std::shared_ptr<const Entry> entry The response to store, or nullptr if it may not be stored
+			 * @param bool drop_stale Whether to drop the stored response even if nothing replaces it
+			 *
+			 * @return void
+			 */
+			void finish(const Request& request, std::shared_ptr<const Entry> entry, bool drop_stale = false);
+
+			/**
+			 * Serialise the head of a stored response for a client, with its Age
+			 *
+			 * @param const Entry& entry The stored response
+			 * @param const Request& request The request it answers
+			 * @param[out] with_body Whether the stored body follows the head
+			 *
+			 * @return std::string The response head, or a 304 if the client's If-None-Match holds the ETag
+			 */
+			static std::string serve(const Entry& entry, const Request& request, bool& with_body);
+
+			/**
+			 * @var size_t The largest response stored
+			 */
+			static const size_t MAX_ENTRY_SIZE = 1024 * 1024;
+
+			/**
+			 * @var int The longest a request waits on another's fetch before going upstream on its own, in seconds
+			 */
+			static const int FETCH_WAIT = 30;
+
+		private:
+			Cache(const Cache&);
+			Cache& operator=(const Cache&);
+
+			/**
+			 * @struct Flight
+			 *
+			 * A fetch in progress that identical requests wait on
+			 */
+			struct Flight
+			{
+				bool done = false;
+				bool stored = false;
+			};
+
+			/**
+			 * @struct Slot
+			 *
+			 * A stored entry and its position in the eviction order
+			 */
+			struct Slot
+			{
+				std::shared_ptr<const Entry> entry;
+				std::list<std::string>::iterator position;
+			};
+
+			/**
+			 * Returns the key responses to a request are stored under
+			 *
+			 * @param const Request& request The request
+			 *
+			 * @return std::string The host and target
+			 */
+			static std::string key(const Request& request);
+
+			/**
+			 * Checks whether a request carries the field values an entry was stored for
+			 *
+			 * @param const Entry& entry The entry
+			 * @param const Request& request The request
+			 *
+			 * @return bool Whether every field named by Vary matches
+			 */
+			static bool matches(const Entry& entry, const Request& request);
+
+			/**
+			 * Removes least recently used entries until size_ fits the capacity
+			 *
+			 * @return void
+			 */
+			void evict();
+
+			/**
+			 * @var size_t The most response bytes held at once
+			 */
+			size_t capacity_;
+
+			/**
+			 * @var size_t The response bytes held
+			 */
+			size_t size_;
+
+			/**
+			 * @var std::map<std::string, Slot> The stored entries, by key
+			 */
+			std::map<std::string, Slot> entries_;
+
+			/**
+			 * @var std::list<std::string> Keys from most to least recently used
+			 */
+			std::list<std::string> order_;
+
+			/**
+			 * @var std::map<std::string, std::shared_ptr<Flight>> Fetches in progress, by key
+			 */
+			std::map<std::string, std::shared_ptr<Flight>> flights_;
+
+			/**
+			 * @var std::mutex Guards the entries and fetches
+			 */
+			std::mutex mutex_;
+
+			/**
+			 * @var std::condition_variable Signalled whenever a fetch ends
+			 */
+			std::condition_variable finished_;
+	};
+}
+
+#endif /* HTTP_CACHE_H */
@@ -0,0 +1,967 @@
+/*
+ * proxy.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HTTP::Proxy class.
+ */
+
+#include <stdexcept>
+#include <map>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "busy_poll.h"
+#include "functions.h"
+#include "settings.h"
+#include "http_response.h"
+#include "http2.h"
+#include "grpc.h"
+#include "websocket.h"
+#include "proxy.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @brief Captures a message whose body is relayed piece by piece
+	 *
+	 * Up to a limit, the message is collected and captured as one record once it
+	 * ends. A larger message is captured as a first record marked continued=1,
+	 * followed by a "chunk" record for each piece relayed after it, so the memory
+	 * held does not depend on the body size. With a limit of 0 the first record is
+	 * written as soon as anything is appended, which keeps the timing of streams.
+	 */
+	class CaptureTee
+	{
+		public:
+			/**
+			 * Construct a CaptureTee
+			 *
+			 * @param const std::shared_ptr<Capture::Writer>& capture Where to record, or nullptr to record nothing
+			 * @param const char* type The type of the first record, e.g. "request"
+			 * @param uint64_t connection The capture connection identifier
+			 * @param char direction The direction of the message
+			 * @param size_t limit The largest message captured as a single record
+			 * @param const Capture::Attributes& attributes Extra details for the first record
+			 */
+			CaptureTee(const std::shared_ptr<Capture::Writer>& capture, const char* type, uint64_t connection, char direction, size_t limit, const Capture::Attributes& attributes = Capture::Attributes())
+				: capture_(capture),
+				  type_(type),
+				  connection_(connection),
+				  direction_(direction),
+				  limit_(limit),
+				  attributes_(attributes),
+				  started_(false),
+				  finished_(false)
+			{
+			}
+
+			/**
+			 * Destruct the CaptureTee, capturing whatever is still collected
+			 */
+			~CaptureTee()
+			{
+				finish();
+			}
+
+			/**
+			 * Capture the next piece of the message
+			 *
+			 * @param const char* data The bytes relayed
+			 * @param size_t size The number of bytes
+			 *
+			 * @return void
+			 */
+			void append(const char* data, size_t size)
+			{
+				if (!capture_ || finished_)
+				{
+					return;
+				}
+
+				if (started_)
+				{
+					if (size > 0)
+					{
+						capture_->write("chunk", connection_, direction_, std::string(data, size));
+					}
+					return;
+				}
+
+				pending_.append(data, size);
+				if (pending_.size() > limit_)
+				{
+					Capture::Attributes attributes = attributes_;
+					if (limit_ > 0)
+					{
+						attributes.push_back(std::make_pair("continued", "1"));
+					}
+
+					capture_->write(type_, connection_, direction_, pending_, attributes);
+					std::string().swap(pending_);
+					started_ = true;
+				}
+			}
+
+			/**
+			 * Capture the message as one record, unless it has already been started
+			 *
+			 * @return void
+			 */
+			void finish()
+			{
+				if (capture_ && !started_ && !finished_)
+				{
+					capture_->write(type_, connection_, direction_, pending_, attributes_);
+				}
+				finished_ = true;
+			}
+
+		private:
+			CaptureTee(const CaptureTee&);
+			CaptureTee& operator=(const CaptureTee&);
+
+			std::shared_ptr<Capture::Writer> capture_;
+			const char* type_;
+			uint64_t connection_;
+			char direction_;
+			size_t limit_;
+			Capture::Attributes attributes_;
+			std::string pending_;
+			bool started_;
+			bool finished_;
+	};
+
+	/**
+	 * @brief Ends a cache fetch exactly once, however the request ends
+	 *
+	 * Requests waiting on the fetch are woken even when the upstream fails, and
+	 * nothing is stored unless finish() is given a response.
+	 */
+	class CacheFetch
+	{
+		public:
+			/**
+			 * Construct a CacheFetch
+			 *
+			 * @param Cache* cache The cache the fetch was acquired from, or nullptr if this request is not fetching
+			 * @param const Request& request The request fetching the response
+			 */
+			CacheFetch(Cache* cache, const Request& request)
+				: cache_(cache),
+				  request_(request)
+			{
+			}
+
+			/**
+			 * Destruct the CacheFetch, ending the fetch without storing anything if it is still open
+			 */
+			~CacheFetch()
+			{
+				finish(nullptr);
+			}
+
+			/**
+			 * End the fetch, storing the response if one is given
+			 *
+			 * @param std::shared_ptr<const Cache::Entry> entry The response to store, or nullptr
+			 * @param bool drop_stale Whether to drop the stored response even if nothing replaces it
+			 *
+			 * @return void
+			 */
+			void finish(std::shared_ptr<const Cache::Entry> entry, bool drop_stale = false)
+			{
+				if (cache_ != nullptr)
+				{
+					cache_->finish(request_, entry, drop_stale);
+					cache_ = nullptr;
+				}
+			}
+
+		private:
+			CacheFetch(const CacheFetch&);
+			CacheFetch& operator=(const CacheFetch&);
+
+			Cache* cache_;
+			const Request& request_;
+	};
+
+	/**
+	 * @var size_t The bytes moved through a pipe at a time, its default capacity
+	 */
+	static const size_t PIPE_CHUNK_SIZE = 64 * 1024;
+
+	/**
+	 * Moves bytes between two plain sockets through kernel pipes until both directions end
+	 *
+	 * splice() hands the pages of one socket's receive queue to a pipe and on to the
+	 * other socket's send queue, so the bytes are never copied to user space. Both
+	 * splices are non-blocking: what a slow receiver cannot take yet stays in its
+	 * direction's pipe until the receiver polls writable, and the sender is not read
+	 * again until that pipe is empty, so each direction is held back by its own
+	 * receiver only and never stalls the other. When one side finishes sending, the
+	 * other side is told so with a shutdown, and the opposite direction keeps
+	 * flowing until it finishes too.
+	 *
+	 * @param int client_fd The client socket
+	 * @param int upstream_fd The upstream socket
+	 * @param[out] bytes The bytes relayed from the client and from the upstream
+	 *
+	 * @return bool Whether the pipes could be created; if not, nothing was relayed
+	 */
+	static bool splice_relay(int client_fd, int upstream_fd, uint64_t bytes[2])
+	{
+		const int sockets[2] = { client_fd, upstream_fd };
+		int pipes[2][2];
+
+		if (pipe2(pipes[0], O_CLOEXEC) == -1)
+		{
+			return false;
+		}
+		if (pipe2(pipes[1], O_CLOEXEC) == -1)
+		{
+			close(pipes[0][0]);
+			close(pipes[0][1]);
+			return false;
+		}
+
+		bool reading[2] = { true, true };
+		size_t queued[2] = { 0, 0 };
+		bool failed = false;
+
+		// Moves what one direction has in its pipe on to its receiver, as much as it takes without blocking
+		auto drain = [&](int side) {
+			while (queued[side] > 0)
+			{
+				ssize_t sent = splice(pipes[side][0], nullptr, sockets[1 - side], nullptr, queued[side], SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if (sent == -1 && errno == EINTR)
+				{
+					continue;
+				}
+				if (sent == -1 && errno == EAGAIN)
+				{
+					return;
+				}
+				if (sent <= 0)
+				{
+					// The receiver is gone, so neither direction can carry on
+					failed = true;
+					return;
+				}
+
+				bytes[side] += sent;
+				queued[side] -= sent;
+			}
+		};
+
+		while (!failed && (reading[0] || reading[1] || queued[0] > 0 || queued[1] > 0))
+		{
+			struct pollfd fds[2];
+			for (int side = 0; side < 2; ++side)
+			{
+				// Read a socket once its pipe is empty, and wait to write to it while the other direction has bytes queued
+				short events = (reading[side] && queued[side] == 0 ? POLLIN : 0) | (queued[1 - side] > 0 ? POLLOUT : 0);
+				fds[side].fd = events != 0 ? sockets[side] : -1;
+				fds[side].events = events;
+				fds[side].revents = 0;
+			}
+
+			if (wait_for_poll(fds, 2, -1) == -1)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				break;
+			}
+
+			for (int side = 0; side < 2 && !failed; ++side)
+			{
+				if (queued[1 - side] > 0 && (fds[side].revents & (POLLOUT | POLLHUP | POLLERR)) != 0)
+				{
+					drain(1 - side);
+				}
+
+				if (!reading[side] || queued[side] > 0 || (fds[side].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+				{
+					continue;
+				}
+
+				ssize_t moved = splice(sockets[side], nullptr, pipes[side][1], nullptr, PIPE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if (moved == -1 && (errno == EAGAIN || errno == EINTR))
+				{
+					continue;
+				}
+				if (moved <= 0)
+				{
+					reading[side] = false;
+					shutdown(sockets[1 - side], SHUT_WR);
+					continue;
+				}
+
+				// Most of the time the receiver takes it all at once, without another poll
+				queued[side] = moved;
+				drain(side);
+			}
+		}
+
+		for (int side = 0; side < 2; ++side)
+		{
+			close(pipes[side][0]);
+			close(pipes[side][1]);
+		}
+
+		return true;
+	}
+
+	/**
+	 * Proxy constructor
+	 *
+	 * @param const std::string& host The upstream host name or IP address
+	 * @param const std::string& port The upstream port
+	 * @param std::shared_ptr<Capture::Writer> capture Where to record traffic, or nullptr to record nothing
+	 *
+	 * @return void
+	 */
+	Proxy::Proxy(const std::string& host, const std::string& port, std::shared_ptr<Capture::Writer> capture)
+		: host_(host),
+		  port_(port),
+		  capture_(capture)
+	{
+	}
+
+	/**
+	 * Sets the cache GET responses are stored in and answered from
+	 *
+	 * @param std::shared_ptr<Cache> cache The cache, or nullptr to forward every request
+	 *
+	 * @return void
+	 */
+	void Proxy::set_cache(std::shared_ptr<Cache> cache)
+	{
+		cache_ = cache;
+	}
+
+	/**
+	 * Forwards a request upstream, streaming its body, and relays the response
+	 *
+	 * Plain requests are sent with "Connection: close", so each recorded connection
+	 * carries exactly one exchange. Both bodies are relayed RELAY_CHUNK_SIZE bytes at a
+	 * time with blocking writes: while the receiving side is slow, nothing more is read
+	 * from the sending side, and TCP flow control throttles it in turn. Messages up to
+	 * MAX_CAPTURED_MESSAGE are captured whole; larger ones piece by piece as relayed.
+	 * Responses without a Content-Length are captured as a head followed by one
+	 * "chunk" record per read, so the timing of streamed events is kept. WebSocket
+	 * upgrades are passed through unchanged and, once the upstream accepts them,
+	 * relayed frame by frame. With a cache set, GET requests are answered from it
+	 * when they can be, and identical misses share a single upstream fetch.
+	 *
+	 * @param Connection& client The client connection
+	 * @param const Request& request The parsed request head
+	 * @param const std::string& head The request head as received, for the capture
+	 * @param const std::string& received Bytes the client sent after the head, the start of the body and possibly more
+	 * @param uint64_t connection The capture connection identifier
+	 *
+	 * @return void
+	 */
+	void Proxy::forward(Connection& client, const Request& request, const std::string& head, const std::string& received, uint64_t connection)
+	{
+		BodyFraming request_framing(request, request.is_chunked() || request.content_length() > 0);
+		size_t body_size = request_framing.consume(received.data(), received.size());
+		std::string leftover = received.substr(body_size);
+
+		CaptureTee request_capture(capture_, "request", connection, Capture::TO_SERVER, MAX_CAPTURED_MESSAGE);
+		request_capture.append(head.data(), head.size());
+		request_capture.append(received.data(), body_size);
+
+		if (request.method == "CONNECT")
+		{
+			request_capture.finish();
+			tunnel(client, request, received, connection);
+			return;
+		}
+
+		// Answer from the cache, possibly after waiting for an identical request to fetch the response
+		std::shared_ptr<const Cache::Entry> cached;
+		bool fetching = false;
+		if (cache_ && Cache::cacheable(request))
+		{
+			cached = cache_->acquire(request, fetching);
+			if (cached && !fetching)
+			{
+				request_capture.finish();
+				send_cached(client, request, *cached, "hit", connection);
+				return;
+			}
+		}
+		CacheFetch fetch(fetching ? cache_.get() : nullptr, request);
+
+		Client upstream;
+		try
+		{
+			upstream.connect(host_, port_);
+		}
+		catch (const std::exception& e)
+		{
+			debug("%s", e.what());
+			request_capture.finish();
+			send_error(client, 502, "Bad Gateway", connection);
+			return;
+		}
+
+		// HTTP/2 with prior knowledge opens with a preface that parses as a "PRI" request
+		if (request.is_http2_preface())
+		{
+			request_capture.finish();
+			relay_http2(client, upstream, head + received, connection);
+			return;
+		}
+
+		bool websocket = request.is_websocket_upgrade();
+
+		Request outgoing = request;
+		if (!websocket)
+		{
+			outgoing.set_header("Connection", "close");
+		}
+
+		// Revalidate a stale response, unless the client is revalidating its own copy
+		bool revalidating = cached && request.header(HEADER_IF_NONE_MATCH) == nullptr && request.header(HEADER_IF_MODIFIED_SINCE) == nullptr;
+		if (revalidating && !cached->etag.empty())
+		{
+			outgoing.set_header("If-None-Match", cached->etag);
+		}
+		if (revalidating && !cached->last_modified.empty())
+		{
+			outgoing.set_header("If-Modified-Since", cached->last_modified);
+		}
+
+		// Answer "Expect: 100-continue" here, so the client starts sending while the upstream is being written to
+		bool expect_continue = !request_framing.complete() && request.has_token(HEADER_EXPECT, "100-continue");
+		if (expect_continue)
+		{
+			outgoing.remove_header(HEADER_EXPECT);
+		}
+
+		std::string outgoing_head = outgoing.serialize_head();
+		bool sending = upstream.write_message(outgoing_head.data(), outgoing_head.size(), received.data(), body_size);
+		if (sending && expect_continue)
+		{
+			client.write_all(std::string("HTTP/1.1 100 Continue\r\n\r\n"));
+		}
+
+		std::vector<char> chunk(RELAY_CHUNK_SIZE);
+		while (sending && !request_framing.complete())
+		{
+			ssize_t received_size = client.read(chunk.data(), chunk.size());
+			if (received_size <= 0)
+			{
+				// The client gave up mid-body, so there is no one to relay a response to
+				return;
+			}
+
+			size_t used = request_framing.consume(chunk.data(), received_size);
+			leftover.append(chunk.data() + used, received_size - used);
+			request_capture.append(chunk.data(), used);
+			sending = upstream.write_all(chunk.data(), used);
+		}
+		request_capture.finish();
+
+		// If the upstream stopped reading the body it may still have answered, e.g. with 413
+		std::string buffer;
+		size_t head_size = upstream.read_head(buffer, Message::MAX_HEAD_SIZE);
+		Response response;
+		if (head_size == 0 || !response.parse_head(buffer.substr(0, head_size)))
+		{
+			send_error(client, 502, "Bad Gateway", connection);
+			return;
+		}
+
+		if (websocket && response.status == 101)
+		{
+			if (capture_)
+			{
+				capture_->write("response", connection, Capture::TO_CLIENT, buffer.substr(0, head_size));
+			}
+
+			if (client.write_all(buffer.data(), head_size))
+			{
+				relay_websocket(client, upstream, leftover, buffer.substr(head_size), connection);
+			}
+			return;
+		}
+
+		if (revalidating && response.status == 304)
+		{
+			std::shared_ptr<const Cache::Entry> refreshed = Cache::revalidate(*cached, response);
+			fetch.finish(refreshed);
+			send_cached(client, request, *refreshed, "revalidated", connection);
+			return;
+		}
+
+		bool has_body = request.method != "HEAD" && response.status >= 200 && response.status != 204 && response.status != 304;
+		BodyFraming framing(response, has_body);
+
+		// Bodies without a length, such as Server-Sent Events, may stream for as long as
+		// the connection lasts, so they are captured piece by piece as they are relayed
+		bool streaming = has_body && (response.is_chunked() || response.content_length() < 0);
+
+		Capture::Attributes attributes;
+		if (streaming)
+		{
+			attributes.push_back(std::make_pair("streaming", "1"));
+		}
+		CaptureTee response_capture(capture_, "response", connection, Capture::TO_CLIENT, streaming ? 0 : MAX_CAPTURED_MESSAGE, attributes);
+
+		// Requests waiting on this one are let go as soon as the response cannot be stored
+		bool storing = fetching && !streaming && Cache::storable(request, response);
+		if (!storing)
+		{
+			fetch.finish(nullptr, Cache::forbids_storing(response));
+		}
+
+		body_size = framing.consume(buffer.data() + head_size, buffer.size() - head_size);
+		bool relaying = client.write_all(buffer.data(), head_size + body_size);
+		response_capture.append(buffer.data(), head_size + body_size);
+
+		std::string stored;
+		if (storing)
+		{
+			stored = buffer.substr(0, head_size + body_size);
+		}
+		std::string().swap(buffer);
+
+		while (relaying && !framing.complete())
+		{
+			ssize_t received_size = upstream.read(chunk.data(), chunk.size());
+			if (received_size <= 0)
+			{
+				break;
+			}
+
+			body_size = framing.consume(chunk.data(), received_size);
+			relaying = client.write_all(chunk.data(), body_size);
+			response_capture.append(chunk.data(), body_size);
+			if (storing)
+			{
+				stored.append(chunk.data(), body_size);
+			}
+		}
+
+		if (storing && framing.complete())
+		{
+			fetch.finish(Cache::make_entry(request, response, stored, head_size));
+		}
+	}
+
+	/**
+	 * Relays bytes in both directions until either side closes
+	 *
+	 * Bytes are passed through untouched as soon as they are read, and handed to the
+	 * observer afterwards, so decoding them for the capture never delays the peer.
+	 *
+	 * @param Connection& client The client connection
+	 * @param Client& upstream The upstream connection
+	 * @param const std::string& client_leftover Bytes the client already sent, to relay first
+	 * @param const std::string& upstream_leftover Bytes the upstream already sent, to relay first
+	 * @param const Observer& observe Called with each side's bytes, or empty to relay only
+	 *
+	 * @return void
+	 */
+	void Proxy::relay(Connection& client, Client& upstream, const std::string& client_leftover, const std::string& upstream_leftover, const Observer& observe)
+	{
+		Connection* sources[2] = { &client, &upstream };
+		Connection* destinations[2] = { &upstream, &client };
+		const std::string* leftovers[2] = { &client_leftover, &upstream_leftover };
+
+		char chunk[RELAY_CHUNK_SIZE];
+		bool open = true;
+
+		for (int side = 0; side < 2 && open; ++side)
+		{
+			if (!leftovers[side]->empty())
+			{
+				open = destinations[side]->write_all(*leftovers[side]);
+				if (observe)
+				{
+					observe(side, leftovers[side]->data(), leftovers[side]->size());
+				}
+			}
+		}
+
+		while (open)
+		{
+			struct pollfd fds[2];
+			fds[0].fd = client.fd();
+			fds[0].events = POLLIN;
+			fds[0].revents = client.pending() > 0 ? POLLIN : 0;
+			fds[1].fd = upstream.fd();
+			fds[1].events = POLLIN;
+			fds[1].revents = 0;
+
+			// TLS may already hold decrypted bytes the socket will never signal again
+			if (fds[0].revents == 0 && wait_for_poll(fds, 2, -1) == -1)
+			{
+				break;
+			}
+
+			for (int side = 0; side < 2 && open; ++side)
+			{
+				if ((fds[side].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+				{
+					continue;
+				}
+
+				ssize_t received = sources[side]->read(chunk, sizeof(chunk));
+				if (received <= 0 || !destinations[side]->write_all(chunk, received))
+				{
+					open = false;
+					break;
+				}
+
+				if (observe)
+				{
+					observe(side, chunk, received);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Relays an upgraded WebSocket connection until either side closes
+	 *
+	 * A frame parser per direction runs alongside the relay to capture each frame
+	 * with its opcode and unmasked payload.
+	 *
+	 * @param Connection& client The client connection
+	 * @param Client& upstream The upstream connection
+	 * @param const std::string& client_leftover Bytes the client sent after the upgrade request
+	 * @param const std::string& upstream_leftover Bytes the upstream sent after its 101 response
+	 * @param uint64_t connection The capture connection identifier
+	 *
+	 * @return void
+	 */
+	void Proxy::relay_websocket(Connection& client, Client& upstream, const std::string& client_leftover, const std::string& upstream_leftover, uint64_t connection)
+	{
+		if (!capture_)
+		{
+			relay(client, upstream, client_leftover, upstream_leftover, Observer());
+			return;
+		}
+
+		WebSocket::FrameParser from_client(MAX_CAPTURED_FRAME);
+		WebSocket::FrameParser from_upstream(MAX_CAPTURED_FRAME);
+		WebSocket::FrameParser* parsers[2] = { &from_client, &from_upstream };
+		const char directions[2] = { Capture::TO_SERVER, Capture::TO_CLIENT };
+
+		relay(client, upstream, client_leftover, upstream_leftover, [&](int side, const char* data, size_t size) {
+			parsers[side]->feed(data, size);
+
+			WebSocket::Frame frame;
+			while (parsers[side]->next(frame))
+			{
+				Capture::Attributes attributes;
+				attributes.push_back(std::make_pair("opcode", std::to_string(frame.opcode)));
+				attributes.push_back(std::make_pair("fin", frame.fin ? "1" : "0"));
+				if (frame.payload.size() != frame.length)
+				{
+					attributes.push_back(std::make_pair("length", std::to_string(frame.length)));
+				}
+
+				capture_->write("ws", connection, directions[side], frame.payload, attributes);
+			}
+		});
+	}
+
+	/**
+	 * Relays an HTTP/2 connection until either side closes
+	 *
+	 * The connection is relayed unchanged, so the client and upstream negotiate
+	 * settings, flow control and streams between themselves. Alongside, each direction
+	 * is decoded to capture, per stream:
+	 *   "h2-headers" records with the decoded header fields (end_stream=1 for trailers),
+	 *   "grpc" records with each length-prefixed message of gRPC streams,
+	 *   "h2-data" records with the DATA of other streams,
+	 *   "h2-end" and "h2-reset" records when a side ends or resets the stream.
+	 *
+	 * @param Connection& client The client connection
+	 * @param Client& upstream The upstream connection
+	 * @param const std::string& client_bytes Everything the client sent, starting with the connection preface
+	 * @param uint64_t connection The capture connection identifier
+	 *
+	 * @return void
+	 */
+	void Proxy::relay_http2(Connection& client, Client& upstream, const std::string& client_bytes, uint64_t connection)
+	{
+		if (!capture_)
+		{
+			relay(client, upstream, client_bytes, "", Observer());
+			return;
+		}
+
+		HTTP2::FrameReader from_client(true);
+		HTTP2::FrameReader from_upstream(false);
+		HTTP2::FrameReader* readers[2] = { &from_client, &from_upstream };
+		const char directions[2] = { Capture::TO_SERVER, Capture::TO_CLIENT };
+
+		std::map<uint32_t, bool> grpc_streams;
+		std::map<uint32_t, GRPC::MessageParser> messages[2];
+
+		relay(client, upstream, client_bytes, "", [&](int side, const char* data, size_t size) {
+			readers[side]->feed(data, size);
+
+			HTTP2::Frame frame;
+			while (readers[side]->next(frame))
+			{
+				Capture::Attributes attributes;
+				attributes.push_back(std::make_pair("stream", std::to_string(frame.stream)));
+				bool end_stream = (frame.flags & HTTP2::END_STREAM) != 0;
+
+				if (frame.type == HTTP2::HEADERS)
+				{
+					// The request's content-type decides how both directions of the stream are captured
+					if (side == 0 && grpc_streams.find(frame.stream) == grpc_streams.end())
+					{
+						grpc_streams[frame.stream] = GRPC::is_grpc(frame.headers);
+					}
+
+					attributes.push_back(std::make_pair("end_stream", end_stream ? "1" : "0"));
+					capture_->write("h2-headers", connection, directions[side], HTTP2::format_headers(frame.headers), attributes);
+				}
+				else if (frame.type == HTTP2::DATA && grpc_streams[frame.stream])
+				{
+					std::map<uint32_t, GRPC::MessageParser>::iterator parser = messages[side].find(frame.stream);
+					if (parser == messages[side].end())
+					{
+						parser = messages[side].insert(std::make_pair(frame.stream, GRPC::MessageParser(MAX_CAPTURED_FRAME))).first;
+					}
+					parser->second.feed(frame.payload);
+
+					GRPC::Message message;
+					while (parser->second.next(message))
+					{
+						Capture::Attributes message_attributes = attributes;
+						message_attributes.push_back(std::make_pair("compressed", message.compressed ? "1" : "0"));
+						if (message.payload.size() != message.length)
+						{
+							message_attributes.push_back(std::make_pair("length", std::to_string(message.length)));
+						}
+
+						capture_->write("grpc", connection, directions[side], message.payload, message_attributes);
+					}
+				}
+				else if (frame.type == HTTP2::DATA && !frame.payload.empty())
+				{
+					capture_->write("h2-data", connection, directions[side], frame.payload, attributes);
+				}
+				else if (frame.type == HTTP2::RST_STREAM)
+				{
+					capture_->write("h2-reset", connection, directions[side], "", attributes);
+					end_stream = true;
+				}
+
+				if (frame.type == HTTP2::DATA && end_stream)
+				{
+					capture_->write("h2-end", connection, directions[side], "", attributes);
+				}
+
+				if (end_stream && (frame.type == HTTP2::DATA || frame.type == HTTP2::HEADERS || frame.type == HTTP2::RST_STREAM))
+				{
+					messages[side].erase(frame.stream);
+				}
+			}
+		});
+	}
+
+	/**
+	 * Opens a CONNECT tunnel to the requested host and relays it until both sides close
+	 *
+	 * The tunnel usually carries TLS, which is relayed as it is rather than decrypted,
+	 * so the capture holds the CONNECT request, the response to it and, once the
+	 * tunnel closes, a "tunnel" record with the bytes sent each way. Over a plain
+	 * client socket the bytes are spliced between the sockets inside the kernel;
+	 * a client on the TLS listener is relayed through user space instead.
+	 *
+	 * @param Connection& client The client connection
+	 * @param const Request& request The CONNECT request
+	 * @param const std::string& received Bytes the client sent after the request head
+	 * @param uint64_t connection The capture connection identifier
+	 *
+	 * @return void
+	 */
+	void Proxy::tunnel(Connection& client, const Request& request, const std::string& received, uint64_t connection)
+	{
+		std::string host;
+		std::string port;
+		if (!split_host_port(request.target, host, port))
+		{
+			send_error(client, 400, "Bad Request", connection);
+			return;
+		}
+
+		if (!tunnel_allowed(host, port))
+		{
+			debug("Refused a tunnel to %s", request.target.c_str());
+			send_error(client, 403, "Forbidden", connection);
+			return;
+		}
+
+		Client upstream;
+		try
+		{
+			upstream.connect(host, port);
+		}
+		catch (const std::exception& e)
+		{
+			debug("%s", e.what());
+			send_error(client, 502, "Bad Gateway", connection);
+			return;
+		}
+
+		std::string established = "HTTP/1.1 200 Connection Established\r\n\r\n";
+		if (!client.write_all(established))
+		{
+			return;
+		}
+		if (capture_)
+		{
+			capture_->write("response", connection, Capture::TO_CLIENT, established);
+		}
+
+		uint64_t bytes[2] = { 0, 0 };
+		if (received.empty() || upstream.write_all(received))
+		{
+			bytes[0] += received.size();
+
+			// Only a plain socket with nothing buffered above it can be spliced
+			bool spliced = dynamic_cast<SocketConnection*>(&client) != nullptr && client.pending() == 0 && splice_relay(client.fd(), upstream.fd(), bytes);
+			if (!spliced)
+			{
+				relay(client, upstream, "", "", [&](int side, const char*, size_t size) {
+					bytes[side] += size;
+				});
+			}
+		}
+
+		if (capture_)
+		{
+			Capture::Attributes attributes;
+			attributes.push_back(std::make_pair("target", request.target));
+			attributes.push_back(std::make_pair("sent", std::to_string(bytes[0])));
+			attributes.push_back(std::make_pair("received", std::to_string(bytes[1])));
+			capture_->write("tunnel", connection, Capture::NO_DIRECTION, "", attributes);
+		}
+	}
+
+	/**
+	 * Checks whether CONNECT tunnels may be opened to a host
+	 *
+	 * @param const std::string& host The requested host
+	 * @param const std::string& port The requested port
+	 *
+	 * @return bool Whether the host, or the host and port, is in the tunnel_hosts setting, or it holds "*"
+	 */
+	bool Proxy::tunnel_allowed(const std::string& host, const std::string& port)
+	{
+		const std::vector<std::string>& allowed = settings().tunnel_hosts;
+		for (size_t i = 0; i < allowed.size(); ++i)
+		{
+			std::string allowed_host;
+			std::string allowed_port;
+			if (allowed[i] == "*")
+			{
+				return true;
+			}
+			else if (split_host_port(allowed[i], allowed_host, allowed_port))
+			{
+				if (Message::iequals(allowed_host, host) && allowed_port == port)
+				{
+					return true;
+				}
+			}
+			else if (Message::iequals(allowed[i], host))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Sends a stored response to the client and captures it
+	 *
+	 * The captured response is marked with how the cache answered, e.g. cache=hit.
+	 *
+	 * @param Connection& client The client connection
+	 * @param const Request& request The request it answers
+	 * @param const Cache::Entry& entry The stored response
+	 * @param const char* outcome How the cache answered: "hit" or "revalidated"
+	 * @param uint64_t connection The capture connection identifier
+	 *
+	 * @return void
+	 */
+	void Proxy::send_cached(Connection& client, const Request& request, const Cache::Entry& entry, const char* outcome, uint64_t connection)
+	{
+		bool with_body;
+		std::string head = Cache::serve(entry, request, with_body);
+		const char* body = entry.response.data() + entry.head_size;
+		size_t body_size = with_body ? entry.response.size() - entry.head_size : 0;
+		client.write_message(head.data(), head.size(), body, body_size);
+
+		if (capture_)
+		{
+			Capture::Attributes attributes;
+			attributes.push_back(std::make_pair("cache", outcome));
+			capture_->write("response", connection, Capture::TO_CLIENT, head + std::string(body, body_size), attributes);
+		}
+	}
+
+	/**
+	 * Sends a short error response to the client and captures it
+	 *
+	 * @param Connection& client The client connection
+	 * @param int status The status code
+	 * @param const std::string& reason The reason phrase
+	 * @param uint64_t connection The capture connection identifier
+	 *
+	 * @return void
+	 */
+	void Proxy::send_error(Connection& client, int status, const std::string& reason, uint64_t connection)
+	{
+		Response response;
+		response.status = status;
+		response.reason = reason;
+		response.set_header("Content-Length", "0");
+		response.set_header("Connection", "close");
+
+		std::string raw = response.serialize_head();
+		client.write_all(raw);
+
+		if (capture_)
+		{
+			capture_->write("response", connection, Capture::TO_CLIENT, raw);
+		}
+	}
+}
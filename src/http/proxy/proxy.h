@@ -0,0 +1,219 @@
+/*
+ * proxy.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the HTTP::Proxy.
+ */
+
+#ifndef HTTP_PROXY_H
+#define HTTP_PROXY_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include "connection.h"
+#include "http_client.h"
+#include "http_request.h"
+#include "cache.h"
+#include "capture.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @brief Forwards recorded requests to an upstream server
+	 *
+	 * Relays each request to the upstream and its response back to the client,
+	 * capturing both. Bodies are streamed through a bounded buffer in both
+	 * directions, so memory per connection does not grow with their size.
+	 * Connections upgraded to WebSocket, and HTTP/2 connections
+	 * (with prior knowledge, as gRPC uses), are relayed in both directions until
+	 * either side closes, with every frame, stream or gRPC message captured.
+	 * CONNECT tunnels to allowed hosts are relayed without being decrypted, and
+	 * only their byte counts and timing are captured. With a cache set, GET
+	 * responses are served from it where Cache-Control allows.
+	 */
+	class Proxy
+	{
+		public:
+			/**
+			 * Construct a Proxy forwarding to the specified upstream
+			 *
+			 * @param const std::string& host The upstream host name or IP address
+			 * @param const std::string& port The upstream port
+			 * @param std::shared_ptr<Capture::Writer> capture Where to record traffic, or nullptr to record nothing
+			 */
+			Proxy(const std::string& host, const std::string& port, std::shared_ptr<Capture::Writer> capture);
+
+			/**
+			 * Set the cache GET responses are stored in and answered from
+			 *
+			 * @param std::shared_ptr<Cache> cache The cache, or nullptr to forward every request
+			 *
+			 * @return void
+			 */
+			void set_cache(std::shared_ptr<Cache> cache);
+
+			/**
+			 * Forward a request upstream, streaming its body, and relay the response
+			 *
+			 * @param Connection& client The client connection
+			 * @param const Request& request The parsed request head
+			 * @param const std::string& head The request head as received, for the capture
+			 * @param const std::string& received Bytes the client sent after the head, the start of the body and possibly more
+			 * @param uint64_t connection The capture connection identifier
+			 *
+			 * @return void
+			 */
+			void forward(Connection& client, const Request& request, const std::string& head, const std::string& received, uint64_t connection);
+
+			/**
+			 * @var size_t The largest WebSocket payload stored in a capture; larger frames are recorded without it
+			 */
+			static const size_t MAX_CAPTURED_FRAME = 16 * 1024 * 1024;
+
+			/**
+			 * @var size_t The largest message captured as a single record; larger ones are captured piece by piece
+			 */
+			static const size_t MAX_CAPTURED_MESSAGE = 64 * 1024;
+
+			/**
+			 * @var size_t The bytes relayed at a time, which bounds what is held per direction
+			 */
+			static const size_t RELAY_CHUNK_SIZE = 16 * 1024;
+
+		protected:
+
+			/**
+			 * @typedef Observer
+			 * Called with the bytes relayed from one side: 0 for the client, 1 for the upstream
+			 */
+			typedef std::function<void(int side, const char* data, size_t size)> Observer;
+
+			/**
+			 * Relay bytes in both directions until either side closes
+			 *
+			 * @param Connection& client The client connection
+			 * @param Client& upstream The upstream connection
+			 * @param const std::string& client_leftover Bytes the client already sent, to relay first
+			 * @param const std::string& upstream_leftover Bytes the upstream already sent, to relay first
+			 * @param const Observer& observe Called with each side's bytes, or empty to relay only
+			 *
+			 * @return void
+			 */
+			void relay(Connection& client, Client& upstream, const std::string& client_leftover, const std::string& upstream_leftover, const Observer& observe);
+
+			/**
+			 * Relay an upgraded WebSocket connection until either side closes
+			 *
+			 * @param Connection& client The client connection
+			 * @param Client& upstream The upstream connection
+			 * @param const std::string& client_leftover Bytes the client sent after the upgrade request
+			 * @param const std::string& upstream_leftover Bytes the upstream sent after its 101 response
+			 * @param uint64_t connection The capture connection identifier
+			 *
+			 * @return void
+			 */
+			void relay_websocket(Connection& client, Client& upstream, const std::string& client_leftover, const std::string& upstream_leftover, uint64_t connection);
+
+			/**
+			 * Relay an HTTP/2 connection until either side closes, capturing its streams and gRPC messages
+			 *
+			 * @param Connection& client The client connection
+			 * @param Client& upstream The upstream connection
+			 * @param const std::string& client_bytes Everything the client sent, starting with the connection preface
+			 * @param uint64_t connection The capture connection identifier
+			 *
+			 * @return void
+			 */
+			void relay_http2(Connection& client, Client& upstream, const std::string& client_bytes, uint64_t connection);
+
+			/**
+			 * Open a CONNECT tunnel to the requested host and relay it until both sides close
+			 *
+			 * @param Connection& client The client connection
+			 * @param const Request& request The CONNECT request
+			 * @param const std::string& received Bytes the client sent after the request head
+			 * @param uint64_t connection The capture connection identifier
+			 *
+			 * @return void
+			 */
+			void tunnel(Connection& client, const Request& request, const std::string& received, uint64_t connection);
+
+			/**
+			 * Check whether CONNECT tunnels may be opened to a host
+			 *
+			 * @param const std::string& host The requested host
+			 * @param const std::string& port The requested port
+			 *
+			 * @return bool Whether the host, or the host and port, is in the tunnel_hosts setting, or it holds "*"
+			 */
+			static bool tunnel_allowed(const std::string& host, const std::string& port);
+
+			/**
+			 * Send a stored response to the client and capture it
+			 *
+			 * @param Connection& client The client connection
+			 * @param const Request& request The request it answers
+			 * @param const Cache::Entry& entry The stored response
+			 * @param const char* outcome How the cache answered: "hit" or "revalidated"
+			 * @param uint64_t connection The capture connection identifier
+			 *
+			 * @return void
+			 */
+			void send_cached(Connection& client, const Request& request, const Cache::Entry& entry, const char* outcome, uint64_t connection);
+
+			/**
+			 * Send a short error response to the client and capture it
+			 *
+			 * @param Connection& client The client connection
+			 * @param int status The status code
+			 * @param const std::string& reason The reason phrase
+			 * @param uint64_t connection The capture connection identifier
+			 *
+			 * @return void
+			 */
+			void send_error(Connection& client, int status, const std::string& reason, uint64_t connection);
+
+			/**
+			 * @var std::string The upstream host
+			 */
+			std::string host_;
+
+			/**
+			 * @var std::string The upstream port
+			 */
+			std::string port_;
+
+			/**
+			 * @var std::shared_ptr<Capture::Writer> Where to record traffic, or nullptr
+			 */
+			std::shared_ptr<Capture::Writer> capture_;
+
+			/**
+			 * @var std::shared_ptr<Cache> Where GET responses are stored, or nullptr
+			 */
+			std::shared_ptr<Cache> cache_;
+	};
+}
+
+#endif /* HTTP_PROXY_H */
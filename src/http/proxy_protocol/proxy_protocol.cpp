@@ -0,0 +1,398 @@
+/*
+ * proxy_protocol.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the PROXY protocol (versions 1 and 2) header parser.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "proxy_protocol.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace ProxyProtocol
+	 * The header a load balancer sends ahead of a connection to pass on the client's address
+	 */
+	namespace ProxyProtocol
+	{
+
+		/**
+		 * @var unsigned char[] The first 12 bytes of every version 2 header
+		 */
+		static const unsigned char V2_SIGNATURE[12] = { 0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D, 0x0A, 0x51, 0x55, 0x49, 0x54, 0x0A };
+
+		/**
+		 * @var size_t The fixed part of a version 2 header, before its addresses
+		 */
+		static const size_t V2_HEAD_SIZE = 16;
+
+		/**
+		 * Limits the next receive on a socket to the time left before a deadline
+		 *
+		 * Each receive would otherwise get the whole SO_RCVTIMEO again, so a client
+		 * sending a byte at a time could take as long as it liked over the header.
+		 *
+		 * @param int socket_fd The socket
+		 * @param std::chrono::steady_clock::time_point deadline When the header must have arrived, or max() for no limit
+		 *
+		 * @return bool Whether there is time left
+		 */
+		static bool bound_receive(int socket_fd, std::chrono::steady_clock::time_point deadline)
+		{
+			if (deadline == std::chrono::steady_clock::time_point::max())
+			{
+				return true;
+			}
+
+			long long left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (left <= 0)
+			{
+				errno = ETIMEDOUT;
+				return false;
+			}
+
+			struct timeval timeout;
+			timeout.tv_sec = left / 1000000;
+			timeout.tv_usec = left % 1000000;
+			return setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+		}
+
+		/**
+		 * Receives exactly size bytes, retrying when interrupted
+		 *
+		 * @param int socket_fd The socket
+		 * @param void* buffer Where to store the bytes
+		 * @param size_t size The number of bytes
+		 * @param int flags Extra recv() flags, e.g. MSG_PEEK
+		 * @param std::chrono::steady_clock::time_point deadline When to give up, or max() to wait as long as SO_RCVTIMEO allows
+		 *
+		 * @return ssize_t The number of bytes received, less than size if the stream ended or failed
+		 */
+		static ssize_t receive(int socket_fd, void* buffer, size_t size, int flags, std::chrono::steady_clock::time_point deadline)
+		{
+			ssize_t received;
+			do
+			{
+				if (!bound_receive(socket_fd, deadline))
+				{
+					return -1;
+				}
+				received = recv(socket_fd, buffer, size, flags | MSG_WAITALL);
+			}
+			while (received == -1 && errno == EINTR);
+
+			return received;
+		}
+
+		/**
+		 * Formats an address the way capture records show clients
+		 *
+		 * @param int family AF_INET or AF_INET6
+		 * @param const void* address The address in network byte order
+		 * @param uint16_t port The port in host byte order
+		 *
+		 * @return std::string The address as "ip:port", or "[ip]:port" for IPv6
+		 */
+		static std::string format_address(int family, const void* address, uint16_t port)
+		{
+			char host[INET6_ADDRSTRLEN] = {0};
+			inet_ntop(family, address, host, sizeof(host));
+
+			if (family == AF_INET6)
+			{
+				return std::string("[") + host + "]:" + std::to_string(port);
+			}
+
+			return std::string(host) + ":" + std::to_string(port);
+		}
+
+		/**
+		 * Parses a version 2 header's command and addresses
+		 *
+		 * @param const unsigned char* head The fixed 16 bytes of the header
+		 * @param const unsigned char* addresses The address block following them
+		 * @param size_t length The length of the address block
+		 * @param[out] source The client address, or empty if the header carries none
+		 *
+		 * @return bool Whether the header was valid
+		 */
+		static bool parse_v2(const unsigned char* head, const unsigned char* addresses, size_t length, std::string& source)
+		{
+			if ((head[12] & 0xF0) != 0x20)
+			{
+				return false;
+			}
+
+			source.clear();
+			int command = head[12] & 0x0F;
+			if (command == 0x0)
+			{
+				// LOCAL: the balancer's own connection, such as a health check
+				return true;
+			}
+			else if (command != 0x1)
+			{
+				return false;
+			}
+
+			int family = head[13] >> 4;
+			if (family == 0x1 && length >= 12)
+			{
+				uint16_t port = static_cast<uint16_t>((addresses[8] << 8) | addresses[9]);
+				source = format_address(AF_INET, addresses, port);
+			}
+			else if (family == 0x2 && length >= 36)
+			{
+				uint16_t port = static_cast<uint16_t>((addresses[32] << 8) | addresses[33]);
+				source = format_address(AF_INET6, addresses, port);
+			}
+			else if (family == 0x1 || family == 0x2)
+			{
+				return false;
+			}
+
+			// Other families, such as UNIX sockets, carry no address worth recording
+			return true;
+		}
+
+		/**
+		 * Parses a version 1 header line
+		 *
+		 * @param const char* line The line, starting with "PROXY "
+		 * @param size_t size Its length, including the CRLF
+		 * @param[out] source The client address, or empty for "PROXY UNKNOWN"
+		 *
+		 * @return bool Whether the header was valid
+		 */
+		static bool parse_v1(const char* line, size_t size, std::string& source)
+		{
+			std::istringstream fields(std::string(line, size - 2));
+			std::string proxy;
+			std::string protocol;
+			std::string source_address;
+			std::string destination_address;
+			std::string source_port;
+			std::string destination_port;
+			fields >> proxy >> protocol;
+
+			source.clear();
+			if (protocol == "UNKNOWN")
+			{
+				return true;
+			}
+
+			fields >> source_address >> destination_address >> source_port >> destination_port;
+
+			int family = protocol == "TCP4" ? AF_INET : (protocol == "TCP6" ? AF_INET6 : AF_UNSPEC);
+			unsigned char address[16];
+			if (family == AF_UNSPEC || inet_pton(family, source_address.c_str(), address) != 1)
+			{
+				return false;
+			}
+
+			if (source_port.empty() || source_port.size() > 5 || source_port.find_first_not_of("0123456789") != std::string::npos)
+			{
+				return false;
+			}
+
+			long port = std::strtol(source_port.c_str(), nullptr, 10);
+			if (port > 65535)
+			{
+				return false;
+			}
+
+			source = format_address(family, address, static_cast<uint16_t>(port));
+			return true;
+		}
+
+		/**
+		 * Reads a version 2 header, whose signature has already been seen
+		 *
+		 * @param int socket_fd The socket
+		 * @param[out] source The client address, or empty if the header carries none
+		 * @param std::chrono::steady_clock::time_point deadline When to give up
+		 *
+		 * @return bool Whether the header was valid
+		 */
+		static bool read_v2(int socket_fd, std::string& source, std::chrono::steady_clock::time_point deadline)
+		{
+			unsigned char head[V2_HEAD_SIZE];
+			if (receive(socket_fd, head, sizeof(head), 0, deadline) != static_cast<ssize_t>(sizeof(head)))
+			{
+				return false;
+			}
+
+			size_t length = (static_cast<size_t>(head[14]) << 8) | head[15];
+			std::vector<unsigned char> addresses(length);
+			if (length > 0 && receive(socket_fd, addresses.data(), length, 0, deadline) != static_cast<ssize_t>(length))
+			{
+				return false;
+			}
+
+			return parse_v2(head, addresses.data(), length, source);
+		}
+
+		/**
+		 * Reads a version 1 header, which starts with "PROXY "
+		 *
+		 * @param int socket_fd The socket
+		 * @param[out] source The client address, or empty for "PROXY UNKNOWN"
+		 * @param std::chrono::steady_clock::time_point deadline When to give up
+		 *
+		 * @return bool Whether the header was valid
+		 */
+		static bool read_v1(int socket_fd, std::string& source, std::chrono::steady_clock::time_point deadline)
+		{
+			char line[MAX_V1_SIZE];
+			ssize_t peeked;
+			do
+			{
+				if (!bound_receive(socket_fd, deadline))
+				{
+					return false;
+				}
+				peeked = recv(socket_fd, line, sizeof(line), MSG_PEEK);
+			}
+			while (peeked == -1 && errno == EINTR);
+
+			size_t size = 0;
+			for (ssize_t i = 1; i < peeked && size == 0; ++i)
+			{
+				if (line[i - 1] == '\r' && line[i] == '\n')
+				{
+					size = i + 1;
+				}
+			}
+
+			if (size > 0)
+			{
+				if (receive(socket_fd, line, size, 0, deadline) != static_cast<ssize_t>(size))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				// The header arrived in pieces, so take it a byte at a time to not read past it
+				while (size < sizeof(line) && (size < 2 || line[size - 2] != '\r' || line[size - 1] != '\n'))
+				{
+					if (receive(socket_fd, line + size, 1, 0, deadline) != 1)
+					{
+						return false;
+					}
+					++size;
+				}
+
+				if (line[size - 2] != '\r' || line[size - 1] != '\n')
+				{
+					return false;
+				}
+			}
+
+			return parse_v1(line, size, source);
+		}
+
+		/**
+		 * Reads the PROXY protocol header at the start of a connection
+		 *
+		 * The first 16 bytes are peeked to tell the versions apart; every header is at
+		 * least that long once the client's own first bytes follow it.
+		 *
+		 * @param int socket_fd The accepted socket, before anything has been read from it
+		 * @param[out] source The client address, or empty for health checks that carry none
+		 * @param std::chrono::steady_clock::time_point deadline When the whole header must have arrived, or max() to bound each read by SO_RCVTIMEO alone
+		 *
+		 * @return bool Whether a valid header was read; connections without one must be closed
+		 */
+		bool read_header(int socket_fd, std::string& source, std::chrono::steady_clock::time_point deadline)
+		{
+			unsigned char start[V2_HEAD_SIZE];
+			ssize_t peeked = receive(socket_fd, start, sizeof(start), MSG_PEEK, deadline);
+
+			if (peeked >= static_cast<ssize_t>(sizeof(V2_SIGNATURE)) && std::memcmp(start, V2_SIGNATURE, sizeof(V2_SIGNATURE)) == 0)
+			{
+				return read_v2(socket_fd, source, deadline);
+			}
+
+			if (peeked >= 6 && std::memcmp(start, "PROXY ", 6) == 0)
+			{
+				return read_v1(socket_fd, source, deadline);
+			}
+
+			return false;
+		}
+
+		/**
+		 * Parses the PROXY protocol header at the start of bytes already read from a connection
+		 *
+		 * @param const std::string& data The bytes read so far
+		 * @param[out] source The client address, or empty for health checks that carry none
+		 *
+		 * @return size_t The length of the header, 0 if more bytes are needed, or std::string::npos if there is no valid header
+		 */
+		size_t parse_header(const std::string& data, std::string& source)
+		{
+			const unsigned char* start = reinterpret_cast<const unsigned char*>(data.data());
+			size_t compared = std::min(data.size(), sizeof(V2_SIGNATURE));
+
+			if (std::memcmp(start, V2_SIGNATURE, compared) == 0)
+			{
+				if (data.size() < V2_HEAD_SIZE)
+				{
+					return 0;
+				}
+
+				size_t length = (static_cast<size_t>(start[14]) << 8) | start[15];
+				if (data.size() < V2_HEAD_SIZE + length)
+				{
+					return 0;
+				}
+
+				return parse_v2(start, start + V2_HEAD_SIZE, length, source) ? V2_HEAD_SIZE + length : std::string::npos;
+			}
+
+			compared = std::min(data.size(), static_cast<size_t>(6));
+			if (std::memcmp(start, "PROXY ", compared) != 0)
+			{
+				return std::string::npos;
+			}
+
+			size_t end = data.find("\r\n");
+			if (end == std::string::npos || end + 2 > MAX_V1_SIZE)
+			{
+				return data.size() < MAX_V1_SIZE ? 0 : std::string::npos;
+			}
+
+			return parse_v1(data.data(), end + 2, source) ? end + 2 : std::string::npos;
+		}
+	}
+}
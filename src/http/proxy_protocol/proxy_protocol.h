@@ -0,0 +1,80 @@
+/*
+ * proxy_protocol.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the PROXY protocol (versions 1 and 2) header parser.
+ */
+
+#ifndef HTTP_PROXY_PROTOCOL_H
+#define HTTP_PROXY_PROTOCOL_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace ProxyProtocol
+	 * The header a load balancer sends ahead of a connection to pass on the client's address
+	 */
+	namespace ProxyProtocol
+	{
+
+		/**
+		 * Reads the PROXY protocol header at the start of a connection
+		 *
+		 * Exactly the header is consumed, so TLS or HTTP can follow on the socket. The
+		 * binary version 2 header is read with two recv() calls; the text version 1
+		 * header usually arrives whole too, and is read byte by byte otherwise.
+		 *
+		 * @param int socket_fd The accepted socket, before anything has been read from it
+		 * @param[out] source The client address as "ip:port", or "[ip]:port" for IPv6, or empty
+		 *                    for health checks (LOCAL, UNKNOWN) that carry no client address
+		 * @param std::chrono::steady_clock::time_point deadline When the whole header must have arrived; each read
+		 *                    then waits only for what is left of it, in place of the socket's SO_RCVTIMEO
+		 *
+		 * @return bool Whether a valid header was read; connections without one must be closed
+		 */
+		bool read_header(int socket_fd, std::string& source, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+
+		/**
+		 * Parses the PROXY protocol header at the start of bytes already read from a connection
+		 *
+		 * For non-blocking sockets, which read ahead into a buffer rather than taking
+		 * exactly the header; the caller drops the header's bytes and keeps the rest.
+		 *
+		 * @param const std::string& data The bytes read so far
+		 * @param[out] source The client address, or empty for health checks that carry none
+		 *
+		 * @return size_t The length of the header, 0 if more bytes are needed, or std::string::npos if there is no valid header
+		 */
+		size_t parse_header(const std::string& data, std::string& source);
+
+		/**
+		 * @var size_t The longest version 1 header, including the CRLF
+		 */
+		static const size_t MAX_V1_SIZE = 107;
+	}
+}
+
+#endif /* HTTP_PROXY_PROTOCOL_H */
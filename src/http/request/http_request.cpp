@@ -0,0 +1,102 @@
+/*
+ * http_request.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HTTP::Request class.
+ */
+
+#include "http_request.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * Parses a request head: the request line and header fields
+	 *
+	 * @param const std::string& head The head, up to and including the blank line
+	 *
+	 * @return bool Whether the head was well formed
+	 */
+	bool Request::parse_head(const std::string& head)
+	{
+		size_t line_end = head.find("\r\n");
+		if (line_end == std::string::npos)
+		{
+			return false;
+		}
+
+		size_t method_end = head.find(' ');
+		if (method_end == std::string::npos || method_end == 0 || method_end > line_end)
+		{
+			return false;
+		}
+
+		size_t target_end = head.find(' ', method_end + 1);
+		if (target_end == std::string::npos || target_end == method_end + 1 || target_end > line_end)
+		{
+			return false;
+		}
+
+		method = head.substr(0, method_end);
+		target = head.substr(method_end + 1, target_end - method_end - 1);
+		version = head.substr(target_end + 1, line_end - target_end - 1);
+
+		if (version.compare(0, 5, "HTTP/") != 0)
+		{
+			return false;
+		}
+
+		return parse_headers(head, line_end + 2);
+	}
+
+	/**
+	 * Serialises the request line and header fields
+	 *
+	 * @return std::string The head, ending with the blank line
+	 */
+	std::string Request::serialize_head() const
+	{
+		std::string head = method + " " + target + " " + version + "\r\n";
+		serialize_headers(head);
+
+		return head;
+	}
+
+	/**
+	 * Checks whether the request asks to upgrade the connection to a WebSocket
+	 *
+	 * @return bool Whether the request carries Upgrade: websocket and Connection: upgrade
+	 */
+	bool Request::is_websocket_upgrade() const
+	{
+		return method == "GET" && has_token(HEADER_UPGRADE, "websocket") && has_token(HEADER_CONNECTION, "upgrade");
+	}
+
+	/**
+	 * Checks whether the head is the start of the HTTP/2 connection preface
+	 *
+	 * @return bool Whether the request line is "PRI * HTTP/2.0"
+	 */
+	bool Request::is_http2_preface() const
+	{
+		return method == "PRI" && target == "*" && version == "HTTP/2.0" && headers.empty();
+	}
+}
@@ -0,0 +1,89 @@
+/*
+ * http_response.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HTTP::Response class.
+ */
+
+#include <cstdlib>
+#include "http_response.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * Response constructor
+	 *
+	 * @return void
+	 */
+	Response::Response()
+		: version("HTTP/1.1"),
+		  status(0)
+	{
+	}
+
+	/**
+	 * Parses a response head: the status line and header fields
+	 *
+	 * @param const std::string& head The head, up to and including the blank line
+	 *
+	 * @return bool Whether the head was well formed
+	 */
+	bool Response::parse_head(const std::string& head)
+	{
+		size_t line_end = head.find("\r\n");
+		if (line_end == std::string::npos || head.compare(0, 5, "HTTP/") != 0)
+		{
+			return false;
+		}
+
+		size_t version_end = head.find(' ');
+		if (version_end == std::string::npos || version_end > line_end || line_end - version_end < 4)
+		{
+			return false;
+		}
+
+		std::string code = head.substr(version_end + 1, 3);
+		if (code.find_first_not_of("0123456789") != std::string::npos)
+		{
+			return false;
+		}
+
+		version = head.substr(0, version_end);
+		status = std::atoi(code.c_str());
+		reason = version_end + 5 <= line_end ? head.substr(version_end + 5, line_end - version_end - 5) : "";
+
+		return parse_headers(head, line_end + 2);
+	}
+
+	/**
+	 * Serialises the status line and header fields
+	 *
+	 * @return std::string The head, ending with the blank line
+	 */
+	std::string Response::serialize_head() const
+	{
+		std::string head = version + " " + std::to_string(status) + " " + reason + "\r\n";
+		serialize_headers(head);
+
+		return head;
+	}
+}
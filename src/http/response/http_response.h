@@ -0,0 +1,79 @@
+/*
+ * http_response.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the HTTP::Response.
+ */
+
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <string>
+#include "http_message.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @brief An HTTP/1.x response
+	 */
+	class Response : public Message
+	{
+		public:
+			/**
+			 * Construct an empty Response
+			 */
+			Response();
+
+			/**
+			 * Parses a response head: the status line and header fields
+			 *
+			 * @param const std::string& head The head, up to and including the blank line
+			 *
+			 * @return bool Whether the head was well formed
+			 */
+			bool parse_head(const std::string& head);
+
+			/**
+			 * Serialises the status line and header fields
+			 *
+			 * @return std::string The head, ending with the blank line
+			 */
+			std::string serialize_head() const;
+
+			/**
+			 * @var std::string The protocol version, e.g. "HTTP/1.1"
+			 */
+			std::string version;
+
+			/**
+			 * @var int The status code, e.g. 200
+			 */
+			int status;
+
+			/**
+			 * @var std::string The reason phrase, e.g. "OK"
+			 */
+			std::string reason;
+	};
+}
+
+#endif /* HTTP_RESPONSE_H */
@@ -19,6 +19,8 @@
  * This file contains the implementation of the HTTP::Server class.
  */
 
+#include <algorithm>
+#include <cerrno>
 #include <iostream>
 #include <chrono>
 #include <ctime>
@@ -30,10 +32,19 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <string.h>
 #include <thread>
 #include <stdexcept>
+#include <vector>
+#include <sys/time.h>
+#include <fcntl.h>
 #include "settings.h"
+#include "affinity.h"
+#include "busy_poll.h"
+#include "functions.h"
+#include "http_request.h"
 #include "server.h"
 
 /**
@@ -43,6 +54,58 @@
 namespace HTTP
 {
 
+	/**
+	 * AcceptBackoff constructor
+	 *
+	 * @return void
+	 */
+	AcceptBackoff::AcceptBackoff()
+		: wait_(0),
+		  failures_(0)
+	{
+	}
+
+	/**
+	 * Notes a failed accept(), reporting it if none was reported lately
+	 *
+	 * A connection aborted before it was accepted, an interrupted call or, on a
+	 * non-blocking listener, no connection pending is retried straight away.
+	 *
+	 * @param int error The errno accept() failed with
+	 *
+	 * @return std::chrono::milliseconds How long to wait before accepting again, zero if the failure was transient
+	 */
+	std::chrono::milliseconds AcceptBackoff::failed(int error)
+	{
+		if (error == EAGAIN || error == EWOULDBLOCK || error == ECONNABORTED || error == EINTR)
+		{
+			return std::chrono::milliseconds(0);
+		}
+
+		wait_ = std::min(std::max(wait_ * 2, std::chrono::milliseconds(MIN_WAIT)), std::chrono::milliseconds(MAX_WAIT));
+		++failures_;
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - reported_ >= std::chrono::seconds(REPORT_INTERVAL))
+		{
+			std::cerr << "accept: " << strerror(error) << " (" << failures_ << (failures_ == 1 ? " time" : " times") << "), retrying in " << wait_.count() << " ms" << std::endl;
+			reported_ = now;
+			failures_ = 0;
+		}
+
+		return wait_;
+	}
+
+	/**
+	 * Notes a connection accepted, so the next failure waits the least again
+	 *
+	 * @return void
+	 */
+	void AcceptBackoff::accepted()
+	{
+		wait_ = std::chrono::milliseconds(0);
+	}
+
 	/**
 	 * Server constructor
 	 *
@@ -73,43 +136,37 @@ namespace HTTP
 	/**
 	 * Runs the HTTP server, listening for incoming connections and spawning threads to handle them
 	 *
+	 * When echoing, and the compiler supports coroutines, connections are served on
+	 * an event loop on this thread instead, as they only ever wait on the client.
+	 *
 	 * @return void
 	 *
 	 * @throws std::runtime_error If an error occurs while running the server
 	 */
 	void Server::run()
 	{
-		// Use getaddrinfo to get address information for the specified address and port
-		// The resulting address information is used to create and bind the server socket
-		struct addrinfo hints, *res;
-		memset(&hints, 0, sizeof(hints));
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = AI_PASSIVE;
+		// Bind the listening socket, TCP or Unix domain
+		open_listener();
 
-		int status = getaddrinfo(address_, port_, &hints, &res);
-		if (status != 0)
+#if COROUTINE_SUPPORT == 1
+		if (!proxy_)
 		{
-			throw std::runtime_error("Failed to get address information");
-		}
+			int flags = fcntl(server_fd_, F_GETFL, 0);
+			if (flags == -1 || fcntl(server_fd_, F_SETFL, flags | O_NONBLOCK) == -1)
+			{
+				perror("fcntl");
+				throw std::runtime_error("Failed to make the listening socket non-blocking");
+			}
 
-		if (res == nullptr)
-		{
-			throw std::runtime_error("Failed to get address information");
+			Async::EventLoop loop;
+			accept_connections(loop);
+			loop.run();
+			return;
 		}
-
-		use_ipv6_ = (res->ai_family == AF_INET6);
-
-		// Create and bind server socket
-		server_fd_ = create_socket(address_, port_, use_ipv6_);
-		set_socket_options(server_fd_);
-		bind_socket(server_fd_, res->ai_addr, res->ai_addrlen);
-		freeaddrinfo(res);
-
-		// Start listening for incoming connections
-		listen_on_socket(server_fd_);
+#endif
 
 		// Accept incoming connections and spawn threads to handle them
+		AcceptBackoff backoff;
 		while (true)
 		{
 			struct sockaddr_storage client_addr;
@@ -118,17 +175,95 @@ namespace HTTP
 
 			if (client_fd == -1)
 			{
-				perror("accept");
+				std::this_thread::sleep_for(backoff.failed(errno));
 				continue;
 			}
 
+			backoff.accepted();
+			busy_poll_socket(client_fd);
+
 			// Spawn a new thread to handle the unencrypted connection
 			std::thread([this, client_fd]() {
+				place_connection_thread(client_fd);
 				handle_request(client_fd);
 			}).detach();
 		}
 	}
 
+	/**
+	 * Creates, binds and starts the listening socket
+	 *
+	 * An address of the form "unix:<path>" listens on a Unix domain socket at that
+	 * path, replacing a socket file left behind by an earlier run; the port is then
+	 * ignored. Any other address is resolved with getaddrinfo for TCP.
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If the socket cannot be created, bound or listened on
+	 */
+	void Server::open_listener()
+	{
+		if (is_unix_address(address_))
+		{
+			std::string path = std::string(address_).substr(5);
+
+			struct sockaddr_un address;
+			memset(&address, 0, sizeof(address));
+			address.sun_family = AF_UNIX;
+			if (path.size() >= sizeof(address.sun_path))
+			{
+				throw std::runtime_error("Unix socket path too long: " + path);
+			}
+			memcpy(address.sun_path, path.c_str(), path.size());
+
+			struct stat info;
+			if (stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+			{
+				unlink(path.c_str());
+			}
+
+			server_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (server_fd_ == -1)
+			{
+				perror("socket");
+				throw std::runtime_error("Failed to create socket");
+			}
+			bind_socket(server_fd_, (struct sockaddr*)&address, sizeof(address));
+		}
+		else
+		{
+			// Use getaddrinfo to get address information for the specified address and port
+			// The resulting address information is used to create and bind the server socket
+			struct addrinfo hints, *res;
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = AI_PASSIVE;
+
+			int status = getaddrinfo(address_, port_, &hints, &res);
+			if (status != 0)
+			{
+				throw std::runtime_error("Failed to get address information");
+			}
+
+			if (res == nullptr)
+			{
+				throw std::runtime_error("Failed to get address information");
+			}
+
+			use_ipv6_ = (res->ai_family == AF_INET6);
+
+			// Create and bind server socket
+			server_fd_ = create_socket(address_, port_, use_ipv6_);
+			set_socket_options(server_fd_);
+			bind_socket(server_fd_, res->ai_addr, res->ai_addrlen);
+			freeaddrinfo(res);
+		}
+
+		// Start listening for incoming connections
+		listen_on_socket(server_fd_);
+	}
+
 	/**
 	 * Returns a formatted string representing the current time
 	 *
@@ -147,6 +282,30 @@ namespace HTTP
 		return oss.str();
 	}
 
+	/**
+	 * Records every exchange handled by this Server
+	 *
+	 * @param std::shared_ptr<Capture::Writer> capture Where to record traffic, or nullptr to stop recording
+	 *
+	 * @return void
+	 */
+	void Server::set_capture(std::shared_ptr<Capture::Writer> capture)
+	{
+		capture_ = capture;
+	}
+
+	/**
+	 * Forwards requests to an upstream instead of echoing them
+	 *
+	 * @param std::shared_ptr<Proxy> proxy The proxy to forward through, or nullptr to echo requests
+	 *
+	 * @return void
+	 */
+	void Server::set_proxy(std::shared_ptr<Proxy> proxy)
+	{
+		proxy_ = proxy;
+	}
+
 	/**
 	 * Handles an incoming request on the specified client socket file descriptor
 	 *
@@ -156,26 +315,517 @@ namespace HTTP
 	 */
 	void Server::handle_request(int client_fd)
 	{
-		char buffer[1024] = {0};
-		int valread = read(client_fd, buffer, 1024);
+		set_read_timeout(client_fd);
 
-		if (valread == -1)
+		std::string address;
+		if (read_client_address(client_fd, address))
 		{
-			perror("read");
-			return;
+			SocketConnection client(client_fd);
+			handle_connection(client, "http", address);
+		}
+
+		close(client_fd);
+	}
+
+	/**
+	 * EchoRequest constructor
+	 *
+	 * @param const std::string& received The bytes received so far
+	 * @param size_t head_size The size of the head at their start, or 0 or std::string::npos if none arrived
+	 *
+	 * @return void
+	 */
+	EchoRequest::EchoRequest(const std::string& received, size_t head_size)
+		: http_(false)
+	{
+		if (head_size != 0 && head_size != std::string::npos && request_.parse_head(received.substr(0, head_size)))
+		{
+			http_ = true;
+			framing_ = BodyFraming(request_, request_.is_chunked() || request_.content_length() > 0);
+			raw_.assign(received, 0, head_size);
+			consume(received.data() + head_size, received.size() - head_size);
+		}
+		else
+		{
+			// Not HTTP, or the client stopped mid-head: echo whatever arrived
+			raw_ = received;
+		}
+	}
+
+	/**
+	 * Adds bytes received after the first ones, up to the end of the body
+	 *
+	 * Whatever would take the request past MAX_SIZE is framed but not kept, so
+	 * a client cannot make the recorder hold more than that however long its body.
+	 *
+	 * @param const char* data The bytes
+	 * @param size_t size How many
+	 *
+	 * @return void
+	 */
+	void EchoRequest::consume(const char* data, size_t size)
+	{
+		if (http_)
+		{
+			size_t body = framing_.consume(data, size);
+			raw_.append(data, std::min(body, MAX_SIZE - std::min(raw_.size(), MAX_SIZE)));
+		}
+	}
+
+	/**
+	 * Returns whether more of the body is expected
+	 *
+	 * @return bool Whether to keep reading
+	 */
+	bool EchoRequest::reading() const
+	{
+		return http_ && !framing_.complete();
+	}
+
+	/**
+	 * Returns whether there is something to echo: a whole request, or bytes that were not a request
+	 *
+	 * @return bool Whether to respond
+	 */
+	bool EchoRequest::responds() const
+	{
+		return http_ ? framing_.complete() : !raw_.empty();
+	}
+
+	/**
+	 * Reads a request from a client connection, then forwards or echoes it
+	 *
+	 * When proxying, only the head is read here and the body is streamed upstream as
+	 * it arrives; when echoing, the whole request is read first. The connection's
+	 * open and close events, the request and the response are all captured when a
+	 * capture is set, the close event with the connection's final TCP statistics.
+	 *
+	 * @param Connection& client The client connection, plain or encrypted
+	 * @param const char* scheme The listener's scheme, "http" or "https"
+	 * @param const std::string& address The client address, from read_client_address()
+	 *
+	 * @return void
+	 */
+	void Server::handle_connection(Connection& client, const char* scheme, const std::string& address)
+	{
+		uint64_t connection = open_capture(client.fd(), scheme, address);
+
+		const size_t chunk_size = settings().read_buffer_size;
+		std::string buffer;
+		size_t head_size = client.read_head(buffer, Message::MAX_HEAD_SIZE, chunk_size);
+
+		Request request;
+		if (proxy_)
+		{
+			if (head_size > 0 && request.parse_head(buffer.substr(0, head_size)))
+			{
+				// The proxy streams the body upstream as it arrives and captures the request itself
+				proxy_->forward(client, request, buffer.substr(0, head_size), buffer.substr(head_size), connection);
+			}
+		}
+		else
+		{
+			// Read the whole body to echo it back
+			EchoRequest echoed(buffer, head_size);
+			std::vector<char> chunk(chunk_size);
+			while (echoed.reading())
+			{
+				ssize_t received = client.read(chunk.data(), chunk.size());
+				if (received <= 0)
+				{
+					break;
+				}
+
+				echoed.consume(chunk.data(), received);
+			}
+
+			capture_request(connection, echoed);
+			if (echoed.responds())
+			{
+				echo(client, echoed.raw(), connection);
+			}
+		}
+
+		if (capture_)
+		{
+			capture_->close_connection(client.fd(), connection);
+		}
+	}
+
+	/**
+	 * Responds with the current time and the bytes received
+	 *
+	 * The bytes received are sent from where they are, after the head, rather
+	 * than copied into one response string first.
+	 *
+	 * @param Connection& client The client connection
+	 * @param const std::string& received The bytes received from the client
+	 * @param uint64_t connection The capture connection identifier
+	 *
+	 * @return void
+	 */
+	void Server::echo(Connection& client, const std::string& received, uint64_t connection)
+	{
+		std::string head = echo_head();
+
+		if (!client.write_message(head, received))
+		{
+			debug("Failed to send response to client");
+		}
+
+		capture_response(connection, head, received);
+	}
+
+	/**
+	 * Records a request read to be echoed, if a capture is set and it is an HTTP request
+	 *
+	 * @param uint64_t connection The capture connection identifier
+	 * @param const EchoRequest& echoed The request
+	 *
+	 * @return void
+	 */
+	void Server::capture_request(uint64_t connection, const EchoRequest& echoed)
+	{
+		if (capture_ && echoed.http())
+		{
+			capture_->write("request", connection, Capture::TO_SERVER, echoed.raw());
+		}
+	}
+
+	/**
+	 * Records an echoed response, if a capture is set
+	 *
+	 * @param uint64_t connection The capture connection identifier
+	 * @param const std::string& head The response head, from echo_head()
+	 * @param const std::string& received The bytes echoed after it
+	 *
+	 * @return void
+	 */
+	void Server::capture_response(uint64_t connection, const std::string& head, const std::string& received)
+	{
+		if (capture_)
+		{
+			capture_->write("response", connection, Capture::TO_CLIENT, head + received);
 		}
+	}
 
+	/**
+	 * Builds the start of the response echoing a request, which the bytes received follow
+	 *
+	 * @return std::string The status line, headers and current time
+	 */
+	std::string Server::echo_head()
+	{
 		// Get the current time
 		std::string current_time = get_formatted_time();
 
-		// Send the response
-		std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
-		response += current_time + " - received:\n\n";
-		response += buffer;
+		std::string head = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
+		head += current_time + " - received:\n\n";
+
+		return head;
+	}
+
+	/**
+	 * Records the opening of a client connection, and watches its TCP statistics
+	 *
+	 * @param int client_fd The client socket
+	 * @param const char* scheme The listener's scheme, "http" or "https"
+	 * @param const std::string& address The client address, from read_client_address()
+	 *
+	 * @return uint64_t The capture connection identifier, or 0 without a capture
+	 */
+	uint64_t Server::open_capture(int client_fd, const char* scheme, const std::string& address)
+	{
+		if (!capture_)
+		{
+			return 0;
+		}
+
+		uint64_t connection = capture_->open_connection();
+
+		Capture::Attributes attributes;
+		attributes.push_back(std::make_pair("client", address));
+
+		// Behind a load balancer, also record which balancer connection carried the client
+		std::string peer = peer_address(client_fd);
+		if (peer != address)
+		{
+			attributes.push_back(std::make_pair("via", peer));
+		}
+		attributes.push_back(std::make_pair("scheme", scheme));
+		capture_->write("open", connection, Capture::NO_DIRECTION, "", attributes);
+		capture_->watch(client_fd, connection);
+
+		return connection;
+	}
+
+#if COROUTINE_SUPPORT == 1
+	/**
+	 * Appends the result of a non-blocking read to a buffer
+	 *
+	 * @param std::string& buffer The bytes received so far
+	 * @param const std::vector<char>& chunk The bytes just read
+	 * @param ssize_t received What the read returned
+	 *
+	 * @return bool Whether the connection is still open; false at end of stream, on error or on timeout
+	 */
+	static bool append_received(std::string& buffer, const std::vector<char>& chunk, ssize_t received)
+	{
+		if (received > 0)
+		{
+			buffer.append(chunk.data(), received);
+			return true;
+		}
+
+		return received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+	}
+
+	/**
+	 * Accepts connections on the non-blocking listening socket, starting a coroutine for each
+	 *
+	 * After a failure such as running out of descriptors, it sleeps on the loop
+	 * before accepting again, as the connections that would free them need the
+	 * loop to run.
+	 *
+	 * @param Async::EventLoop& loop The loop serving the connections
+	 *
+	 * @return Async::Task The coroutine, which never ends
+	 */
+	Async::Task Server::accept_connections(Async::EventLoop& loop)
+	{
+		AcceptBackoff backoff;
+
+		while (true)
+		{
+			ssize_t client_fd = co_await loop.accept(server_fd_);
+
+			if (client_fd == -1)
+			{
+				std::chrono::milliseconds wait = backoff.failed(errno);
+				if (wait.count() > 0)
+				{
+					co_await loop.sleep_until(Async::Clock::now() + wait);
+				}
+				continue;
+			}
+
+			backoff.accepted();
+
+			busy_poll_socket(static_cast<int>(client_fd));
+
+			// Runs until the connection first waits, then the loop takes over
+			serve(loop, static_cast<int>(client_fd));
+		}
+	}
+
+	/**
+	 * Reads a request from a non-blocking client socket and echoes it, capturing the exchange
+	 *
+	 * The same exchange as handle_connection() without a proxy, framed and captured
+	 * by the same helpers, with every read bounded by the read_timeout setting as
+	 * SO_RCVTIMEO bounds it there.
+	 *
+	 * @param Async::EventLoop& loop The loop serving the connection
+	 * @param int client_fd The accepted socket, which the coroutine closes
+	 *
+	 * @return Async::Task The coroutine
+	 */
+	Async::Task Server::serve(Async::EventLoop& loop, int client_fd)
+	{
+		const size_t chunk_size = settings().read_buffer_size;
+		const int read_timeout = settings().read_timeout;
+		std::vector<char> chunk(chunk_size);
+		std::string buffer;
+		bool open = true;
+
+		auto read = [&]() {
+			Async::Clock::time_point deadline = read_timeout > 0 ? Async::Clock::now() + std::chrono::seconds(read_timeout) : Async::Clock::time_point::max();
+			return loop.read(client_fd, chunk.data(), chunk.size(), deadline);
+		};
+
+		// The PROXY protocol header arrives with whatever follows it, so parse it out of the buffer
+		std::string address;
+		if (settings().proxy_protocol)
+		{
+			size_t header_size;
+			while ((header_size = ProxyProtocol::parse_header(buffer, address)) == 0 && open)
+			{
+				open = append_received(buffer, chunk, co_await read());
+			}
+
+			if (header_size == 0 || header_size == std::string::npos)
+			{
+				debug("Closing a connection from %s without a valid PROXY protocol header", peer_address(client_fd).c_str());
+				close(client_fd);
+				co_return;
+			}
+
+			buffer.erase(0, header_size);
+		}
+
+		if (address.empty())
+		{
+			address = peer_address(client_fd);
+		}
+
+		uint64_t connection = open_capture(client_fd, "http", address);
+
+		size_t head_size;
+		while ((head_size = Message::find_head_end(buffer)) == std::string::npos && buffer.size() <= Message::MAX_HEAD_SIZE && open)
+		{
+			open = append_received(buffer, chunk, co_await read());
+		}
+
+		// Read the whole body to echo it back
+		EchoRequest echoed(buffer, head_size);
+		while (echoed.reading() && open)
+		{
+			ssize_t received = co_await read();
+			if (received > 0)
+			{
+				echoed.consume(chunk.data(), received);
+			}
+			else
+			{
+				open = received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+			}
+		}
+
+		capture_request(connection, echoed);
+
+		std::string head;
+		if (echoed.responds())
+		{
+			head = echo_head();
+
+			// The body is sent from where it was read, after the head, which goes out with MSG_MORE so the two still share a segment
+			const std::string* parts[2] = { &head, &echoed.raw() };
+			size_t part = 0;
+			size_t sent = 0;
+			while (part < 2)
+			{
+				if (sent == parts[part]->size())
+				{
+					++part;
+					sent = 0;
+					continue;
+				}
+
+				int flags = part == 0 && !parts[1]->empty() ? MSG_MORE : 0;
+				ssize_t written = co_await loop.write(client_fd, parts[part]->data() + sent, parts[part]->size() - sent, Async::Clock::time_point::max(), flags);
+				if (written > 0)
+				{
+					sent += written;
+				}
+				else if (written == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+				{
+					debug("Failed to send response to client");
+					break;
+				}
+			}
+		}
+
+		if (!head.empty())
+		{
+			capture_response(connection, head, echoed.raw());
+		}
+		if (capture_)
+		{
+			capture_->close_connection(client_fd, connection);
+		}
 
-		write(client_fd, response.c_str(), response.size());
 		close(client_fd);
 	}
+#endif
+
+	/**
+	 * Returns the address of the peer connected to a socket
+	 *
+	 * @param int socket_fd The connected socket
+	 *
+	 * @return std::string The address as "ip:port", or "[ip]:port" for IPv6, "unix" for a Unix domain socket, or "-" if unknown
+	 */
+	std::string Server::peer_address(int socket_fd)
+	{
+		struct sockaddr_storage address;
+		socklen_t address_size = sizeof(address);
+		if (getpeername(socket_fd, (struct sockaddr*)&address, &address_size) == -1)
+		{
+			return "-";
+		}
+
+		char host[INET6_ADDRSTRLEN] = {0};
+		if (address.ss_family == AF_INET6)
+		{
+			struct sockaddr_in6* ipv6 = (struct sockaddr_in6*)&address;
+			inet_ntop(AF_INET6, &ipv6->sin6_addr, host, sizeof(host));
+			return std::string("[") + host + "]:" + std::to_string(ntohs(ipv6->sin6_port));
+		}
+
+		if (address.ss_family == AF_INET)
+		{
+			struct sockaddr_in* ipv4 = (struct sockaddr_in*)&address;
+			inet_ntop(AF_INET, &ipv4->sin_addr, host, sizeof(host));
+			return std::string(host) + ":" + std::to_string(ntohs(ipv4->sin_port));
+		}
+
+		if (address.ss_family == AF_UNIX)
+		{
+			// Clients of a Unix domain socket are normally unnamed
+			return "unix";
+		}
+
+		return "-";
+	}
+
+	/**
+	 * Determines the address of the client behind an accepted socket
+	 *
+	 * With the proxy_protocol setting, the connection must open with a PROXY protocol
+	 * header, which is consumed here and gives the real client address; the balancer's
+	 * own health checks, which carry no client address, keep the socket's peer.
+	 *
+	 * @param int client_fd The accepted socket, before anything has been read from it
+	 * @param[out] address The client address
+	 * @param std::chrono::steady_clock::time_point deadline When the PROXY protocol header must have arrived, or max() to bound each read by SO_RCVTIMEO alone
+	 *
+	 * @return bool Whether the connection may go on; false if its PROXY protocol header was missing or invalid
+	 */
+	bool Server::read_client_address(int client_fd, std::string& address, std::chrono::steady_clock::time_point deadline)
+	{
+		address.clear();
+		if (settings().proxy_protocol && !ProxyProtocol::read_header(client_fd, address, deadline))
+		{
+			debug("Closing a connection from %s without a valid PROXY protocol header", peer_address(client_fd).c_str());
+			return false;
+		}
+
+		if (address.empty())
+		{
+			address = peer_address(client_fd);
+		}
+
+		return true;
+	}
+
+	/**
+	 * Applies the configured read timeout to a client socket
+	 *
+	 * @param int client_fd The client socket file descriptor
+	 *
+	 * @return void
+	 */
+	void Server::set_read_timeout(int client_fd)
+	{
+		struct timeval timeout;
+		timeout.tv_sec = settings().read_timeout;
+		timeout.tv_usec = 0;
+
+		if (setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1)
+		{
+			perror("setsockopt");
+		}
+	}
 
 	/**
 	 * Create a new socket for the server to listen on
@@ -36,7 +36,16 @@
 #include <string.h>
 #include <thread>
 #include <stdexcept>
+#include <memory>
+#include <cstdint>
 #include "settings.h"
+#include "connection.h"
+#include "http_message.h"
+#include "http_request.h"
+#include "proxy.h"
+#include "proxy_protocol.h"
+#include "capture.h"
+#include "event_loop.h"
 
 /**
  * @namespace HTTP
@@ -45,6 +54,132 @@
 namespace HTTP
 {
 
+	/**
+	 * @brief A request being read to be echoed back
+	 *
+	 * Frames the body after the head, so the blocking and the coroutine connection
+	 * handlers, which only differ in how they wait for bytes, read and echo alike.
+	 * Bytes that do not start with a valid request head are echoed as they are.
+	 * Only the first MAX_SIZE bytes are kept; the rest of a longer body is still
+	 * read to its end, so the response follows the whole request, but dropped.
+	 */
+	class EchoRequest
+	{
+		public:
+			/**
+			 * Construct an EchoRequest from the bytes received so far
+			 *
+			 * @param const std::string& received The bytes received so far
+			 * @param size_t head_size The size of the head at their start, or 0 or std::string::npos if none arrived
+			 */
+			EchoRequest(const std::string& received, size_t head_size);
+
+			/**
+			 * Add bytes received after the first ones
+			 *
+			 * @param const char* data The bytes
+			 * @param size_t size How many
+			 *
+			 * @return void
+			 */
+			void consume(const char* data, size_t size);
+
+			/**
+			 * Returns whether more of the body is expected
+			 *
+			 * @return bool Whether to keep reading
+			 */
+			bool reading() const;
+
+			/**
+			 * Returns whether there is something to echo: a whole request, or bytes that were not a request
+			 *
+			 * @return bool Whether to respond
+			 */
+			bool responds() const;
+
+			/**
+			 * Returns whether the bytes received started with a valid request head
+			 *
+			 * @return bool Whether they are an HTTP request
+			 */
+			bool http() const
+			{
+				return http_;
+			}
+
+			/**
+			 * Returns the request as received, its head and as much of its body as arrived, or the bytes that were not a request
+			 *
+			 * @return const std::string& The bytes
+			 */
+			const std::string& raw() const
+			{
+				return raw_;
+			}
+
+			/**
+			 * @var size_t The most of a request kept to be echoed and captured, head included
+			 */
+			static const size_t MAX_SIZE = 1024 * 1024;
+
+		private:
+			Request request_;
+			BodyFraming framing_;
+			std::string raw_;
+			bool http_;
+	};
+
+	/**
+	 * @brief How long a listener waits before accepting again after a failure
+	 *
+	 * A listener that has run out of descriptors or memory stays readable, and
+	 * accept() fails again at once, so retrying straight away only spins: the
+	 * connections being served have to finish to free what it lacks. The wait
+	 * doubles while the failures go on, and they are reported now and then
+	 * rather than once each.
+	 */
+	class AcceptBackoff
+	{
+		public:
+			/**
+			 * Construct an AcceptBackoff that does not wait
+			 */
+			AcceptBackoff();
+
+			/**
+			 * Note a failed accept(), reporting it if none was reported lately
+			 *
+			 * @param int error The errno accept() failed with
+			 *
+			 * @return std::chrono::milliseconds How long to wait before accepting again, zero if the failure was transient
+			 */
+			std::chrono::milliseconds failed(int error);
+
+			/**
+			 * Note a connection accepted, so the next failure waits the least again
+			 *
+			 * @return void
+			 */
+			void accepted();
+
+			/**
+			 * @var int The shortest and longest waits, in milliseconds
+			 */
+			static const int MIN_WAIT = 10;
+			static const int MAX_WAIT = 1000;
+
+			/**
+			 * @var int How often failures are reported while they go on, in seconds
+			 */
+			static const int REPORT_INTERVAL = 5;
+
+		private:
+			std::chrono::milliseconds wait_;
+			std::chrono::steady_clock::time_point reported_;
+			size_t failures_;
+	};
+
 	/**
 	 * @brief A simple HTTP server implementation
 	 *
@@ -79,6 +214,24 @@ namespace HTTP
 			 */
 			virtual void run();
 
+			/**
+			 * Record every exchange handled by this Server
+			 *
+			 * @param std::shared_ptr<Capture::Writer> capture Where to record traffic, or nullptr to stop recording
+			 *
+			 * return void
+			 */
+			void set_capture(std::shared_ptr<Capture::Writer> capture);
+
+			/**
+			 * Forward requests to an upstream instead of echoing them
+			 *
+			 * @param std::shared_ptr<Proxy> proxy The proxy to forward through, or nullptr to echo requests
+			 *
+			 * return void
+			 */
+			void set_proxy(std::shared_ptr<Proxy> proxy);
+
 		protected:
 
 			/**
@@ -97,6 +250,124 @@ namespace HTTP
 			 */
 			void handle_request(int client_fd);
 
+			/**
+			 * Read a request from a client connection, then forward or echo it, capturing the exchange
+			 *
+			 * @param Connection& client The client connection, plain or encrypted
+			 * @param const char* scheme The listener's scheme, "http" or "https"
+			 * @param const std::string& address The client address, from read_client_address()
+			 *
+			 * @return void
+			 */
+			void handle_connection(Connection& client, const char* scheme, const std::string& address);
+
+			/**
+			 * Respond with the current time and the bytes received, as the recorder does without an upstream
+			 *
+			 * @param Connection& client The client connection
+			 * @param const std::string& received The bytes received from the client
+			 * @param uint64_t connection The capture connection identifier
+			 *
+			 * @return void
+			 */
+			void echo(Connection& client, const std::string& received, uint64_t connection);
+
+			/**
+			 * Record a request read to be echoed, if a capture is set and it is an HTTP request
+			 *
+			 * @param uint64_t connection The capture connection identifier
+			 * @param const EchoRequest& echoed The request
+			 *
+			 * @return void
+			 */
+			void capture_request(uint64_t connection, const EchoRequest& echoed);
+
+			/**
+			 * Record an echoed response, if a capture is set
+			 *
+			 * @param uint64_t connection The capture connection identifier
+			 * @param const std::string& head The response head, from echo_head()
+			 * @param const std::string& received The bytes echoed after it
+			 *
+			 * @return void
+			 */
+			void capture_response(uint64_t connection, const std::string& head, const std::string& received);
+
+			/**
+			 * Build the start of the response echoing a request, which the bytes received follow
+			 *
+			 * @return std::string The status line, headers and current time
+			 */
+			std::string echo_head();
+
+			/**
+			 * Record the opening of a client connection, if a capture is set
+			 *
+			 * @param int client_fd The client socket
+			 * @param const char* scheme The listener's scheme, "http" or "https"
+			 * @param const std::string& address The client address, from read_client_address()
+			 *
+			 * @return uint64_t The capture connection identifier, or 0 without a capture
+			 */
+			uint64_t open_capture(int client_fd, const char* scheme, const std::string& address);
+
+#if COROUTINE_SUPPORT == 1
+			/**
+			 * Accept connections on the non-blocking listening socket, serving each on the event loop
+			 *
+			 * @param Async::EventLoop& loop The loop serving the connections
+			 *
+			 * @return Async::Task The coroutine
+			 */
+			Async::Task accept_connections(Async::EventLoop& loop);
+
+			/**
+			 * Read a request from a non-blocking client socket and echo it, capturing the exchange
+			 *
+			 * @param Async::EventLoop& loop The loop serving the connection
+			 * @param int client_fd The accepted socket, closed when the coroutine ends
+			 *
+			 * @return Async::Task The coroutine
+			 */
+			Async::Task serve(Async::EventLoop& loop, int client_fd);
+#endif
+
+			/**
+			 * Returns the address of the peer connected to a socket
+			 *
+			 * @param int socket_fd The connected socket
+			 *
+			 * @return std::string The address as "ip:port", or "[ip]:port" for IPv6
+			 */
+			static std::string peer_address(int socket_fd);
+
+			/**
+			 * Determine the client address of an accepted socket, reading its PROXY protocol header if enabled
+			 *
+			 * @param int client_fd The accepted socket, before anything has been read from it
+			 * @param[out] address The client address
+			 * @param std::chrono::steady_clock::time_point deadline When the PROXY protocol header must have arrived, or max() to bound each read by SO_RCVTIMEO alone
+			 *
+			 * @return bool Whether the connection may go on
+			 */
+			bool read_client_address(int client_fd, std::string& address, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+
+			/**
+			 * Apply the configured read timeout to a client socket
+			 *
+			 * @param int client_fd The file descriptor for the connected client socket
+			 *
+			 * @return void
+			 */
+			void set_read_timeout(int client_fd);
+
+			/**
+			 * Create, bind and start the listening socket for address_ and port_
+			 *
+			 * @return void
+			 */
+			void open_listener();
+
 			/**
 			 * Create a new socket for the Server to listen on
 			 *
@@ -156,6 +427,16 @@ namespace HTTP
 			 * @var int The file descriptor for the server socket
 			 */
 			int server_fd_;
+
+			/**
+			 * @var std::shared_ptr<Capture::Writer> Where to record traffic, or nullptr
+			 */
+			std::shared_ptr<Capture::Writer> capture_;
+
+			/**
+			 * @var std::shared_ptr<Proxy> The proxy to forward requests through, or nullptr to echo them
+			 */
+			std::shared_ptr<Proxy> proxy_;
 	};
 }
 
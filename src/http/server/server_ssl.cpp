@@ -37,9 +37,22 @@
 #include <string.h>
 #include <thread>
 #include <stdexcept>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/time.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/x509v3.h>
 #include "settings.h"
+#include "affinity.h"
+#include "busy_poll.h"
+#include "functions.h"
 #include "server_ssl.h"
 
 /**
@@ -62,33 +75,354 @@ namespace HTTP
 	 * @return void
 	 */
 	ServerSSL::ServerSSL(const char* address, const char* port, const std::string& cert_file, const std::string& key_file)
-		: Server(address, port), cert_file_(cert_file), key_file_(key_file)
+		: ServerSSL(address, port, std::vector<Certificate>(1, Certificate{cert_file, key_file}))
 	{
+	}
+
+	/**
+	 * Server constructor
+	 *
+	 * Initialises an ServerSSL instance serving several certificates, selected by the server name each client requests.
+	 *
+	 * @param const char* address The IP address to listen on
+	 * @param const char* port The port number to listen on
+	 * @param const std::vector<Certificate>& certificates The certificate and key pairs, the first being the default
+	 * @param const TLSSettings& settings The protocol versions, ciphers, curves and ALPN protocols to offer
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If no certificate is given, one cannot be loaded, or the settings are invalid
+	 */
+	ServerSSL::ServerSSL(const char* address, const char* port, const std::vector<Certificate>& certificates, const TLSSettings& settings)
+		: Server(address, port), certificates_(certificates), settings_(settings), handshake_pool_(::settings().handshake_workers)
+	{
+		if (certificates_.empty())
+		{
+			throw std::runtime_error("At least one certificate is required");
+		}
+
+		for (size_t i = 0; i < settings_.alpn.size(); ++i)
+		{
+			if (settings_.alpn[i].empty() || settings_.alpn[i].size() > 255)
+			{
+				throw std::runtime_error("Invalid ALPN protocol \"" + settings_.alpn[i] + "\"");
+			}
+			alpn_protocols_ += static_cast<char>(settings_.alpn[i].size());
+			alpn_protocols_ += settings_.alpn[i];
+		}
+
 		// Initialise SSL library and create SSL context if SSL is enabled
 		SSL_library_init();
 		OpenSSL_add_all_algorithms();
 		SSL_load_error_strings();
 
-		// Create SSL context
-		ctx_ = SSL_CTX_new(TLS_server_method());
+		// Create SSL contexts
+		contexts_ = create_contexts();
+
+		debug("Running TLS handshakes on %zu worker threads", handshake_pool_.size());
+	}
+
+	/**
+	 * Builds a new SSL context from a certificate and key file
+	 *
+	 * @param const Certificate& certificate The certificate and key to load
+	 *
+	 * @return std::shared_ptr<SSL_CTX> The loaded context
+	 *
+	 * @throws std::runtime_error If the certificate or key cannot be loaded
+	 */
+	std::shared_ptr<SSL_CTX> ServerSSL::create_context(const Certificate& certificate) const
+	{
+		std::shared_ptr<SSL_CTX> ctx(SSL_CTX_new(TLS_server_method()), SSL_CTX_free);
+		if (!ctx)
+		{
+			throw std::runtime_error("Failed to create SSL context");
+		}
 
 		// Load server certificate
-		if (SSL_CTX_use_certificate_file(ctx_, cert_file_.c_str(), SSL_FILETYPE_PEM) <= 0)
+		if (SSL_CTX_use_certificate_chain_file(ctx.get(), certificate.cert_file.c_str()) <= 0)
 		{
-			throw std::runtime_error("Failed to load server certificate");
+			throw std::runtime_error("Failed to load server certificate " + certificate.cert_file);
 		}
 
 		// Load private key
-		if (SSL_CTX_use_PrivateKey_file(ctx_, key_file_.c_str(), SSL_FILETYPE_PEM) <= 0)
+		if (SSL_CTX_use_PrivateKey_file(ctx.get(), certificate.key_file.c_str(), SSL_FILETYPE_PEM) <= 0)
 		{
-			throw std::runtime_error("Failed to load server private key");
+			throw std::runtime_error("Failed to load server private key " + certificate.key_file);
 		}
 
 		// Check the private key
-		if (!SSL_CTX_check_private_key(ctx_))
+		if (!SSL_CTX_check_private_key(ctx.get()))
+		{
+			throw std::runtime_error("Server private key " + certificate.key_file + " does not match the certificate public key");
+		}
+
+		#ifdef SSL_OP_NO_RENEGOTIATION
+		// A renegotiation would run the SNI callback again after the handshake-time contexts may have been reloaded
+		SSL_CTX_set_options(ctx.get(), SSL_OP_NO_RENEGOTIATION);
+		#endif /* SSL_OP_NO_RENEGOTIATION */
+
+		apply_settings(ctx.get());
+
+		return ctx;
+	}
+
+	/**
+	 * Applies the listener's protocol versions, ciphers, curves and ALPN protocols to a context
+	 *
+	 * Every context of the listener gets the same settings, as a connection switched over by
+	 * SNI keeps the versions and ciphers negotiated from the context it started with.
+	 *
+	 * @param SSL_CTX* ctx The context to configure
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If OpenSSL rejects any of the settings
+	 */
+	void ServerSSL::apply_settings(SSL_CTX* ctx) const
+	{
+		if (!settings_.min_version.empty() && !SSL_CTX_set_min_proto_version(ctx, protocol_version(settings_.min_version)))
+		{
+			throw std::runtime_error("Failed to set minimum TLS version " + settings_.min_version);
+		}
+
+		if (!settings_.max_version.empty() && !SSL_CTX_set_max_proto_version(ctx, protocol_version(settings_.max_version)))
+		{
+			throw std::runtime_error("Failed to set maximum TLS version " + settings_.max_version);
+		}
+
+		if (!settings_.ciphers.empty() && !SSL_CTX_set_cipher_list(ctx, settings_.ciphers.c_str()))
+		{
+			throw std::runtime_error("Invalid cipher list \"" + settings_.ciphers + "\"");
+		}
+
+		if (!settings_.ciphersuites.empty() && !SSL_CTX_set_ciphersuites(ctx, settings_.ciphersuites.c_str()))
+		{
+			throw std::runtime_error("Invalid TLS 1.3 cipher suites \"" + settings_.ciphersuites + "\"");
+		}
+
+		if (!settings_.curves.empty() && !SSL_CTX_set1_groups_list(ctx, settings_.curves.c_str()))
+		{
+			throw std::runtime_error("Invalid curve list \"" + settings_.curves + "\"");
+		}
+
+		if (!alpn_protocols_.empty())
+		{
+			SSL_CTX_set_alpn_select_cb(ctx, select_alpn, const_cast<ServerSSL*>(this));
+		}
+	}
+
+	/**
+	 * Returns the OpenSSL protocol version constant for a version such as "1.2"
+	 *
+	 * @param const std::string& version The version name, with or without a "TLSv" prefix
+	 *
+	 * @return int The matching protocol version constant
+	 *
+	 * @throws std::runtime_error If the version is not recognised
+	 */
+	int ServerSSL::protocol_version(const std::string& version)
+	{
+		std::string number = version.compare(0, 4, "TLSv") == 0 ? version.substr(4) : version;
+
+		if (number == "1.0" || number == "1")
+		{
+			return TLS1_VERSION;
+		}
+		if (number == "1.1")
+		{
+			return TLS1_1_VERSION;
+		}
+		if (number == "1.2")
+		{
+			return TLS1_2_VERSION;
+		}
+		if (number == "1.3")
 		{
-			throw std::runtime_error("Server private key does not match the certificate public key");
+			return TLS1_3_VERSION;
 		}
+
+		throw std::runtime_error("Unknown TLS version \"" + version + "\"");
+	}
+
+	/**
+	 * Chooses the first protocol in the server's preference list that the client also offers
+	 *
+	 * @param SSL* ssl The connection being handshaken
+	 * @param const unsigned char** out The selected protocol
+	 * @param unsigned char* outlen The length of the selected protocol
+	 * @param const unsigned char* in The client's protocols in wire format
+	 * @param unsigned int inlen The length of the client's protocols
+	 * @param void* arg The ServerSSL instance
+	 *
+	 * @return int SSL_TLSEXT_ERR_OK if a protocol was chosen, SSL_TLSEXT_ERR_NOACK to continue without ALPN
+	 */
+	int ServerSSL::select_alpn(SSL* ssl, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void* arg)
+	{
+		(void)ssl;
+		const ServerSSL* server = static_cast<const ServerSSL*>(arg);
+		const unsigned char* protocols = reinterpret_cast<const unsigned char*>(server->alpn_protocols_.data());
+
+		unsigned char* selected = nullptr;
+		if (SSL_select_next_proto(&selected, outlen, protocols, server->alpn_protocols_.size(), in, inlen) != OPENSSL_NPN_NEGOTIATED)
+		{
+			return SSL_TLSEXT_ERR_NOACK;
+		}
+
+		*out = selected;
+		return SSL_TLSEXT_ERR_OK;
+	}
+
+	/**
+	 * Builds the contexts for every certificate and indexes them by the host names they cover
+	 *
+	 * All files are loaded here, so handshakes only ever do a hash lookup to pick a certificate.
+	 *
+	 * @return std::shared_ptr<const Contexts> The loaded contexts
+	 *
+	 * @throws std::runtime_error If any certificate or key cannot be loaded
+	 */
+	std::shared_ptr<const ServerSSL::Contexts> ServerSSL::create_contexts() const
+	{
+		std::shared_ptr<Contexts> contexts = std::make_shared<Contexts>();
+
+		for (size_t i = 0; i < certificates_.size(); ++i)
+		{
+			std::shared_ptr<SSL_CTX> ctx = create_context(certificates_[i]);
+			if (i == 0)
+			{
+				contexts->fallback = ctx;
+			}
+
+			std::vector<std::string> names = certificate_names(ctx.get());
+			for (size_t j = 0; j < names.size(); ++j)
+			{
+				// Earlier certificates take precedence when several cover the same name
+				if (contexts->by_name.insert(std::make_pair(names[j], ctx)).second)
+				{
+					debug("Serving %s for %s", certificates_[i].cert_file.c_str(), names[j].c_str());
+				}
+			}
+		}
+
+		// Connections always start on the first context, which switches them over once the server name is known
+		SSL_CTX_set_tlsext_servername_callback(contexts->fallback.get(), select_context);
+		SSL_CTX_set_tlsext_servername_arg(contexts->fallback.get(), contexts.get());
+
+		return contexts;
+	}
+
+	/**
+	 * Returns the host names a context's certificate is valid for
+	 *
+	 * @param SSL_CTX* ctx The context holding the certificate
+	 *
+	 * @return std::vector<std::string> The lower-case DNS subject alternative names, or the common name if there are none
+	 */
+	std::vector<std::string> ServerSSL::certificate_names(SSL_CTX* ctx)
+	{
+		std::vector<std::string> names;
+		X509* cert = SSL_CTX_get0_certificate(ctx);
+		if (cert == nullptr)
+		{
+			return names;
+		}
+
+		GENERAL_NAMES* alt_names = static_cast<GENERAL_NAMES*>(X509_get_ext_d2i(cert, NID_subject_alt_name, nullptr, nullptr));
+		if (alt_names != nullptr)
+		{
+			for (int i = 0; i < sk_GENERAL_NAME_num(alt_names); ++i)
+			{
+				const GENERAL_NAME* alt_name = sk_GENERAL_NAME_value(alt_names, i);
+				if (alt_name->type == GEN_DNS)
+				{
+					const unsigned char* data = ASN1_STRING_get0_data(alt_name->d.dNSName);
+					names.push_back(std::string(reinterpret_cast<const char*>(data), ASN1_STRING_length(alt_name->d.dNSName)));
+				}
+			}
+			GENERAL_NAMES_free(alt_names);
+		}
+
+		if (names.empty())
+		{
+			X509_NAME* subject = X509_get_subject_name(cert);
+			int index = X509_NAME_get_index_by_NID(subject, NID_commonName, -1);
+			if (index >= 0)
+			{
+				ASN1_STRING* common_name = X509_NAME_ENTRY_get_data(X509_NAME_get_entry(subject, index));
+				const unsigned char* data = ASN1_STRING_get0_data(common_name);
+				names.push_back(std::string(reinterpret_cast<const char*>(data), ASN1_STRING_length(common_name)));
+			}
+		}
+
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			std::transform(names[i].begin(), names[i].end(), names[i].begin(), ::tolower);
+		}
+
+		return names;
+	}
+
+	/**
+	 * Switches a connection to the context matching the server name it requested
+	 *
+	 * An exact match is preferred over a wildcard covering the first label. Clients
+	 * without SNI, or asking for a name no certificate covers, keep the first certificate.
+	 *
+	 * @param SSL* ssl The connection being handshaken
+	 * @param int* alert The alert to send on failure
+	 * @param void* arg The Contexts the connection was created from
+	 *
+	 * @return int SSL_TLSEXT_ERR_OK
+	 */
+	int ServerSSL::select_context(SSL* ssl, int* alert, void* arg)
+	{
+		(void)alert;
+		const Contexts* contexts = static_cast<const Contexts*>(arg);
+
+		const char* server_name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+		if (server_name == nullptr)
+		{
+			return SSL_TLSEXT_ERR_OK;
+		}
+
+		std::string name(server_name);
+		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+		std::unordered_map<std::string, std::shared_ptr<SSL_CTX>>::const_iterator match = contexts->by_name.find(name);
+		if (match == contexts->by_name.end())
+		{
+			size_t dot = name.find('.');
+			if (dot != std::string::npos)
+			{
+				match = contexts->by_name.find("*" + name.substr(dot));
+			}
+		}
+
+		if (match != contexts->by_name.end() && match->second.get() != SSL_get_SSL_CTX(ssl))
+		{
+			SSL_set_SSL_CTX(ssl, match->second.get());
+		}
+
+		return SSL_TLSEXT_ERR_OK;
+	}
+
+	/**
+	 * Reloads the certificate and key files and swaps in the new contexts
+	 *
+	 * The contexts are built on the calling thread; handshakes already in progress keep
+	 * the contexts they started with until they complete.
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If the new certificate or key cannot be loaded, in which case the current context stays in use
+	 */
+	void ServerSSL::reload()
+	{
+		std::shared_ptr<const Contexts> contexts = create_contexts();
+		std::atomic_store(&contexts_, contexts);
+
+		debug("Reloaded %zu certificates", certificates_.size());
 	}
 
 	/**
@@ -113,103 +447,303 @@ namespace HTTP
 	 */
 	void ServerSSL::run()
 	{
-		// Use getaddrinfo to get address information for the specified address and port
-		// The resulting address information is used to create and bind the server socket
-		struct addrinfo hints, *res;
-		memset(&hints, 0, sizeof(hints));
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = AI_PASSIVE;
+		// Bind the listening socket, TCP or Unix domain
+		open_listener();
 
-		int status = getaddrinfo(address_, port_, &hints, &res);
-		if (status != 0)
+		// Accept incoming connections and spawn threads to handle them
+		AcceptBackoff backoff;
+		while (true)
 		{
-			throw std::runtime_error("Failed to get address information");
+			struct sockaddr_storage client_addr;
+			socklen_t client_addr_size = sizeof(client_addr);
+			int client_fd = accept(server_fd_, (struct sockaddr*)&client_addr, &client_addr_size);
+
+			if (client_fd == -1)
+			{
+				std::this_thread::sleep_for(backoff.failed(errno));
+				continue;
+			}
+
+			backoff.accepted();
+			busy_poll_socket(client_fd);
+
+			// Hand the handshake to the pool so a slow client or an expensive
+			// private key operation never holds up the next accept()
+			handshake_pool_.submit([this, client_fd]() {
+				handshake(client_fd);
+			});
 		}
+	}
 
-		if (res == nullptr)
+	/**
+	 * Performs the TLS handshake for an accepted client and spawns a thread to handle the connection
+	 *
+	 * @param int client_fd The client socket file descriptor
+	 *
+	 * @return void
+	 */
+	void ServerSSL::handshake(int client_fd)
+	{
+		// Bound the time a client may take over the whole handshake, as it occupies a pool worker
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(::settings().handshake_timeout);
+
+		// A PROXY protocol header comes before the TLS handshake
+		std::string address;
+		if (!read_client_address(client_fd, address, deadline))
 		{
-			throw std::runtime_error("Failed to get address information");
+			close(client_fd);
+			return;
 		}
 
-		use_ipv6_ = (res->ai_family == AF_INET6);
+		// Take the contexts current at accept time; a concurrent reload only affects later connections.
+		// They are held until the handshake ends, as the SNI callback reads them during SSL_accept.
+		std::shared_ptr<const Contexts> contexts = std::atomic_load(&contexts_);
+		SSL* ssl = SSL_new(contexts->fallback.get());
+		SSL_set_fd(ssl, client_fd);
 
-		// Create and bind server socket
-		server_fd_ = create_socket(address_, port_, use_ipv6_);
-		set_socket_options(server_fd_);
-		bind_socket(server_fd_, res->ai_addr, res->ai_addrlen);
-		freeaddrinfo(res);
+		#ifdef SSL_MODE_ASYNC
+		// Let the handshake's private key operations run as async jobs, so one waiting on an
+		// async-capable engine or provider is paused instead of blocking its worker. Only the
+		// handshake needs it: afterwards every SSL_read and SSL_write would pay for a job switch.
+		SSL_set_mode(ssl, SSL_MODE_ASYNC);
+		#endif /* SSL_MODE_ASYNC */
+
+		// The handshake runs non-blocking, so every wait is for the time left before the deadline
+		int flags = fcntl(client_fd, F_GETFL, 0);
+		if (flags == -1 || fcntl(client_fd, F_SETFL, flags | O_NONBLOCK) == -1 || !accept_ssl(ssl, deadline))
+		{
+			SSL_free(ssl);
+			close(client_fd);
+			return;
+		}
 
-		// Start listening for incoming connections
-		listen_on_socket(server_fd_);
+		#ifdef SSL_MODE_ASYNC
+		SSL_clear_mode(ssl, SSL_MODE_ASYNC);
+		#endif /* SSL_MODE_ASYNC */
 
-		// Accept incoming connections and spawn threads to handle them
+		// The handshake is done, so the connection goes back to blocking
+		if (fcntl(client_fd, F_SETFL, flags) == -1)
+		{
+			perror("fcntl");
+			SSL_free(ssl);
+			close(client_fd);
+			return;
+		}
+
+		// Spawn a new thread to handle the SSL connection
+		std::thread([this, ssl, address]() {
+			place_connection_thread(SSL_get_fd(ssl));
+			handle_request_ssl(ssl, address);
+			SSL_shutdown(ssl);
+			SSL_free(ssl);
+		}).detach();
+	}
+
+	/**
+	 * Runs SSL_accept until the handshake completes or fails
+	 *
+	 * The socket is non-blocking, so SSL_accept returns with SSL_ERROR_WANT_READ or
+	 * SSL_ERROR_WANT_WRITE whenever the client is slow, and the socket is polled
+	 * for the time left. When a private key operation is offloaded to an async
+	 * engine, it returns with SSL_ERROR_WANT_ASYNC instead, and the handshake is
+	 * resumed once the engine signals that the job is ready. The whole handshake,
+	 * however many times it pauses, must complete by the deadline.
+	 *
+	 * @param SSL* ssl The SSL object for the client connection, on a non-blocking socket
+	 * @param std::chrono::steady_clock::time_point deadline When the handshake times out
+	 *
+	 * @return bool Whether the handshake succeeded
+	 */
+	bool ServerSSL::accept_ssl(SSL* ssl, std::chrono::steady_clock::time_point deadline)
+	{
 		while (true)
 		{
-			struct sockaddr_storage client_addr;
-			socklen_t client_addr_size = sizeof(client_addr);
-			int client_fd = accept(server_fd_, (struct sockaddr*)&client_addr, &client_addr_size);
+			int result = SSL_accept(ssl);
+			if (result > 0)
+			{
+				return true;
+			}
 
-			if (client_fd == -1)
+			int error = SSL_get_error(ssl, result);
+
+			#ifdef SSL_ERROR_WANT_ASYNC
+			if (error == SSL_ERROR_WANT_ASYNC)
 			{
-				perror("accept");
+				if (!wait_for_async_job(ssl, deadline))
+				{
+					return false;
+				}
 				continue;
 			}
+			#endif /* SSL_ERROR_WANT_ASYNC */
 
-			SSL* ssl = SSL_new(ctx_);
-			SSL_set_fd(ssl, client_fd);
+			if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+			{
+				return false;
+			}
 
-			if (SSL_accept(ssl) <= 0)
+			long long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (left <= 0)
 			{
-				SSL_free(ssl);
-				close(client_fd);
-				continue;
+				debug("TLS handshake from %s did not complete within the handshake timeout", peer_address(SSL_get_fd(ssl)).c_str());
+				return false;
 			}
 
-			// Spawn a new thread to handle the SSL connection
-			std::thread([this, ssl]() {
-				handle_request_ssl(ssl);
-				SSL_shutdown(ssl);
-				SSL_free(ssl);
-			}).detach();
+			struct pollfd descriptor;
+			descriptor.fd = SSL_get_fd(ssl);
+			descriptor.events = error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT;
+			descriptor.revents = 0;
+
+			// Round up, so the last wait does not busy loop on a zero timeout
+			int ready = poll(&descriptor, 1, static_cast<int>(left) + 1);
+			if (ready == -1 && errno != EINTR)
+			{
+				return false;
+			}
+		}
+	}
+
+	/**
+	 * Waits on the file descriptors of the async job paused in SSL_accept
+	 *
+	 * Engines that do not expose wait descriptors are retried after a short sleep,
+	 * so a job that never completes holds a handshake worker until the deadline
+	 * without spinning it.
+	 *
+	 * @param SSL* ssl The SSL object whose handshake is paused
+	 * @param std::chrono::steady_clock::time_point deadline When the handshake times out
+	 *
+	 * @return bool Whether the job became ready before the handshake timeout
+	 */
+	bool ServerSSL::wait_for_async_job(SSL* ssl, std::chrono::steady_clock::time_point deadline)
+	{
+		#ifdef SSL_MODE_ASYNC
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+		{
+			debug("Async TLS handshake job did not complete within the handshake timeout");
+			return false;
+		}
+
+		size_t num_fds = 0;
+		if (!SSL_get_all_async_fds(ssl, nullptr, &num_fds) || num_fds == 0)
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			return true;
 		}
+
+		std::vector<OSSL_ASYNC_FD> async_fds(num_fds);
+		SSL_get_all_async_fds(ssl, async_fds.data(), &num_fds);
+
+		std::vector<struct pollfd> poll_fds(num_fds);
+		for (size_t i = 0; i < num_fds; ++i)
+		{
+			poll_fds[i].fd = async_fds[i];
+			poll_fds[i].events = POLLIN;
+			poll_fds[i].revents = 0;
+		}
+
+		// Round up, so the last wait does not busy loop on a zero timeout
+		int timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+		return poll(poll_fds.data(), poll_fds.size(), timeout) > 0;
+		#else
+		(void)ssl;
+		(void)deadline;
+		return false;
+		#endif /* SSL_MODE_ASYNC */
 	}
 
 	/**
 	 * Handles an incoming SSL request on the specified SSL socket
 	 *
 	 * @param SSL* ssl The SSL socket representing the encrypted client connection
+	 * @param const std::string& address The client address
 	 *
 	 * @return void
 	 */
-	void ServerSSL::handle_request_ssl(SSL* ssl)
+	void ServerSSL::handle_request_ssl(SSL* ssl, const std::string& address)
 	{
-		char buffer[1024] = {0};
-		int valread = SSL_read(ssl, buffer, 1024);
+		set_read_timeout(SSL_get_fd(ssl));
 
-		if (valread <= 0)
-		{
-			return;
-		}
+		SSLConnection client(ssl);
+		handle_connection(client, "https", address);
 
-		// Get the current time
-		std::string current_time = get_formatted_time();
+		SSL_shutdown(ssl);
+		close(SSL_get_fd(ssl));
+	}
 
-		std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
-		response += current_time + " - received:\n\n";
-		response += buffer;
+	/**
+	 * SSLConnection constructor
+	 *
+	 * @param SSL* ssl The TLS session
+	 *
+	 * @return void
+	 */
+	SSLConnection::SSLConnection(SSL* ssl)
+		: ssl_(ssl)
+	{
+	}
 
-		// Send response to client
-		int bytes_written = SSL_write(ssl, response.c_str(), response.size());
+	/**
+	 * Reads decrypted bytes from the session
+	 *
+	 * When busy polling and no decrypted bytes are buffered, the thread spins
+	 * until the socket is readable before SSL_read() blocks on it.
+	 *
+	 * @param char* buffer The buffer to read into
+	 * @param size_t size The size of the buffer
+	 *
+	 * @return ssize_t The number of bytes read, 0 at end of stream, or -1 on error
+	 */
+	ssize_t SSLConnection::read(char* buffer, size_t size)
+	{
+		if (SSL_pending(ssl_) == 0)
+		{
+			spin_until_readable(SSL_get_fd(ssl_));
+		}
 
-		if (bytes_written <= 0)
+		int received = SSL_read(ssl_, buffer, size > INT_MAX ? INT_MAX : static_cast<int>(size));
+		if (received > 0)
 		{
-			// Handle error
-			std::cerr << "Failed to send response to client" << std::endl;
+			return received;
 		}
 
-		SSL_shutdown(ssl);
-		close(SSL_get_fd(ssl));
+		return SSL_get_error(ssl_, received) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+	}
+
+	/**
+	 * Encrypts and writes bytes to the session
+	 *
+	 * @param const char* data The bytes to write
+	 * @param size_t size The number of bytes to write
+	 *
+	 * @return ssize_t The number of bytes written, or -1 on error
+	 */
+	ssize_t SSLConnection::write(const char* data, size_t size)
+	{
+		int written = SSL_write(ssl_, data, size > INT_MAX ? INT_MAX : static_cast<int>(size));
+
+		return written > 0 ? written : -1;
+	}
+
+	/**
+	 * Returns the session's socket file descriptor
+	 *
+	 * @return int The file descriptor
+	 */
+	int SSLConnection::fd() const
+	{
+		return SSL_get_fd(ssl_);
+	}
+
+	/**
+	 * Returns the number of decrypted bytes buffered in the session
+	 *
+	 * @return size_t The number of bytes readable without waiting on the socket
+	 */
+	size_t SSLConnection::pending() const
+	{
+		return SSL_pending(ssl_);
 	}
 }
 
@@ -40,10 +40,15 @@
 #include <string.h>
 #include <thread>
 #include <stdexcept>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
 #include "settings.h"
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include "server.h"
+#include "thread_pool.h"
 
 /**
  * @namespace HTTP
@@ -52,6 +57,60 @@
 namespace HTTP
 {
 
+	/**
+	 * @struct Certificate
+	 *
+	 * A certificate and private key pair served by ServerSSL
+	 */
+	struct Certificate
+	{
+		std::string cert_file;
+		std::string key_file;
+	};
+
+	/**
+	 * @struct TLSSettings
+	 *
+	 * Protocol tuning applied to every context of a ServerSSL listener. Empty values keep the OpenSSL defaults.
+	 */
+	struct TLSSettings
+	{
+		std::string ciphers;
+		std::string ciphersuites;
+		std::string min_version;
+		std::string max_version;
+		std::string curves;
+		std::vector<std::string> alpn;
+	};
+
+	/**
+	 * @brief A Connection over an established TLS session
+	 *
+	 * The session and its socket are not freed by this class; its owner stays responsible for them.
+	 */
+	class SSLConnection : public Connection
+	{
+		public:
+			/**
+			 * Construct an SSLConnection over a session that completed its handshake
+			 *
+			 * @param SSL* ssl The TLS session
+			 */
+			explicit SSLConnection(SSL* ssl);
+
+			virtual ssize_t read(char* buffer, size_t size) override;
+			virtual ssize_t write(const char* data, size_t size) override;
+			virtual int fd() const override;
+			virtual size_t pending() const override;
+
+		protected:
+
+			/**
+			 * @var SSL* The TLS session
+			 */
+			SSL* ssl_;
+	};
+
 	/**
 	 * @brief Overloads the HTTP server implementation with encryption
 	 *
@@ -73,6 +132,20 @@ namespace HTTP
 			 */
 			ServerSSL(const char* address, const char* port, const std::string& cert_file, const std::string& key_file);
 
+			/**
+			 * Construct an instance of ServerSSL that serves several certificates, selected per connection by SNI
+			 *
+			 * The first certificate is used when the client sends no server name, or one that no certificate covers.
+			 *
+			 * @param const char* address The IP address to listen on, or nullptr to listen on all available addresses
+			 * @param const char* port The port to listen on
+			 * @param const std::vector<Certificate>& certificates The certificate and key pairs to serve
+			 * @param const TLSSettings& settings The protocol versions, ciphers, curves and ALPN protocols to offer
+			 *
+			 * return void
+			 */
+			ServerSSL(const char* address, const char* port, const std::vector<Certificate>& certificates, const TLSSettings& settings = TLSSettings());
+
 			/**
 			 * Destruct the ServerSSL and release any resources
 			 */
@@ -88,31 +161,166 @@ namespace HTTP
 			 */
 			virtual void run() override;
 
+			/**
+			 * Reload the certificate and key files, swapping the new contexts in for new connections
+			 *
+			 * @note This method is safe to call from any thread while the server is running.
+			 *
+			 * return void
+			 */
+			void reload();
+
 		protected:
 
+			/**
+			 * @struct Contexts
+			 *
+			 * The loaded SSL/TLS contexts, indexed by the host names their certificates cover
+			 */
+			struct Contexts
+			{
+				/**
+				 * @var std::shared_ptr<SSL_CTX> The context connections start with, from the first certificate
+				 */
+				std::shared_ptr<SSL_CTX> fallback;
+
+				/**
+				 * @var std::unordered_map<std::string, std::shared_ptr<SSL_CTX>> Contexts by lower-case host name, including wildcards such as "*.example.com"
+				 */
+				std::unordered_map<std::string, std::shared_ptr<SSL_CTX>> by_name;
+			};
+
+			/**
+			 * Create an SSL/TLS context from a certificate and key file
+			 *
+			 * @param const Certificate& certificate The certificate and key to load
+			 *
+			 * @return std::shared_ptr<SSL_CTX> The loaded context
+			 */
+			std::shared_ptr<SSL_CTX> create_context(const Certificate& certificate) const;
+
+			/**
+			 * Create the SSL/TLS contexts for every configured certificate
+			 *
+			 * @return std::shared_ptr<const Contexts> The loaded contexts
+			 */
+			std::shared_ptr<const Contexts> create_contexts() const;
+
+			/**
+			 * Returns the host names a context's certificate is valid for
+			 *
+			 * @param SSL_CTX* ctx The context holding the certificate
+			 *
+			 * @return std::vector<std::string> The lower-case DNS subject alternative names, or the common name if there are none
+			 */
+			static std::vector<std::string> certificate_names(SSL_CTX* ctx);
+
+			/**
+			 * Apply the listener's TLS settings to a context
+			 *
+			 * @param SSL_CTX* ctx The context to configure
+			 *
+			 * @return void
+			 */
+			void apply_settings(SSL_CTX* ctx) const;
+
+			/**
+			 * Returns the OpenSSL protocol version constant for a version such as "1.2"
+			 *
+			 * @param const std::string& version The version name
+			 *
+			 * @return int The matching protocol version constant
+			 */
+			static int protocol_version(const std::string& version);
+
+			/**
+			 * ALPN callback choosing the first protocol in the server's preference list that the client offers
+			 *
+			 * @param SSL* ssl The connection being handshaken
+			 * @param const unsigned char** out The selected protocol
+			 * @param unsigned char* outlen The length of the selected protocol
+			 * @param const unsigned char* in The client's protocols in wire format
+			 * @param unsigned int inlen The length of the client's protocols
+			 * @param void* arg The ServerSSL instance
+			 *
+			 * @return int SSL_TLSEXT_ERR_OK if a protocol was chosen, SSL_TLSEXT_ERR_NOACK otherwise
+			 */
+			static int select_alpn(SSL* ssl, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void* arg);
+
+			/**
+			 * SNI callback switching a connection to the context whose certificate matches the requested server name
+			 *
+			 * @param SSL* ssl The connection being handshaken
+			 * @param int* alert The alert to send on failure
+			 * @param void* arg The Contexts the connection was created from
+			 *
+			 * @return int SSL_TLSEXT_ERR_OK, as unknown names fall back to the first certificate
+			 */
+			static int select_context(SSL* ssl, int* alert, void* arg);
+
+			/**
+			 * Perform the TLS handshake for an accepted client and hand the connection off to a handler thread
+			 *
+			 * @param int client_fd The file descriptor for the connected client socket
+			 *
+			 * @return void
+			 */
+			void handshake(int client_fd);
+
+			/**
+			 * Run SSL_accept to completion, waiting on the socket or on async crypto jobs when they pause it
+			 *
+			 * @param SSL* ssl The SSL object for the client connection, on a non-blocking socket
+			 * @param std::chrono::steady_clock::time_point deadline When the handshake times out
+			 *
+			 * @return bool Whether the handshake succeeded
+			 */
+			bool accept_ssl(SSL* ssl, std::chrono::steady_clock::time_point deadline);
+
+			/**
+			 * Wait until the async job paused in an SSL_accept call is ready to resume
+			 *
+			 * @param SSL* ssl The SSL object whose handshake is paused
+			 * @param std::chrono::steady_clock::time_point deadline When the handshake times out
+			 *
+			 * @return bool Whether the job became ready before the handshake timeout
+			 */
+			bool wait_for_async_job(SSL* ssl, std::chrono::steady_clock::time_point deadline);
+
 			/**
 			 * Handle an incoming encrypted HTTPS request
 			 *
 			 * @param SSL* ssl The SSL object representing the encrypted client connection
+			 * @param const std::string& address The client address
 			 *
 			 * @return bool
 			 */
-			void handle_request_ssl(SSL* ssl);
+			void handle_request_ssl(SSL* ssl, const std::string& address);
+
+			/**
+			 * @var std::vector<Certificate> The SSL/TLS certificate and private key files, the first being the default
+			 */
+			std::vector<Certificate> certificates_;
+
+			/**
+			 * @var TLSSettings The protocol tuning for this listener
+			 */
+			TLSSettings settings_;
 
 			/**
-			 * @var std::string The path to the SSL/TLS certificate file
+			 * @var std::string The ALPN protocols in wire format, each prefixed by its length
 			 */
-			std::string cert_file_;
+			std::string alpn_protocols_;
 
 			/**
-			 * @var std::string The path to the SSL/TLS private key file
+			 * @var std::shared_ptr<const Contexts> The SSL/TLS contexts for new connections, swapped atomically on reload
 			 */
-			std::string key_file_;
+			std::shared_ptr<const Contexts> contexts_;
 
 			/**
-			 * @var SSL_CTX* The SSL/TLS context for the server
+			 * @var ThreadPool Workers that run TLS handshakes so the accept loop never blocks on crypto
 			 */
-			SSL_CTX* ctx_;
+			ThreadPool handshake_pool_;
 	};
 }
 
@@ -0,0 +1,269 @@
+/*
+ * websocket.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the WebSocket framing functions and classes.
+ */
+
+#include <string.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+#include "websocket.h"
+
+/**
+ * @namespace HTTP
+ * This namespace contains a variety of classes and functions for working with HTTP
+ */
+namespace HTTP
+{
+
+	/**
+	 * @namespace WebSocket
+	 * Framing for connections upgraded to the WebSocket protocol
+	 */
+	namespace WebSocket
+	{
+
+		/**
+		 * XORs data with a 4-byte masking key
+		 *
+		 * The key is first rotated to line up with offset, after which every 16-byte block
+		 * (and every 8-byte word) starts on a key boundary and can be XORed in one step.
+		 *
+		 * @param char* data The bytes to mask or unmask in place
+		 * @param size_t length The number of bytes
+		 * @param const unsigned char* key The 4-byte masking key
+		 * @param size_t offset The position of data[0] within the frame payload
+		 *
+		 * @return void
+		 */
+		void apply_mask(char* data, size_t length, const unsigned char* key, size_t offset)
+		{
+			unsigned char rotated[16];
+			for (size_t i = 0; i < sizeof(rotated); ++i)
+			{
+				rotated[i] = key[(offset + i) % 4];
+			}
+
+			size_t i = 0;
+
+			#ifdef __SSE2__
+			__m128i wide_mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rotated));
+			for (; i + 16 <= length; i += 16)
+			{
+				__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(block, wide_mask));
+			}
+			#endif /* __SSE2__ */
+
+			uint64_t word_mask;
+			memcpy(&word_mask, rotated, sizeof(word_mask));
+			for (; i + 8 <= length; i += 8)
+			{
+				uint64_t word;
+				memcpy(&word, data + i, sizeof(word));
+				word ^= word_mask;
+				memcpy(data + i, &word, sizeof(word));
+			}
+
+			for (; i < length; ++i)
+			{
+				data[i] ^= rotated[i % 4];
+			}
+		}
+
+		/**
+		 * Encodes a single frame
+		 *
+		 * @param int opcode The frame opcode
+		 * @param const std::string& payload The unmasked payload
+		 * @param bool fin Whether this is the final frame of a message
+		 * @param const unsigned char* mask_key The 4-byte masking key for client frames, or nullptr for server frames
+		 *
+		 * @return std::string The encoded frame
+		 */
+		std::string encode_frame(int opcode, const std::string& payload, bool fin, const unsigned char* mask_key)
+		{
+			std::string frame;
+			frame.reserve(payload.size() + 14);
+
+			frame += static_cast<char>((fin ? 0x80 : 0x00) | (opcode & 0x0F));
+
+			unsigned char mask_bit = mask_key != nullptr ? 0x80 : 0x00;
+			uint64_t length = payload.size();
+			if (length < 126)
+			{
+				frame += static_cast<char>(mask_bit | length);
+			}
+			else if (length <= 0xFFFF)
+			{
+				frame += static_cast<char>(mask_bit | 126);
+				frame += static_cast<char>((length >> 8) & 0xFF);
+				frame += static_cast<char>(length & 0xFF);
+			}
+			else
+			{
+				frame += static_cast<char>(mask_bit | 127);
+				for (int shift = 56; shift >= 0; shift -= 8)
+				{
+					frame += static_cast<char>((length >> shift) & 0xFF);
+				}
+			}
+
+			if (mask_key == nullptr)
+			{
+				frame += payload;
+				return frame;
+			}
+
+			frame.append(reinterpret_cast<const char*>(mask_key), 4);
+			size_t payload_start = frame.size();
+			frame += payload;
+			apply_mask(&frame[payload_start], payload.size(), mask_key);
+
+			return frame;
+		}
+
+		/**
+		 * FrameParser constructor
+		 *
+		 * @param size_t max_payload The largest payload kept
+		 *
+		 * @return void
+		 */
+		FrameParser::FrameParser(size_t max_payload)
+			: max_payload_(max_payload),
+			  skipping_(0)
+		{
+		}
+
+		/**
+		 * Appends bytes read from the connection
+		 *
+		 * @param const char* data The bytes read
+		 * @param size_t size The number of bytes
+		 *
+		 * @return void
+		 */
+		void FrameParser::feed(const char* data, size_t size)
+		{
+			buffer_.append(data, size);
+			skip();
+		}
+
+		/**
+		 * Discards buffered bytes belonging to an oversized payload
+		 *
+		 * @return void
+		 */
+		void FrameParser::skip()
+		{
+			size_t skipped = static_cast<size_t>(std::min<uint64_t>(skipping_, buffer_.size()));
+			buffer_.erase(0, skipped);
+			skipping_ -= skipped;
+		}
+
+		/**
+		 * Takes the next complete frame
+		 *
+		 * @param[out] frame The decoded frame
+		 *
+		 * @return bool Whether a frame was available
+		 */
+		bool FrameParser::next(Frame& frame)
+		{
+			if (skipping_ > 0 || buffer_.size() < 2)
+			{
+				return false;
+			}
+
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(buffer_.data());
+			bool masked = (bytes[1] & 0x80) != 0;
+			uint64_t length = bytes[1] & 0x7F;
+
+			size_t header_size = 2;
+			if (length == 126)
+			{
+				header_size += 2;
+			}
+			else if (length == 127)
+			{
+				header_size += 8;
+			}
+			if (masked)
+			{
+				header_size += 4;
+			}
+
+			if (buffer_.size() < header_size)
+			{
+				return false;
+			}
+
+			if (length == 126)
+			{
+				length = (static_cast<uint64_t>(bytes[2]) << 8) | bytes[3];
+			}
+			else if (length == 127)
+			{
+				length = 0;
+				for (int i = 0; i < 8; ++i)
+				{
+					length = (length << 8) | bytes[2 + i];
+				}
+			}
+
+			bool oversized = length > max_payload_;
+			if (!oversized && buffer_.size() - header_size < length)
+			{
+				return false;
+			}
+
+			frame.fin = (bytes[0] & 0x80) != 0;
+			frame.opcode = bytes[0] & 0x0F;
+			frame.masked = masked;
+			frame.length = length;
+			frame.payload.clear();
+
+			if (oversized)
+			{
+				buffer_.erase(0, header_size);
+				skipping_ = length;
+				skip();
+				return true;
+			}
+
+			unsigned char mask_key[4];
+			if (masked)
+			{
+				memcpy(mask_key, bytes + header_size - 4, 4);
+			}
+
+			frame.payload.assign(buffer_, header_size, static_cast<size_t>(length));
+			buffer_.erase(0, header_size + static_cast<size_t>(length));
+
+			if (masked && !frame.payload.empty())
+			{
+				apply_mask(&frame.payload[0], frame.payload.size(), mask_key);
+			}
+
+			return true;
+		}
+	}
+}
@@ -0,0 +1,295 @@
+/*
+ * huge_pages.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the HugePageBuffer class, and
+ * the functions asking the kernel for huge pages and counting those it gave.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "huge_pages.h"
+
+/**
+ * Asks the kernel to back a mapping with transparent huge pages
+ *
+ * The advice fails where transparent huge pages are disabled, and file mappings
+ * only get them on kernels built with CONFIG_READ_ONLY_THP_FOR_FS, once
+ * khugepaged gets round to collapsing them.
+ *
+ * @param void* address The start of the mapping
+ * @param size_t size Its length
+ *
+ * @return bool Whether the kernel took the advice, which it may still not act on
+ */
+bool advise_huge_pages(void* address, size_t size)
+{
+	#ifdef MADV_HUGEPAGE
+	return madvise(address, size, MADV_HUGEPAGE) == 0;
+	#else
+	(void)address;
+	(void)size;
+	return false;
+	#endif /* MADV_HUGEPAGE */
+}
+
+/**
+ * Returns how much of a range of memory the kernel currently backs with huge pages
+ *
+ * /proc/self/smaps lists every mapping with the kilobytes of it on transparent
+ * huge pages (AnonHugePages for anonymous memory, FilePmdMapped for files) and
+ * on hugetlbfs pages. The counts of the mappings overlapping the range are
+ * summed, so a neighbouring mapping the kernel merged with it may be counted too.
+ *
+ * @param const void* address The start of the range
+ * @param size_t size Its length
+ *
+ * @return size_t The number of bytes on huge pages, at most size
+ */
+size_t huge_page_bytes(const void* address, size_t size)
+{
+	if (address == nullptr || size == 0)
+	{
+		return 0;
+	}
+
+	std::ifstream smaps("/proc/self/smaps");
+	uintptr_t start = reinterpret_cast<uintptr_t>(address);
+	uintptr_t end = start + size;
+	bool overlapping = false;
+	size_t bytes = 0;
+
+	std::string line;
+	while (std::getline(smaps, line))
+	{
+		// Each mapping starts with its address range, such as "7f12a0000000-7f12a0400000 rw-p ..."
+		size_t dash = line.find('-');
+		if (dash != std::string::npos && dash > 0 && line.find_first_not_of("0123456789abcdef") == dash)
+		{
+			uintptr_t from = std::strtoull(line.c_str(), nullptr, 16);
+			uintptr_t to = std::strtoull(line.c_str() + dash + 1, nullptr, 16);
+			overlapping = from < end && to > start;
+			continue;
+		}
+
+		if (overlapping && (line.compare(0, 14, "AnonHugePages:") == 0 || line.compare(0, 14, "FilePmdMapped:") == 0
+			|| line.compare(0, 16, "Private_Hugetlb:") == 0 || line.compare(0, 15, "Shared_Hugetlb:") == 0))
+		{
+			bytes += std::strtoull(line.c_str() + line.find(':') + 1, nullptr, 10) * 1024;
+		}
+	}
+
+	return std::min(bytes, size);
+}
+
+/**
+ * HugePageBuffer constructor
+ *
+ * @param bool huge_pages Whether to ask for huge pages
+ *
+ * @return void
+ */
+HugePageBuffer::HugePageBuffer(bool huge_pages)
+	: data_(nullptr),
+	  size_(0),
+	  capacity_(0),
+	  huge_pages_(huge_pages),
+	  hugetlb_(false)
+{
+}
+
+/**
+ * HugePageBuffer destructor
+ *
+ * @return void
+ */
+HugePageBuffer::~HugePageBuffer()
+{
+	clear();
+}
+
+/**
+ * Sets whether to ask for huge pages, which applies from the next time the buffer grows
+ *
+ * @param bool huge_pages Whether to ask for huge pages
+ *
+ * @return void
+ */
+void HugePageBuffer::set_huge_pages(bool huge_pages)
+{
+	huge_pages_ = huge_pages;
+}
+
+/**
+ * Appends bytes, growing the buffer if needed
+ *
+ * The capacity doubles as it grows, so appending is amortised constant time
+ * like std::string's, and each growth copies the data once into a new mapping.
+ *
+ * @param const char* data The bytes
+ * @param size_t size How many
+ *
+ * @return void
+ *
+ * @throws std::bad_alloc If no memory could be mapped
+ */
+void HugePageBuffer::append(const char* data, size_t size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	if (size_ + size > capacity_)
+	{
+		reserve(std::max(size_ + size, capacity_ * 2));
+	}
+
+	memcpy(data_ + size_, data, size);
+	size_ += size;
+}
+
+/**
+ * Moves the data to a new mapping of at least the given capacity
+ *
+ * @param size_t capacity The number of bytes needed
+ *
+ * @return void
+ *
+ * @throws std::bad_alloc If no memory could be mapped
+ */
+void HugePageBuffer::reserve(size_t capacity)
+{
+	size_t page = huge_pages_ ? HUGE_PAGE_SIZE : static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	capacity = (capacity + page - 1) / page * page;
+
+	char* memory = nullptr;
+	bool hugetlb = false;
+
+	#ifdef MAP_HUGETLB
+	if (huge_pages_)
+	{
+		void* mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (mapping != MAP_FAILED)
+		{
+			memory = static_cast<char*>(mapping);
+			hugetlb = true;
+		}
+	}
+	#endif /* MAP_HUGETLB */
+
+	if (memory == nullptr)
+	{
+		// Transparent huge pages only back whole aligned huge pages, so map one extra to align the start
+		size_t slack = huge_pages_ ? HUGE_PAGE_SIZE : 0;
+		void* mapping = mmap(nullptr, capacity + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapping == MAP_FAILED)
+		{
+			throw std::bad_alloc();
+		}
+
+		memory = static_cast<char*>(mapping);
+		if (slack > 0)
+		{
+			char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(memory) + slack - 1) & ~static_cast<uintptr_t>(slack - 1));
+			if (aligned > memory)
+			{
+				munmap(memory, aligned - memory);
+			}
+			if (memory + slack > aligned)
+			{
+				munmap(aligned + capacity, memory + slack - aligned);
+			}
+
+			memory = aligned;
+			advise_huge_pages(memory, capacity);
+		}
+	}
+
+	if (size_ > 0)
+	{
+		memcpy(memory, data_, size_);
+	}
+	if (data_ != nullptr)
+	{
+		munmap(data_, capacity_);
+	}
+
+	data_ = memory;
+	capacity_ = capacity;
+	hugetlb_ = hugetlb;
+}
+
+/**
+ * Unmaps the whole pages past the end of the data
+ *
+ * When huge pages were asked for, the mapping is only cut at a huge page
+ * boundary, which hugetlbfs requires and which keeps the last huge page whole.
+ *
+ * @return void
+ */
+void HugePageBuffer::shrink()
+{
+	if (size_ == 0)
+	{
+		clear();
+		return;
+	}
+
+	size_t page = huge_pages_ || hugetlb_ ? HUGE_PAGE_SIZE : static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t keep = (size_ + page - 1) / page * page;
+	if (keep < capacity_)
+	{
+		munmap(data_ + keep, capacity_ - keep);
+		capacity_ = keep;
+	}
+}
+
+/**
+ * Removes every byte and unmaps the memory
+ *
+ * @return void
+ */
+void HugePageBuffer::clear()
+{
+	if (data_ != nullptr)
+	{
+		munmap(data_, capacity_);
+	}
+
+	data_ = nullptr;
+	size_ = 0;
+	capacity_ = 0;
+	hugetlb_ = false;
+}
+
+/**
+ * Returns how many bytes of the buffer the kernel currently backs with huge pages
+ *
+ * @return size_t The number of bytes, at most size()
+ */
+size_t HugePageBuffer::huge_bytes() const
+{
+	return std::min(huge_page_bytes(data_, capacity_), size_);
+}
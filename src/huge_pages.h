@@ -0,0 +1,190 @@
+/*
+ * huge_pages.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the HugePageBuffer class, and
+ * the functions asking the kernel for huge pages and counting those it gave.
+ */
+
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <cstddef>
+
+/**
+ * @var size_t The size of a huge page on x86-64 and most arm64 kernels
+ */
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/**
+ * Asks the kernel to back a mapping with transparent huge pages
+ *
+ * @param void* address The start of the mapping
+ * @param size_t size Its length
+ *
+ * @return bool Whether the kernel took the advice, which it may still not act on
+ */
+bool advise_huge_pages(void* address, size_t size);
+
+/**
+ * Returns how much of a range of memory the kernel currently backs with huge pages
+ *
+ * @param const void* address The start of the range
+ * @param size_t size Its length
+ *
+ * @return size_t The number of bytes on huge pages
+ */
+size_t huge_page_bytes(const void* address, size_t size);
+
+/**
+ * @brief A growable byte buffer in its own anonymous mapping, optionally on huge pages
+ *
+ * With huge pages, the buffer is first taken from the hugetlbfs pool with
+ * MAP_HUGETLB, which only succeeds when the administrator has reserved pages
+ * (vm.nr_hugepages). Otherwise it is mapped normally, aligned to a huge page
+ * and advised for transparent huge pages, which the kernel grants as it sees
+ * fit; huge_bytes() tells what was actually obtained.
+ */
+class HugePageBuffer
+{
+	public:
+		/**
+		 * Construct an empty HugePageBuffer
+		 *
+		 * @param bool huge_pages Whether to ask for huge pages
+		 */
+		explicit HugePageBuffer(bool huge_pages = false);
+
+		/**
+		 * Destruct the HugePageBuffer, unmapping its memory
+		 */
+		~HugePageBuffer();
+
+		/**
+		 * Set whether to ask for huge pages, which applies from the next time the buffer grows
+		 *
+		 * @param bool huge_pages Whether to ask for huge pages
+		 *
+		 * @return void
+		 */
+		void set_huge_pages(bool huge_pages);
+
+		/**
+		 * Append bytes, growing the buffer if needed
+		 *
+		 * @param const char* data The bytes
+		 * @param size_t size How many
+		 *
+		 * @return void
+		 *
+		 * @throws std::bad_alloc If no memory could be mapped
+		 */
+		void append(const char* data, size_t size);
+
+		/**
+		 * Returns the bytes appended so far
+		 *
+		 * @return const char* The bytes
+		 */
+		const char* data() const
+		{
+			return data_ != nullptr ? data_ : "";
+		}
+
+		/**
+		 * Returns the number of bytes appended so far
+		 *
+		 * @return size_t The number of bytes
+		 */
+		size_t size() const
+		{
+			return size_;
+		}
+
+		/**
+		 * Unmap the whole pages past the end of the data
+		 *
+		 * @return void
+		 */
+		void shrink();
+
+		/**
+		 * Remove every byte and unmap the memory
+		 *
+		 * @return void
+		 */
+		void clear();
+
+		/**
+		 * Returns whether the buffer came from the hugetlbfs pool
+		 *
+		 * @return bool Whether it is on reserved huge pages
+		 */
+		bool hugetlb() const
+		{
+			return hugetlb_;
+		}
+
+		/**
+		 * Returns how many bytes of the buffer the kernel currently backs with huge pages
+		 *
+		 * @return size_t The number of bytes
+		 */
+		size_t huge_bytes() const;
+
+	private:
+		HugePageBuffer(const HugePageBuffer&);
+		HugePageBuffer& operator=(const HugePageBuffer&);
+
+		/**
+		 * Moves the data to a new mapping of at least the given capacity
+		 *
+		 * @param size_t capacity The number of bytes needed
+		 *
+		 * @return void
+		 *
+		 * @throws std::bad_alloc If no memory could be mapped
+		 */
+		void reserve(size_t capacity);
+
+		/**
+		 * @var char* The mapping, or nullptr before anything was appended
+		 */
+		char* data_;
+
+		/**
+		 * @var size_t The number of bytes appended
+		 */
+		size_t size_;
+
+		/**
+		 * @var size_t The length of the mapping
+		 */
+		size_t capacity_;
+
+		/**
+		 * @var bool Whether to ask for huge pages
+		 */
+		bool huge_pages_;
+
+		/**
+		 * @var bool Whether the mapping came from the hugetlbfs pool
+		 */
+		bool hugetlb_;
+};
+
+#endif /* HUGE_PAGES_H */
@@ -23,19 +23,45 @@
 #include <thread>
 #include <memory>
 #include <string>
+#include <vector>
+#include <csignal>
+#include <pthread.h>
 #include "config.h"
 #include "settings.h"
+#include "affinity.h"
+#include "busy_poll.h"
 #include "functions.h"
 #include "cli_arguments.h"
+#include "config_file.h"
 #include "server.h"
+#include "capture.h"
+#include "proxy.h"
+#include "replay.h"
 #if SSL_SUPPORT == 1
 #include "server_ssl.h"
 #endif /* SSL_SUPPORT */
 
 /**
- * @var bool verbose Whether verbose mode is enabled or not. Defaults to false.
+ * Reads the configuration file, if any, and applies the command-line options on top
+ *
+ * @param const Options& opts The parsed command-line options
+ *
+ * @return Settings The validated settings
+ *
+ * @throws std::runtime_error If the configuration file or an option is invalid
  */
-bool verbose = false;
+static Settings load_settings(const Options& opts)
+{
+	Settings loaded;
+	if (!opts.config_file.empty())
+	{
+		load_config_file(opts.config_file, loaded);
+	}
+	apply_options(opts, loaded);
+	validate_settings(loaded);
+
+	return loaded;
+}
 
 /**
  * The main function of the HAperf command-line application
@@ -51,17 +77,34 @@ int main(int argc, char* argv[])
 	Commands cmds;
 	parse_arguments(argc, argv, opts, cmds);
 
-	// Set verbose mode
-	if (opts.verbose)
+	try
 	{
-		verbose = true;
+		publish_settings(load_settings(opts));
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "\033[1mError:\033[0m " << e.what() << "\n\n";
+		exit(1);
+	}
+
+	const Settings& startup = settings();
+
+	try
+	{
+		configure_placement(startup.cpus, startup.numa);
+		configure_busy_poll(static_cast<unsigned int>(startup.busy_poll));
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "\033[1mError:\033[0m " << e.what() << "\n\n";
+		exit(1);
 	}
 
 	// Check if record options are valid
 	#if SSL_SUPPORT == 1
 	if (cmds.record)
 	{
-		if (opts.cert_file.empty() || opts.cert_key.empty())
+		if (startup.cert_files.empty() || startup.cert_keys.empty())
 		{
 			std::cerr << "\033[1mError:\033[0m Certificate file and key are required to run this command.\n\n";
 			exit(1);
@@ -69,8 +112,50 @@ int main(int argc, char* argv[])
 	}
 	#endif /* SSL_SUPPORT */
 
+	if (cmds.replay)
+	{
+		std::string target_host;
+		std::string target_port;
+		if (startup.capture_file.empty() || !split_host_port(startup.target, target_host, target_port))
+		{
+			std::cerr << "\033[1mError:\033[0m A capture file and a target are required to run this command.\n\n";
+			exit(1);
+		}
+
+		if (startup.protocol == "h3" && is_unix_address(startup.target))
+		{
+			std::cerr << "\033[1mError:\033[0m HTTP/3 runs over UDP, so it cannot be replayed against a Unix domain socket.\n\n";
+			exit(1);
+		}
+
+		#if HTTP3_SUPPORT != 1
+		if (startup.protocol == "h3")
+		{
+			std::cerr << "\033[1mError:\033[0m This build has no HTTP/3 support. It needs OpenSSL 3.2 or later and nghttp3.\n\n";
+			exit(1);
+		}
+		#endif /* HTTP3_SUPPORT */
+
+		try
+		{
+			Replay::Engine engine(target_host, target_port);
+			engine.set_protocol(startup.protocol == "h3" ? Replay::HTTP_3 : (startup.protocol == "h2" ? Replay::HTTP_2 : Replay::HTTP_1_1));
+			engine.set_spin_budget(startup.spin_budget);
+			engine.set_huge_pages(startup.huge_pages);
+			engine.load(startup.capture_file);
+			engine.run();
+			engine.report(std::cout);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Error replaying capture: " << e.what() << std::endl;
+			exit(1);
+		}
+
+		return 0;
+	}
+
 	// If we don't have a main activity chosen, then there's not much to do
-	// This check if just until we support other commands
 	if (!cmds.record)
 	{
 		std::cout << "Invalid request. For information on usage: " << argv[0] << " --help" << std::endl;
@@ -78,28 +163,122 @@ int main(int argc, char* argv[])
 	}
 
 	// Determine address and port to use
-	std::string address_to_use = opts.address.empty() ? "::" : opts.address;
-	std::string port_to_use = opts.port.empty() ? "80" : opts.port;
-	std::string cert_to_use = opts.cert_file.empty() ? "ssl/server.crt" : opts.cert_file;
-	std::string key_to_use = opts.cert_key.empty() ? "ssl/server.key" : opts.cert_key;
+	std::string address_to_use = startup.address;
+	std::string port_to_use = startup.port;
+	#if SSL_SUPPORT == 1
+	std::vector<HTTP::Certificate> certificates_to_use;
+	for (size_t i = 0; i < startup.cert_files.size(); ++i)
+	{
+		certificates_to_use.push_back(HTTP::Certificate{startup.cert_files[i], startup.cert_keys[i]});
+	}
+
+	std::string ssl_address_to_use = startup.ssl_address.empty() ? address_to_use : startup.ssl_address;
+	std::string ssl_port_to_use = startup.ssl_port;
+
+	HTTP::TLSSettings tls_settings;
+	tls_settings.ciphers = startup.tls_ciphers;
+	tls_settings.ciphersuites = startup.tls_ciphersuites;
+	tls_settings.min_version = startup.tls_min_version;
+	tls_settings.max_version = startup.tls_max_version;
+	tls_settings.curves = startup.tls_curves;
+	tls_settings.alpn = startup.tls_alpn;
+	#endif /* SSL_SUPPORT */
+
+	// Block SIGHUP in every thread so it is only ever delivered to the reload thread via sigwait
+	sigset_t reload_signals;
+	sigemptyset(&reload_signals);
+	sigaddset(&reload_signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &reload_signals, nullptr);
+
+	// A peer closing its connection mid-write is reported by send() and handled there
+	signal(SIGPIPE, SIG_IGN);
 
 	try
 	{
+		std::shared_ptr<Capture::Writer> capture;
+		if (!startup.capture_file.empty())
+		{
+			capture.reset(new Capture::Writer(startup.capture_file));
+			capture->start_tcp_sampling(static_cast<unsigned int>(startup.tcp_info_interval));
+		}
+
+		std::shared_ptr<HTTP::Proxy> proxy;
+		std::string upstream_host;
+		std::string upstream_port;
+		if (split_host_port(startup.upstream, upstream_host, upstream_port))
+		{
+			proxy.reset(new HTTP::Proxy(upstream_host, upstream_port, capture));
+			if (startup.cache_size > 0)
+			{
+				proxy->set_cache(std::make_shared<HTTP::Cache>(startup.cache_size));
+			}
+		}
+
+		#if SSL_SUPPORT == 1
+		// Load the certificate up front so a bad certificate is reported before anything runs
+		std::shared_ptr<HTTP::ServerSSL> https_server(new HTTP::ServerSSL(ssl_address_to_use.c_str(), ssl_port_to_use.c_str(), certificates_to_use, tls_settings));
+		https_server->set_capture(capture);
+		https_server->set_proxy(proxy);
+		#endif /* SSL_SUPPORT */
+
 		// Start HTTP server on the determined address and port in its own thread
 		debug("Starting HTTP server on port %s", port_to_use.c_str());
 		std::thread http_thread([=](){
+			place_thread();
 			std::unique_ptr<HTTP::Server> http_server(new HTTP::Server(address_to_use.c_str(), port_to_use.c_str()));
+			http_server->set_capture(capture);
+			http_server->set_proxy(proxy);
 			http_server->run();
 		});
 
 		#if SSL_SUPPORT == 1
-		// Start HTTPS server on port 443 in its own thread
-		debug("Starting HTTPS server on port %s", "443");
+		// Start HTTPS server on the determined address and port in its own thread
+		debug("Starting HTTPS server on port %s", ssl_port_to_use.c_str());
 		std::thread https_thread([=]() {
-			std::unique_ptr<HTTP::ServerSSL> https_server(new HTTP::ServerSSL(address_to_use.c_str(), "443", cert_to_use.c_str(), key_to_use.c_str()));
+			place_thread();
 			https_server->run();
 		});
+		#endif /* SSL_SUPPORT */
+
+		// Reload the settings, certificate and key on SIGHUP, keeping the current ones if the new files are invalid
+		std::thread reload_thread([=]() {
+			while (true)
+			{
+				int signal_number;
+				if (sigwait(&reload_signals, &signal_number) != 0)
+				{
+					return;
+				}
+
+				try
+				{
+					Settings reloaded = load_settings(opts);
+					if (retain_startup_settings(reloaded, settings()))
+					{
+						std::cerr << "Listener, certificate list, TLS, upstream and capture settings changes take effect after a restart" << std::endl;
+					}
+					publish_settings(reloaded);
+				}
+				catch (const std::exception& e)
+				{
+					std::cerr << "Error reloading configuration: " << e.what() << std::endl;
+				}
+
+				#if SSL_SUPPORT == 1
+				try
+				{
+					https_server->reload();
+				}
+				catch (const std::exception& e)
+				{
+					std::cerr << "Error reloading certificate: " << e.what() << std::endl;
+				}
+				#endif /* SSL_SUPPORT */
+			}
+		});
+		reload_thread.detach();
 
+		#if SSL_SUPPORT == 1
 		// Wait for both threads to finish
 		http_thread.join();
 		https_thread.join();
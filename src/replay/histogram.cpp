@@ -0,0 +1,250 @@
+/*
+ * histogram.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the Replay::Histogram class.
+ */
+
+#include <algorithm>
+#include <string>
+#include "histogram.h"
+
+/**
+ * @namespace Replay
+ * Replaying captured traffic against a target server and measuring how it responds
+ */
+namespace Replay
+{
+
+	/**
+	 * @var size_t Buckets per power of two
+	 */
+	static const size_t SUB_BUCKETS = 4;
+
+	/**
+	 * @var size_t Buckets needed to cover every 64-bit value
+	 */
+	static const size_t BUCKETS = 64 * SUB_BUCKETS;
+
+	/**
+	 * @var size_t The widest bar printed, in characters
+	 */
+	static const size_t BAR_WIDTH = 40;
+
+	/**
+	 * Histogram constructor
+	 *
+	 * @return void
+	 */
+	Histogram::Histogram()
+		: counts_(BUCKETS, 0),
+		  count_(0),
+		  total_(0),
+		  max_(0)
+	{
+	}
+
+	/**
+	 * Returns the bucket a value falls in
+	 *
+	 * Values below 4 have a bucket each; above that, the two bits after the most
+	 * significant one pick one of four buckets within its power of two.
+	 *
+	 * @param uint64_t value The value
+	 *
+	 * @return size_t The bucket index
+	 */
+	size_t Histogram::bucket(uint64_t value)
+	{
+		if (value < SUB_BUCKETS)
+		{
+			return static_cast<size_t>(value);
+		}
+
+		size_t magnitude = 63 - __builtin_clzll(value);
+		size_t sub_bucket = (value >> (magnitude - 2)) & (SUB_BUCKETS - 1);
+
+		return (magnitude - 1) * SUB_BUCKETS + sub_bucket;
+	}
+
+	/**
+	 * Returns the largest value that falls in a bucket
+	 *
+	 * @param size_t bucket The bucket index
+	 *
+	 * @return uint64_t The largest value of the bucket
+	 */
+	uint64_t Histogram::upper_bound(size_t bucket)
+	{
+		if (bucket < SUB_BUCKETS)
+		{
+			return bucket;
+		}
+
+		size_t magnitude = bucket / SUB_BUCKETS + 1;
+		uint64_t sub_bucket = bucket % SUB_BUCKETS;
+
+		return ((SUB_BUCKETS + sub_bucket + 1) << (magnitude - 2)) - 1;
+	}
+
+	/**
+	 * Records a value
+	 *
+	 * @param uint64_t value The duration in microseconds
+	 *
+	 * @return void
+	 */
+	void Histogram::add(uint64_t value)
+	{
+		++counts_[bucket(value)];
+		++count_;
+		total_ += value;
+		max_ = std::max(max_, value);
+	}
+
+	/**
+	 * Adds every value recorded in another histogram
+	 *
+	 * @param const Histogram& other The histogram to add
+	 *
+	 * @return void
+	 */
+	void Histogram::merge(const Histogram& other)
+	{
+		for (size_t i = 0; i < BUCKETS; ++i)
+		{
+			counts_[i] += other.counts_[i];
+		}
+
+		count_ += other.count_;
+		total_ += other.total_;
+		max_ = std::max(max_, other.max_);
+	}
+
+	/**
+	 * Returns the number of values recorded
+	 *
+	 * @return uint64_t The number of values
+	 */
+	uint64_t Histogram::count() const
+	{
+		return count_;
+	}
+
+	/**
+	 * Returns the mean of the values recorded
+	 *
+	 * @return double The mean, or 0 if there are none
+	 */
+	double Histogram::mean() const
+	{
+		return count_ == 0 ? 0 : static_cast<double>(total_) / count_;
+	}
+
+	/**
+	 * Returns the largest value recorded
+	 *
+	 * @return uint64_t The largest value, or 0 if there are none
+	 */
+	uint64_t Histogram::max() const
+	{
+		return max_;
+	}
+
+	/**
+	 * Returns an upper bound for the given percentile
+	 *
+	 * @param double percentile The percentile, between 0 and 100
+	 *
+	 * @return uint64_t The upper bound of the bucket holding the percentile, capped at the largest value
+	 */
+	uint64_t Histogram::percentile(double percentile) const
+	{
+		if (count_ == 0)
+		{
+			return 0;
+		}
+
+		uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count_ + 0.5);
+		rank = std::max<uint64_t>(1, std::min(rank, count_));
+
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUCKETS; ++i)
+		{
+			seen += counts_[i];
+			if (seen >= rank)
+			{
+				return std::min(upper_bound(i), max_);
+			}
+		}
+
+		return max_;
+	}
+
+	/**
+	 * Writes the percentiles and a bar per power of two of milliseconds
+	 *
+	 * @param std::ostream& out Where to write
+	 * @param const char* indent The prefix of every line
+	 *
+	 * @return void
+	 */
+	void Histogram::print(std::ostream& out, const char* indent) const
+	{
+		out << indent << "avg " << mean() / 1000.0
+			<< " p50 " << percentile(50) / 1000.0
+			<< " p90 " << percentile(90) / 1000.0
+			<< " p99 " << percentile(99) / 1000.0
+			<< " max " << max_ / 1000.0 << " ms" << std::endl;
+
+		if (count_ == 0)
+		{
+			return;
+		}
+
+		// Fold the buckets into powers of two of milliseconds: <1ms, <2ms, <4ms, ...
+		std::vector<uint64_t> rows;
+		for (size_t i = 0; i < BUCKETS; ++i)
+		{
+			if (counts_[i] == 0)
+			{
+				continue;
+			}
+
+			uint64_t milliseconds = upper_bound(i) / 1000;
+			size_t row = milliseconds == 0 ? 0 : 64 - __builtin_clzll(milliseconds);
+			if (rows.size() <= row)
+			{
+				rows.resize(row + 1, 0);
+			}
+			rows[row] += counts_[i];
+		}
+
+		uint64_t widest = *std::max_element(rows.begin(), rows.end());
+		size_t first = 0;
+		while (rows[first] == 0)
+		{
+			++first;
+		}
+
+		for (size_t row = first; row < rows.size(); ++row)
+		{
+			size_t width = static_cast<size_t>(rows[row] * BAR_WIDTH / widest);
+			out << indent << "<" << (1ULL << row) << "ms\t" << rows[row] << "\t" << std::string(width, '#') << std::endl;
+		}
+	}
+}
@@ -0,0 +1,150 @@
+/*
+ * histogram.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the Replay::Histogram class.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/**
+ * @namespace Replay
+ * Replaying captured traffic against a target server and measuring how it responds
+ */
+namespace Replay
+{
+
+	/**
+	 * @brief A log-linear histogram of durations in microseconds
+	 *
+	 * Each power of two is split into four buckets, so percentiles are accurate to
+	 * within 25% whatever the range, in a fixed 2 KiB of memory.
+	 */
+	class Histogram
+	{
+		public:
+			/**
+			 * Construct an empty Histogram
+			 */
+			Histogram();
+
+			/**
+			 * Record a value
+			 *
+			 * @param uint64_t value The duration in microseconds
+			 *
+			 * @return void
+			 */
+			void add(uint64_t value);
+
+			/**
+			 * Add every value recorded in another histogram
+			 *
+			 * @param const Histogram& other The histogram to add
+			 *
+			 * @return void
+			 */
+			void merge(const Histogram& other);
+
+			/**
+			 * Returns the number of values recorded
+			 *
+			 * @return uint64_t The number of values
+			 */
+			uint64_t count() const;
+
+			/**
+			 * Returns the mean of the values recorded
+			 *
+			 * @return double The mean, or 0 if there are none
+			 */
+			double mean() const;
+
+			/**
+			 * Returns the largest value recorded
+			 *
+			 * @return uint64_t The largest value, or 0 if there are none
+			 */
+			uint64_t max() const;
+
+			/**
+			 * Returns an upper bound for the given percentile
+			 *
+			 * @param double percentile The percentile, between 0 and 100
+			 *
+			 * @return uint64_t The upper bound of the bucket holding the percentile, capped at the largest value
+			 */
+			uint64_t percentile(double percentile) const;
+
+			/**
+			 * Write the percentiles and a bar per power of two of milliseconds
+			 *
+			 * @param std::ostream& out Where to write
+			 * @param const char* indent The prefix of every line
+			 *
+			 * @return void
+			 */
+			void print(std::ostream& out, const char* indent) const;
+
+		private:
+
+			/**
+			 * Returns the bucket a value falls in
+			 *
+			 * @param uint64_t value The value
+			 *
+			 * @return size_t The bucket index
+			 */
+			static size_t bucket(uint64_t value);
+
+			/**
+			 * Returns the largest value that falls in a bucket
+			 *
+			 * @param size_t bucket The bucket index
+			 *
+			 * @return uint64_t The largest value of the bucket
+			 */
+			static uint64_t upper_bound(size_t bucket);
+
+			/**
+			 * @var std::vector<uint64_t> The number of values in each bucket
+			 */
+			std::vector<uint64_t> counts_;
+
+			/**
+			 * @var uint64_t The number of values recorded
+			 */
+			uint64_t count_;
+
+			/**
+			 * @var uint64_t The sum of the values recorded
+			 */
+			uint64_t total_;
+
+			/**
+			 * @var uint64_t The largest value recorded
+			 */
+			uint64_t max_;
+	};
+}
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,312 @@
+/*
+ * pacer.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the Replay::Pacer class.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif /* __x86_64__ || __i386__ */
+#include "pacer.h"
+
+/**
+ * @namespace Replay
+ * Replaying captured traffic against a target server and measuring how it responds
+ */
+namespace Replay
+{
+
+	/**
+	 * @struct TimestampCounter
+	 *
+	 * Whether the CPU's timestamp counter can be spun on, and how fast it ticks
+	 */
+	struct TimestampCounter
+	{
+		bool usable = false;
+		double ticks_per_nanosecond = 0;
+	};
+
+	/**
+	 * Checks for an invariant timestamp counter and measures its rate against Clock
+	 *
+	 * An invariant counter ticks at a constant rate whatever the frequency or power
+	 * state of the core, and is synchronised across cores, so a thread may spin on
+	 * it even if it migrates. Virtual machines that hide the flag fall back to Clock.
+	 *
+	 * @return TimestampCounter The counter's properties
+	 */
+	static TimestampCounter calibrate()
+	{
+		TimestampCounter counter;
+
+		#if defined(__x86_64__) || defined(__i386__)
+		unsigned int eax = 0;
+		unsigned int ebx = 0;
+		unsigned int ecx = 0;
+		unsigned int edx = 0;
+		if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0 || (edx & (1u << 8)) == 0)
+		{
+			return counter;
+		}
+
+		Clock::time_point start = Clock::now();
+		uint64_t start_ticks = __rdtsc();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		uint64_t end_ticks = __rdtsc();
+		Clock::time_point end = Clock::now();
+
+		long long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		if (nanoseconds > 0 && end_ticks > start_ticks)
+		{
+			counter.ticks_per_nanosecond = static_cast<double>(end_ticks - start_ticks) / nanoseconds;
+			counter.usable = true;
+		}
+		#endif /* __x86_64__ || __i386__ */
+
+		return counter;
+	}
+
+	/**
+	 * Returns the timestamp counter's properties, calibrating it on first use
+	 *
+	 * @return const TimestampCounter& The counter's properties
+	 */
+	static const TimestampCounter& timestamp_counter()
+	{
+		static const TimestampCounter counter = calibrate();
+		return counter;
+	}
+
+	/**
+	 * Pacer constructor
+	 *
+	 * The timestamp counter is calibrated here rather than on the first wait, so
+	 * the calibration never delays a send. With a single CPU the budget is dropped,
+	 * as spinning would only take the CPU from the target and the other replay threads.
+	 *
+	 * @param uint64_t spin_budget Microseconds to spin before each deadline, or 0 to only sleep
+	 *
+	 * @return void
+	 */
+	Pacer::Pacer(uint64_t spin_budget)
+		: spin_budget_(std::chrono::microseconds(spin_budget)),
+		  spun_(Clock::duration::zero()),
+		  timer_fd_(-1)
+	{
+		if (sysconf(_SC_NPROCESSORS_ONLN) == 1)
+		{
+			spin_budget_ = Clock::duration::zero();
+		}
+
+		if (spin_budget_ > Clock::duration::zero())
+		{
+			timestamp_counter();
+		}
+	}
+
+	/**
+	 * Pacer destructor
+	 *
+	 * @return void
+	 */
+	Pacer::~Pacer()
+	{
+		if (timer_fd_ != -1)
+		{
+			close(timer_fd_);
+		}
+	}
+
+	/**
+	 * Converts a point in time to a timespec on CLOCK_MONOTONIC, the clock behind Clock on Linux
+	 *
+	 * @param Clock::time_point time The point in time
+	 *
+	 * @return struct timespec The same point in time
+	 */
+	static struct timespec monotonic(Clock::time_point time)
+	{
+		long long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+		struct timespec value;
+		value.tv_sec = static_cast<time_t>(nanoseconds / 1000000000);
+		value.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+		return value;
+	}
+
+	/**
+	 * Waits until a deadline, returning at once if it has passed
+	 *
+	 * The sleep is an absolute clock_nanosleep(), so a signal interrupting it
+	 * cannot stretch the wait.
+	 *
+	 * @param Clock::time_point deadline The deadline
+	 *
+	 * @return void
+	 */
+	void Pacer::wait_until(Clock::time_point deadline)
+	{
+		Clock::time_point wake = deadline - spin_budget_;
+		if (Clock::now() < wake)
+		{
+			struct timespec until = monotonic(wake);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR)
+			{
+			}
+		}
+
+		if (spin_budget_ == Clock::duration::zero())
+		{
+			return;
+		}
+
+		Clock::time_point spinning = Clock::now();
+		if (spinning >= deadline)
+		{
+			return;
+		}
+
+		#if defined(__x86_64__) || defined(__i386__)
+		const TimestampCounter& counter = timestamp_counter();
+		if (counter.usable)
+		{
+			long long remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - spinning).count();
+			uint64_t end = __rdtsc() + static_cast<uint64_t>(remaining * counter.ticks_per_nanosecond);
+			while (__rdtsc() < end)
+			{
+				_mm_pause();
+			}
+		}
+		else
+		#endif /* __x86_64__ || __i386__ */
+		{
+			while (Clock::now() < deadline)
+			{
+			}
+		}
+
+		spun_ += Clock::now() - spinning;
+	}
+
+	/**
+	 * Records how late a send due at a deadline is being made
+	 *
+	 * @param Clock::time_point deadline When the send was due
+	 *
+	 * @return void
+	 */
+	void Pacer::record(Clock::time_point deadline)
+	{
+		Clock::time_point now = Clock::now();
+		lag_.add(now <= deadline ? 0 : std::chrono::duration_cast<std::chrono::nanoseconds>(now - deadline).count());
+	}
+
+	/**
+	 * Returns how long an event loop may block waiting for events before a deadline
+	 *
+	 * epoll_wait() only takes whole milliseconds, so the timeout is rounded up and
+	 * a loop relying on it alone wakes up to a millisecond late; the timer wakes
+	 * it on time.
+	 *
+	 * @param Clock::time_point deadline The deadline
+	 *
+	 * @return int Milliseconds to pass to epoll_wait(), rounded up, 0 once it is time to spin
+	 */
+	int Pacer::poll_timeout(Clock::time_point deadline) const
+	{
+		Clock::duration wait = deadline - Clock::now() - spin_budget_;
+		if (wait <= Clock::duration::zero())
+		{
+			return 0;
+		}
+
+		long long milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(wait + std::chrono::milliseconds(1) - Clock::duration(1)).count();
+		return static_cast<int>(std::min<long long>(milliseconds, INT_MAX));
+	}
+
+	/**
+	 * Returns a timerfd for an event loop to wait on, creating it on first use
+	 *
+	 * @return int The file descriptor, or -1 if none could be created
+	 */
+	int Pacer::timer()
+	{
+		if (timer_fd_ == -1)
+		{
+			timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		}
+
+		return timer_fd_;
+	}
+
+	/**
+	 * Arms the timer to fire when it is time to spin for a deadline
+	 *
+	 * Rearming for the deadline it is already armed for is skipped, so a loop may
+	 * call this every iteration for a system call only when the deadline changes.
+	 *
+	 * @param Clock::time_point deadline The deadline
+	 *
+	 * @return void
+	 */
+	void Pacer::arm(Clock::time_point deadline)
+	{
+		Clock::time_point wake = deadline - spin_budget_;
+		if (timer() == -1 || wake == armed_)
+		{
+			return;
+		}
+
+		struct itimerspec value;
+		value.it_interval.tv_sec = 0;
+		value.it_interval.tv_nsec = 0;
+		value.it_value = monotonic(wake);
+		if (value.it_value.tv_sec == 0 && value.it_value.tv_nsec == 0)
+		{
+			// Zero would disarm the timer rather than fire it at once
+			value.it_value.tv_nsec = 1;
+		}
+
+		if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &value, nullptr) == 0)
+		{
+			armed_ = wake;
+		}
+	}
+
+	/**
+	 * Consumes the timer's expiry once it has fired
+	 *
+	 * @return void
+	 */
+	void Pacer::timer_fired()
+	{
+		uint64_t expirations;
+		if (timer_fd_ != -1 && read(timer_fd_, &expirations, sizeof(expirations)) == sizeof(expirations))
+		{
+			armed_ = Clock::time_point();
+		}
+	}
+}
@@ -0,0 +1,167 @@
+/*
+ * pacer.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the Replay::Pacer class.
+ */
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <cstdint>
+#include <chrono>
+#include "histogram.h"
+
+/**
+ * @namespace Replay
+ * Replaying captured traffic against a target server and measuring how it responds
+ */
+namespace Replay
+{
+
+	/**
+	 * @typedef Clock
+	 * The clock used to schedule and time replayed traffic
+	 */
+	typedef std::chrono::steady_clock Clock;
+
+	/**
+	 * @brief Waits for scheduled send times and measures how late each send was
+	 *
+	 * Sleeping alone wakes a thread tens of microseconds after it asked to, so a
+	 * Pacer sleeps until a spin budget before the deadline and spins the rest of
+	 * the way on the CPU's timestamp counter, calibrated against Clock, where the
+	 * counter is invariant. The lag of every send, from its scheduled time to the
+	 * moment it was made, is kept in nanoseconds. Each thread has its own Pacer.
+	 * An event loop cannot sleep, so it adds the Pacer's timer to its epoll set to
+	 * be woken when it is time to spin. With a single CPU online a Pacer only
+	 * sleeps, as spinning there holds off the very threads it is waiting on.
+	 */
+	class Pacer
+	{
+		public:
+			/**
+			 * Construct a Pacer
+			 *
+			 * @param uint64_t spin_budget Microseconds to spin before each deadline, or 0 to only sleep
+			 */
+			explicit Pacer(uint64_t spin_budget);
+
+			/**
+			 * Pacer destructor
+			 */
+			~Pacer();
+
+			/**
+			 * Wait until a deadline, returning at once if it has passed
+			 *
+			 * @param Clock::time_point deadline The deadline
+			 *
+			 * @return void
+			 */
+			void wait_until(Clock::time_point deadline);
+
+			/**
+			 * Record how late a send due at a deadline is being made
+			 *
+			 * @param Clock::time_point deadline When the send was due
+			 *
+			 * @return void
+			 */
+			void record(Clock::time_point deadline);
+
+			/**
+			 * Returns how long an event loop may block waiting for events before a deadline
+			 *
+			 * @param Clock::time_point deadline The deadline
+			 *
+			 * @return int Milliseconds to pass to epoll_wait(), rounded up, 0 once it is time to spin
+			 */
+			int poll_timeout(Clock::time_point deadline) const;
+
+			/**
+			 * Returns a timerfd for an event loop to wait on, creating it on first use
+			 *
+			 * @return int The file descriptor, or -1 if none could be created
+			 */
+			int timer();
+
+			/**
+			 * Arm the timer to fire when it is time to spin for a deadline
+			 *
+			 * @param Clock::time_point deadline The deadline
+			 *
+			 * @return void
+			 */
+			void arm(Clock::time_point deadline);
+
+			/**
+			 * Consume the timer's expiry once it has fired
+			 *
+			 * @return void
+			 */
+			void timer_fired();
+
+			/**
+			 * Returns the time spent spinning for deadlines
+			 *
+			 * @return uint64_t The time in microseconds
+			 */
+			uint64_t spin_time() const
+			{
+				return std::chrono::duration_cast<std::chrono::microseconds>(spun_).count();
+			}
+
+			/**
+			 * Returns the lag of every send recorded
+			 *
+			 * @return const Histogram& The lags in nanoseconds
+			 */
+			const Histogram& lag() const
+			{
+				return lag_;
+			}
+
+		private:
+			/**
+			 * @var Clock::duration How long before a deadline to stop sleeping and start spinning
+			 */
+			Clock::duration spin_budget_;
+
+			/**
+			 * @var Clock::duration The time spent spinning for deadlines, which shows up as CPU time without being work
+			 */
+			Clock::duration spun_;
+
+			/**
+			 * @var int The timerfd, or -1 until one is needed
+			 */
+			int timer_fd_;
+
+			/**
+			 * @var Clock::time_point When the timer is armed to fire, or the epoch if it is not
+			 */
+			Clock::time_point armed_;
+
+			/**
+			 * @var Histogram The lag of every send recorded, in nanoseconds
+			 */
+			Histogram lag_;
+	};
+}
+
+#endif /* PACER_H */
@@ -0,0 +1,2526 @@
+/*
+ * replay.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the Replay::Engine class.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include "affinity.h"
+#include "busy_poll.h"
+#include "capture.h"
+#include "functions.h"
+#include "grpc.h"
+#include "http2.h"
+#include "http_client.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "websocket.h"
+#include "histogram.h"
+#include "replay.h"
+#include "thread_pool.h"
+
+#if HTTP3_SUPPORT == 1
+#include "http3_client.h"
+#endif /* HTTP3_SUPPORT */
+
+/**
+ * @namespace Replay
+ * Replaying captured traffic against a target server and measuring how it responds
+ */
+namespace Replay
+{
+
+	/**
+	 * @var int Seconds to wait for the target before giving up on a session
+	 */
+	static const int RESPONSE_TIMEOUT = 30;
+
+	/**
+	 * @var size_t The largest WebSocket payload kept when reading frames from the target
+	 */
+	static const size_t MAX_FRAME = 16 * 1024 * 1024;
+
+	/**
+	 * @var size_t The largest HTTP/2 frame payload sent, the size every peer must accept
+	 */
+	static const size_t HTTP2_FRAME_SIZE = 16384;
+
+	/**
+	 * @var uint64_t The 99th percentile schedule lag, in nanoseconds, above which the replay could not keep up
+	 */
+	static const uint64_t SATURATED_LAG = 1000000;
+
+	/**
+	 * @var double The share of its time a thread, or the whole process per CPU, may be busy before it is saturated
+	 */
+	static const double SATURATED_SHARE = 0.9;
+
+	/**
+	 * @var size_t How many of the slowest responses the report shows the TCP statistics of
+	 */
+	static const size_t SLOWEST_RESPONSES = 5;
+
+	/**
+	 * @var size_t The fewest and most replay workers started, however many sessions the capture had open at once
+	 *
+	 * A replayed session can stay open longer than its captured one, when the
+	 * target is slower or the request is still being sent, so there are always
+	 * some workers to spare.
+	 */
+	static const size_t MIN_WORKERS = 64;
+	static const size_t MAX_WORKERS = 1024;
+
+	/**
+	 * Returns the microseconds elapsed between two points in time
+	 *
+	 * @param Clock::time_point from The earlier point
+	 * @param Clock::time_point to The later point
+	 *
+	 * @return uint64_t The elapsed microseconds, or 0 if to is before from
+	 */
+	static uint64_t elapsed(Clock::time_point from, Clock::time_point to)
+	{
+		if (to <= from)
+		{
+			return 0;
+		}
+
+		return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+	}
+
+	/**
+	 * Returns the nanoseconds elapsed between two points in time
+	 *
+	 * @param Clock::time_point from The earlier point
+	 * @param Clock::time_point to The later point
+	 *
+	 * @return uint64_t The elapsed nanoseconds, or 0 if to is before from
+	 */
+	static uint64_t elapsed_nanoseconds(Clock::time_point from, Clock::time_point to)
+	{
+		if (to <= from)
+		{
+			return 0;
+		}
+
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+	}
+
+	/**
+	 * Returns a CPU time reported by getrusage() in microseconds
+	 *
+	 * @param const struct timeval& time The CPU time
+	 *
+	 * @return uint64_t The CPU time in microseconds
+	 */
+	static uint64_t cpu_time(const struct timeval& time)
+	{
+		return static_cast<uint64_t>(time.tv_sec) * 1000000 + time.tv_usec;
+	}
+
+	/**
+	 * Returns the CPU time the calling thread has spent so far
+	 *
+	 * @return uint64_t The CPU time in microseconds
+	 */
+	static uint64_t thread_cpu_time()
+	{
+		struct timespec time;
+		if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0)
+		{
+			return 0;
+		}
+
+		return static_cast<uint64_t>(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+	}
+
+	/**
+	 * Converts a number of bytes to kibibytes, rounding up so a partly used kibibyte shows
+	 *
+	 * @param size_t bytes The number of bytes
+	 *
+	 * @return size_t The number of kibibytes
+	 */
+	static size_t kibibytes(size_t bytes)
+	{
+		return (bytes + 1023) / 1024;
+	}
+
+	/**
+	 * Returns the share of its time a thread was busy, leaving out deliberate spinning
+	 *
+	 * @param const ThreadUsage& usage How the thread ran
+	 *
+	 * @return double The share, between 0 and 1
+	 */
+	static double busy_share(const ThreadUsage& usage)
+	{
+		if (usage.wall_time == 0 || usage.cpu_time <= usage.spin_time)
+		{
+			return 0;
+		}
+
+		return std::min(1.0, static_cast<double>(usage.cpu_time - usage.spin_time) / usage.wall_time);
+	}
+
+	/**
+	 * Sends data on a blocking connection, timing how long the send queue held it up
+	 *
+	 * A blocking send returns once the data is queued, so its duration is the wait
+	 * for room in the socket's send queue plus a copy into the kernel.
+	 *
+	 * @param HTTP::Client& client The connection
+	 * @param const std::string& data The data to send
+	 * @param[out] result The outcome the wait is added to
+	 *
+	 * @return bool Whether all of the data was sent
+	 */
+	static bool timed_write(HTTP::Client& client, const std::string& data, Result& result)
+	{
+		Clock::time_point start = Clock::now();
+		bool written = client.write_all(data);
+		uint64_t wait = elapsed(start, Clock::now());
+
+		result.send_wait += wait;
+		result.max_send_wait = std::max(result.max_send_wait, wait);
+		return written;
+	}
+
+	/**
+	 * Sends a request head and body on a blocking connection, timing how long the send queue held it up
+	 *
+	 * The two are coalesced by the connection rather than concatenated here, so
+	 * a large body is neither copied into a request string nor, where the socket
+	 * supports MSG_ZEROCOPY, into the kernel.
+	 *
+	 * @param HTTP::Client& client The connection
+	 * @param const std::string& head The request head
+	 * @param const std::string& body The request body
+	 * @param[out] result The outcome the wait is added to
+	 *
+	 * @return bool Whether all of the request was sent
+	 */
+	static bool timed_write(HTTP::Client& client, const std::string& head, const std::string& body, Result& result)
+	{
+		Clock::time_point start = Clock::now();
+		bool written = client.write_message(head, body);
+		uint64_t wait = elapsed(start, Clock::now());
+
+		result.send_wait += wait;
+		result.max_send_wait = std::max(result.max_send_wait, wait);
+		return written;
+	}
+
+	/**
+	 * Connects a client to the target and bounds how long it waits for responses
+	 *
+	 * @param HTTP::Client& client The client to connect
+	 * @param const std::string& host The target host
+	 * @param const std::string& port The target port
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If the connection fails
+	 */
+	static void connect_target(HTTP::Client& client, const std::string& host, const std::string& port)
+	{
+		client.connect(host, port);
+
+		struct timeval timeout;
+		timeout.tv_sec = RESPONSE_TIMEOUT;
+		timeout.tv_usec = 0;
+		setsockopt(client.fd(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	}
+
+	/**
+	 * @struct Stream
+	 *
+	 * The state of one streamed response being replayed by Engine::replay_streams()
+	 */
+	struct Stream
+	{
+		size_t index = 0;
+		int fd = -1;
+		bool connected = false;
+		std::string request;
+		size_t sent = 0;
+		std::string head;
+		bool has_body = true;
+		bool head_done = false;
+		HTTP::BodyFraming framing;
+		EventCounter counter;
+		uint64_t content = 0;
+		Clock::time_point started;
+		Clock::time_point deadline;
+		bool blocked = false;
+		Clock::time_point blocked_since;
+	};
+
+	/**
+	 * @struct TcpSampler
+	 *
+	 * Samples a replay client's TCP statistics when its session ends, whether it
+	 * returned or threw. Declared after the client, it is destroyed first, while
+	 * the connection is still open.
+	 */
+	struct TcpSampler
+	{
+		const HTTP::Connection& client;
+		TcpSample& sample;
+
+		~TcpSampler()
+		{
+			sample_tcp_info(client.fd(), sample);
+		}
+	};
+
+	/**
+	 * @struct MethodSummary
+	 *
+	 * The replayed calls of one HTTP/2 method, as summarised by Engine::report()
+	 */
+	struct MethodSummary
+	{
+		size_t calls = 0;
+		size_t failed = 0;
+		size_t messages_captured = 0;
+		size_t messages_received = 0;
+		std::map<int, size_t> grpc_statuses;
+		Histogram latency;
+	};
+
+	/**
+	 * @struct TcpSummary
+	 *
+	 * The TCP statistics of a set of connections, as summarised by Engine::report_network()
+	 */
+	struct TcpSummary
+	{
+		size_t connections = 0;
+		size_t retransmits = 0;
+		size_t retransmitting = 0;
+		Histogram rtt;
+	};
+
+	/**
+	 * Adds a connection's TCP statistics to a summary
+	 *
+	 * @param const TcpSample& sample The connection's statistics, skipped if invalid
+	 * @param[out] summary The summary
+	 *
+	 * @return void
+	 */
+	static void summarise_tcp(const TcpSample& sample, TcpSummary& summary)
+	{
+		if (!sample.valid)
+		{
+			return;
+		}
+
+		++summary.connections;
+		summary.retransmits += sample.retransmits;
+		summary.retransmitting += sample.retransmits > 0 ? 1 : 0;
+		summary.rtt.add(sample.rtt);
+	}
+
+	/**
+	 * Writes a summary of TCP statistics as "RTT avg/p99/max ... us, ... retransmits on ... connections"
+	 *
+	 * @param std::ostream& out Where to write
+	 * @param const TcpSummary& summary The summary
+	 *
+	 * @return void
+	 */
+	static void write_tcp_summary(std::ostream& out, const TcpSummary& summary)
+	{
+		out << "RTT avg/p99/max " << summary.rtt.mean() << "/" << summary.rtt.percentile(99) << "/" << summary.rtt.max() << " us, "
+			<< summary.retransmits << " retransmits on " << summary.retransmitting << " connections";
+	}
+
+	/**
+	 * @struct StreamCapture
+	 *
+	 * The state of one streamed response being read from a capture by Engine::load()
+	 */
+	struct StreamCapture
+	{
+		HTTP::BodyFraming framing;
+		EventCounter counter;
+		uint64_t content = 0;
+	};
+
+	/**
+	 * Records the events completed by a captured piece of a streamed response
+	 *
+	 * @param Session& session The session the response belongs to
+	 * @param StreamCapture& state The decoding state of the response
+	 * @param const std::string& data The captured body bytes
+	 * @param uint64_t offset When they were captured, relative to the start of the capture
+	 *
+	 * @return void
+	 */
+	static void capture_events(Session& session, StreamCapture& state, const std::string& data, uint64_t offset)
+	{
+		std::string content;
+		state.framing.consume(data.data(), data.size(), &content);
+		if (content.empty())
+		{
+			return;
+		}
+
+		if (session.event_stream)
+		{
+			session.events.insert(session.events.end(), state.counter.feed(content), offset);
+			return;
+		}
+
+		state.content += content.size();
+		session.events.push_back(offset);
+		session.milestones.push_back(state.content);
+	}
+
+	/**
+	 * Records a captured HTTP/2 record in the session it belongs to
+	 *
+	 * Streams are numbered in the order their request headers were captured; records
+	 * for streams opened before the capture started are dropped. From the server only
+	 * the number of gRPC messages per call is kept.
+	 *
+	 * @param Session& session The session the record belongs to
+	 * @param std::map<uint32_t, size_t>& calls The call index of each captured stream identifier
+	 * @param const Capture::Record& record The "h2-headers", "h2-data", "h2-end", "h2-reset" or "grpc" record
+	 * @param uint64_t offset When it was captured, relative to the start of the capture
+	 *
+	 * @return void
+	 */
+	static void capture_stream_event(Session& session, std::map<uint32_t, size_t>& calls, const Capture::Record& record, uint64_t offset)
+	{
+		uint32_t stream = static_cast<uint32_t>(std::strtoul(record.attribute("stream").c_str(), nullptr, 10));
+		std::map<uint32_t, size_t>::iterator call = calls.find(stream);
+
+		if (record.direction == Capture::TO_CLIENT)
+		{
+			if (record.type == "grpc" && call != calls.end())
+			{
+				++session.calls[call->second].messages;
+			}
+			return;
+		}
+
+		StreamEvent event;
+		event.offset = offset;
+
+		if (record.type == "h2-headers")
+		{
+			event.type = HTTP::HTTP2::HEADERS;
+			event.headers = HTTP::HTTP2::parse_headers(record.payload);
+			event.end_stream = record.attribute("end_stream") == "1";
+
+			if (call == calls.end())
+			{
+				Call opened;
+				const std::string* path = HTTP::HTTP2::field(event.headers, ":path");
+				opened.method = path != nullptr ? *path : "-";
+				opened.grpc = HTTP::GRPC::is_grpc(event.headers);
+
+				call = calls.insert(std::make_pair(stream, session.calls.size())).first;
+				session.calls.push_back(opened);
+			}
+		}
+		else if (call == calls.end())
+		{
+			return;
+		}
+		else if (record.type == "grpc")
+		{
+			// Messages too large to capture are replayed with a payload of the same size
+			std::string length = record.attribute("length");
+			std::string payload = length.empty() ? record.payload : std::string(std::strtoull(length.c_str(), nullptr, 10), '\0');
+
+			event.type = HTTP::HTTP2::DATA;
+			event.payload = HTTP::GRPC::encode_message(payload, record.attribute("compressed") == "1");
+		}
+		else if (record.type == "h2-data" || record.type == "h2-end")
+		{
+			event.type = HTTP::HTTP2::DATA;
+			event.payload = record.payload;
+			event.end_stream = record.type == "h2-end";
+		}
+		else if (record.type == "h2-reset")
+		{
+			event.type = HTTP::HTTP2::RST_STREAM;
+		}
+		else
+		{
+			return;
+		}
+
+		event.call = call->second;
+		session.stream_events.push_back(event);
+	}
+
+	/**
+	 * EventCounter constructor
+	 *
+	 * @return void
+	 */
+	EventCounter::EventCounter()
+		: line_start_(true),
+		  comment_(false),
+		  fields_(false),
+		  carriage_return_(false)
+	{
+	}
+
+	/**
+	 * Consumes the next piece of stream content
+	 *
+	 * Lines may end in CR, LF or CRLF, as the Server-Sent Events format allows, and
+	 * may be split across pieces.
+	 *
+	 * @param const std::string& content The content, with any chunked framing removed
+	 *
+	 * @return size_t The number of events completed by this piece
+	 */
+	size_t EventCounter::feed(const std::string& content)
+	{
+		size_t completed = 0;
+
+		for (size_t i = 0; i < content.size(); ++i)
+		{
+			char c = content[i];
+			if (carriage_return_ && c == '\n')
+			{
+				carriage_return_ = false;
+				continue;
+			}
+			carriage_return_ = c == '\r';
+
+			if (c == '\r' || c == '\n')
+			{
+				if (line_start_)
+				{
+					if (fields_)
+					{
+						++completed;
+						fields_ = false;
+					}
+				}
+				else if (!comment_)
+				{
+					fields_ = true;
+				}
+
+				line_start_ = true;
+				comment_ = false;
+			}
+			else if (line_start_)
+			{
+				comment_ = c == ':';
+				line_start_ = false;
+			}
+		}
+
+		return completed;
+	}
+
+	/**
+	 * Engine constructor
+	 *
+	 * @param const std::string& host The host name or IP address of the target
+	 * @param const std::string& port The port number or service name of the target
+	 *
+	 * @return void
+	 */
+	Engine::Engine(const std::string& host, const std::string& port)
+		: host_(host),
+		  port_(port),
+		  protocol_(HTTP_1_1),
+		  spin_budget_(50),
+		  huge_pages_(false),
+		  capture_bytes_(0),
+		  capture_huge_bytes_(0),
+		  workers_(0),
+		  wall_time_(0),
+		  user_time_(0),
+		  system_time_(0)
+	{
+	}
+
+	/**
+	 * Sets the protocol plain HTTP sessions are replayed over
+	 *
+	 * @param Protocol protocol HTTP_1_1 (the default), HTTP_2 with prior knowledge, or HTTP_3
+	 *
+	 * @return void
+	 */
+	void Engine::set_protocol(Protocol protocol)
+	{
+		protocol_ = protocol;
+	}
+
+	/**
+	 * Sets how long before each scheduled send to stop sleeping and spin instead
+	 *
+	 * @param uint64_t spin_budget The budget in microseconds, or 0 to only sleep
+	 *
+	 * @return void
+	 */
+	void Engine::set_spin_budget(uint64_t spin_budget)
+	{
+		spin_budget_ = spin_budget;
+	}
+
+	/**
+	 * Sets whether the capture file and the loaded strings are put on huge pages
+	 *
+	 * Every request sent is assembled from the string table, so with many
+	 * sessions in flight the replay threads touch it all over; on huge pages it
+	 * takes a handful of TLB entries rather than one for every 4 KiB.
+	 *
+	 * @param bool huge_pages Whether to ask for huge pages
+	 *
+	 * @return void
+	 */
+	void Engine::set_huge_pages(bool huge_pages)
+	{
+		huge_pages_ = huge_pages;
+		strings_.set_huge_pages(huge_pages);
+	}
+
+	/**
+	 * Loads the sessions to replay from a capture file
+	 *
+	 * Connections without a captured request, such as clients that sent nothing, are skipped.
+	 *
+	 * @param const std::string& path The path to the capture file
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If the capture file cannot be read
+	 */
+	void Engine::load(const std::string& path)
+	{
+		Capture::Reader reader(path, huge_pages_);
+		Capture::Record record;
+
+		std::map<uint64_t, Session> sessions;
+		std::map<uint64_t, StreamCapture> streams;
+		std::map<uint64_t, std::map<uint32_t, size_t>> calls;
+		uint64_t start = 0;
+		bool started = false;
+		strings_.clear();
+
+		while (reader.next(record))
+		{
+			if (!started)
+			{
+				start = record.timestamp;
+				started = true;
+			}
+
+			uint64_t offset = record.timestamp > start ? record.timestamp - start : 0;
+			Session& session = sessions[record.connection];
+			session.connection = record.connection;
+
+			if (record.type == "request")
+			{
+				HTTP::Request request;
+				size_t head_size = HTTP::Message::find_head_end(record.payload);
+				if (head_size == std::string::npos || !request.parse_head(record.payload.substr(0, head_size)))
+				{
+					continue;
+				}
+
+				// Tunnels carry opaque bytes, of which only the counts were captured
+				if (request.method == "CONNECT")
+				{
+					continue;
+				}
+
+				// Requests repeat the same header names and values, so keep each distinct string once
+				session.offset = offset;
+				session.head.clear();
+				session.head.push_back(strings_.intern(record.payload.data(), record.payload.find("\r\n")));
+				for (size_t i = 0; i < request.headers.size(); ++i)
+				{
+					session.head.push_back(strings_.intern(request.headers[i].first));
+					session.head.push_back(strings_.intern(request.headers[i].second));
+				}
+				session.body = record.payload.substr(head_size);
+				session.websocket = request.is_websocket_upgrade();
+				session.http2 = request.is_http2_preface();
+			}
+			else if (record.type == "response" && record.attribute("streaming") == "1")
+			{
+				HTTP::Response response;
+				size_t head_size = HTTP::Message::find_head_end(record.payload);
+				if (head_size == std::string::npos || !response.parse_head(record.payload.substr(0, head_size)))
+				{
+					continue;
+				}
+
+				const std::string* content_type = response.header(HTTP::HEADER_CONTENT_TYPE);
+				session.streaming = true;
+				session.event_stream = content_type != nullptr && HTTP::Message::iequals(content_type->substr(0, 17), "text/event-stream");
+
+				StreamCapture& state = streams[record.connection];
+				state.framing = HTTP::BodyFraming(response, true);
+				capture_events(session, state, record.payload.substr(head_size), offset);
+			}
+			else if (record.type == "chunk" && record.direction == Capture::TO_SERVER)
+			{
+				// The rest of a request body too large to capture as one record
+				session.body += record.payload;
+			}
+			else if (record.type == "chunk")
+			{
+				std::map<uint64_t, StreamCapture>::iterator state = streams.find(record.connection);
+				if (state != streams.end())
+				{
+					capture_events(session, state->second, record.payload, offset);
+				}
+			}
+			else if (record.type == "close")
+			{
+				session.closed = offset;
+				session.tcp = Capture::tcp_attributes(record);
+			}
+			else if (record.type == "tcp-info")
+			{
+				session.tcp = Capture::tcp_attributes(record);
+			}
+			else if (record.type == "ws" && record.direction == Capture::TO_SERVER)
+			{
+				Frame frame;
+				frame.offset = offset;
+				frame.opcode = std::atoi(record.attribute("opcode").c_str());
+				frame.fin = record.attribute("fin") != "0";
+				frame.payload = record.payload;
+
+				// Frames too large to capture are replayed with a payload of the same size
+				std::string length = record.attribute("length");
+				if (!length.empty())
+				{
+					frame.payload.assign(std::strtoull(length.c_str(), nullptr, 10), '\0');
+				}
+
+				session.client_frames.push_back(frame);
+			}
+			else if (record.type == "ws" && record.direction == Capture::TO_CLIENT)
+			{
+				session.server_frames.push_back(offset);
+			}
+			else if (record.type == "grpc" || record.type.compare(0, 3, "h2-") == 0)
+			{
+				capture_stream_event(session, calls[record.connection], record, offset);
+			}
+		}
+
+		for (std::map<uint64_t, StreamCapture>::iterator it = streams.begin(); it != streams.end(); ++it)
+		{
+			sessions[it->first].hang_up = !it->second.framing.complete();
+		}
+
+		sessions_.clear();
+		schedule_.clear();
+		uint64_t request_bytes = 0;
+		std::vector<uint64_t> starts;
+		std::vector<uint64_t> ends;
+		for (std::map<uint64_t, Session>::iterator it = sessions.begin(); it != sessions.end(); ++it)
+		{
+			const Session& session = it->second;
+			if (session.head.empty())
+			{
+				continue;
+			}
+
+			size_t size = session.body.size();
+			for (size_t i = 0; i < session.head.size(); ++i)
+			{
+				size += strings_.size(session.head[i]) + 2;
+			}
+			request_bytes += size;
+
+			Schedule::Kind kind = Schedule::PLAIN;
+			if (session.http2)
+			{
+				kind = Schedule::HTTP2;
+			}
+			else if (session.websocket)
+			{
+				kind = Schedule::WEBSOCKET;
+			}
+			else if (session.streaming)
+			{
+				kind = Schedule::STREAM;
+			}
+
+			if (kind != Schedule::STREAM)
+			{
+				starts.push_back(session.offset);
+				// A connection the recorder never saw close counts as open to the end
+				ends.push_back(session.closed > 0 ? std::max(session.closed, session.offset) : UINT64_MAX);
+			}
+
+			schedule_.add(session.offset, static_cast<uint32_t>(sessions_.size()), kind);
+			sessions_.push_back(session);
+		}
+
+		schedule_.sort();
+
+		// Size the worker pool for as many sessions as the capture had open at once
+		std::sort(starts.begin(), starts.end());
+		std::sort(ends.begin(), ends.end());
+		size_t open = 0;
+		size_t peak = 0;
+		for (size_t start = 0, end = 0; start < starts.size(); ++start)
+		{
+			for (; end < ends.size() && ends[end] < starts[start]; ++end)
+			{
+				--open;
+			}
+			peak = std::max(peak, ++open);
+		}
+
+		workers_ = std::min(std::max(peak, MIN_WORKERS), MAX_WORKERS);
+		workers_ = std::max<size_t>(std::min(workers_, starts.size()), 1);
+
+		strings_.shrink();
+		capture_bytes_ = reader.size();
+		capture_huge_bytes_ = huge_pages_ ? reader.huge_bytes() : 0;
+		debug("Loaded %zu sessions from %s, with %llu request bytes and %zu distinct header strings in %zu bytes, at most %zu open at once", sessions_.size(), path.c_str(), (unsigned long long)request_bytes, strings_.count(), strings_.bytes(), peak);
+		if (huge_pages_)
+		{
+			debug("Huge pages back %zu of %zu capture bytes and %zu of %zu string bytes%s", capture_huge_bytes_, capture_bytes_, strings_.huge_bytes(), strings_.bytes(), strings_.hugetlb() ? ", from the hugetlbfs pool" : "");
+		}
+	}
+
+	/**
+	 * Replays every loaded session and waits for them all to finish
+	 *
+	 * Sessions run on a fixed pool of workers, sized when the capture was loaded
+	 * for as many sessions as it had open at once, so a slow response does not
+	 * delay the start of the sessions captured after it; this thread walks the
+	 * schedule and hands each one to the pool when it is due, reading only the
+	 * schedule's columns. A session that finds every worker busy starts late,
+	 * which shows in the schedule lag. Sessions with streamed responses,
+	 * which may stay open for the whole replay, share a single epoll thread instead.
+	 * The CPU time the whole process spends is measured alongside, so the cost of
+	 * replaying one workload over different protocols can be compared, and so is
+	 * how late each scheduled send was made, to show the replay kept its schedule.
+	 *
+	 * @return void
+	 */
+	void Engine::run()
+	{
+		results_.assign(sessions_.size(), Result());
+		schedule_lag_ = Histogram();
+		loop_time_ = Histogram();
+		spin_time_ = 0;
+		scheduler_usage_ = ThreadUsage();
+		streams_usage_ = ThreadUsage();
+		place_thread();
+		Pacer pacer(spin_budget_);
+
+		struct rusage usage_before;
+		getrusage(RUSAGE_SELF, &usage_before);
+
+		Clock::time_point origin = Clock::now();
+		uint64_t scheduler_cpu_time = thread_cpu_time();
+		std::thread streams_thread;
+		std::vector<size_t> streams;
+
+		for (size_t i = 0; i < schedule_.size(); ++i)
+		{
+			if (schedule_.kinds[i] == Schedule::STREAM)
+			{
+				streams.push_back(schedule_.sessions[i]);
+			}
+		}
+
+		if (!streams.empty())
+		{
+			streams_thread = std::thread([this, &streams, origin]() {
+				place_thread();
+				replay_streams(streams, origin);
+			});
+		}
+
+		{
+			ThreadPool workers(workers_);
+
+			// Hand each session to the pool once it is due, rather than all of them up front
+			size_t next = 0;
+			while (next < schedule_.size())
+			{
+				pacer.wait_until(origin + std::chrono::microseconds(schedule_.offsets[next]));
+
+				size_t end = schedule_.due(next, elapsed(origin, Clock::now()));
+				for (; next < end; ++next)
+				{
+					Schedule::Kind kind = static_cast<Schedule::Kind>(schedule_.kinds[next]);
+					if (kind != Schedule::STREAM)
+					{
+						size_t index = schedule_.sessions[next];
+						uint64_t offset = schedule_.offsets[next];
+						workers.submit([this, index, offset, kind, origin]() {
+							replay_session(index, offset, kind, origin);
+						});
+					}
+				}
+			}
+
+			scheduler_usage_.wall_time = elapsed(origin, Clock::now());
+			scheduler_usage_.cpu_time = thread_cpu_time() - scheduler_cpu_time;
+			scheduler_usage_.spin_time = pacer.spin_time();
+			merge_pacer(pacer);
+		}
+
+		if (streams_thread.joinable())
+		{
+			streams_thread.join();
+		}
+
+		struct rusage usage_after;
+		getrusage(RUSAGE_SELF, &usage_after);
+
+		wall_time_ = elapsed(origin, Clock::now());
+		user_time_ = cpu_time(usage_after.ru_utime) - cpu_time(usage_before.ru_utime);
+		system_time_ = cpu_time(usage_after.ru_stime) - cpu_time(usage_before.ru_stime);
+	}
+
+	/**
+	 * Replays one session that is due, recording its outcome
+	 *
+	 * @param size_t index The session's index in sessions_
+	 * @param uint64_t offset When it was due, in microseconds since the start of the replay
+	 * @param Schedule::Kind kind How it is replayed
+	 * @param Clock::time_point origin When the replay started
+	 *
+	 * @return void
+	 */
+	void Engine::replay_session(size_t index, uint64_t offset, Schedule::Kind kind, Clock::time_point origin)
+	{
+		const Session& session = sessions_[index];
+		Result& result = results_[index];
+		Clock::time_point started = Clock::now();
+		uint64_t cpu_time = thread_cpu_time();
+		Pacer pacer(spin_budget_);
+		pacer.record(origin + std::chrono::microseconds(offset));
+
+		try
+		{
+			if (kind == Schedule::HTTP2)
+			{
+				replay_http2(session, origin, pacer, result);
+			}
+			else if (kind == Schedule::WEBSOCKET)
+			{
+				replay_websocket(session, origin, pacer, result);
+			}
+			else if (protocol_ == HTTP_2)
+			{
+				replay_http_over_h2(session, result);
+			}
+			else if (protocol_ == HTTP_3)
+			{
+				replay_http_over_h3(session, result);
+			}
+			else
+			{
+				replay_http(session, result);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			result.failed = true;
+			result.error = e.what();
+		}
+
+		if (result.failed)
+		{
+			debug("Session %llu failed: %s", (unsigned long long)session.connection, result.error.c_str());
+		}
+
+		result.thread.wall_time = elapsed(started, Clock::now());
+		result.thread.cpu_time = thread_cpu_time() - cpu_time;
+		result.thread.spin_time = pacer.spin_time();
+		merge_pacer(pacer);
+	}
+
+	/**
+	 * Adds the send lags and spinning a thread's Pacer recorded to the totals
+	 *
+	 * @param const Pacer& pacer The Pacer
+	 *
+	 * @return void
+	 */
+	void Engine::merge_pacer(const Pacer& pacer)
+	{
+		std::lock_guard<std::mutex> lock(lag_mutex_);
+		schedule_lag_.merge(pacer.lag());
+		spin_time_ += pacer.spin_time();
+	}
+
+	/**
+	 * Rebuilds the request head of a session from the interned strings
+	 *
+	 * Fields are rebuilt as "name: value", as HTTP::Request serialises them anyway.
+	 * Only the HTTP/2 and HTTP/3 conversions need the parsed head; HTTP/1.1 heads
+	 * are written by write_request_head() without it.
+	 *
+	 * @param const Session& session The session
+	 * @param[out] request The parsed request head
+	 *
+	 * @return void
+	 */
+	void Engine::request_head(const Session& session, HTTP::Request& request) const
+	{
+		request.parse_head(strings_.str(session.head[0]) + "\r\n\r\n");
+		request.headers.reserve((session.head.size() - 1) / 2);
+		for (size_t i = 1; i + 1 < session.head.size(); i += 2)
+		{
+			request.headers.push_back(HTTP::HeaderField(strings_.str(session.head[i]), strings_.str(session.head[i + 1])));
+		}
+	}
+
+	/**
+	 * Writes the HTTP/1.1 request head of a session straight from the interned strings
+	 *
+	 * The request line and each field are appended as they are stored, without
+	 * copying any of them into a string of its own, so a buffer kept by the calling
+	 * thread is reused from one send to the next without allocating.
+	 *
+	 * @param const Session& session The session
+	 * @param bool close Whether to send "Connection: close" in place of any captured Connection field
+	 * @param[out] out The buffer the head replaces the contents of
+	 *
+	 * @return void
+	 */
+	void Engine::write_request_head(const Session& session, bool close, std::string& out) const
+	{
+		out.assign(strings_.data(session.head[0]), strings_.size(session.head[0]));
+		out += "\r\n";
+		for (size_t i = 1; i + 1 < session.head.size(); i += 2)
+		{
+			const char* name = strings_.data(session.head[i]);
+			size_t name_size = strings_.size(session.head[i]);
+			if (close && HTTP::header_id(name, name_size) == HTTP::HEADER_CONNECTION)
+			{
+				continue;
+			}
+
+			out.append(name, name_size);
+			out += ": ";
+			out.append(strings_.data(session.head[i + 1]), strings_.size(session.head[i + 1]));
+			out += "\r\n";
+		}
+
+		if (close)
+		{
+			out += "Connection: close\r\n";
+		}
+		out += "\r\n";
+	}
+
+	/**
+	 * Returns whether a session's request is a HEAD request, whose response has no body
+	 *
+	 * @param const Session& session The session
+	 *
+	 * @return bool Whether the method is HEAD
+	 */
+	bool Engine::head_request(const Session& session) const
+	{
+		return strings_.size(session.head[0]) > 5 && memcmp(strings_.data(session.head[0]), "HEAD ", 5) == 0;
+	}
+
+	/**
+	 * Replays a plain HTTP session
+	 *
+	 * The request is sent with "Connection: close" and the latency covers the whole
+	 * response, from sending the request to reading the last byte of the body.
+	 *
+	 * @param const Session& session The session to replay
+	 * @param[out] result The outcome
+	 *
+	 * @return void
+	 */
+	void Engine::replay_http(const Session& session, Result& result)
+	{
+		// Kept by each thread, so sending a request allocates nothing once it is large enough
+		static thread_local std::string head;
+		write_request_head(session, true, head);
+
+		HTTP::Client client;
+		connect_target(client, host_, port_);
+		TcpSampler tcp_sampler = { client, result.tcp };
+
+		Clock::time_point sent = Clock::now();
+		if (!timed_write(client, head, session.body, result))
+		{
+			throw std::runtime_error("Failed to send request");
+		}
+		++result.sends;
+
+		std::string buffer;
+		size_t response_size = client.read_head(buffer, HTTP::Message::MAX_HEAD_SIZE);
+		HTTP::Response response;
+		if (response_size == 0 || !response.parse_head(buffer.substr(0, response_size)))
+		{
+			throw std::runtime_error("No valid response");
+		}
+
+		bool has_body = !head_request(session) && response.status >= 200 && response.status != 204 && response.status != 304;
+		HTTP::BodyFraming framing(response, has_body);
+		framing.consume(buffer.data() + response_size, buffer.size() - response_size);
+
+		char chunk[16384];
+		while (!framing.complete())
+		{
+			ssize_t received = client.read(chunk, sizeof(chunk));
+			if (received <= 0)
+			{
+				if (!framing.until_close())
+				{
+					throw std::runtime_error("Response body ended early");
+				}
+				break;
+			}
+
+			framing.consume(chunk, received);
+		}
+
+		result.status = response.status;
+		result.latency = elapsed(sent, Clock::now());
+	}
+
+	/**
+	 * Replays a session that upgrades to WebSocket
+	 *
+	 * Client frames are masked with a fresh key and sent on their captured schedule
+	 * while a second thread reads frames from the target. The lag of each received
+	 * frame is how long after its captured counterpart's scheduled time it arrived.
+	 *
+	 * @param const Session& session The session to replay
+	 * @param Clock::time_point origin When the replay started
+	 * @param Pacer& pacer Paces the frames sent
+	 * @param[out] result The outcome
+	 *
+	 * @return void
+	 */
+	void Engine::replay_websocket(const Session& session, Clock::time_point origin, Pacer& pacer, Result& result)
+	{
+		static thread_local std::string head;
+		write_request_head(session, false, head);
+
+		HTTP::Client client;
+		connect_target(client, host_, port_);
+		TcpSampler tcp_sampler = { client, result.tcp };
+
+		Clock::time_point sent = Clock::now();
+		if (!timed_write(client, head, session.body, result))
+		{
+			throw std::runtime_error("Failed to send upgrade request");
+		}
+		++result.sends;
+
+		std::string buffer;
+		size_t response_size = client.read_head(buffer, HTTP::Message::MAX_HEAD_SIZE);
+		HTTP::Response response;
+		if (response_size == 0 || !response.parse_head(buffer.substr(0, response_size)))
+		{
+			throw std::runtime_error("No valid upgrade response");
+		}
+
+		result.status = response.status;
+		result.latency = elapsed(sent, Clock::now());
+		if (response.status != 101)
+		{
+			throw std::runtime_error("Upgrade refused with status " + std::to_string(response.status));
+		}
+
+		std::string leftover = buffer.substr(response_size);
+		std::thread reader([&]() {
+			HTTP::WebSocket::FrameParser parser(MAX_FRAME);
+			parser.feed(leftover.data(), leftover.size());
+
+			std::vector<char> chunk(16384);
+			HTTP::WebSocket::Frame frame;
+			for (;;)
+			{
+				while (parser.next(frame))
+				{
+					if (frame.opcode == HTTP::WebSocket::CLOSE)
+					{
+						return;
+					}
+
+					size_t index = result.frames_received++;
+					if (index < session.server_frames.size())
+					{
+						uint64_t lag = elapsed(origin + std::chrono::microseconds(session.server_frames[index]), Clock::now());
+						result.total_lag += lag;
+						result.max_lag = std::max(result.max_lag, lag);
+					}
+				}
+
+				ssize_t received = client.read(chunk.data(), chunk.size());
+				if (received <= 0)
+				{
+					return;
+				}
+
+				parser.feed(chunk.data(), received);
+			}
+		});
+
+		std::mt19937 random(std::random_device{}());
+		unsigned char mask_key[4];
+		bool closed = false;
+
+		for (size_t i = 0; i < session.client_frames.size() && !result.failed; ++i)
+		{
+			const Frame& frame = session.client_frames[i];
+			Clock::time_point due = origin + std::chrono::microseconds(frame.offset);
+			pacer.wait_until(due);
+
+			for (int b = 0; b < 4; ++b)
+			{
+				mask_key[b] = static_cast<unsigned char>(random());
+			}
+
+			pacer.record(due);
+			if (!timed_write(client, HTTP::WebSocket::encode_frame(frame.opcode, frame.payload, frame.fin, mask_key), result))
+			{
+				result.failed = true;
+				result.error = "Failed to send frame";
+				break;
+			}
+
+			++result.frames_sent;
+			++result.sends;
+			closed = closed || frame.opcode == HTTP::WebSocket::CLOSE;
+		}
+
+		// End the session cleanly if the capture stopped before the client closed it
+		if (!closed && !result.failed)
+		{
+			for (int b = 0; b < 4; ++b)
+			{
+				mask_key[b] = static_cast<unsigned char>(random());
+			}
+			client.write_all(HTTP::WebSocket::encode_frame(HTTP::WebSocket::CLOSE, std::string("\x03\xe8", 2), true, mask_key));
+		}
+
+		if (result.failed)
+		{
+			shutdown(client.fd(), SHUT_RDWR);
+		}
+
+		reader.join();
+	}
+
+	/**
+	 * Encodes a header block as a HEADERS frame and as many CONTINUATION frames as it needs
+	 *
+	 * @param uint32_t stream The stream identifier
+	 * @param const HTTP::Headers& headers The header fields
+	 * @param bool end_stream Whether the headers end the stream
+	 *
+	 * @return std::string The encoded frames
+	 */
+	static std::string encode_headers(uint32_t stream, const HTTP::Headers& headers, bool end_stream)
+	{
+		std::string block = HTTP::HPACK::encode(headers);
+		std::string frames;
+		size_t position = 0;
+
+		do
+		{
+			size_t size = std::min(HTTP2_FRAME_SIZE, block.size() - position);
+			int flags = position + size == block.size() ? HTTP::HTTP2::END_HEADERS : 0;
+			if (position == 0)
+			{
+				frames += HTTP::HTTP2::encode_frame(HTTP::HTTP2::HEADERS, flags | (end_stream ? HTTP::HTTP2::END_STREAM : 0), stream, block.substr(0, size));
+			}
+			else
+			{
+				frames += HTTP::HTTP2::encode_frame(HTTP::HTTP2::CONTINUATION, flags, stream, block.substr(position, size));
+			}
+			position += size;
+		}
+		while (position < block.size());
+
+		return frames;
+	}
+
+	/**
+	 * Encodes content as DATA frames no larger than the default maximum frame size
+	 *
+	 * @param uint32_t stream The stream identifier
+	 * @param const std::string& payload The content
+	 * @param bool end_stream Whether the last frame ends the stream
+	 *
+	 * @return std::string The encoded frames
+	 */
+	static std::string encode_data(uint32_t stream, const std::string& payload, bool end_stream)
+	{
+		std::string frames;
+		size_t position = 0;
+
+		do
+		{
+			size_t size = std::min(HTTP2_FRAME_SIZE, payload.size() - position);
+			int flags = end_stream && position + size == payload.size() ? HTTP::HTTP2::END_STREAM : 0;
+			frames += HTTP::HTTP2::encode_frame(HTTP::HTTP2::DATA, flags, stream, payload.substr(position, size));
+			position += size;
+		}
+		while (position < payload.size());
+
+		return frames;
+	}
+
+	/**
+	 * Encodes a WINDOW_UPDATE frame
+	 *
+	 * @param uint32_t stream The stream identifier, 0 for the connection
+	 * @param uint32_t increment The bytes the peer may send in addition
+	 *
+	 * @return std::string The encoded frame
+	 */
+	static std::string encode_window_update(uint32_t stream, uint32_t increment)
+	{
+		std::string payload(4, '\0');
+		payload[0] = static_cast<char>((increment >> 24) & 0x7f);
+		payload[1] = static_cast<char>((increment >> 16) & 0xff);
+		payload[2] = static_cast<char>((increment >> 8) & 0xff);
+		payload[3] = static_cast<char>(increment & 0xff);
+
+		return HTTP::HTTP2::encode_frame(HTTP::HTTP2::WINDOW_UPDATE, 0, stream, payload);
+	}
+
+	/**
+	 * Returns the content of a captured HTTP/1.x request, without any chunked framing
+	 *
+	 * @param const Session& session The session holding the raw request body
+	 * @param const HTTP::Request& request The parsed request head
+	 *
+	 * @return std::string The request content
+	 */
+	static std::string request_content(const Session& session, const HTTP::Request& request)
+	{
+		HTTP::BodyFraming framing(request, request.is_chunked() || request.content_length() > 0);
+		std::string content;
+		framing.consume(session.body.data(), session.body.size(), &content);
+
+		return content;
+	}
+
+	/**
+	 * Converts a captured HTTP/1.x request head into HTTP/2 or HTTP/3 header fields
+	 *
+	 * Host becomes :authority, names are lowercased, and the connection-specific
+	 * fields neither protocol allows are dropped. Content-Length is recomputed, as a
+	 * chunked request is sent with its framing removed.
+	 *
+	 * @param const HTTP::Request& request The parsed request head
+	 * @param const std::string& scheme The value of :scheme
+	 * @param const std::string& content The request content
+	 *
+	 * @return HTTP::Headers The header fields, pseudo-header fields first
+	 */
+	static HTTP::Headers request_fields(const HTTP::Request& request, const std::string& scheme, const std::string& content)
+	{
+		HTTP::Headers fields;
+		fields.push_back(std::make_pair(":method", request.method));
+		fields.push_back(std::make_pair(":scheme", scheme));
+		const std::string* host = request.header(HTTP::HEADER_HOST);
+		if (host != nullptr)
+		{
+			fields.push_back(std::make_pair(":authority", *host));
+		}
+		fields.push_back(std::make_pair(":path", request.target));
+
+		for (size_t i = 0; i < request.headers.size(); ++i)
+		{
+			bool dropped = false;
+			switch (request.headers[i].id)
+			{
+				case HTTP::HEADER_CONNECTION:
+				case HTTP::HEADER_CONTENT_LENGTH:
+				case HTTP::HEADER_HOST:
+				case HTTP::HEADER_KEEP_ALIVE:
+				case HTTP::HEADER_PROXY_CONNECTION:
+				case HTTP::HEADER_TRANSFER_ENCODING:
+				case HTTP::HEADER_UPGRADE:
+					dropped = true;
+					break;
+				case HTTP::HEADER_TE:
+					dropped = request.headers[i].second != "trailers";
+					break;
+				default:
+					break;
+			}
+
+			if (dropped)
+			{
+				continue;
+			}
+
+			if (request.headers[i].id != HTTP::HEADER_OTHER)
+			{
+				fields.push_back(std::make_pair(HTTP::header_name(request.headers[i].id), request.headers[i].second));
+			}
+			else
+			{
+				std::string name = request.headers[i].first;
+				std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+				fields.push_back(std::make_pair(name, request.headers[i].second));
+			}
+		}
+
+		if (!content.empty() || request.content_length() == 0)
+		{
+			fields.push_back(std::make_pair("content-length", std::to_string(content.size())));
+		}
+
+		return fields;
+	}
+
+	/**
+	 * Replays a session that spoke HTTP/2, such as a gRPC client
+	 *
+	 * The captured streams are renumbered 1, 3, 5... in the order they opened and
+	 * everything the client sent on them is replayed on its captured schedule over a
+	 * single connection, while a second thread reads the target's frames. That thread
+	 * answers SETTINGS and PING, returns the flow-control window of every DATA frame,
+	 * counts gRPC messages and ends each call at the end of its response: for gRPC,
+	 * the trailers carrying grpc-status. The target's own flow-control window is not
+	 * enforced on what is sent, so request bodies beyond 64 KiB per stream rely on
+	 * the target advertising a larger window.
+	 *
+	 * @param const Session& session The session to replay
+	 * @param Clock::time_point origin When the replay started
+	 * @param Pacer& pacer Paces the events sent
+	 * @param[out] result The outcome
+	 *
+	 * @return void
+	 */
+	void Engine::replay_http2(const Session& session, Clock::time_point origin, Pacer& pacer, Result& result)
+	{
+		HTTP::Client client;
+		connect_target(client, host_, port_);
+		TcpSampler tcp_sampler = { client, result.tcp };
+
+		std::mutex write_mutex;
+		std::mutex state_mutex;
+		std::vector<Clock::time_point> started(session.calls.size());
+		std::vector<bool> opened(session.calls.size(), false);
+		std::vector<bool> done(session.calls.size(), false);
+		size_t outstanding = 0;
+		bool sending_done = false;
+
+		result.calls.assign(session.calls.size(), CallResult());
+
+		auto send = [&](const std::string& frames) {
+			std::lock_guard<std::mutex> lock(write_mutex);
+			return client.write_all(frames);
+		};
+
+		// Ends a call that was opened; returns whether every call has now ended, with nothing left to send
+		auto finish = [&](size_t call, const char* error) {
+			if (opened[call] && !done[call])
+			{
+				done[call] = true;
+				--outstanding;
+				result.calls[call].latency = elapsed(started[call], Clock::now());
+				if (error != nullptr)
+				{
+					result.calls[call].failed = true;
+					result.calls[call].error = error;
+				}
+			}
+			return sending_done && outstanding == 0;
+		};
+
+		if (!send(std::string(HTTP::HTTP2::PREFACE, HTTP::HTTP2::PREFACE_SIZE) + HTTP::HTTP2::encode_frame(HTTP::HTTP2::SETTINGS, 0, 0, "")))
+		{
+			throw std::runtime_error("Failed to send connection preface");
+		}
+
+		std::thread reader([&]() {
+			HTTP::HTTP2::FrameReader frames(false);
+			std::vector<HTTP::GRPC::MessageParser> messages(session.calls.size(), HTTP::GRPC::MessageParser(0));
+			std::vector<char> chunk(16384);
+			HTTP::HTTP2::Frame frame;
+
+			for (;;)
+			{
+				while (frames.next(frame))
+				{
+					bool end_stream = (frame.flags & HTTP::HTTP2::END_STREAM) != 0;
+
+					if (frame.type == HTTP::HTTP2::SETTINGS && !(frame.flags & HTTP::HTTP2::ACK))
+					{
+						send(HTTP::HTTP2::encode_frame(HTTP::HTTP2::SETTINGS, HTTP::HTTP2::ACK, 0, ""));
+						continue;
+					}
+					if (frame.type == HTTP::HTTP2::PING && !(frame.flags & HTTP::HTTP2::ACK))
+					{
+						send(HTTP::HTTP2::encode_frame(HTTP::HTTP2::PING, HTTP::HTTP2::ACK, 0, frame.payload));
+						continue;
+					}
+					size_t call = (frame.stream - 1) / 2;
+					if (frame.stream % 2 == 0 || call >= session.calls.size())
+					{
+						continue;
+					}
+
+					bool call_opened;
+					{
+						std::lock_guard<std::mutex> lock(state_mutex);
+						call_opened = opened[call];
+					}
+
+					// DATA counts against the connection's window whichever stream it is on
+					if (frame.type == HTTP::HTTP2::DATA && !frame.payload.empty())
+					{
+						uint32_t size = static_cast<uint32_t>(frame.payload.size());
+						send(encode_window_update(0, size) + (end_stream || !call_opened ? "" : encode_window_update(frame.stream, size)));
+					}
+
+					// A target answering a stream before it was opened is in error; its frames must not end the call unsent
+					if (!call_opened)
+					{
+						debug("Ignoring HTTP/2 frame of type %d on stream %u, which was not opened yet", frame.type, frame.stream);
+						continue;
+					}
+
+					std::lock_guard<std::mutex> lock(state_mutex);
+					CallResult& call_result = result.calls[call];
+					bool finished = false;
+
+					if (frame.type == HTTP::HTTP2::HEADERS)
+					{
+						const std::string* status = HTTP::HTTP2::field(frame.headers, ":status");
+						if (status != nullptr && call_result.status == 0)
+						{
+							call_result.status = std::atoi(status->c_str());
+						}
+
+						// Trailers, or headers alone for a gRPC call that failed before sending anything
+						const std::string* grpc_status = HTTP::HTTP2::field(frame.headers, "grpc-status");
+						if (grpc_status != nullptr)
+						{
+							call_result.grpc_status = std::atoi(grpc_status->c_str());
+						}
+
+						if (end_stream)
+						{
+							finished = finish(call, session.calls[call].grpc && grpc_status == nullptr ? "No grpc-status" : nullptr);
+						}
+					}
+					else if (frame.type == HTTP::HTTP2::DATA)
+					{
+						if (session.calls[call].grpc)
+						{
+							messages[call].feed(frame.payload);
+							HTTP::GRPC::Message message;
+							while (messages[call].next(message))
+							{
+								++call_result.messages;
+							}
+						}
+
+						if (end_stream)
+						{
+							finished = finish(call, session.calls[call].grpc ? "No grpc-status" : nullptr);
+						}
+					}
+					else if (frame.type == HTTP::HTTP2::RST_STREAM)
+					{
+						finished = finish(call, "Stream reset");
+					}
+
+					if (finished)
+					{
+						return;
+					}
+				}
+
+				if (frames.failed())
+				{
+					std::lock_guard<std::mutex> lock(state_mutex);
+					result.failed = true;
+					result.error = "Invalid HTTP/2 frame from target";
+					return;
+				}
+
+				ssize_t received = client.read(chunk.data(), chunk.size());
+				if (received <= 0)
+				{
+					return;
+				}
+
+				frames.feed(chunk.data(), received);
+			}
+		});
+
+		// Captured events are timed like any scheduled send, unlike the reader thread's replies
+		auto send_event = [&](const std::string& frames) {
+			Clock::time_point start = Clock::now();
+			bool written = send(frames);
+			uint64_t wait = elapsed(start, Clock::now());
+
+			result.send_wait += wait;
+			result.max_send_wait = std::max(result.max_send_wait, wait);
+			result.sends += written ? 1 : 0;
+			return written;
+		};
+
+		bool sent = true;
+		for (size_t i = 0; i < session.stream_events.size() && sent; ++i)
+		{
+			const StreamEvent& event = session.stream_events[i];
+			Clock::time_point due = origin + std::chrono::microseconds(event.offset);
+			pacer.wait_until(due);
+			pacer.record(due);
+
+			uint32_t stream = static_cast<uint32_t>(event.call * 2 + 1);
+			if (event.type == HTTP::HTTP2::HEADERS)
+			{
+				std::string frames = encode_headers(stream, event.headers, event.end_stream);
+				{
+					std::lock_guard<std::mutex> lock(state_mutex);
+					if (!opened[event.call])
+					{
+						opened[event.call] = true;
+						started[event.call] = Clock::now();
+						++outstanding;
+					}
+				}
+				sent = send_event(frames);
+			}
+			else if (event.type == HTTP::HTTP2::DATA)
+			{
+				sent = send_event(encode_data(stream, event.payload, event.end_stream));
+			}
+			else if (event.type == HTTP::HTTP2::RST_STREAM)
+			{
+				// The captured client cancelled the call, so no further response is expected
+				sent = send_event(HTTP::HTTP2::encode_frame(HTTP::HTTP2::RST_STREAM, 0, stream, std::string("\0\0\0\x08", 4)));
+
+				std::lock_guard<std::mutex> lock(state_mutex);
+				finish(event.call, nullptr);
+			}
+		}
+
+		// No more streams will be opened, though the target still answers those that are open
+		if (sent)
+		{
+			send(HTTP::HTTP2::encode_frame(HTTP::HTTP2::GOAWAY, 0, 0, std::string(8, '\0')));
+		}
+
+		bool finished;
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			sending_done = true;
+			finished = outstanding == 0;
+			if (!sent)
+			{
+				result.failed = true;
+				result.error = "Failed to send frame";
+			}
+		}
+
+		if (finished || !sent)
+		{
+			shutdown(client.fd(), SHUT_RDWR);
+		}
+
+		reader.join();
+
+		for (size_t i = 0; i < done.size(); ++i)
+		{
+			if (!done[i])
+			{
+				result.calls[i].failed = true;
+				result.calls[i].error = opened[i] ? "No response" : "Not sent";
+			}
+		}
+	}
+
+	/**
+	 * Replays a plain HTTP session as a single HTTP/2 stream, with prior knowledge
+	 *
+	 * Like replay_http(), each session gets its own connection and the latency runs
+	 * from sending the request to the end of the response, so the two protocols are
+	 * timed alike. The connection preface and SETTINGS go out with the request.
+	 *
+	 * @param const Session& session The session to replay
+	 * @param[out] result The outcome
+	 *
+	 * @return void
+	 */
+	void Engine::replay_http_over_h2(const Session& session, Result& result)
+	{
+		HTTP::Request request;
+		request_head(session, request);
+		std::string content = request_content(session, request);
+
+		HTTP::Client client;
+		connect_target(client, host_, port_);
+		TcpSampler tcp_sampler = { client, result.tcp };
+
+		std::string frames(HTTP::HTTP2::PREFACE, HTTP::HTTP2::PREFACE_SIZE);
+		frames += HTTP::HTTP2::encode_frame(HTTP::HTTP2::SETTINGS, 0, 0, "");
+		frames += encode_headers(1, request_fields(request, "http", content), content.empty());
+		if (!content.empty())
+		{
+			frames += encode_data(1, content, true);
+		}
+
+		Clock::time_point sent = Clock::now();
+		if (!timed_write(client, frames, result))
+		{
+			throw std::runtime_error("Failed to send request");
+		}
+		++result.sends;
+
+		HTTP::HTTP2::FrameReader reader(false);
+		std::vector<char> chunk(16384);
+		HTTP::HTTP2::Frame frame;
+		bool complete = false;
+
+		while (!complete)
+		{
+			ssize_t received = client.read(chunk.data(), chunk.size());
+			if (received <= 0)
+			{
+				throw std::runtime_error("Connection closed before the response ended");
+			}
+			reader.feed(chunk.data(), received);
+
+			std::string replies;
+			while (reader.next(frame))
+			{
+				bool end_stream = (frame.flags & HTTP::HTTP2::END_STREAM) != 0;
+
+				if (frame.type == HTTP::HTTP2::SETTINGS && !(frame.flags & HTTP::HTTP2::ACK))
+				{
+					replies += HTTP::HTTP2::encode_frame(HTTP::HTTP2::SETTINGS, HTTP::HTTP2::ACK, 0, "");
+				}
+				else if (frame.type == HTTP::HTTP2::PING && !(frame.flags & HTTP::HTTP2::ACK))
+				{
+					replies += HTTP::HTTP2::encode_frame(HTTP::HTTP2::PING, HTTP::HTTP2::ACK, 0, frame.payload);
+				}
+				else if (frame.type == HTTP::HTTP2::GOAWAY && !complete)
+				{
+					throw std::runtime_error("Connection refused with GOAWAY");
+				}
+				else if (frame.stream != 1)
+				{
+					continue;
+				}
+				else if (frame.type == HTTP::HTTP2::HEADERS)
+				{
+					// Interim responses such as 100 Continue are followed by the final one
+					const std::string* status = HTTP::HTTP2::field(frame.headers, ":status");
+					if (status != nullptr && std::atoi(status->c_str()) >= 200)
+					{
+						result.status = std::atoi(status->c_str());
+					}
+					complete = end_stream;
+				}
+				else if (frame.type == HTTP::HTTP2::DATA)
+				{
+					if (!frame.payload.empty())
+					{
+						uint32_t size = static_cast<uint32_t>(frame.payload.size());
+						replies += encode_window_update(0, size);
+						if (!end_stream)
+						{
+							replies += encode_window_update(1, size);
+						}
+					}
+					complete = end_stream;
+				}
+				else if (frame.type == HTTP::HTTP2::RST_STREAM)
+				{
+					throw std::runtime_error("Stream reset by target");
+				}
+			}
+
+			if (reader.failed())
+			{
+				throw std::runtime_error("Invalid HTTP/2 frame from target");
+			}
+
+			if (!replies.empty())
+			{
+				client.write_all(replies);
+			}
+		}
+
+		result.latency = elapsed(sent, Clock::now());
+		client.write_all(HTTP::HTTP2::encode_frame(HTTP::HTTP2::GOAWAY, 0, 0, std::string(8, '\0')));
+	}
+
+	/**
+	 * Replays a plain HTTP session as a single HTTP/3 request
+	 *
+	 * The target's UDP port with the same number is used. As with the other
+	 * protocols, each session gets its own connection, but only the request and
+	 * response are timed: the QUIC handshake is not.
+	 *
+	 * @param const Session& session The session to replay
+	 * @param[out] result The outcome
+	 *
+	 * @return void
+	 *
+	 * @throws std::runtime_error If this build has no HTTP/3 support
+	 */
+	void Engine::replay_http_over_h3(const Session& session, Result& result)
+	{
+		#if HTTP3_SUPPORT == 1
+		HTTP::Request request;
+		request_head(session, request);
+		std::string content = request_content(session, request);
+
+		HTTP::HTTP3::Client client;
+		client.connect(host_, port_, RESPONSE_TIMEOUT);
+
+		uint64_t body_size = 0;
+		Clock::time_point sent = Clock::now();
+		result.status = client.request(request_fields(request, "https", content), content, RESPONSE_TIMEOUT, body_size);
+		result.latency = elapsed(sent, Clock::now());
+		++result.sends;
+		#else
+		(void)session;
+		(void)result;
+		throw std::runtime_error("This build has no HTTP/3 support");
+		#endif /* HTTP3_SUPPORT */
+	}
+
+	/**
+	 * Replays sessions with streamed responses from a single thread
+	 *
+	 * Each stream is a non-blocking socket registered with one epoll instance, and the
+	 * loop sleeps in epoll_wait(), after spinning when busy polling, until a socket is
+	 * ready or the next stream is due to start. Every event read from the target is
+	 * timed against its captured counterpart: Server-Sent Events by message, other
+	 * streams by the amount of content received. A stream the captured client hung up
+	 * on is closed once every captured event has arrived, and any stream still open
+	 * RESPONSE_TIMEOUT seconds after its captured connection closed fails.
+	 *
+	 * @param const std::vector<size_t>& indices The sessions to replay, in the order they start
+	 * @param Clock::time_point origin When the replay started
+	 *
+	 * @return void
+	 */
+	void Engine::replay_streams(const std::vector<size_t>& indices, Clock::time_point origin)
+	{
+		struct addrinfo hints;
+		struct addrinfo* target = nullptr;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		int status = getaddrinfo(host_.c_str(), port_.c_str(), &hints, &target);
+		int epoll_fd = status == 0 ? epoll_create1(EPOLL_CLOEXEC) : -1;
+		if (epoll_fd == -1)
+		{
+			std::string error = status != 0 ? gai_strerror(status) : strerror(errno);
+			for (size_t i = 0; i < indices.size(); ++i)
+			{
+				results_[indices[i]].failed = true;
+				results_[indices[i]].error = error;
+			}
+			if (target != nullptr)
+			{
+				freeaddrinfo(target);
+			}
+			return;
+		}
+
+		// Every stream holds a socket open, so allow as many as the hard limit permits
+		struct rlimit files;
+		if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max)
+		{
+			files.rlim_cur = files.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &files);
+		}
+
+		std::vector<Stream> streams(indices.size());
+		std::vector<char> buffer(16384);
+		struct epoll_event ready[MAX_EVENTS];
+		size_t next = 0;
+		size_t active = 0;
+		Clock::time_point swept = Clock::now();
+		Pacer pacer(spin_budget_);
+		Clock::time_point begun = Clock::now();
+		uint64_t cpu_time = thread_cpu_time();
+		Clock::time_point woke = begun;
+
+		// The pacer's timer wakes the loop to start the next stream, its entry marked by a null pointer
+		struct epoll_event timer_event;
+		timer_event.events = EPOLLIN;
+		timer_event.data.ptr = nullptr;
+		bool timed = pacer.timer() != -1 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pacer.timer(), &timer_event) == 0;
+
+		// Closes a stream's socket, which also removes it from the epoll instance
+		auto finish = [&](Stream& stream, const char* error) {
+			if (error != nullptr)
+			{
+				results_[stream.index].failed = true;
+				results_[stream.index].error = error;
+				debug("Session %llu failed: %s", (unsigned long long)sessions_[stream.index].connection, error);
+			}
+			sample_tcp_info(stream.fd, results_[stream.index].tcp);
+			close(stream.fd);
+			stream.fd = -1;
+			--active;
+		};
+
+		while (next < streams.size() || active > 0)
+		{
+			// Start every stream that is due
+			Clock::time_point now = Clock::now();
+			while (next < streams.size() && origin + std::chrono::microseconds(sessions_[indices[next]].offset) <= now)
+			{
+				Stream& stream = streams[next];
+				stream.index = indices[next++];
+				stream.started = now;
+
+				const Session& session = sessions_[stream.index];
+				pacer.record(origin + std::chrono::microseconds(session.offset));
+				stream.deadline = origin + std::chrono::microseconds(std::max(session.closed, session.offset)) + std::chrono::seconds(RESPONSE_TIMEOUT);
+				write_request_head(session, true, stream.request);
+				stream.request += session.body;
+				stream.has_body = !head_request(session);
+
+				stream.fd = socket(target->ai_family, target->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, target->ai_protocol);
+				++active;
+				if (stream.fd == -1)
+				{
+					--active;
+					results_[stream.index].failed = true;
+					results_[stream.index].error = strerror(errno);
+					continue;
+				}
+				busy_poll_socket(stream.fd);
+
+				struct epoll_event event;
+				event.events = EPOLLOUT;
+				event.data.ptr = &stream;
+				if ((connect(stream.fd, target->ai_addr, target->ai_addrlen) == -1 && errno != EINPROGRESS)
+					|| epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stream.fd, &event) == -1)
+				{
+					finish(stream, strerror(errno));
+				}
+			}
+
+			// Deadlines are far apart compared to events, so checking them once a second is enough
+			if (now - swept >= std::chrono::seconds(1))
+			{
+				for (size_t i = 0; i < next; ++i)
+				{
+					if (streams[i].fd != -1 && streams[i].deadline <= now)
+					{
+						finish(streams[i], "Timed out");
+					}
+				}
+				swept = now;
+			}
+
+			int timeout = active > 0 ? 1000 : -1;
+			if (next < streams.size())
+			{
+				Clock::time_point due = origin + std::chrono::microseconds(sessions_[indices[next]].offset);
+				// With nothing to wait for, or the start within the spin budget, wait for it here
+				timeout = std::min(1000, pacer.poll_timeout(due));
+				if (active == 0 || timeout == 0)
+				{
+					loop_time_.add(elapsed_nanoseconds(woke, Clock::now()));
+					pacer.wait_until(due);
+					woke = Clock::now();
+					continue;
+				}
+
+				if (timed)
+				{
+					pacer.arm(due);
+					timeout = 1000;
+				}
+			}
+
+			loop_time_.add(elapsed_nanoseconds(woke, Clock::now()));
+			int count = wait_for_events(epoll_fd, ready, MAX_EVENTS, timeout);
+			woke = Clock::now();
+			if (count == -1 && errno != EINTR)
+			{
+				perror("epoll_wait");
+				break;
+			}
+
+			for (int i = 0; i < count; ++i)
+			{
+				if (ready[i].data.ptr == nullptr)
+				{
+					pacer.timer_fired();
+					continue;
+				}
+
+				Stream& stream = *static_cast<Stream*>(ready[i].data.ptr);
+				const Session& session = sessions_[stream.index];
+				Result& result = results_[stream.index];
+
+				if (!stream.connected)
+				{
+					int error = 0;
+					socklen_t error_size = sizeof(error);
+					getsockopt(stream.fd, SOL_SOCKET, SO_ERROR, &error, &error_size);
+					if (error != 0)
+					{
+						finish(stream, strerror(error));
+						continue;
+					}
+					stream.connected = true;
+				}
+
+				if (stream.sent < stream.request.size())
+				{
+					ssize_t written = send(stream.fd, stream.request.data() + stream.sent, stream.request.size() - stream.sent, MSG_NOSIGNAL);
+					if (written == -1 && errno != EAGAIN && errno != EINTR)
+					{
+						finish(stream, strerror(errno));
+						continue;
+					}
+					stream.sent += written > 0 ? written : 0;
+
+					// A short send means the send queue is full until the next EPOLLOUT
+					Clock::time_point attempted = Clock::now();
+					if (stream.blocked && written > 0)
+					{
+						uint64_t wait = elapsed(stream.blocked_since, attempted);
+						result.send_wait += wait;
+						result.max_send_wait = std::max(result.max_send_wait, wait);
+						stream.blocked = false;
+					}
+					if (!stream.blocked && stream.sent < stream.request.size())
+					{
+						stream.blocked = true;
+						stream.blocked_since = attempted;
+					}
+
+					if (stream.sent == stream.request.size())
+					{
+						++result.sends;
+						struct epoll_event event;
+						event.events = EPOLLIN;
+						event.data.ptr = &stream;
+						epoll_ctl(epoll_fd, EPOLL_CTL_MOD, stream.fd, &event);
+					}
+					continue;
+				}
+
+				ssize_t received = recv(stream.fd, buffer.data(), buffer.size(), 0);
+				if (received == -1 && (errno == EAGAIN || errno == EINTR))
+				{
+					continue;
+				}
+				if (received <= 0)
+				{
+					finish(stream, received == 0 && stream.head_done && stream.framing.until_close() ? nullptr : "Response ended early");
+					continue;
+				}
+
+				Clock::time_point arrived = Clock::now();
+				const char* data = buffer.data();
+				size_t size = received;
+
+				if (!stream.head_done)
+				{
+					stream.head.append(data, size);
+					size_t head_size = HTTP::Message::find_head_end(stream.head);
+					if (head_size == std::string::npos)
+					{
+						if (stream.head.size() > HTTP::Message::MAX_HEAD_SIZE)
+						{
+							finish(stream, "No valid response");
+						}
+						continue;
+					}
+
+					HTTP::Response response;
+					if (!response.parse_head(stream.head.substr(0, head_size)))
+					{
+						finish(stream, "No valid response");
+						continue;
+					}
+
+					stream.head_done = true;
+					stream.framing = HTTP::BodyFraming(response, stream.has_body && response.status >= 200 && response.status != 204 && response.status != 304);
+					result.status = response.status;
+					result.latency = elapsed(stream.started, arrived);
+
+					data = stream.head.data() + head_size;
+					size = stream.head.size() - head_size;
+				}
+
+				std::string content;
+				stream.framing.consume(data, size, &content);
+
+				// Time each event completed by this read against when it was captured
+				size_t completed = 0;
+				if (session.event_stream)
+				{
+					completed = stream.counter.feed(content);
+				}
+				else
+				{
+					stream.content += content.size();
+					while (result.events_received + completed < session.milestones.size()
+						&& session.milestones[result.events_received + completed] <= stream.content)
+					{
+						++completed;
+					}
+				}
+
+				for (size_t event = 0; event < completed; ++event, ++result.events_received)
+				{
+					if (result.events_received < session.events.size())
+					{
+						uint64_t lag = elapsed(origin + std::chrono::microseconds(session.events[result.events_received]), arrived);
+						result.total_lag += lag;
+						result.max_lag = std::max(result.max_lag, lag);
+					}
+				}
+
+				if (stream.framing.complete() || (session.hang_up && result.events_received >= session.events.size()))
+				{
+					finish(stream, nullptr);
+				}
+			}
+		}
+
+		for (size_t i = 0; i < streams.size(); ++i)
+		{
+			if (streams[i].fd != -1)
+			{
+				sample_tcp_info(streams[i].fd, results_[streams[i].index].tcp);
+				close(streams[i].fd);
+			}
+		}
+
+		close(epoll_fd);
+		freeaddrinfo(target);
+
+		streams_usage_.wall_time = elapsed(begun, Clock::now());
+		streams_usage_.cpu_time = thread_cpu_time() - cpu_time;
+		streams_usage_.spin_time = pacer.spin_time();
+		merge_pacer(pacer);
+	}
+
+	/**
+	 * Writes a summary of the results
+	 *
+	 * @param std::ostream& out Where to write the summary
+	 *
+	 * @return void
+	 */
+	void Engine::report(std::ostream& out) const
+	{
+		size_t failed = 0;
+		size_t responses = 0;
+		uint64_t total_latency = 0;
+		uint64_t min_latency = 0;
+		uint64_t max_latency = 0;
+		std::map<int, size_t> statuses;
+
+		size_t websockets = 0;
+		size_t frames_sent = 0;
+		size_t frames_received = 0;
+		uint64_t total_lag = 0;
+		uint64_t max_lag = 0;
+
+		size_t streams = 0;
+		size_t events_captured = 0;
+		size_t events_received = 0;
+		uint64_t total_event_lag = 0;
+		uint64_t max_event_lag = 0;
+
+		size_t calls = 0;
+		size_t failed_calls = 0;
+		std::map<std::string, MethodSummary> methods;
+
+		for (size_t i = 0; i < results_.size(); ++i)
+		{
+			const Result& result = results_[i];
+			if (result.failed)
+			{
+				++failed;
+			}
+
+			if (result.status != 0)
+			{
+				++statuses[result.status];
+				min_latency = responses == 0 ? result.latency : std::min(min_latency, result.latency);
+				max_latency = std::max(max_latency, result.latency);
+				total_latency += result.latency;
+				++responses;
+			}
+
+			if (sessions_[i].websocket)
+			{
+				++websockets;
+				frames_sent += result.frames_sent;
+				frames_received += result.frames_received;
+				total_lag += result.total_lag;
+				max_lag = std::max(max_lag, result.max_lag);
+			}
+			else if (sessions_[i].streaming)
+			{
+				++streams;
+				events_captured += sessions_[i].events.size();
+				events_received += result.events_received;
+				total_event_lag += result.total_lag;
+				max_event_lag = std::max(max_event_lag, result.max_lag);
+			}
+
+			for (size_t c = 0; c < result.calls.size(); ++c)
+			{
+				const CallResult& call = result.calls[c];
+				MethodSummary& method = methods[sessions_[i].calls[c].method];
+				++calls;
+				++method.calls;
+				method.messages_captured += sessions_[i].calls[c].messages;
+				method.messages_received += call.messages;
+
+				if (call.failed)
+				{
+					++failed_calls;
+					++method.failed;
+					continue;
+				}
+
+				if (call.grpc_status != -1)
+				{
+					++method.grpc_statuses[call.grpc_status];
+				}
+				method.latency.add(call.latency);
+			}
+		}
+
+		static const char* const PROTOCOL_NAMES[] = { "HTTP/1.1", "HTTP/2", "HTTP/3" };
+
+		out << "Replayed " << results_.size() << " sessions against " << (port_.empty() ? host_ : host_ + ":" + port_) << " over " << PROTOCOL_NAMES[protocol_] << ", " << failed << " failed" << std::endl;
+		out << "CPU time: user " << user_time_ / 1000.0 << " ms, system " << system_time_ / 1000.0 << " ms over " << wall_time_ / 1000.0 << " ms";
+		if (responses > 0)
+		{
+			out << ", " << (user_time_ + system_time_) / responses / 1000.0 << " ms per response";
+		}
+		out << std::endl;
+
+		report_generator(out);
+
+		if (responses > 0)
+		{
+			out << "Responses: " << responses
+				<< ", latency min/avg/max " << min_latency / 1000.0 << "/" << total_latency / responses / 1000.0 << "/" << max_latency / 1000.0 << " ms" << std::endl;
+
+			for (std::map<int, size_t>::const_iterator it = statuses.begin(); it != statuses.end(); ++it)
+			{
+				out << "  " << it->first << ": " << it->second << std::endl;
+			}
+		}
+
+		if (websockets > 0)
+		{
+			out << "WebSocket sessions: " << websockets << ", frames sent " << frames_sent << ", received " << frames_received << std::endl;
+			if (frames_received > 0)
+			{
+				out << "  delivery lag avg/max " << total_lag / frames_received / 1000.0 << "/" << max_lag / 1000.0 << " ms" << std::endl;
+			}
+		}
+
+		if (streams > 0)
+		{
+			out << "Streamed responses: " << streams << ", events captured " << events_captured << ", received " << events_received << std::endl;
+			if (events_received > 0)
+			{
+				out << "  delivery lag avg/max " << total_event_lag / events_received / 1000.0 << "/" << max_event_lag / 1000.0 << " ms" << std::endl;
+			}
+		}
+
+		if (calls > 0)
+		{
+			out << "HTTP/2 calls: " << calls << ", " << failed_calls << " failed" << std::endl;
+
+			for (std::map<std::string, MethodSummary>::const_iterator it = methods.begin(); it != methods.end(); ++it)
+			{
+				const MethodSummary& method = it->second;
+				out << "  " << it->first << ": " << method.calls << " calls, " << method.failed << " failed"
+					<< ", messages captured " << method.messages_captured << ", received " << method.messages_received << std::endl;
+
+				for (std::map<int, size_t>::const_iterator status = method.grpc_statuses.begin(); status != method.grpc_statuses.end(); ++status)
+				{
+					out << "    grpc-status " << status->first << ": " << status->second << std::endl;
+				}
+
+				if (method.latency.count() > 0)
+				{
+					method.latency.print(out, "    ");
+				}
+			}
+		}
+
+		report_network(out);
+	}
+
+	/**
+	 * Writes how well the replay itself kept up, and whether it was saturated
+	 *
+	 * Latency measured by a generator that cannot keep up includes the time it
+	 * added itself, so the replay is reported saturated when its sends fell behind
+	 * schedule, or when a thread or the process as a whole was busy nearly all the
+	 * time. Spinning for send times is left out, as it only fills time that would
+	 * otherwise be idle. Time a send waited for room in a full send queue, and
+	 * scheduled sends never made because their session failed first, are shown
+	 * too; they point at the target or the network as often as at the generator.
+	 * With huge pages asked for, it shows how much memory the kernel granted them.
+	 *
+	 * @param std::ostream& out Where to write
+	 *
+	 * @return void
+	 */
+	void Engine::report_generator(std::ostream& out) const
+	{
+		size_t scheduled = 0;
+		size_t sends = 0;
+		uint64_t send_wait = 0;
+		uint64_t max_send_wait = 0;
+		size_t threads = 0;
+		double total_share = 0;
+		double max_share = 0;
+
+		for (size_t i = 0; i < results_.size(); ++i)
+		{
+			const Session& session = sessions_[i];
+			const Result& result = results_[i];
+
+			scheduled += session.http2 ? session.stream_events.size() : 1 + (session.websocket ? session.client_frames.size() : 0);
+			sends += result.sends;
+			send_wait += result.send_wait;
+			max_send_wait = std::max(max_send_wait, result.max_send_wait);
+
+			if (result.thread.wall_time > 0)
+			{
+				double share = busy_share(result.thread);
+				total_share += share;
+				max_share = std::max(max_share, share);
+				++threads;
+			}
+		}
+
+		std::vector<std::string> reasons;
+		if (schedule_lag_.count() > 0 && schedule_lag_.percentile(99) > SATURATED_LAG)
+		{
+			reasons.push_back("p99 schedule lag above " + std::to_string(SATURATED_LAG / 1000000) + " ms");
+		}
+		if (busy_share(scheduler_usage_) >= SATURATED_SHARE)
+		{
+			reasons.push_back("scheduler thread busy");
+		}
+		if (busy_share(streams_usage_) >= SATURATED_SHARE)
+		{
+			reasons.push_back("streamed-response thread busy");
+		}
+
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		uint64_t cpu_time = user_time_ + system_time_;
+		double process_share = wall_time_ > 0 && cpu_time > spin_time_ ? static_cast<double>(cpu_time - spin_time_) / wall_time_ / (cpus > 0 ? cpus : 1) : 0;
+		if (process_share >= SATURATED_SHARE)
+		{
+			reasons.push_back("every CPU busy");
+		}
+
+		if (reasons.empty())
+		{
+			out << "Generator: kept up" << std::endl;
+		}
+		else
+		{
+			out << "Generator: SATURATED (";
+			for (size_t i = 0; i < reasons.size(); ++i)
+			{
+				out << (i > 0 ? ", " : "") << reasons[i];
+			}
+			out << "), so the latencies below include delay added by the replay itself" << std::endl;
+		}
+
+		if (schedule_lag_.count() > 0)
+		{
+			// Lags are kept in nanoseconds and shown in microseconds
+			out << "  schedule lag: " << schedule_lag_.count() << " sends, avg " << schedule_lag_.mean() / 1000.0
+				<< " p50 " << schedule_lag_.percentile(50) / 1000.0
+				<< " p99 " << schedule_lag_.percentile(99) / 1000.0
+				<< " p99.9 " << schedule_lag_.percentile(99.9) / 1000.0
+				<< " max " << schedule_lag_.max() / 1000.0 << " us" << std::endl;
+		}
+
+		out << "  threads busy: scheduler " << busy_share(scheduler_usage_) * 100 << "%";
+		if (streams_usage_.wall_time > 0)
+		{
+			out << ", streamed responses " << busy_share(streams_usage_) * 100 << "%";
+		}
+		if (threads > 0)
+		{
+			out << ", " << threads << " sessions on " << workers_ << " workers avg " << total_share / threads * 100 << "% max " << max_share * 100 << "%";
+		}
+		out << ", process " << process_share * 100 << "% of " << (cpus > 0 ? cpus : 1) << " CPUs, spinning " << spin_time_ / 1000.0 << " ms" << std::endl;
+
+		if (loop_time_.count() > 0)
+		{
+			out << "  streamed-response loop: " << loop_time_.count() << " iterations, busy avg " << loop_time_.mean() / 1000.0
+				<< " p99 " << loop_time_.percentile(99) / 1000.0
+				<< " max " << loop_time_.max() / 1000.0 << " us" << std::endl;
+		}
+
+		out << "  sends: " << scheduled << " scheduled, " << sends << " made, " << (scheduled > sends ? scheduled - sends : 0) << " dropped"
+			<< ", send-queue wait total/max " << send_wait / 1000.0 << "/" << max_send_wait / 1000.0 << " ms" << std::endl;
+
+		if (huge_pages_)
+		{
+			// Only what the kernel actually granted counts; the request alone guarantees nothing
+			out << "  huge pages: capture " << kibibytes(capture_huge_bytes_) << " of " << kibibytes(capture_bytes_) << " KiB"
+				<< ", strings " << kibibytes(strings_.huge_bytes()) << " of " << kibibytes(strings_.bytes()) << " KiB"
+				<< (strings_.hugetlb() ? " (hugetlbfs)" : " (transparent)") << std::endl;
+		}
+	}
+
+	/**
+	 * Writes the TCP statistics of the replayed connections, and of those behind the slowest responses
+	 *
+	 * Each connection is sampled just before it closes, so the round-trip time is
+	 * the kernel's smoothed estimate over the whole exchange and retransmits count
+	 * every segment sent twice. Where the capture has the recorder's statistics for
+	 * the same connection, they are shown alongside, to tell a network that changed
+	 * since the capture from a server that did.
+	 *
+	 * A response cannot take less than one round trip, so a slow response whose
+	 * connection retransmitted, or that took under two round trips, is put down to
+	 * the network, and any other to the server. Connections to Unix domain sockets
+	 * and over HTTP/3 have no TCP statistics and are left out.
+	 *
+	 * @param std::ostream& out Where to write
+	 *
+	 * @return void
+	 */
+	void Engine::report_network(std::ostream& out) const
+	{
+		TcpSummary replayed;
+		TcpSummary captured;
+		std::vector<size_t> responses;
+
+		for (size_t i = 0; i < results_.size(); ++i)
+		{
+			summarise_tcp(results_[i].tcp, replayed);
+			summarise_tcp(sessions_[i].tcp, captured);
+			if (results_[i].status != 0)
+			{
+				responses.push_back(i);
+			}
+		}
+
+		if (replayed.connections == 0 && captured.connections == 0)
+		{
+			return;
+		}
+
+		out << "Network: " << replayed.connections << " of " << results_.size() << " connections sampled";
+		if (replayed.connections > 0)
+		{
+			out << ", ";
+			write_tcp_summary(out, replayed);
+		}
+		out << std::endl;
+
+		if (captured.connections > 0)
+		{
+			out << "  as captured: " << captured.connections << " connections, ";
+			write_tcp_summary(out, captured);
+			out << std::endl;
+		}
+
+		size_t slowest = std::min(responses.size(), SLOWEST_RESPONSES);
+		std::partial_sort(responses.begin(), responses.begin() + slowest, responses.end(), [this](size_t a, size_t b) {
+			return results_[a].latency > results_[b].latency;
+		});
+
+		if (replayed.connections == 0 || slowest == 0)
+		{
+			return;
+		}
+
+		out << "  slowest responses:" << std::endl;
+		for (size_t i = 0; i < slowest; ++i)
+		{
+			const Result& result = results_[responses[i]];
+			const TcpSample& tcp = result.tcp;
+			out << "    " << result.latency / 1000.0 << " ms, connection " << sessions_[responses[i]].connection;
+			if (!tcp.valid)
+			{
+				out << ": not sampled" << std::endl;
+				continue;
+			}
+
+			out << ": RTT " << tcp.rtt << " us (var " << tcp.rtt_var << "), " << tcp.retransmits << " retransmits, cwnd " << tcp.cwnd
+				<< ", " << tcp.delivery_rate * 8 / 1000000.0 << " Mbit/s";
+
+			const TcpSample& as_captured = sessions_[responses[i]].tcp;
+			if (as_captured.valid)
+			{
+				out << "; captured RTT " << as_captured.rtt << " us, " << as_captured.retransmits << " retransmits";
+			}
+
+			bool network = tcp.retransmits > 0 || result.latency < 2 * static_cast<uint64_t>(tcp.rtt);
+			out << " -> " << (network ? "network" : "server") << std::endl;
+		}
+	}
+}
@@ -0,0 +1,593 @@
+/*
+ * replay.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the Replay::Engine class.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "http_message.h"
+#include "http_request.h"
+#include "histogram.h"
+#include "pacer.h"
+#include "schedule.h"
+#include "string_table.h"
+#include "tcp_info.h"
+
+/**
+ * @namespace Replay
+ * Replaying captured traffic against a target server and measuring how it responds
+ */
+namespace Replay
+{
+
+	/**
+	 * @enum Protocol
+	 *
+	 * The protocols plain HTTP sessions can be replayed over
+	 */
+	enum Protocol
+	{
+		HTTP_1_1,
+		HTTP_2,
+		HTTP_3
+	};
+
+	/**
+	 * @struct Frame
+	 *
+	 * A captured WebSocket frame, timed relative to the start of the capture
+	 */
+	struct Frame
+	{
+		uint64_t offset = 0;
+		int opcode = 0;
+		bool fin = true;
+		std::string payload;
+	};
+
+	/**
+	 * @struct StreamEvent
+	 *
+	 * Something the client sent on a captured HTTP/2 connection, timed relative to
+	 * the start of the capture. The type is HTTP::HTTP2::HEADERS, DATA or RST_STREAM,
+	 * and DATA payloads of gRPC calls are already framed as gRPC messages.
+	 */
+	struct StreamEvent
+	{
+		uint64_t offset = 0;
+		size_t call = 0;
+		int type = 0;
+		bool end_stream = false;
+		HTTP::Headers headers;
+		std::string payload;
+	};
+
+	/**
+	 * @struct Call
+	 *
+	 * One stream of a captured HTTP/2 connection, in the order the streams opened
+	 */
+	struct Call
+	{
+		std::string method;
+		bool grpc = false;
+		size_t messages = 0;
+	};
+
+	/**
+	 * @struct Session
+	 *
+	 * The captured traffic of one client connection
+	 */
+	struct Session
+	{
+		/**
+		 * @var uint64_t The capture connection identifier
+		 */
+		uint64_t connection = 0;
+
+		/**
+		 * @var uint64_t When the request was captured, in microseconds since the start of the capture
+		 */
+		uint64_t offset = 0;
+
+		/**
+		 * @var std::vector<StringTable::Ref> The request line, then the name and value of each header field, interned in the Engine's strings
+		 */
+		std::vector<StringTable::Ref> head;
+
+		/**
+		 * @var std::string The raw request body
+		 */
+		std::string body;
+
+		/**
+		 * @var bool Whether the request upgraded the connection to WebSocket
+		 */
+		bool websocket = false;
+
+		/**
+		 * @var std::vector<Frame> The frames the client sent after the upgrade
+		 */
+		std::vector<Frame> client_frames;
+
+		/**
+		 * @var std::vector<uint64_t> When each frame from the server was captured, relative to the start of the capture
+		 */
+		std::vector<uint64_t> server_frames;
+
+		/**
+		 * @var bool Whether the response was streamed, without a Content-Length
+		 */
+		bool streaming = false;
+
+		/**
+		 * @var bool Whether the streamed response is a Server-Sent Events stream
+		 */
+		bool event_stream = false;
+
+		/**
+		 * @var std::vector<uint64_t> When each streamed event was captured, relative to the start of the capture
+		 *
+		 * For Server-Sent Events an event is a complete message; for other streams it is each piece read from the upstream.
+		 */
+		std::vector<uint64_t> events;
+
+		/**
+		 * @var std::vector<uint64_t> How much content had been streamed when each event was captured, for streams that are not Server-Sent Events
+		 */
+		std::vector<uint64_t> milestones;
+
+		/**
+		 * @var bool Whether the client hung up before the streamed response ended, as it does on endless streams
+		 */
+		bool hang_up = false;
+
+		/**
+		 * @var uint64_t When the connection closed, relative to the start of the capture
+		 */
+		uint64_t closed = 0;
+
+		/**
+		 * @var TcpSample The connection's TCP statistics as last captured, at close if the recorder saw it close
+		 */
+		TcpSample tcp;
+
+		/**
+		 * @var bool Whether the connection spoke HTTP/2 with prior knowledge
+		 */
+		bool http2 = false;
+
+		/**
+		 * @var std::vector<Call> The streams the client opened on an HTTP/2 connection
+		 */
+		std::vector<Call> calls;
+
+		/**
+		 * @var std::vector<StreamEvent> Everything the client sent on its HTTP/2 streams, in order
+		 */
+		std::vector<StreamEvent> stream_events;
+	};
+
+	/**
+	 * @brief Counts the Server-Sent Events completed in a stream
+	 *
+	 * An event ends at a blank line after at least one field; comment lines, such as
+	 * keep-alive pings, do not make an event on their own.
+	 */
+	class EventCounter
+	{
+		public:
+			/**
+			 * Construct an EventCounter at the start of a stream
+			 */
+			EventCounter();
+
+			/**
+			 * Consume the next piece of stream content
+			 *
+			 * @param const std::string& content The content, with any chunked framing removed
+			 *
+			 * @return size_t The number of events completed by this piece
+			 */
+			size_t feed(const std::string& content);
+
+		private:
+			bool line_start_;
+			bool comment_;
+			bool fields_;
+			bool carriage_return_;
+	};
+
+	/**
+	 * @struct CallResult
+	 *
+	 * What happened to one stream when an HTTP/2 session was replayed. The latency
+	 * runs from sending the request headers to the end of the response, which for
+	 * gRPC is the trailers carrying grpc-status.
+	 */
+	struct CallResult
+	{
+		bool failed = false;
+		std::string error;
+		int status = 0;
+		int grpc_status = -1;
+		uint64_t latency = 0;
+		size_t messages = 0;
+	};
+
+	/**
+	 * @struct ThreadUsage
+	 *
+	 * How long a replay thread ran, and how much of that it spent on a CPU and
+	 * spinning for send times, in microseconds
+	 */
+	struct ThreadUsage
+	{
+		uint64_t wall_time = 0;
+		uint64_t cpu_time = 0;
+		uint64_t spin_time = 0;
+	};
+
+	/**
+	 * @struct Result
+	 *
+	 * What happened when a session was replayed. Sends are the scheduled ones, the
+	 * request and each captured frame or stream event, and the send wait is the
+	 * time they were held up by a full socket send queue. The TCP statistics are
+	 * sampled as the session ends, just before its connection is closed.
+	 */
+	struct Result
+	{
+		bool failed = false;
+		std::string error;
+		int status = 0;
+		uint64_t latency = 0;
+		size_t frames_sent = 0;
+		size_t frames_received = 0;
+		size_t events_received = 0;
+		uint64_t total_lag = 0;
+		uint64_t max_lag = 0;
+		size_t sends = 0;
+		uint64_t send_wait = 0;
+		uint64_t max_send_wait = 0;
+		ThreadUsage thread;
+		TcpSample tcp;
+		std::vector<CallResult> calls;
+	};
+
+	/**
+	 * @brief Replays a capture against a target server
+	 *
+	 * Every captured connection is replayed on its own connection to the target,
+	 * starting at the same offset from the start of the replay as it had from the
+	 * start of the capture. WebSocket frames are sent on their captured schedule,
+	 * and frames from the target are timed against when the captured server sent them.
+	 * Streamed responses are all held open by one epoll loop, so thousands of them
+	 * cost a socket each rather than a thread each, and every event is timed the same way.
+	 * HTTP/2 connections are replayed stream by stream, and gRPC calls are reported
+	 * per method with a latency histogram.
+	 */
+	class Engine
+	{
+		public:
+			/**
+			 * Construct an Engine replaying against the specified target
+			 *
+			 * @param const std::string& host The host name or IP address of the target
+			 * @param const std::string& port The port number or service name of the target
+			 */
+			Engine(const std::string& host, const std::string& port);
+
+			/**
+			 * Set the protocol plain HTTP sessions are replayed over
+			 *
+			 * Sessions that upgraded to WebSocket, streamed their response or already
+			 * spoke HTTP/2 are always replayed as they were captured.
+			 *
+			 * @param Protocol protocol HTTP_1_1 (the default), HTTP_2 with prior knowledge, or HTTP_3
+			 *
+			 * @return void
+			 */
+			void set_protocol(Protocol protocol);
+
+			/**
+			 * Set how long before each scheduled send to stop sleeping and spin instead
+			 *
+			 * @param uint64_t spin_budget The budget in microseconds, or 0 to only sleep
+			 *
+			 * @return void
+			 */
+			void set_spin_budget(uint64_t spin_budget);
+
+			/**
+			 * Set whether the capture file and the loaded strings are put on huge pages
+			 *
+			 * @param bool huge_pages Whether to ask for huge pages
+			 *
+			 * @return void
+			 */
+			void set_huge_pages(bool huge_pages);
+
+			/**
+			 * Load the sessions to replay from a capture file
+			 *
+			 * @param const std::string& path The path to the capture file
+			 *
+			 * @return void
+			 *
+			 * @throws std::runtime_error If the capture file cannot be read
+			 */
+			void load(const std::string& path);
+
+			/**
+			 * Replay every loaded session and wait for them all to finish
+			 *
+			 * @return void
+			 */
+			void run();
+
+			/**
+			 * @var int The largest number of streamed responses waited on in one call to epoll_wait
+			 */
+			static const int MAX_EVENTS = 256;
+
+			/**
+			 * Write a summary of the results
+			 *
+			 * @param std::ostream& out Where to write the summary
+			 *
+			 * @return void
+			 */
+			void report(std::ostream& out) const;
+
+		protected:
+
+			/**
+			 * Replay one session that is due, recording its outcome
+			 *
+			 * @param size_t index The session's index in sessions_
+			 * @param uint64_t offset When it was due, in microseconds since the start of the replay
+			 * @param Schedule::Kind kind How it is replayed
+			 * @param Clock::time_point origin When the replay started
+			 *
+			 * @return void
+			 */
+			void replay_session(size_t index, uint64_t offset, Schedule::Kind kind, Clock::time_point origin);
+
+			/**
+			 * Rebuild the request head of a session from the interned strings
+			 *
+			 * @param const Session& session The session
+			 * @param[out] request The parsed request head
+			 *
+			 * @return void
+			 */
+			void request_head(const Session& session, HTTP::Request& request) const;
+
+			/**
+			 * Write the HTTP/1.1 request head of a session straight from the interned strings
+			 *
+			 * @param const Session& session The session
+			 * @param bool close Whether to send "Connection: close" in place of any captured Connection field
+			 * @param[out] out The buffer the head replaces the contents of
+			 *
+			 * @return void
+			 */
+			void write_request_head(const Session& session, bool close, std::string& out) const;
+
+			/**
+			 * Returns whether a session's request is a HEAD request, whose response has no body
+			 *
+			 * @param const Session& session The session
+			 *
+			 * @return bool Whether the method is HEAD
+			 */
+			bool head_request(const Session& session) const;
+
+			/**
+			 * Replay a plain HTTP session
+			 *
+			 * @param const Session& session The session to replay
+			 * @param[out] result The outcome
+			 *
+			 * @return void
+			 */
+			void replay_http(const Session& session, Result& result);
+
+			/**
+			 * Replay a plain HTTP session as a single HTTP/2 stream, with prior knowledge
+			 *
+			 * @param const Session& session The session to replay
+			 * @param[out] result The outcome
+			 *
+			 * @return void
+			 */
+			void replay_http_over_h2(const Session& session, Result& result);
+
+			/**
+			 * Replay a plain HTTP session as a single HTTP/3 request
+			 *
+			 * @param const Session& session The session to replay
+			 * @param[out] result The outcome
+			 *
+			 * @return void
+			 */
+			void replay_http_over_h3(const Session& session, Result& result);
+
+			/**
+			 * Replay a session that upgrades to WebSocket
+			 *
+			 * @param const Session& session The session to replay
+			 * @param Clock::time_point origin When the replay started
+			 * @param Pacer& pacer Paces the frames sent
+			 * @param[out] result The outcome
+			 *
+			 * @return void
+			 */
+			void replay_websocket(const Session& session, Clock::time_point origin, Pacer& pacer, Result& result);
+
+			/**
+			 * Replay a session that spoke HTTP/2, such as a gRPC client
+			 *
+			 * @param const Session& session The session to replay
+			 * @param Clock::time_point origin When the replay started
+			 * @param Pacer& pacer Paces the events sent
+			 * @param[out] result The outcome
+			 *
+			 * @return void
+			 */
+			void replay_http2(const Session& session, Clock::time_point origin, Pacer& pacer, Result& result);
+
+			/**
+			 * Replay sessions with streamed responses from a single thread
+			 *
+			 * @param const std::vector<size_t>& indices The sessions to replay, in the order they start
+			 * @param Clock::time_point origin When the replay started
+			 *
+			 * @return void
+			 */
+			void replay_streams(const std::vector<size_t>& indices, Clock::time_point origin);
+
+			/**
+			 * Add the send lags and spinning a thread's Pacer recorded to the totals
+			 *
+			 * @param const Pacer& pacer The Pacer
+			 *
+			 * @return void
+			 */
+			void merge_pacer(const Pacer& pacer);
+
+			/**
+			 * Write how well the replay itself kept up, and whether it was saturated
+			 *
+			 * @param std::ostream& out Where to write
+			 *
+			 * @return void
+			 */
+			void report_generator(std::ostream& out) const;
+
+			/**
+			 * Write the TCP statistics of the replayed connections, and of those behind the slowest responses
+			 *
+			 * @param std::ostream& out Where to write
+			 *
+			 * @return void
+			 */
+			void report_network(std::ostream& out) const;
+
+			/**
+			 * @var std::string The host name or IP address of the target
+			 */
+			std::string host_;
+
+			/**
+			 * @var std::string The port number or service name of the target
+			 */
+			std::string port_;
+
+			/**
+			 * @var Protocol The protocol plain HTTP sessions are replayed over
+			 */
+			Protocol protocol_;
+
+			/**
+			 * @var uint64_t Microseconds spun before each scheduled send
+			 */
+			uint64_t spin_budget_;
+
+			/**
+			 * @var bool Whether the capture file and the loaded strings are put on huge pages
+			 */
+			bool huge_pages_;
+
+			/**
+			 * @var size_t The size of the loaded capture file, and how much of it was on huge pages once read
+			 */
+			size_t capture_bytes_;
+			size_t capture_huge_bytes_;
+
+			/**
+			 * @var size_t The number of workers sessions are replayed on, set when the capture is loaded
+			 */
+			size_t workers_;
+
+			/**
+			 * @var uint64_t The wall-clock, user and system CPU time of the last run, in microseconds
+			 */
+			uint64_t wall_time_;
+			uint64_t user_time_;
+			uint64_t system_time_;
+
+			/**
+			 * @var Histogram How late every scheduled send of the last run was, in nanoseconds
+			 */
+			Histogram schedule_lag_;
+
+			/**
+			 * @var uint64_t The time every thread of the last run spent spinning for send times, in microseconds
+			 */
+			uint64_t spin_time_;
+
+			/**
+			 * @var std::mutex Guards schedule_lag_ and spin_time_ while replay threads finish
+			 */
+			std::mutex lag_mutex_;
+
+			/**
+			 * @var ThreadUsage How the threads starting sessions and holding streamed responses open ran in the last run
+			 */
+			ThreadUsage scheduler_usage_;
+			ThreadUsage streams_usage_;
+
+			/**
+			 * @var Histogram How long each iteration of the streamed-response loop spent working, in nanoseconds
+			 */
+			Histogram loop_time_;
+
+			/**
+			 * @var StringTable The request lines, header names and header values of the loaded sessions
+			 */
+			StringTable strings_;
+
+			/**
+			 * @var std::vector<Session> The sessions to replay, in the order of their connection identifiers
+			 */
+			std::vector<Session> sessions_;
+
+			/**
+			 * @var Schedule When each session starts, in start order
+			 */
+			Schedule schedule_;
+
+			/**
+			 * @var std::vector<Result> The outcome of each session, indexed like sessions_
+			 */
+			std::vector<Result> results_;
+	};
+}
+
+#endif /* REPLAY_H */
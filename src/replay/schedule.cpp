@@ -0,0 +1,133 @@
+/*
+ * schedule.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the Replay::Schedule class.
+ */
+
+#include <algorithm>
+#include "schedule.h"
+
+/**
+ * @namespace Replay
+ * Replaying captured traffic against a target server and measuring how it responds
+ */
+namespace Replay
+{
+
+	/**
+	 * Adds a session
+	 *
+	 * @param uint64_t offset When it starts, in microseconds since the start of the capture
+	 * @param uint32_t session Its index in the Engine's sessions
+	 * @param Kind kind How it is replayed
+	 *
+	 * @return void
+	 */
+	void Schedule::add(uint64_t offset, uint32_t session, Kind kind)
+	{
+		offsets.push_back(offset);
+		sessions.push_back(session);
+		kinds.push_back(static_cast<uint8_t>(kind));
+	}
+
+	/**
+	 * Orders the sessions by start time
+	 *
+	 * Only a permutation is sorted, then every column is gathered through it once.
+	 *
+	 * @return void
+	 */
+	void Schedule::sort()
+	{
+		std::vector<uint32_t> order(offsets.size());
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			order[i] = static_cast<uint32_t>(i);
+		}
+
+		std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+			return offsets[a] < offsets[b];
+		});
+
+		std::vector<uint64_t> sorted_offsets(order.size());
+		std::vector<uint32_t> sorted_sessions(order.size());
+		std::vector<uint8_t> sorted_kinds(order.size());
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			sorted_offsets[i] = offsets[order[i]];
+			sorted_sessions[i] = sessions[order[i]];
+			sorted_kinds[i] = kinds[order[i]];
+		}
+
+		offsets.swap(sorted_offsets);
+		sessions.swap(sorted_sessions);
+		kinds.swap(sorted_kinds);
+	}
+
+	/**
+	 * Removes every session
+	 *
+	 * @return void
+	 */
+	void Schedule::clear()
+	{
+		offsets.clear();
+		sessions.clear();
+		kinds.clear();
+	}
+
+	/**
+	 * Finds the end of the sessions due by a point in time
+	 *
+	 * Start times only grow, so the due sessions are a run from the first one not
+	 * yet started; a burst of them is counted in blocks of eight with no early
+	 * exit, which compilers turn into vector compares.
+	 *
+	 * @param size_t from The first position not yet started
+	 * @param uint64_t now The time, in microseconds since the start of the replay
+	 *
+	 * @return size_t The position just past the last session due, from if none is
+	 */
+	size_t Schedule::due(size_t from, uint64_t now) const
+	{
+		const uint64_t* offset = offsets.data();
+		size_t end = from;
+
+		while (end + 8 <= offsets.size())
+		{
+			size_t count = 0;
+			for (size_t i = 0; i < 8; ++i)
+			{
+				count += offset[end + i] <= now;
+			}
+
+			end += count;
+			if (count < 8)
+			{
+				return end;
+			}
+		}
+
+		while (end < offsets.size() && offset[end] <= now)
+		{
+			++end;
+		}
+
+		return end;
+	}
+}
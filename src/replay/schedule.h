@@ -0,0 +1,121 @@
+/*
+ * schedule.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the Replay::Schedule class.
+ */
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @namespace Replay
+ * Replaying captured traffic against a target server and measuring how it responds
+ */
+namespace Replay
+{
+
+	/**
+	 * @brief When each loaded session starts, stored column by column
+	 *
+	 * The start times, session indices and kinds are kept in separate arrays in
+	 * start order, so finding the sessions that are due only walks the contiguous
+	 * start times, and starting one needs nothing from the loaded session itself.
+	 */
+	class Schedule
+	{
+		public:
+			/**
+			 * @enum Kind
+			 *
+			 * How a session is replayed
+			 */
+			enum Kind
+			{
+				PLAIN,
+				WEBSOCKET,
+				HTTP2,
+				STREAM
+			};
+
+			/**
+			 * Add a session
+			 *
+			 * @param uint64_t offset When it starts, in microseconds since the start of the capture
+			 * @param uint32_t session Its index in the Engine's sessions
+			 * @param Kind kind How it is replayed
+			 *
+			 * @return void
+			 */
+			void add(uint64_t offset, uint32_t session, Kind kind);
+
+			/**
+			 * Order the sessions by start time, keeping sessions that start together in the order they were added
+			 *
+			 * @return void
+			 */
+			void sort();
+
+			/**
+			 * Remove every session
+			 *
+			 * @return void
+			 */
+			void clear();
+
+			/**
+			 * Find the end of the sessions due by a point in time
+			 *
+			 * @param size_t from The first position not yet started
+			 * @param uint64_t now The time, in microseconds since the start of the replay
+			 *
+			 * @return size_t The position just past the last session due, from if none is
+			 */
+			size_t due(size_t from, uint64_t now) const;
+
+			/**
+			 * Returns the number of sessions
+			 *
+			 * @return size_t The number of sessions
+			 */
+			size_t size() const
+			{
+				return offsets.size();
+			}
+
+			/**
+			 * @var std::vector<uint64_t> When each session starts, in microseconds since the start of the capture
+			 */
+			std::vector<uint64_t> offsets;
+
+			/**
+			 * @var std::vector<uint32_t> The index of each session in the Engine's sessions
+			 */
+			std::vector<uint32_t> sessions;
+
+			/**
+			 * @var std::vector<uint8_t> How each session is replayed, a Kind
+			 */
+			std::vector<uint8_t> kinds;
+	};
+}
+
+#endif /* SCHEDULE_H */
@@ -0,0 +1,169 @@
+/*
+ * string_table.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the Replay::StringTable class.
+ */
+
+#include <string.h>
+#include <stdexcept>
+#include "string_table.h"
+
+/**
+ * @namespace Replay
+ * Replaying captured traffic against a target server and measuring how it responds
+ */
+namespace Replay
+{
+
+	/**
+	 * StringTable constructor
+	 *
+	 * @return void
+	 */
+	StringTable::StringTable()
+		: slots_(1024, 0)
+	{
+	}
+
+	/**
+	 * Hashes a string with FNV-1a
+	 *
+	 * @param const char* data The string
+	 * @param size_t size Its length
+	 *
+	 * @return uint32_t The hash
+	 */
+	uint32_t StringTable::hash(const char* data, size_t size)
+	{
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= static_cast<unsigned char>(data[i]);
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+
+	/**
+	 * Adds a string, unless an equal one is already stored
+	 *
+	 * Slots are probed linearly from the string's hash, and the table doubles
+	 * once it is half full, so a lookup rarely looks at more than two slots.
+	 *
+	 * @param const char* data The string
+	 * @param size_t size Its length
+	 *
+	 * @return Ref The reference to the stored string
+	 *
+	 * @throws std::runtime_error If the table is full
+	 */
+	StringTable::Ref StringTable::intern(const char* data, size_t size)
+	{
+		uint32_t value_hash = hash(data, size);
+		size_t mask = slots_.size() - 1;
+
+		for (size_t slot = value_hash & mask; ; slot = (slot + 1) & mask)
+		{
+			uint32_t stored = slots_[slot];
+			if (stored == 0)
+			{
+				break;
+			}
+
+			const Span& span = spans_[stored - 1];
+			if (span.hash == value_hash && span.size == size && memcmp(buffer_.data() + span.offset, data, size) == 0)
+			{
+				return stored - 1;
+			}
+		}
+
+		if (spans_.size() >= UINT32_MAX - 1 || size > UINT32_MAX)
+		{
+			throw std::runtime_error("Too many distinct strings in the capture");
+		}
+
+		Span span;
+		span.offset = buffer_.size();
+		span.size = static_cast<uint32_t>(size);
+		span.hash = value_hash;
+		buffer_.append(data, size);
+		spans_.push_back(span);
+
+		Ref ref = static_cast<Ref>(spans_.size() - 1);
+		if (spans_.size() * 2 > slots_.size())
+		{
+			grow();
+		}
+		else
+		{
+			size_t slot = value_hash & mask;
+			while (slots_[slot] != 0)
+			{
+				slot = (slot + 1) & mask;
+			}
+			slots_[slot] = ref + 1;
+		}
+
+		return ref;
+	}
+
+	/**
+	 * Doubles the number of slots, placing every string again
+	 *
+	 * @return void
+	 */
+	void StringTable::grow()
+	{
+		slots_.assign(slots_.size() * 2, 0);
+		size_t mask = slots_.size() - 1;
+
+		for (size_t ref = 0; ref < spans_.size(); ++ref)
+		{
+			size_t slot = spans_[ref].hash & mask;
+			while (slots_[slot] != 0)
+			{
+				slot = (slot + 1) & mask;
+			}
+			slots_[slot] = static_cast<uint32_t>(ref + 1);
+		}
+	}
+
+	/**
+	 * Releases the spare capacity left from growing, once every string has been added
+	 *
+	 * @return void
+	 */
+	void StringTable::shrink()
+	{
+		buffer_.shrink();
+		spans_.shrink_to_fit();
+	}
+
+	/**
+	 * Removes every string, invalidating all references
+	 *
+	 * @return void
+	 */
+	void StringTable::clear()
+	{
+		buffer_.clear();
+		spans_.clear();
+		slots_.assign(1024, 0);
+	}
+}
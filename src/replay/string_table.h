@@ -0,0 +1,235 @@
+/*
+ * string_table.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the Replay::StringTable class.
+ */
+
+#ifndef STRING_TABLE_H
+#define STRING_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "huge_pages.h"
+
+/**
+ * @namespace Replay
+ * Replaying captured traffic against a target server and measuring how it responds
+ */
+namespace Replay
+{
+
+	/**
+	 * @brief Distinct strings stored once, referred to by 32-bit references
+	 *
+	 * A capture repeats the same header names and many of the same values in
+	 * every request, so the loader keeps each distinct string once, back to back
+	 * in a single buffer, and sessions hold references to them. Once loading is
+	 * done the table is only read, so replay threads share it without locking.
+	 * Every request the replay sends is assembled from this buffer, so it may be
+	 * put on huge pages to spare the replay threads TLB misses.
+	 */
+	class StringTable
+	{
+		public:
+			/**
+			 * @typedef Ref
+			 * A reference to a string in the table
+			 */
+			typedef uint32_t Ref;
+
+			/**
+			 * Construct an empty StringTable
+			 */
+			StringTable();
+
+			/**
+			 * Add a string, unless an equal one is already stored
+			 *
+			 * @param const char* data The string
+			 * @param size_t size Its length
+			 *
+			 * @return Ref The reference to the stored string
+			 *
+			 * @throws std::runtime_error If the table is full
+			 */
+			Ref intern(const char* data, size_t size);
+
+			/**
+			 * Add a string, unless an equal one is already stored
+			 *
+			 * @param const std::string& value The string
+			 *
+			 * @return Ref The reference to the stored string
+			 */
+			Ref intern(const std::string& value)
+			{
+				return intern(value.data(), value.size());
+			}
+
+			/**
+			 * Returns the characters of a stored string, which are not null-terminated
+			 *
+			 * @param Ref ref The reference
+			 *
+			 * @return const char* The characters
+			 */
+			const char* data(Ref ref) const
+			{
+				return buffer_.data() + spans_[ref].offset;
+			}
+
+			/**
+			 * Returns the length of a stored string
+			 *
+			 * @param Ref ref The reference
+			 *
+			 * @return size_t The length
+			 */
+			size_t size(Ref ref) const
+			{
+				return spans_[ref].size;
+			}
+
+			/**
+			 * Returns a copy of a stored string
+			 *
+			 * @param Ref ref The reference
+			 *
+			 * @return std::string The string
+			 */
+			std::string str(Ref ref) const
+			{
+				return std::string(data(ref), size(ref));
+			}
+
+			/**
+			 * Returns the number of distinct strings stored
+			 *
+			 * @return size_t The number of strings
+			 */
+			size_t count() const
+			{
+				return spans_.size();
+			}
+
+			/**
+			 * Returns the number of bytes of string data stored
+			 *
+			 * @return size_t The number of bytes
+			 */
+			size_t bytes() const
+			{
+				return buffer_.size();
+			}
+
+			/**
+			 * Set whether the string data is put on huge pages, before any string is added
+			 *
+			 * @param bool huge_pages Whether to ask for huge pages
+			 *
+			 * @return void
+			 */
+			void set_huge_pages(bool huge_pages)
+			{
+				buffer_.set_huge_pages(huge_pages);
+			}
+
+			/**
+			 * Returns how many bytes of string data the kernel currently backs with huge pages
+			 *
+			 * @return size_t The number of bytes
+			 */
+			size_t huge_bytes() const
+			{
+				return buffer_.huge_bytes();
+			}
+
+			/**
+			 * Returns whether the string data is on pages reserved from the hugetlbfs pool
+			 *
+			 * @return bool Whether it is on reserved huge pages
+			 */
+			bool hugetlb() const
+			{
+				return buffer_.hugetlb();
+			}
+
+			/**
+			 * Release the spare capacity left from growing, once every string has been added
+			 *
+			 * @return void
+			 */
+			void shrink();
+
+			/**
+			 * Remove every string, invalidating all references
+			 *
+			 * @return void
+			 */
+			void clear();
+
+		private:
+			/**
+			 * @struct Span
+			 *
+			 * Where a string lies in the buffer
+			 */
+			struct Span
+			{
+				uint64_t offset;
+				uint32_t size;
+				uint32_t hash;
+			};
+
+			/**
+			 * Hashes a string with FNV-1a
+			 *
+			 * @param const char* data The string
+			 * @param size_t size Its length
+			 *
+			 * @return uint32_t The hash
+			 */
+			static uint32_t hash(const char* data, size_t size);
+
+			/**
+			 * Doubles the number of slots, placing every string again
+			 *
+			 * @return void
+			 */
+			void grow();
+
+			/**
+			 * @var HugePageBuffer The strings, back to back
+			 */
+			HugePageBuffer buffer_;
+
+			/**
+			 * @var std::vector<Span> Where each string lies, indexed by reference
+			 */
+			std::vector<Span> spans_;
+
+			/**
+			 * @var std::vector<uint32_t> Open-addressed slots holding a reference plus one, or 0 when empty
+			 */
+			std::vector<uint32_t> slots_;
+	};
+}
+
+#endif /* STRING_TABLE_H */
@@ -0,0 +1,128 @@
+/*
+ * settings.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file holds the published settings snapshots of the HAperf application.
+ */
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "settings.h"
+
+/**
+ * @var Settings The snapshot in effect until the first call to publish_settings()
+ */
+static const Settings default_settings;
+
+/**
+ * @var std::atomic<const Settings*> The current snapshot
+ */
+static std::atomic<const Settings*> current_settings(&default_settings);
+
+/**
+ * @var std::vector<std::unique_ptr<const Settings>> Every snapshot ever published
+ *
+ * Snapshots are only published at startup and on reload, so keeping them all is cheap,
+ * and it means readers never need a reference count or a lock to use one safely.
+ */
+static std::vector<std::unique_ptr<const Settings>> published_settings;
+
+/**
+ * @var std::mutex Serialises publishers
+ */
+static std::mutex publish_mutex;
+
+/**
+ * Returns the current settings snapshot
+ *
+ * @return const Settings& The current settings
+ */
+const Settings& settings()
+{
+	return *current_settings.load(std::memory_order_acquire);
+}
+
+/**
+ * Publishes a new settings snapshot for subsequent calls to settings()
+ *
+ * @param const Settings& updated The validated settings to publish
+ *
+ * @return void
+ */
+void publish_settings(const Settings& updated)
+{
+	std::lock_guard<std::mutex> lock(publish_mutex);
+
+	published_settings.push_back(std::unique_ptr<const Settings>(new Settings(updated)));
+	current_settings.store(published_settings.back().get(), std::memory_order_release);
+}
+
+/**
+ * Keeps the settings that are only read at startup from the current snapshot
+ *
+ * @param[out] updated The reloaded settings, whose startup-only settings are replaced
+ * @param const Settings& current The settings in effect
+ *
+ * @return bool Whether any startup-only setting differed and was discarded
+ */
+bool retain_startup_settings(Settings& updated, const Settings& current)
+{
+	bool changed = updated.address != current.address
+		|| updated.port != current.port
+		|| updated.ssl_address != current.ssl_address
+		|| updated.ssl_port != current.ssl_port
+		|| updated.cert_files != current.cert_files
+		|| updated.cert_keys != current.cert_keys
+		|| updated.tls_ciphers != current.tls_ciphers
+		|| updated.tls_ciphersuites != current.tls_ciphersuites
+		|| updated.tls_min_version != current.tls_min_version
+		|| updated.tls_max_version != current.tls_max_version
+		|| updated.tls_curves != current.tls_curves
+		|| updated.tls_alpn != current.tls_alpn
+		|| updated.handshake_workers != current.handshake_workers
+		|| updated.upstream != current.upstream
+		|| updated.cache_size != current.cache_size
+		|| updated.capture_file != current.capture_file
+		|| updated.tcp_info_interval != current.tcp_info_interval
+		|| updated.cpus != current.cpus
+		|| updated.numa != current.numa
+		|| updated.busy_poll != current.busy_poll;
+
+	updated.address = current.address;
+	updated.port = current.port;
+	updated.ssl_address = current.ssl_address;
+	updated.ssl_port = current.ssl_port;
+	updated.cert_files = current.cert_files;
+	updated.cert_keys = current.cert_keys;
+	updated.tls_ciphers = current.tls_ciphers;
+	updated.tls_ciphersuites = current.tls_ciphersuites;
+	updated.tls_min_version = current.tls_min_version;
+	updated.tls_max_version = current.tls_max_version;
+	updated.tls_curves = current.tls_curves;
+	updated.tls_alpn = current.tls_alpn;
+	updated.handshake_workers = current.handshake_workers;
+	updated.upstream = current.upstream;
+	updated.cache_size = current.cache_size;
+	updated.capture_file = current.capture_file;
+	updated.tcp_info_interval = current.tcp_info_interval;
+	updated.cpus = current.cpus;
+	updated.numa = current.numa;
+	updated.busy_poll = current.busy_poll;
+
+	return changed;
+}
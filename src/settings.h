@@ -22,9 +22,179 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
+#include <string>
+#include <vector>
+
+/**
+ * @struct Settings
+ *
+ * The validated configuration of the application, merged from defaults, the
+ * configuration file and the command line. A published Settings snapshot is
+ * never modified, so it can be read from any thread without locking.
+ */
+struct Settings
+{
+	/**
+	 * @var bool Whether verbose mode is enabled or not
+	 */
+	bool verbose = false;
+
+	/**
+	 * @var std::vector<int> The CPUs worker threads are pinned to, or empty to leave them to the scheduler
+	 */
+	std::vector<int> cpus;
+
+	/**
+	 * @var bool Whether worker threads are pinned and allocate memory from the NUMA node of their CPU
+	 */
+	bool numa = false;
+
+	/**
+	 * @var size_t Microseconds each wait for a socket spins before blocking, or 0 to block at once
+	 */
+	size_t busy_poll = 0;
+
+	/**
+	 * @var std::string The IP address to record HTTP on
+	 */
+	std::string address = "::";
+
+	/**
+	 * @var std::string The port number to record HTTP on
+	 */
+	std::string port = "80";
+
+	/**
+	 * @var bool Whether every connection opens with a PROXY protocol header giving the real client address
+	 */
+	bool proxy_protocol = false;
+
+	/**
+	 * @var size_t The number of bytes read from a client at a time
+	 */
+	size_t read_buffer_size = 1024;
+
+	/**
+	 * @var int Seconds to wait for a client to send its request, or 0 to wait forever
+	 */
+	int read_timeout = 0;
+
+	/**
+	 * @var std::string The "host:port" to forward recorded requests to, or empty to echo them
+	 */
+	std::string upstream;
+
+	/**
+	 * @var std::vector<std::string> Hosts, or "host:port" pairs, that CONNECT tunnels may be opened to; "*" allows any
+	 */
+	std::vector<std::string> tunnel_hosts;
+
+	/**
+	 * @var size_t The bytes of upstream responses the proxy may cache, or 0 to cache nothing
+	 */
+	size_t cache_size = 0;
+
+	/**
+	 * @var std::string The capture file recorded to and replayed from, or empty to record nothing
+	 */
+	std::string capture_file;
+
+	/**
+	 * @var size_t Milliseconds between samples of each recorded connection's TCP statistics, or 0 to sample them only at close
+	 */
+	size_t tcp_info_interval = 0;
+
+	/**
+	 * @var std::string The "host:port" to replay captured traffic against
+	 */
+	std::string target;
+
+	/**
+	 * @var std::string The protocol plain HTTP sessions are replayed over: h1, h2 (prior knowledge) or h3
+	 */
+	std::string protocol = "h1";
+
+	/**
+	 * @var size_t Microseconds the replay spins before each scheduled send rather than sleeping, or 0 to only sleep
+	 */
+	size_t spin_budget = 50;
+
+	/**
+	 * @var bool Whether the replay asks for huge pages for the capture file and the loaded strings
+	 */
+	bool huge_pages = false;
+
+	/**
+	 * @var std::string The IP address to record HTTPS on, or empty to use the HTTP address
+	 */
+	std::string ssl_address;
+
+	/**
+	 * @var std::string The port number to record HTTPS on
+	 */
+	std::string ssl_port = "443";
+
+	/**
+	 * @var std::vector<std::string> Certificate files, paired in order with cert_keys
+	 */
+	std::vector<std::string> cert_files;
+
+	/**
+	 * @var std::vector<std::string> Private key files, paired in order with cert_files
+	 */
+	std::vector<std::string> cert_keys;
+
+	/**
+	 * @var std::string TLS tuning, see HTTP::TLSSettings
+	 */
+	std::string tls_ciphers;
+	std::string tls_ciphersuites;
+	std::string tls_min_version;
+	std::string tls_max_version;
+	std::string tls_curves;
+	std::vector<std::string> tls_alpn;
+
+	/**
+	 * @var size_t The number of TLS handshake worker threads, or 0 for one per CPU
+	 */
+	size_t handshake_workers = 0;
+
+	/**
+	 * @var int Seconds a client may take to complete the TLS handshake
+	 */
+	int handshake_timeout = 10;
+};
+
 /**
- * @var bool Whether verbose mode is enabled or not
+ * Returns the current settings snapshot
+ *
+ * The snapshot is read with a single atomic load and stays valid for the lifetime
+ * of the process, so callers may hold on to the reference.
+ *
+ * @return const Settings& The current settings
+ */
+const Settings& settings();
+
+/**
+ * Publishes a new settings snapshot for subsequent calls to settings()
+ *
+ * @param const Settings& updated The validated settings to publish
+ *
+ * @return void
+ */
+void publish_settings(const Settings& updated);
+
+/**
+ * Keeps the settings that are only read at startup from the current snapshot
+ *
+ * Listeners, certificates, TLS settings, worker pools, the upstream, the cache and the capture file are set up once, so a reload
+ * may only change the remaining settings.
+ *
+ * @param[out] updated The reloaded settings, whose startup-only settings are replaced
+ * @param const Settings& current The settings in effect
+ *
+ * @return bool Whether any startup-only setting differed and was discarded
  */
-extern bool verbose;
+bool retain_startup_settings(Settings& updated, const Settings& current);
 
 #endif /* SETTINGS_H */
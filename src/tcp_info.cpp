@@ -0,0 +1,69 @@
+/*
+ * tcp_info.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the function reading the kernel's statistics of a TCP connection.
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+// The kernel's own definition, as glibc's struct tcp_info stops short of the delivery rate
+#include <linux/tcp.h>
+#include "tcp_info.h"
+
+/**
+ * Samples the kernel's statistics of a TCP connection
+ *
+ * A connection the peer already closed can still be sampled until the socket
+ * itself is closed. Unix domain and UDP sockets have no TCP_INFO and fail, and
+ * kernels older than 4.9 do not report the delivery rate, which is left 0.
+ *
+ * @param int fd The socket
+ * @param[out] sample The statistics, left invalid on failure
+ *
+ * @return bool Whether the socket is a TCP socket that could be sampled
+ */
+bool sample_tcp_info(int fd, TcpSample& sample)
+{
+	sample = TcpSample();
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct tcp_info info;
+	memset(&info, 0, sizeof(info));
+	socklen_t size = sizeof(info);
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &size) != 0 || size < offsetof(struct tcp_info, tcpi_total_retrans) + sizeof(info.tcpi_total_retrans))
+	{
+		return false;
+	}
+
+	sample.valid = true;
+	sample.rtt = info.tcpi_rtt;
+	sample.rtt_var = info.tcpi_rttvar;
+	sample.retransmits = info.tcpi_total_retrans;
+	sample.cwnd = info.tcpi_snd_cwnd;
+	if (size >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof(info.tcpi_delivery_rate))
+	{
+		sample.delivery_rate = info.tcpi_delivery_rate;
+	}
+
+	return true;
+}
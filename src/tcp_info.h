@@ -0,0 +1,55 @@
+/*
+ * tcp_info.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the function reading the kernel's statistics of a TCP connection.
+ */
+
+#ifndef TCP_INFO_H
+#define TCP_INFO_H
+
+#include <cstdint>
+
+/**
+ * @struct TcpSample
+ *
+ * What the kernel knew about a TCP connection's path when it was sampled.
+ * Round-trip times are the kernel's smoothed estimate, in microseconds, the
+ * retransmits count every segment sent again over the connection's life, the
+ * congestion window is in segments and the delivery rate in bytes per second.
+ */
+struct TcpSample
+{
+	bool valid = false;
+	uint32_t rtt = 0;
+	uint32_t rtt_var = 0;
+	uint32_t retransmits = 0;
+	uint32_t cwnd = 0;
+	uint64_t delivery_rate = 0;
+};
+
+/**
+ * Samples the kernel's statistics of a TCP connection
+ *
+ * @param int fd The socket
+ * @param[out] sample The statistics, left invalid on failure
+ *
+ * @return bool Whether the socket is a TCP socket that could be sampled
+ */
+bool sample_tcp_info(int fd, TcpSample& sample);
+
+#endif /* TCP_INFO_H */
@@ -0,0 +1,129 @@
+/*
+ * thread_pool.cpp - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the implementation of the ThreadPool class.
+ */
+
+#include <utility>
+#include "affinity.h"
+#include "thread_pool.h"
+
+/**
+ * ThreadPool constructor
+ *
+ * Starts the requested number of worker threads, defaulting to one per CPU
+ *
+ * @param size_t workers The number of worker threads, or 0 to use one per available CPU
+ *
+ * @return void
+ */
+ThreadPool::ThreadPool(size_t workers)
+	: stopping_(false)
+{
+	if (workers == 0)
+	{
+		workers = std::thread::hardware_concurrency();
+	}
+
+	if (workers == 0)
+	{
+		workers = 1;
+	}
+
+	for (size_t i = 0; i < workers; ++i)
+	{
+		workers_.push_back(std::thread(&ThreadPool::work, this));
+	}
+}
+
+/**
+ * ThreadPool destructor
+ *
+ * Lets the workers drain the queue, then joins them
+ *
+ * @return void
+ */
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	condition_.notify_all();
+
+	for (size_t i = 0; i < workers_.size(); ++i)
+	{
+		workers_[i].join();
+	}
+}
+
+/**
+ * Queues a job to be run by the next free worker
+ *
+ * @param std::function<void()> job The job to run
+ *
+ * @return void
+ */
+void ThreadPool::submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		jobs_.push_back(std::move(job));
+	}
+	condition_.notify_one();
+}
+
+/**
+ * Returns the number of worker threads in the pool
+ *
+ * @return size_t The number of workers
+ */
+size_t ThreadPool::size() const
+{
+	return workers_.size();
+}
+
+/**
+ * Waits for jobs and runs them until the pool is stopped and the queue is empty
+ *
+ * @return void
+ */
+void ThreadPool::work()
+{
+	place_thread();
+
+	while (true)
+	{
+		std::function<void()> job;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			condition_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+
+			if (jobs_.empty())
+			{
+				return;
+			}
+
+			job = std::move(jobs_.front());
+			jobs_.pop_front();
+		}
+
+		job();
+	}
+}
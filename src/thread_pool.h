@@ -0,0 +1,107 @@
+/*
+ * thread_pool.h - A simple HTTP and HTTPS server implementation
+ *
+ * Copyright (C) 2023 HAperf.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file contains the class definition for the ThreadPool.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A fixed-size pool of worker threads consuming a shared job queue
+ *
+ * Jobs are run in submission order by whichever worker becomes free first.
+ * The pool is used to keep expensive work (such as TLS handshakes) off
+ * threads that must stay responsive, like the accept loop.
+ */
+class ThreadPool
+{
+	public:
+		/**
+		 * Construct a ThreadPool and start its worker threads
+		 *
+		 * @param size_t workers The number of worker threads, or 0 to use one per available CPU
+		 *
+		 * return void
+		 */
+		explicit ThreadPool(size_t workers = 0);
+
+		/**
+		 * Destruct the ThreadPool, waiting for queued jobs to finish
+		 */
+		~ThreadPool();
+
+		/**
+		 * Queue a job to be run by the next free worker
+		 *
+		 * @param std::function<void()> job The job to run
+		 *
+		 * @return void
+		 */
+		void submit(std::function<void()> job);
+
+		/**
+		 * Returns the number of worker threads in the pool
+		 *
+		 * @return size_t The number of workers
+		 */
+		size_t size() const;
+
+	private:
+
+		/**
+		 * The main loop of each worker thread
+		 *
+		 * @return void
+		 */
+		void work();
+
+		/**
+		 * @var std::vector<std::thread> The worker threads
+		 */
+		std::vector<std::thread> workers_;
+
+		/**
+		 * @var std::deque<std::function<void()>> Jobs waiting for a free worker
+		 */
+		std::deque<std::function<void()>> jobs_;
+
+		/**
+		 * @var std::mutex Guards the job queue and the stopping flag
+		 */
+		std::mutex mutex_;
+
+		/**
+		 * @var std::condition_variable Signalled when a job is queued or the pool is stopping
+		 */
+		std::condition_variable condition_;
+
+		/**
+		 * @var bool Whether the pool is shutting down
+		 */
+		bool stopping_;
+};
+
+#endif /* THREAD_POOL_H */